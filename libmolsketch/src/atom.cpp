@@ -23,54 +23,39 @@
 #include "atom.h"
 
 #include <QPainter>
-#include <QSettings>
 #include <QDebug>
 
 #include "bond.h"
 #include "molecule.h"
 
 #include "element.h"
+#include "labellayout.h"
+#include "moleculerenderer.h"
 #include "molscene.h"
 #include <iostream>
 
 namespace Molsketch {
 
-  //                                        //
-  //     /    \      \   /      H           //
-  //   HN      NH      N        N           //
-  //     \    /        H      /   \         //
-  //                                        //
-  //   Left   Right   Down     Up           //
-  //                                        //
-  enum {
-    Left,
-    Right,
-    Up,
-    Down
-  };
-
-  int labelAlignment(Atom *atom)
+  /**
+   * Helper function to get the LabelLayout::Alignment of the label of @p atom.
+   */
+  static int labelAlignment(Atom *atom)
   {
     // compute the sum of the bond vectors, this gives
     QPointF direction(0.0, 0.0);
     foreach (Atom *nbr, atom->neighbours())
       direction += atom->pos() - nbr->pos();
 
-    int alignment = 0;
-    if ((atom->numBonds() == 2) && (abs(direction.y()) > abs(direction.x()))) {
-      if (direction.y() <= 0.0)
-        alignment = Up;
-      else
-        alignment = Down;
-    } else {
-      //qDebug() << "x =" << direction.x();
-      if (direction.x() < -0.1) // hack to make almost vertical lines align Right
-        alignment = Left;
-      else
-        alignment = Right;
-    }
+    return MoleculeRenderer::labelAlignment(direction, atom->numBonds());
+  }
 
-    return alignment;
+  /**
+   * Helper function to get the label of @p atom: its element symbol with the
+   * implicit hydrogens on the side given by @p alignment.
+   */
+  static QString labelText(const Atom *atom, int alignment)
+  {
+    return MoleculeRenderer::labelText(atom->element(), atom->numImplicitHydrogens(), alignment);
   }
 
 
@@ -97,14 +82,28 @@ namespace Molsketch {
 
     // Setting private fields
     m_elementSymbol = element;
+    m_atomicNumber = symbol2number(element);
     m_hidden = true;
     m_drawn = false;
 
     m_userCharge = 0; // The initial additional charge is zero
     m_userElectrons = 0;
     m_userImplicitHydrogens =  0;
+    m_valenceValid = false;
     enableImplicitHydrogens(implicitHydrogens);
     computeBoundingRect();
+#if QT_VERSION >= 0x040600
+    // needed for the position notifications in itemChange()
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges);
+#endif
+  }
+
+  Atom::~Atom()
+  {
+    // items deleted while on the scene don't get a scene change notification
+    MolScene *molScene = qobject_cast<MolScene*>(scene());
+    if (molScene)
+      molScene->spatialIndex()->removeAtom(this);
   }
 
 
@@ -114,97 +113,16 @@ namespace Molsketch {
 
   void Atom::computeBoundingRect()
   {
-    //qDebug() << "Atom::computeBoundingRect";
     int alignment = labelAlignment(this);
-    bool leftAligned = false;
-    switch (alignment) {
-      case Left:
-        leftAligned = true;
-      default:
-        break;
-    }
-
-    int hCount = numImplicitHydrogens();
-
-    QString lbl;
-    if (hCount && leftAligned)
-      lbl += "H";
-    if ((hCount > 1) && leftAligned)
-      lbl += QString::number(hCount);
-
-    lbl += m_elementSymbol;
-    
-    if (hCount && !leftAligned)
-      lbl += "H";
-    if ((hCount > 1) && !leftAligned)
-      lbl += QString::number(hCount);
-
-    // get the font & metrics
-    QSettings settings;
-    QFont symbolFont = settings.value("atom-symbol-font").value<QFont>();
-    QFont subscriptFont = symbolFont;
-    subscriptFont.setPointSize(0.75 * symbolFont.pointSize());
-    QFontMetrics fmSymbol(symbolFont);
-    QFontMetrics fmScript(subscriptFont);
-
-    // compute the total width
-    qreal totalWidth = 0.0;
-    if ((alignment == Right) || (alignment == Left) || !lbl.contains("H")) {
-      for (int i = 0; i < lbl.size(); ++i) {
-        if (lbl[i].isDigit())
-          totalWidth += fmScript.width(lbl[i]);
-        else
-          totalWidth += fmSymbol.width(lbl[i]);
-      }
-    } else {
-      totalWidth = fmSymbol.width(lbl.left(lbl.indexOf("H")));
-      qreal width = 0.0; 
-      for (int i = lbl.indexOf("H"); i < lbl.size(); ++i) {
-        if (lbl[i].isDigit())
-          width += fmScript.width(lbl[i]);
-        else
-          width += fmSymbol.width(lbl[i]);
-      }
-
-      if (width > totalWidth)
-        totalWidth = width; 
-    }
-
-    QString str, subscript;
-    // compute the horizontal starting position
-    qreal xOffset, yOffset, yOffsetSubscript;
-    switch (alignment) {
-      case Right:
-        xOffset = - 0.5 * fmSymbol.width(lbl.left(1));
-        break;
-      case Left:
-        xOffset = 0.5 * fmSymbol.width(lbl.right(1)) - totalWidth;
-        break;
-      case Up:
-      case Down:
-        if (lbl.contains("H"))
-          xOffset = - 0.5 * fmSymbol.width(lbl.left(lbl.indexOf("H")));
-        else
-          xOffset = - 0.5 * totalWidth;
-        break;
-      default:
-        xOffset = - 0.5 * totalWidth;
-        break;
-    }
-    // compute the vertical starting position
-    yOffset = 0.5 * (fmSymbol.ascent() - fmSymbol.descent());
-    yOffsetSubscript = yOffset + fmSymbol.descent();
-
-    // compute the shape
-    if ((alignment == Right) || (alignment == Left) || !lbl.contains("H"))
-      m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.height(), totalWidth, fmSymbol.height());
-    else {
-      if (alignment == Down)
-        m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.height(), totalWidth, fmSymbol.ascent() + fmSymbol.height());
-      else
-        m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.ascent() - fmSymbol.height(), totalWidth, fmSymbol.ascent() + fmSymbol.height());
-    }
+    m_shape = LabelLayout::layout(labelText(this, alignment), alignment, labelFont()).shape();
+  }
 
+  QFont Atom::labelFont() const
+  {
+    MolScene *molScene = qobject_cast<MolScene*>(scene());
+    if (molScene)
+      return molScene->atomSymbolFont();
+    return QFont();
   }
 
   QRectF Atom::boundingRect() const
@@ -225,141 +143,22 @@ namespace Molsketch {
 
   void Atom::drawAtomLabel(QPainter *painter, const QString &lbl, int alignment)
   {
-    MolScene* molScene = dynamic_cast<MolScene*>(scene());
-
-    painter->save();
-    QFont symbolFont = molScene->atomSymbolFont();
-    QFont subscriptFont = symbolFont;
-    subscriptFont.setPointSize(0.75 * symbolFont.pointSize());
-    QFontMetrics fmSymbol(symbolFont);
-    QFontMetrics fmScript(subscriptFont);
-
-
-    // compute the total width
-    qreal totalWidth = 0.0;
-    if ((alignment == Right) || (alignment == Left) || !lbl.contains("H")) {
-      for (int i = 0; i < lbl.size(); ++i) {
-        if (lbl[i].isDigit())
-          totalWidth += fmScript.width(lbl[i]);
-        else
-          totalWidth += fmSymbol.width(lbl[i]);
-      }
-    } else {
-      totalWidth = fmSymbol.width(lbl.left(lbl.indexOf("H")));
-      qreal width = 0.0; 
-      for (int i = lbl.indexOf("H"); i < lbl.size(); ++i) {
-        if (lbl[i].isDigit())
-          width += fmScript.width(lbl[i]);
-        else
-          width += fmSymbol.width(lbl[i]);
-      }
-
-      if (width > totalWidth)
-        totalWidth = width; 
-    }
-
-    // debug
-    /*
-    painter->save();
-    painter->setPen(Qt::red);
-    painter->drawPoint(QPointF(0.0, 0.0));
-    painter->restore();
-    */
-
-    QString str, subscript;
-    // compute the horizontal starting position
-    qreal xOffset, yOffset, yOffsetSubscript;
-    switch (alignment) {
-      case Right:
-        xOffset = - 0.5 * fmSymbol.width(lbl.left(1));
-        break;
-      case Left:
-        xOffset = 0.5 * fmSymbol.width(lbl.right(1)) - totalWidth;
-        break;
-      case Up:
-      case Down:
-        if (lbl.contains("H"))
-          xOffset = - 0.5 * fmSymbol.width(lbl.left(lbl.indexOf("H")));
-        else
-          xOffset = - 0.5 * totalWidth;
-        break;
-      default:
-        xOffset = - 0.5 * totalWidth;
-        break;
-    }
-    // compute the vertical starting position
-    yOffset = 0.5 * (fmSymbol.ascent() - fmSymbol.descent());
-    yOffsetSubscript = yOffset + fmSymbol.descent();
-    qreal xInitial = xOffset;
-
-    // compute the shape
-    if ((alignment == Right) || (alignment == Left) || !lbl.contains("H"))
-      m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.height(), totalWidth, fmSymbol.height());
-    else {
-      if (alignment == Down)
-        m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.height(), totalWidth, fmSymbol.ascent() + fmSymbol.height());
-      else
-        m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.ascent() - fmSymbol.height(), totalWidth, fmSymbol.ascent() + fmSymbol.height());
-    }
-
-    for (int i = 0; i < lbl.size(); ++i) {
-      if (lbl[i] == 'H') {
-        if ((alignment == Up) || (alignment == Down))
-          if (!str.isEmpty()) {
-            // write the current string
-            painter->setFont(symbolFont);
-            painter->drawText(xOffset, yOffset, str);
-            if (alignment == Down) {
-              yOffset += fmSymbol.ascent()/* - fmSymbol.descent()*/;
-              yOffsetSubscript += fmSymbol.ascent()/* - fmSymbol.descent()*/;
-            } else {
-              yOffset -= fmSymbol.ascent()/* + fmSymbol.descent()*/;
-              yOffsetSubscript -= fmSymbol.ascent()/* + fmSymbol.descent()*/;
-            }
-            xOffset = xInitial;
-            str.clear();
-          }
-      }
-
-      if (lbl[i].isDigit()) {
-        if (!str.isEmpty()) {
-          // write the current string
-          painter->setFont(symbolFont);
-          painter->drawText(xOffset, yOffset, str);
-          xOffset += fmSymbol.width(str);
-          str.clear();
-        }
-
-        subscript += lbl.mid(i, 1);
-      } else {
-        if (!subscript.isEmpty()) {
-          // write the current subscript
-          painter->setFont(subscriptFont);
-          painter->drawText(xOffset, yOffsetSubscript, subscript);
-          xOffset += fmScript.width(subscript);
-          subscript.clear();
-        }
-
-        str += lbl.mid(i, 1);
-      }
+    LabelLayout layout = LabelLayout::layout(lbl, alignment, labelFont());
+    // the alignment depends on the neighbours, which may have moved since the last layout
+    if (layout.shape() != m_shape) {
+      m_shape = layout.shape();
+      updateSpatialIndex();
     }
-    if (!str.isEmpty()) {
-      painter->setFont(symbolFont);
-      painter->drawText(xOffset, yOffset, str);
-    }
-    if (!subscript.isEmpty()) {
-      painter->setFont(subscriptFont);
-      painter->drawText(xOffset, yOffsetSubscript, subscript);
-    }
-
-    painter->restore();
+    layout.draw(painter);
   }
 
 
   void Atom::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
   {
-    Q_UNUSED(option)
-    Q_UNUSED(widget)
+    // a collapsed or cached molecule paints its atoms itself
+    Molecule *mol = molecule();
+    if (mol && mol->drawsChildren())
+      return;
     
     painter->setPen(m_color);
     // Save the original painter state
@@ -375,7 +174,8 @@ namespace Molsketch {
     MolScene* molScene = dynamic_cast<MolScene*>(scene());
     Q_CHECK_PTR(molScene);
 
-    int element = symbol2number(m_elementSymbol);
+    updateValence();
+    int element = m_atomicNumber;
     
     switch (molScene->renderMode()) {
       case MolScene::RenderColoredSquares:
@@ -422,31 +222,18 @@ namespace Molsketch {
 
     m_drawn = true;
 
-    int alignment = labelAlignment(this);
-    bool leftAligned = false;
-    switch (alignment) {
-      case Left:
-        leftAligned = true;
-      default:
-        break;
+    if (molScene->detailLevel(option, painter, widget) == MolScene::ReducedDetail) {
+      // the label would be too small to read
+      painter->save();
+      painter->setPen(Qt::NoPen);
+      painter->setBrush(elementColor(element));
+      painter->drawEllipse(QPointF(0.0, 0.0), 6.0, 6.0);
+      painter->restore();
+      return;
     }
 
-    int hCount = numImplicitHydrogens();
-
-    QString lbl;
-    if (hCount && leftAligned)
-      lbl += "H";
-    if ((hCount > 1) && leftAligned)
-      lbl += QString::number(hCount);
-
-    lbl += m_elementSymbol;
-    
-    if (hCount && !leftAligned)
-      lbl += "H";
-    if ((hCount > 1) && !leftAligned)
-      lbl += QString::number(hCount);
-
-    drawAtomLabel(painter, lbl, alignment);
+    int alignment = labelAlignment(this);
+    drawAtomLabel(painter, labelText(this, alignment), alignment);
 
     // Drawing background
     if (this->isSelected()) {
@@ -589,10 +376,46 @@ namespace Molsketch {
 //       molecule()->setSm_elementSymbolected(isSm_elementSymbolected());
       molecule()->setFlag(ItemIsSelectable, isSelected());
     }
+    if (change == ItemSelectedHasChanged && molecule())
+      molecule()->invalidateCache();
+    // implicit hydrogens are only computed for atoms in a molecule
+    if (change == ItemParentHasChanged)
+      invalidateValence();
+
+    // the bonds of this atom change shape
+    if (change == ItemPositionHasChanged)
+      foreach (Bond *bond, m_bonds)
+        bond->invalidateGeometry();
+
+    // keep the spatial index of the scene up to date
+    if (change == ItemSceneChange) {
+      MolScene *molScene = qobject_cast<MolScene*>(scene());
+      if (molScene)
+        molScene->spatialIndex()->removeAtom(this);
+    }
+    if (change == ItemSceneHasChanged || change == ItemParentHasChanged ||
+        change == ItemPositionHasChanged || change == ItemTransformHasChanged)
+      updateSpatialIndex();
+    // the label is laid out in the font of the scene
+    if (change == ItemSceneHasChanged && scene())
+      updateLabel();
     
     return QGraphicsItem::itemChange(change, value);
   }
 
+  void Atom::updateSpatialIndex()
+  {
+    MolScene *molScene = qobject_cast<MolScene*>(scene());
+    if (!molScene)
+      return;
+
+    molScene->spatialIndex()->updateAtom(this);
+    // the bonds of this atom move along
+    foreach (Bond *bond, m_bonds)
+      if (bond->scene() == molScene)
+        molScene->spatialIndex()->updateBond(bond);
+  }
+
 
   //////////////////////////////////////////////////////////////////////////////
   // Event handlers
@@ -607,17 +430,33 @@ namespace Molsketch {
   void Atom::hoverEnterEvent( QGraphicsSceneHoverEvent * event )
   {
     m_hidden = false;
+    if (molecule())
+      molecule()->invalidateCache();
     // Execute default behavior
     QGraphicsItem::hoverEnterEvent( event );
   }
 
   void Atom::hoverLeaveEvent( QGraphicsSceneHoverEvent * event )
   {
-    m_hidden = true;
+    hoverOut();
     // Execute default behavior
     QGraphicsItem::hoverLeaveEvent( event );
   }
 
+  void Atom::setColor(QColor col)
+  {
+    m_color = col;
+    if (molecule())
+      molecule()->invalidateCache();
+  }
+
+  void Atom::hoverOut()
+  {
+    m_hidden = true;
+    if (molecule())
+      molecule()->invalidateCache();
+  }
+
 
 
 
@@ -629,9 +468,11 @@ namespace Molsketch {
   void Atom::setElement(const QString &element)
   {
     m_elementSymbol = element;
-    prepareGeometryChange();
-    computeBoundingRect();
-    molecule()->invalidateElectronSystems();
+    m_atomicNumber = symbol2number(element);
+    invalidateValence();
+    updateLabel();
+    if (molecule())
+      molecule()->invalidateElectronSystems(this);
   }
 
   void Atom::setNumImplicitHydrogens(int number)
@@ -639,11 +480,13 @@ namespace Molsketch {
     m_implicitHydrogens = true;
 
     m_userImplicitHydrogens = 0;
+    invalidateValence();
     int deltaH = number - numImplicitHydrogens();
 //  int newNoB = m_numBonds - deltaNoIH;
   //m_numBonds = (newNoB < 0) ? 0 : newNoB;
 
     m_userImplicitHydrogens = deltaH;
+    invalidateValence();
   }
 
 
@@ -656,58 +499,97 @@ namespace Molsketch {
 
   int Atom::bondOrderSum() const
   {
-    Molecule *mol = molecule();
-    if (!mol) 
-      return 0;
-
-    // count explicit bonds
-    int sum = 0;
-    foreach (Bond *bond, mol->bonds(this))
-      sum += bond->bondOrder();
-
-    // take implicit hydrogens into account 
-    sum += numImplicitHydrogens();
-
-    return sum;
+    updateValence();
+    return m_bondOrderSum;
   }
       
   int Atom::numNonBondingElectrons() const
   {
-    int boSum = bondOrderSum();
-    switch (elementGroup(symbol2number(m_elementSymbol))) {
+    updateValence();
+    return m_numNonBondingElectrons;
+  }
+
+  void Atom::invalidateValence()
+  {
+    m_valenceValid = false;
+    // charged carbons have a label, which the bonds end before
+    Molecule *mol = molecule();
+    if (mol)
+      mol->invalidateBondPaths();
+  }
+
+  /**
+   * Helper function to compute the number of non-bonding electrons for an atom
+   * of group @p group with bond order sum @p boSum.
+   */
+  static int nonBondingElectrons(int group, int boSum)
+  {
+    switch (group) {
       case 1:
       case 2:
       case 13:
       case 14:
-        return 0 + m_userElectrons;
+        return 0;
       case 15:
         if (boSum > 3)
-          return 0 + m_userElectrons;
+          return 0;
         else
-          return 2 + 3 - boSum + m_userElectrons;
+          return 2 + 3 - boSum;
       case 16:
         switch (boSum) {
           case 0:
-            return 6 + m_userElectrons;
+            return 6;
           case 1:
-            return 5 + m_userElectrons;
+            return 5;
           case 2:
-            return 4 + m_userElectrons;
+            return 4;
           case 3:
-            return 2 + m_userElectrons;
+            return 2;
           default:
-            return 0 + m_userElectrons;
+            return 0;
         }
       case 17:
         if (boSum == 1)
-          return 6 + m_userElectrons;
+          return 6;
         else
-          return 8 + m_userElectrons;
+          return 8;
       case 18:
-        return 8 + m_userElectrons;
+        return 8;
       default:
-        return 0 + m_userElectrons;
+        return 0;
+    }
+  }
+
+  void Atom::updateValence() const
+  {
+    if (m_valenceValid)
+      return;
+
+    // bond order sum and implicit hydrogens are only defined inside a molecule
+    m_bondOrderSum = 0;
+    m_numImplicitHydrogens = 0;
+    if (molecule()) {
+      // count explicit bonds
+      int bosum = 0;
+      foreach (Bond *bond, m_bonds)
+        bosum += bond->bondOrder();
+
+      m_numImplicitHydrogens = implicitHydrogens(m_atomicNumber, bosum - m_userImplicitHydrogens);
+
+      // take implicit hydrogens into account 
+      m_bondOrderSum = bosum + m_numImplicitHydrogens;
     }
+
+    m_numNonBondingElectrons = nonBondingElectrons(elementGroup(m_atomicNumber), m_bondOrderSum) + m_userElectrons;
+
+    // non element atoms have no charge unless explicitly set (m_userCharge)
+    // special case: He uses duet rule (<-> octet rule)
+    if (!m_atomicNumber || (m_atomicNumber == Element::He))
+      m_charge = m_userCharge;
+    else
+      m_charge = Molsketch::numValenceElectrons(m_atomicNumber) - m_bondOrderSum - m_numNonBondingElectrons + m_userCharge;
+
+    m_valenceValid = true;
   }
 
 	QString Atom::string () const {
@@ -726,30 +608,23 @@ namespace Molsketch {
 	
   int Atom::numImplicitHydrogens() const
   {
-    Molecule *mol = molecule();
-    if (!mol) 
-      return 0;
-    
-    switch (symbol2number(m_elementSymbol)) {
+    updateValence();
+    return m_numImplicitHydrogens;
+  }
+
+  int Atom::implicitHydrogens(int atomicNumber, int bondOrderSum)
+  {
+    switch (atomicNumber) {
       case Element::B:
       case Element::C:
       case Element::N:
       case Element::O:
       case Element::P:
       case Element::S:
-        break;
+        return qMax(0, Molsketch::expectedValence(atomicNumber) - bondOrderSum);
       default:
         return 0;
     }
-
-    // count explicit bonds
-    int bosum = 0;
-    foreach (Bond *bond, mol->bonds(this))
-      bosum += bond->bondOrder();
-
-    int n = Molsketch::expectedValence(Molsketch::symbol2number(m_elementSymbol)) - bosum + m_userImplicitHydrogens;
-    
-    return (n > 0) ? n : 0;
   }
 
   QString Atom::element() const
@@ -759,50 +634,25 @@ namespace Molsketch {
 
   int Atom::charge()  const
   {
-    // non element atoms have no charge unless explicitly set (m_userCharge)
-    int atomicNumber = symbol2number(m_elementSymbol);
-    if (!atomicNumber)
-      return m_userCharge;
-    
-    // special case: He uses duet rule (<-> octet rule)
-    if (atomicNumber == Element::He)
-      return m_userCharge;
-    
-    return Molsketch::numValenceElectrons(atomicNumber) - bondOrderSum() - numNonBondingElectrons() + m_userCharge;
+    updateValence();
+    return m_charge;
   }
 
   void Atom::setCharge(int requiredCharge)
   {
     int computedCharge = charge() - m_userCharge;
     m_userCharge = requiredCharge - computedCharge;
+    invalidateValence();
   }
 
   QString Atom::chargeString() const
   {
-    // Get the charge
-    int c = charge();
-
-    // Drawing text
-    QString string;
-    string.setNum(c);
-    if (c < -1) // ..., "3-", "2-"
-      string =  string.remove(0,1) + "-";
-    if (c == -1) // "-"
-      string = "-";
-    if (c == 0) // ""
-      string = "";
-    if (c == 1) // "+"
-      string = "+";
-    if (c > 1) // "2+", "3+", ...
-      string = string + "+";
-
-    // Return the charge string
-    return string;
+    return MoleculeRenderer::chargeString(charge());
   }
 
   qreal Atom::weight( ) const
   {
-    return Molsketch::weightOfElement(Molsketch::symbol2number(m_elementSymbol)) + numImplicitHydrogens() * Molsketch::weightOfElement(1);
+    return Molsketch::weightOfElement(m_atomicNumber) + numImplicitHydrogens() * Molsketch::weightOfElement(Element::H);
   }
 
   Molecule * Atom::molecule() const
@@ -843,15 +693,37 @@ namespace Molsketch {
 
     if (!m_bonds.contains(bond))
       m_bonds.append(bond);
-    
-    computeBoundingRect();
+    invalidateValence();
+    updateLabel();
   }
 
   void Atom::removeBond(Bond *bond)
   {
     Q_CHECK_PTR(bond);
     m_bonds.removeAll(bond);
+    invalidateValence();
+    updateLabel();
+  }
+
+  void Atom::updateLabel()
+  {
+    Molecule *mol = molecule();
+    if (mol)
+      mol->invalidateLabel(this);
+    else
+      layoutLabel();
+  }
+
+  void Atom::layoutLabel()
+  {
+    prepareGeometryChange();
     computeBoundingRect();
+    // atomAt() searches as far as the widest label reaches
+    updateSpatialIndex();
+    // the bonds end before the label
+    Molecule *mol = molecule();
+    if (mol)
+      mol->invalidateBondPaths();
   }
 
   QList<Bond*> Atom::bonds() const
@@ -24,6 +24,7 @@
 #include <molsketch/graphicsitemtypes.h>
 
 #include <QGraphicsItem>
+#include <QFont>
 #include <QList>
 
 namespace Molsketch {
@@ -56,6 +57,10 @@ namespace Molsketch {
        */
       Atom(const QPointF & position, const QString & element, 
           bool implicitHydrogens, QGraphicsItem* parent = 0, QGraphicsScene* scene = 0);
+      /**
+       * Removes the atom from the spatial index of its scene.
+       */
+      virtual ~Atom();
 
       //@name Inherited drawing methods
       //@{
@@ -75,7 +80,7 @@ namespace Molsketch {
       /** Returns whether the atom is hidden. */
       bool isHidden() const;
 
-	  void setColor (QColor col) {m_color = col;}
+	  void setColor (QColor col);
 	  QColor getColor () {return m_color;}
 
       //@name Chemistry methods
@@ -92,6 +97,14 @@ namespace Molsketch {
        * Get the element symbol of the atom, including the implicit hydrogens. 
        */
       QString element() const;
+      /**
+       * Get the atomic number of the element of the atom, or 0 if the element
+       * symbol is not an element (e.g. a label).
+       */
+      int atomicNumber() const
+      {
+        return m_atomicNumber;
+      }
       /** 
        * Set the element symbol of the current atom to @p element (e.g. "C", "N").
        */
@@ -126,6 +139,7 @@ namespace Molsketch {
       void setNumUnpairedElectrons(int n)
       {
         m_userElectrons = n;
+        invalidateValence();
       }
       /** 
        * Returns the string for the superscript charge (e.g. "3-", "2-", "-", "", "+", "2+", ...).
@@ -162,6 +176,12 @@ namespace Molsketch {
        * @note Requires molecule() to be set.
        */
       int numImplicitHydrogens() const;
+      /**
+       * @return The number of implicit hydrogens of an atom of element
+       * @p atomicNumber with bonds of total order @p bondOrderSum, as used by
+       * numImplicitHydrogens(). Only B, C, N, O, P and S get hydrogens.
+       */
+      static int implicitHydrogens(int atomicNumber, int bondOrderSum);
       // Manupilation methods
 
 
@@ -181,6 +201,23 @@ namespace Molsketch {
       void setNumImplicitHydrogens(int number);
       /** Sets whether implicit hydrogens should be used */
       void enableImplicitHydrogens(bool enabled);
+      /**
+       * Mark the cached bond order sum, implicit hydrogens, non-bonding electrons
+       * and charge as outdated. Called when the element, the bonds or the order of
+       * one of the bonds of this atom change. The values are recomputed on the next
+       * query.
+       */
+      void invalidateValence();
+      /**
+       * Update the position of this atom and its bonds in the spatial index of
+       * the scene. Called when the atom or its molecule is moved.
+       */
+      void updateSpatialIndex();
+      /**
+       * Lay out the label now, or at the end of the batch if the molecule is in one.
+       * Called when the element, bonds or label font of the atom change.
+       */
+      void updateLabel();
 
 
 
@@ -193,7 +230,7 @@ namespace Molsketch {
        */       
       int number() const { return m_number; }
 
-	  void hoverOut () {m_hidden = true;}
+	  void hoverOut ();
     protected:
       // Event handlers
       /** Event handler to show hidden atoms when the mouse hovers over them. */
@@ -220,10 +257,26 @@ namespace Molsketch {
        * the elelement symbol, adding bonds, ...
        */
       void computeBoundingRect();
+      /**
+       * @return The font of the label: the atom symbol font of the scene, or the
+       * default font if the atom is not on a MolScene.
+       */
+      QFont labelFont() const;
+      /**
+       * Lay out the label and update the bounding rect.
+       */
+      void layoutLabel();
+      /**
+       * Recompute the cached valence state if invalidateValence() was called
+       * since the last update.
+       */
+      void updateValence() const;
 
       // Internal representation
       /** Represents the atom's element symbol. */
       QString m_elementSymbol;
+      /** The atomic number for m_elementSymbol. */
+      int m_atomicNumber;
       /** Stores whether the atom is hidden. */
       bool m_hidden;
       /** Stores whether the atom is drawn. */
@@ -258,6 +311,15 @@ namespace Molsketch {
       int m_userImplicitHydrogens;
       /** Stores whether implicit hydrogens should be used */
       bool m_implicitHydrogens;
+
+      //@name Cached valence state, see updateValence()
+      //@{
+      mutable bool m_valenceValid;
+      mutable int m_bondOrderSum;
+      mutable int m_numImplicitHydrogens;
+      mutable int m_numNonBondingElectrons;
+      mutable int m_charge;
+      //@}
       /** Stores the shape of the atom */
       QRectF m_shape;
   };
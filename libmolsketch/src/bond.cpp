@@ -28,6 +28,7 @@
 #include "ring.h"
 #include "element.h"
 #include "molscene.h"
+#include "moleculerenderer.h"
 #include "math2d.h"
 
 #include <QDebug>
@@ -46,6 +47,7 @@ namespace Molsketch {
     m_beginAtom = atomA;
     m_endAtom = atomB;
     m_ring = 0;
+    m_geometryValid = false;
 
     atomA->addBond(this);
     atomB->addBond(this);
@@ -59,10 +61,18 @@ namespace Molsketch {
 
   //   setFlag(QGraphicsItem::ItemIsSelectable);
   //   setAcceptedMouseButtons(Qt::LeftButton);
+#if QT_VERSION >= 0x040600
+    // needed for the position notifications in itemChange()
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges);
+#endif
   }
   
   Bond::~Bond()
   {
+    // items deleted while on the scene don't get a scene change notification
+    MolScene *molScene = qobject_cast<MolScene*>(scene());
+    if (molScene)
+      molScene->spatialIndex()->removeBond(this);
     //m_beginAtom->removeNeighbor(m_endAtom);
     //m_endAtom->removeNeighbor(m_beginAtom);
   }
@@ -71,240 +81,92 @@ namespace Molsketch {
 
   QRectF Bond::boundingRect() const
   {
-    Q_CHECK_PTR(m_beginAtom);
-    Q_CHECK_PTR(m_endAtom);
-
-    qreal w = m_endAtom->x() - m_beginAtom->x();
-    qreal h = m_endAtom->y() - m_beginAtom->y();
-
-    // 	qreal x = qMax(m_beginAtom->pos().x(),m_endAtom->pos().x());
-    // 	qreal y = qMax(m_beginAtom->pos().y(),m_beginAtom->pos().y());
-    return QRectF(mapFromParent(m_beginAtom->pos()) - QPointF(5,5), QSizeF(w+10,h+10));
+    updateGeometry();
+    return m_boundingRect;
   }
 
-  // draw single, double and triple bonds
-  void Bond::drawSimpleBond(QPainter *painter)
+  void Bond::invalidateGeometry()
   {
-    if (m_ring && (m_bondOrder == 2)) {
-      // draw double bond inside ring
-      drawRingBond(painter);
-      return;
-    }
-
-    Q_CHECK_PTR(m_beginAtom);
-    Q_CHECK_PTR(m_endAtom);
-
-    qreal m_bondSpacing = 4.0;
-
-    QPointF begin = mapFromParent(m_beginAtom->pos());
-    QPointF end = mapFromParent(m_endAtom->pos());
-    QPointF vb = end - begin;
-    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
-
-
-    if (m_beginAtom->hasLabel())
-      begin += 0.20 * uvb * 40/*molScene->bondLength()*/; // FIXME
-    if (m_endAtom->hasLabel())
-      end -= 0.20 * uvb * 40/*molScene->bondLength()*/; // FIXME
-
-    switch (m_bondOrder) {
-      case 1:
-        painter->drawLine(QLineF(begin, end));
-        break;
-      case 2:
-      {
-        QPointF orthogonal(uvb.y(), -uvb.x());
-        QPointF offset = orthogonal * 0.5 * m_bondSpacing;
-        if (m_bondType == CisOrTrans) {
-          painter->drawLine(QLineF(begin + offset, end - offset));
-          painter->drawLine(QLineF(begin - offset, end + offset));
-        } else {
-          painter->drawLine(QLineF(begin + offset, end + offset));
-          painter->drawLine(QLineF(begin - offset, end - offset));
-        }
-        break;
-      }
-      case 3:
-      {
-        QPointF orthogonal(uvb.y(), -uvb.x());
-        QPointF offset = orthogonal * m_bondSpacing;
-        painter->drawLine(QLineF(begin, end));
-        painter->drawLine(QLineF(begin + offset, end + offset));
-        painter->drawLine(QLineF(begin - offset, end - offset));
-        break;
-      }
-    }
+    prepareGeometryChange();
+    m_geometryValid = false;
   }
 
-  // draw a double bond with one line inside the ring
-  void Bond::drawRingBond(QPainter *painter)
+  void Bond::updateGeometry() const
   {
-    Q_CHECK_PTR(m_beginAtom);
-    Q_CHECK_PTR(m_endAtom);
-    Q_CHECK_PTR(m_ring);
-
-    qreal m_bondSpacing = 4.0;
-
-    QPointF center = mapFromParent(m_ring->center());
-    QPointF begin = mapFromParent(m_beginAtom->pos());
-    QPointF end = mapFromParent(m_endAtom->pos());
-    QPointF vb = end - begin;
-
-    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
-    QPointF orthogonal(uvb.y(), -uvb.x());
-    QPointF spacing = orthogonal * m_bondSpacing;
-    QPointF offset = uvb * m_bondSpacing;
-
-    QPointF offset2 = 0.20 * uvb * 40/*molScene->bondLength()*/; //FIXME
-
-    if (length(begin + spacing - center) > length(begin - spacing - center))
-      spacing *= -1.0;
-    
-    if (!m_beginAtom->hasLabel() && !m_endAtom->hasLabel()) {
-      // begin & end have no label
-      painter->drawLine(QLineF(begin, end));
-      painter->drawLine(QLineF(begin + spacing + offset, end + spacing - offset));
-    } else if (m_beginAtom->hasLabel() && m_endAtom->hasLabel()) {
-      painter->drawLine(QLineF(begin + offset2, end - offset2));
-      painter->drawLine(QLineF(begin + spacing + offset2, end + spacing - offset2));
-    } else if (m_beginAtom->hasLabel()) {
-      painter->drawLine(QLineF(begin + offset2, end));
-      painter->drawLine(QLineF(begin + spacing + offset2, end + spacing - offset));
-    } else if (m_endAtom->hasLabel()) {
-      painter->drawLine(QLineF(begin, end - offset2));
-      painter->drawLine(QLineF(begin + spacing + offset, end + spacing - offset2));
-    }
-
-  }
+    if (m_geometryValid)
+      return;
 
-  void Bond::drawHashBond(QPainter *painter, bool inverted)
-  {
     Q_CHECK_PTR(m_beginAtom);
     Q_CHECK_PTR(m_endAtom);
 
-    qreal m_bondSpacing = 4.0;
-
     QPointF begin = mapFromParent(m_beginAtom->pos());
     QPointF end = mapFromParent(m_endAtom->pos());
-    if (inverted) {
-      QPointF swap = begin;
-      begin = end;
-      end = swap;
-    }
-    QPointF vb = end - begin;
-
-    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
-    QPointF orthogonal(uvb.y(), -uvb.x());
-    orthogonal *= m_bondSpacing;
 
-    qreal lines[5] = { 0.25, 0.40, 0.55, 0.70, 0.90 };
+    qreal w = end.x() - begin.x();
+    qreal h = end.y() - begin.y();
 
-    int last = (m_endAtom->hasLabel()) ? 4 : 5;
-
-    for (int i = 0; i < last; ++i) {
-      qreal w = lines[i];
-      painter->drawLine( QLineF(begin + w * (vb + orthogonal), begin + w * (vb - orthogonal)) );
-    }
-  }
-
-  void Bond::drawWedgeBond(QPainter *painter, bool inverted)
-  {
-    Q_CHECK_PTR(m_beginAtom);
-    Q_CHECK_PTR(m_endAtom);
+    // 	qreal x = qMax(m_beginAtom->pos().x(),m_endAtom->pos().x());
+    // 	qreal y = qMax(m_beginAtom->pos().y(),m_beginAtom->pos().y());
+    m_boundingRect = QRectF(begin - QPointF(5,5), QSizeF(w+10,h+10));
 
-    qreal m_bondSpacing = 4.0;
+    QLineF line(begin, end);
+    QPolygonF polygon;
+    polygon << shiftVector(line,shapeHalfWidth()).p1()
+    << shiftVector(line,shapeHalfWidth()).p2()
+    << shiftVector(line,-shapeHalfWidth()).p2() << shiftVector(line,-shapeHalfWidth()).p1();
 
-    QPointF begin = mapFromParent(m_beginAtom->pos());
-    QPointF end = mapFromParent(m_endAtom->pos());
-    QPointF vb = end - begin;
-
-    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
-    QPointF orthogonal(uvb.y(), -uvb.x());
-    orthogonal *= m_bondSpacing;
-
-    int i = 0;
-    QPointF points[4];
-    if (m_beginAtom->hasLabel()) {
-      if (!inverted) {
-        points[i++] = begin + 0.25 * (vb - orthogonal);
-        points[i++] = begin + 0.25 * (vb + orthogonal);
-      } else {
-        points[i++] = begin + 0.25 * vb + 0.75 * orthogonal;
-        points[i++] = begin + 0.25 * vb - 0.75 * orthogonal;
-      }
-    } else {
-      if (!inverted) {
-        points[i++] = begin;
-      } else {
-        points[i++] = begin + orthogonal;
-        points[i++] = begin - orthogonal;
-      }
-    }
-    if (m_endAtom->hasLabel()) {
-      if (inverted) {
-        points[i++] = end - 0.25 * (vb + orthogonal);
-        points[i++] = end - 0.25 * (vb - orthogonal);
-      } else {
-        points[i++] = end - 0.25 * vb + 0.75 * orthogonal;
-        points[i++] = end - 0.25 * vb - 0.75 * orthogonal;
-      }
-    } else {
-      if (inverted) {
-        points[i++] = end;
-      } else {
-        points[i++] = end + orthogonal;
-        points[i++] = end - orthogonal;
-      }
-    }
+    m_shape = QPainterPath(begin);
+    // path.quadTo(QPointF(),m_endAtom->pos());
+    m_shape.addPolygon( polygon );
+    m_shape.closeSubpath();
 
-    painter->setBrush( QBrush(m_color) );
-    painter->drawConvexPolygon( points, i);
+    m_geometryValid = true;
   }
 
   void Bond::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
   {
-    Q_UNUSED(option);
-    Q_UNUSED(widget);
+    // a collapsed or cached molecule paints its bonds itself
+    Molecule *mol = molecule();
+    if (mol && mol->drawsChildren())
+      return;
 
     // Check the scene
     MolScene* molScene = dynamic_cast<MolScene*>(scene());
     Q_CHECK_PTR(molScene);
 
+    // plain bonds may be drawn by the molecule, see Molecule::paint()
+    MolScene::DetailLevel detail = molScene->detailLevel(option, painter, widget);
+    bool batched = (detail == MolScene::FullDetail) && molScene->batchedBondRendering() && drawnAsLines();
+    if (batched && !isSelected())
+      return;
+
     // Set painter defaults
     painter->save();
-    QPen pen;
-    pen.setWidthF(2/*molScene->bondWidth()*/); // FIXME
-    pen.setCapStyle(Qt::RoundCap);
-    pen.setColor (m_color);
-    painter->setPen(pen);
+    painter->setPen(pen());
 
-
-    // Create dash pattern for dot
-    QVector<qreal> dash;
-    dash << 2 << 5;
-
-    switch ( m_bondType )
+    // one line per bond when zoomed out
+    if (detail == MolScene::ReducedDetail)
+      painter->drawLine(QLineF(mapFromParent(m_beginAtom->pos()),mapFromParent(m_endAtom->pos())));
+    else if (!batched) switch ( m_bondType )
     {
       case Bond::Hash:
-        drawHashBond(painter, false);
+        painter->drawLines(MoleculeRenderer::hashBondLines(mapFromParent(m_beginAtom->pos()),
+            mapFromParent(m_endAtom->pos()), m_endAtom->hasLabel()));
         break;
       case Bond::InvertedHash:
-        drawHashBond(painter, true);
-        break;
-      case Bond::WedgeOrHash:
-        pen.setDashPattern(dash);
-        painter->setPen(pen);
-        painter->drawLine(QLineF(mapFromParent(m_beginAtom->pos()),mapFromParent(m_endAtom->pos())));
+        painter->drawLines(MoleculeRenderer::hashBondLines(mapFromParent(m_endAtom->pos()),
+            mapFromParent(m_beginAtom->pos()), m_endAtom->hasLabel()));
         break;
       case Bond::Wedge:
-        drawWedgeBond(painter, false);
-        break;
       case Bond::InvertedWedge:
-        drawWedgeBond(painter, true);
+        painter->setBrush( QBrush(m_color) );
+        painter->drawConvexPolygon(MoleculeRenderer::wedgeBondPolygon(mapFromParent(m_beginAtom->pos()),
+            mapFromParent(m_endAtom->pos()), m_beginAtom->hasLabel(), m_endAtom->hasLabel(),
+            m_bondType == Bond::InvertedWedge));
         break;
 
       default:
-        drawSimpleBond(painter);
+        painter->drawLines(lines());
     }
 
     if (isSelected()) {
@@ -334,26 +196,71 @@ namespace Molsketch {
   QVariant Bond::itemChange(GraphicsItemChange change, const QVariant &value)
   {
     if (change == ItemPositionChange && parentItem()) parentItem()->update();
+
+    // keep the spatial index of the scene up to date
+    if (change == ItemSceneChange) {
+      MolScene *molScene = qobject_cast<MolScene*>(scene());
+      if (molScene)
+        molScene->spatialIndex()->removeBond(this);
+    }
+    if (change == ItemSceneHasChanged || change == ItemParentHasChanged) {
+      MolScene *molScene = qobject_cast<MolScene*>(scene());
+      if (molScene)
+        molScene->spatialIndex()->updateBond(this);
+    }
+    if (change == ItemSelectedHasChanged && molecule())
+      molecule()->invalidateCache();
+    // the geometry is in the coordinates of the bond
+    if (change == ItemPositionHasChanged || change == ItemTransformHasChanged)
+      invalidateGeometry();
+
     return QGraphicsItem::itemChange(change, value);
   }
 
   QPainterPath Bond::shape() const
   {
-    QPolygonF polygon;
-    polygon << shiftVector(QLineF(mapFromParent(m_beginAtom->pos()),mapFromParent(m_endAtom->pos())),10).p1()
-    << shiftVector(QLineF(mapFromParent(m_beginAtom->pos()),mapFromParent(m_endAtom->pos())),10).p2()
-    << shiftVector(QLineF(mapFromParent(m_beginAtom->pos()),mapFromParent(m_endAtom->pos())),-10).p2() << shiftVector(QLineF(mapFromParent(m_beginAtom->pos()),mapFromParent(m_endAtom->pos())),-10).p1();
+    updateGeometry();
+    return m_shape;
+  }
 
-    QPainterPath path(mapFromParent(m_beginAtom->pos()));
-    // path.quadTo(QPointF(),m_endAtom->pos());
-    path.addPolygon( polygon );
-    path.closeSubpath();
+  bool Bond::drawnAsLines() const
+  {
+    return (m_bondType == InPlane) || (m_bondType == WedgeOrHash) || (m_bondType == CisOrTrans);
+  }
+
+  QVector<QLineF> Bond::lines() const
+  {
+    if (!drawnAsLines())
+      return QVector<QLineF>();
 
-    return path;
+    QPointF begin = mapFromParent(m_beginAtom->pos());
+    QPointF end = mapFromParent(m_endAtom->pos());
+    if (m_ring) {
+      // double bonds are drawn inside the ring
+      QPointF center = mapFromParent(m_ring->center());
+      return MoleculeRenderer::bondLines(begin, end, m_bondOrder, m_bondType,
+          m_beginAtom->hasLabel(), m_endAtom->hasLabel(), &center);
+    }
+    return MoleculeRenderer::bondLines(begin, end, m_bondOrder, m_bondType,
+        m_beginAtom->hasLabel(), m_endAtom->hasLabel());
+  }
+
+  QPen Bond::pen() const
+  {
+    return MoleculeRenderer::bondPen(m_bondType, m_color);
   }
 
   // Manipulation methods
 
+  void Bond::setColor(QColor col)
+  {
+    m_color = col;
+    Molecule *mol = molecule();
+    if (mol)
+      mol->invalidateBondPaths();
+    update();
+  }
+
   void Bond::setOrder(int order)
   {
     //pre: order>0
@@ -361,8 +268,13 @@ namespace Molsketch {
 
     Q_ASSERT( order > 0 );
     m_bondOrder = order;
-    molecule()->perceiveRings();
-    molecule()->invalidateElectronSystems();
+    m_beginAtom->invalidateValence();
+    m_endAtom->invalidateValence();
+    molecule()->invalidateRings();
+    molecule()->invalidateElectronSystems(m_beginAtom);
+    molecule()->invalidateElectronSystems(m_endAtom);
+    molecule()->invalidateBondPaths();
+    invalidateGeometry();
     update();
   }
 
@@ -407,6 +319,10 @@ namespace Molsketch {
     }
 */
 
+    Molecule *mol = molecule();
+    if (mol)
+      mol->invalidateBondPaths();
+    invalidateGeometry();
     update();
   }
 
@@ -33,6 +33,8 @@
 #include <molsketch/atom.h>
 
 #include <QGraphicsItem>
+#include <QPen>
+#include <QVector>
 
 
 namespace Molsketch {
@@ -106,6 +108,11 @@ class Bond : public QGraphicsItem
     virtual QPainterPath shape() const;
     /** Returns the bounding rectangle of the bond. Needed for Qt painting. */
     virtual QRectF boundingRect() const;
+    /**
+     * Mark the cached shape and bounding rect as outdated. Called when one of
+     * the atoms moves or the order or type of the bond changes.
+     */
+    void invalidateGeometry();
 
 
     // Manipulation methods
@@ -123,7 +130,7 @@ class Bond : public QGraphicsItem
     /** Cycle backward through the bond orders. */
     void decOrder();
 	
-	void setColor (QColor col) {m_color = col;}
+	void setColor (QColor col);
 	QColor getColor () {return m_color;}
 
     // Query methods
@@ -141,6 +148,22 @@ class Bond : public QGraphicsItem
 
     Atom* otherAtom(const Atom *atom) const;
 
+    /**
+     * @return @c true if the bond is drawn as lines in a single pen (i.e. it is
+     * not a wedge or hash bond). These bonds can be drawn by their molecule, see
+     * MolScene::setBatchedBondRendering().
+     */
+    bool drawnAsLines() const;
+    /**
+     * @return The lines of a bond for which drawnAsLines() is @c true, in the
+     * coordinates of the bond. Empty for the other bonds.
+     */
+    QVector<QLineF> lines() const;
+    /**
+     * @return The pen the bond is drawn with.
+     */
+    QPen pen() const;
+
     /** Returns the molecule this bond is part of. */
     Molecule* molecule() const;
 
@@ -155,6 +178,11 @@ class Bond : public QGraphicsItem
      * @return the shifted vector
      */
     static QLineF shiftVector(const QLineF & vector, qreal shift);
+    /**
+     * @return The distance the shape() of a bond extends on both sides of
+     * the line between its atoms.
+     */
+    static qreal shapeHalfWidth() { return 10.0; }
 
     /**
      * Get the ring for this bond. If the bond is part of multiple rings,
@@ -169,10 +197,8 @@ class Bond : public QGraphicsItem
     void setRing(Ring *ring) { m_ring = ring; }
 
   private:
-    void drawSimpleBond(QPainter *painter);
-    void drawRingBond(QPainter *painter);
-    void drawHashBond(QPainter *painter, bool inverted);
-    void drawWedgeBond(QPainter *painter, bool inverted);
+    /** Compute m_shape and m_boundingRect if invalidateGeometry() was called since the last update. */
+    void updateGeometry() const;
 
     // Internal representation
     /** Stores the bond type as integer. */
@@ -188,6 +214,13 @@ class Bond : public QGraphicsItem
 
     Ring *m_ring;      
 
+    //@name Cached geometry, see updateGeometry()
+    //@{
+    mutable bool m_geometryValid;
+    mutable QPainterPath m_shape;
+    mutable QRectF m_boundingRect;
+    //@}
+
 };
 
 } // namespace
@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include <QTransform>
+#include <QUndoStack>
 #include <QDebug>
 
 #include "commands.h"
@@ -36,6 +37,23 @@ using Molsketch::Bond;
 using Molsketch::Molecule;
 using namespace Molsketch::Commands;
 
+/**
+ * Helper function to drop the cache of @p item if it is a molecule, or else of
+ * the molecule of @p item, after a command changed it (see Molecule::invalidateCache()).
+ */
+static void invalidateCache(QGraphicsItem *item)
+{
+  Molecule *molecule = 0;
+  if (item->type() == Molecule::Type)
+    molecule = dynamic_cast<Molecule*>(item);
+  else if (item->type() == Atom::Type)
+    molecule = dynamic_cast<Atom*>(item)->molecule();
+  else if (item->type() == Bond::Type)
+    molecule = dynamic_cast<Bond*>(item)->molecule();
+  if (molecule)
+    molecule->invalidateCache();
+}
+
 /////////////////////////////////////////
 // AddAtom
 /////////////////////////////////////////
@@ -54,6 +72,7 @@ AddAtom::~AddAtom()
 void AddAtom::undo()
 {
   m_molecule->delAtom(m_atom);
+  invalidateCache(m_molecule);
   m_undone = true;
 }
 
@@ -64,6 +83,7 @@ void AddAtom::redo()
   Q_CHECK_PTR(m_molecule->scene());
 
   m_molecule->addAtom(m_atom);
+  invalidateCache(m_molecule);
   m_atom->setFlag(QGraphicsItem::ItemIsSelectable, m_molecule->scene()->editMode() == MolScene::MoveMode);
   m_undone = false;
 }
@@ -108,12 +128,14 @@ ChangeElement::ChangeElement(Atom* changeAtom, const QString &newEl, const QStri
 void ChangeElement::undo()
 {
   m_atom->setElement(m_oldName);
+  invalidateCache(m_atom);
   m_undone = true;
 }
 
 void ChangeElement::redo()
 {
   m_atom->setElement(m_newName);
+  invalidateCache(m_atom);
   m_undone = false;
 }
 
@@ -128,6 +150,7 @@ IncCharge::IncCharge(Atom* atom, const QString & text) : QUndoCommand(text), m_a
 void IncCharge::undo()
 {
   m_atom->setCharge(m_atom->charge() - 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) 
     m_atom->scene()->update();
   m_undone = true;
@@ -136,6 +159,7 @@ void IncCharge::undo()
 void IncCharge::redo()
 {
   m_atom->setCharge(m_atom->charge() + 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) 
     m_atom->scene()->update();
   m_undone = false;
@@ -152,6 +176,7 @@ DecCharge::DecCharge(Atom* atom, const QString & text) : QUndoCommand(text), m_a
 void DecCharge::undo()
 {
   m_atom->setCharge(m_atom->charge() + 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) 
     m_atom->scene()->update();
   m_undone = true;
@@ -160,6 +185,7 @@ void DecCharge::undo()
 void DecCharge::redo()
 {
   m_atom->setCharge(m_atom->charge() - 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) 
     m_atom->scene()->update();
   m_undone = false;
@@ -176,6 +202,7 @@ AddImplicitHydrogen::AddImplicitHydrogen(Atom* atom, const QString & text) : QUn
 void AddImplicitHydrogen::undo()
 {
   m_atom->setNumImplicitHydrogens(m_atom->numImplicitHydrogens() - 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) m_atom->scene()->update();
   m_undone = true;
 }
@@ -183,6 +210,7 @@ void AddImplicitHydrogen::undo()
 void AddImplicitHydrogen::redo()
 {
   m_atom->setNumImplicitHydrogens(m_atom->numImplicitHydrogens() + 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) m_atom->scene()->update();
   m_undone = false;
 }
@@ -193,12 +221,14 @@ RemoveImplicitHydrogen::RemoveImplicitHydrogen(Atom* atom, const QString & text)
 void RemoveImplicitHydrogen::undo()
 {
   m_atom->setNumImplicitHydrogens(m_atom->numImplicitHydrogens() + 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) m_atom->scene()->update();
   m_undone = true;
 }
 void RemoveImplicitHydrogen::redo()
 {
   m_atom->setNumImplicitHydrogens(m_atom->numImplicitHydrogens() - 1);
+  invalidateCache(m_atom);
   if (m_atom->scene()) m_atom->scene()->update();
   m_undone = false;
 }
@@ -223,15 +253,18 @@ DelAtom::~DelAtom()
 
 void DelAtom::undo()
 {
+  Molecule::Batch batch(m_molecule);
   m_molecule->addAtom(m_atom);
   m_atom->setFlag(QGraphicsItem::ItemIsSelectable, m_molecule->scene()->editMode()==MolScene::MoveMode);
   for (int i = 0; i < m_bondList.size(); i++) m_molecule->addBond(m_bondList.at(i));
+  invalidateCache(m_molecule);
   m_undone = true;
 }
 
 void DelAtom::redo()
 {
   m_bondList = m_molecule->delAtom(m_atom);
+  invalidateCache(m_molecule);
   m_undone = false;
 }
 
@@ -251,6 +284,7 @@ AddBond::~AddBond()
 void AddBond::undo()
 {
   m_mol->delBond(m_bond);
+  invalidateCache(m_mol);
   Atom *begin = m_bond->beginAtom();
   Atom *end = m_bond->endAtom();
   if (begin)
@@ -263,6 +297,7 @@ void AddBond::undo()
 void AddBond::redo()
 {
   m_mol->addBond(m_bond);
+  invalidateCache(m_mol);
   Atom *begin = m_bond->beginAtom();
   Atom *end = m_bond->endAtom(); 
   if (begin)
@@ -284,11 +319,13 @@ DelBond::~DelBond()
 void DelBond::undo()
 {
   m_mol->addBond(m_bond);
+  invalidateCache(m_mol);
   m_undone = true;
 }
 void DelBond::redo()
 {
   m_mol->delBond(m_bond);
+  invalidateCache(m_mol);
   m_undone = false;
 }
 
@@ -308,6 +345,7 @@ void SetBondType::undo()
   m_bond->setType(m_oldType);
   m_bond->setOrder(m_oldOrder);
   m_bond->update();
+  invalidateCache(m_bond);
 }
 
 void SetBondType::redo()
@@ -316,6 +354,7 @@ void SetBondType::redo()
     m_bond->setOrder(2);
   m_bond->setType(m_newType);
   m_bond->update();
+  invalidateCache(m_bond);
 }
 
 ////////////////////////////////////////////////////////////
@@ -327,14 +366,59 @@ IncOrder::IncOrder(Bond* incBond, const QString & text) : QUndoCommand(text), m_
 void IncOrder::undo()
 {
   m_bond->decOrder();
+  invalidateCache(m_bond);
   m_undone = true;
 }
 void IncOrder::redo()
 {
   m_bond->incOrder();
+  invalidateCache(m_bond);
   m_undone = false;
 }
 
+////////////////////////////////////////////////////////////
+// Edit batch
+////////////////////////////////////////////////////////////
+
+EditBatch::EditBatch(Molecule* molecule, bool begin, const QString & text) : QUndoCommand(text), m_molecule(molecule), m_begin(begin)
+{}
+void EditBatch::push(QUndoStack *stack, const QList<Molecule*> &molecules, bool begin)
+{
+  foreach (Molecule *molecule, molecules)
+    stack->push(new EditBatch(molecule, begin));
+}
+QList<Molecule*> EditBatch::molecules(const QList<QGraphicsItem*> &items)
+{
+  QList<Molecule*> result;
+  foreach (QGraphicsItem *item, items) {
+    Molecule *molecule = 0;
+    if (item->type() == Molecule::Type)
+      molecule = dynamic_cast<Molecule*>(item);
+    else if (item->type() == Atom::Type)
+      molecule = dynamic_cast<Atom*>(item)->molecule();
+    else if (item->type() == Bond::Type)
+      molecule = dynamic_cast<Bond*>(item)->molecule();
+    if (molecule && !result.contains(molecule))
+      result.append(molecule);
+  }
+  return result;
+}
+void EditBatch::undo()
+{
+  // the commands of the macro are undone in reverse order
+  if (m_begin)
+    m_molecule->endBatch();
+  else
+    m_molecule->beginBatch();
+}
+void EditBatch::redo()
+{
+  if (m_begin)
+    m_molecule->beginBatch();
+  else
+    m_molecule->endBatch();
+}
+
 MergeMol::MergeMol(Molecule* moleculeA, Molecule* moleculeB, Molecule*& mergedMolecule, const QString & text) :  QUndoCommand(text), m_molA(moleculeA), m_molB(moleculeB), m_molC(mergedMolecule), m_scene(moleculeA->scene())
 {
   //pre: molA.scene = molB.scene
@@ -358,6 +442,8 @@ void MergeMol::undo()
   foreach(Atom* atom, m_molC->atoms()) 
     atom->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
   m_scene->addItem(m_molB);
+  invalidateCache(m_molA);
+  invalidateCache(m_molB);
   m_molB->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
   foreach(Atom* atom, m_molC->atoms()) 
     atom->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
@@ -369,6 +455,7 @@ void MergeMol::redo()
   m_scene->removeItem(m_molA);
   m_scene->removeItem(m_molB);
   m_scene->addItem(m_molC);
+  invalidateCache(m_molC);
   m_molC->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);  
   foreach(Atom* atom, m_molC->atoms()) 
     atom->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
@@ -386,24 +473,8 @@ void MergeMol::redo()
     Molecule* molC = new Molecule;
 
     // Adding the bonds and atoms of the first two molecules
-    foreach (Atom* a, molA->atoms())
-    {
-      Atom* a2 = new Atom(a->scenePos(),a->element(),a->hasImplicitHydrogens());
-    a2 ->setColor( a->getColor ());
-      molC->addAtom(a2);
-    }
-    foreach (Bond* b, molA->bonds())
-    {
-      molC->addBond( molC->atomAt(b->beginAtom()->scenePos()), molC->atomAt(b->endAtom()->scenePos()), b->bondOrder(), b->bondType(), b->getColor ());
-    }
-    foreach (Atom* a, molB->atoms())
-    {
-      molC->addAtom( a->element(), a->scenePos(), a->hasImplicitHydrogens(), a->getColor ());
-    }
-    foreach (Bond* b, molB->bonds())
-    {
-      molC->addBond( molC->atomAt(b->beginAtom()->scenePos()), molC->atomAt(b->endAtom()->scenePos()), b->bondOrder(), b->bondType(), b->getColor ());
-    }
+    molC->addCopies(molA->atoms(), molA->bonds(), true);
+    molC->addCopies(molB->atoms(), molB->bonds(), true);
 
     //         molC->setPos(molA->scenePos());
 
@@ -412,7 +483,15 @@ void MergeMol::redo()
 
 SplitMol::SplitMol(Molecule* mol, const QString & text) :  QUndoCommand(text), m_oldMol(mol), m_scene(mol->scene())
 {
+  m_atomList = m_oldMol->atoms();
+  m_bondList = m_oldMol->bonds();
+  // split() moves the atoms and bonds to the new molecules
   m_newMolList = m_oldMol->split();
+  foreach(Molecule* mol,m_newMolList)
+  {
+    m_newAtomLists.append(mol->atoms());
+    m_newBondLists.append(mol->bonds());
+  }
 }
 SplitMol::~SplitMol()
 {
@@ -421,8 +500,14 @@ SplitMol::~SplitMol()
 }
 void SplitMol::undo()
 {
-  foreach(Molecule* mol,m_newMolList) m_scene->removeItem(mol);
+  foreach(Molecule* mol,m_newMolList) 
+  {
+    m_scene->removeItem(mol);
+    mol->releaseAtomsAndBonds();
+  }
+  m_oldMol->addAtomsAndBonds(m_atomList, m_bondList);
   m_scene->addItem(m_oldMol);
+  invalidateCache(m_oldMol);
   m_oldMol->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
   foreach(Atom* atom, m_oldMol->atoms()) 
     atom->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
@@ -431,9 +516,17 @@ void SplitMol::undo()
 void SplitMol::redo()
 {
   m_scene->removeItem(m_oldMol);
+  // the atoms are still in the original molecule after an undo
+  if (!m_oldMol->atoms().isEmpty())
+  {
+    m_oldMol->releaseAtomsAndBonds();
+    for (int i = 0; i < m_newMolList.size(); ++i)
+      m_newMolList.at(i)->addAtomsAndBonds(m_newAtomLists.at(i), m_newBondLists.at(i));
+  }
   foreach(Molecule* mol,m_newMolList) 
   {
     m_scene->addItem(mol);
+    invalidateCache(mol);
 	mol->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
 	foreach(Atom* atom, mol->atoms()) 
       atom->setFlag(QGraphicsItem::ItemIsSelectable, m_scene->editMode()==MolScene::MoveMode);
@@ -498,26 +591,55 @@ MoveItem::MoveItem(QGraphicsItem* moveItem, const QPointF & moveVector, const QS
 void MoveItem::undo()
 {
   m_item -> setPos(m_oldPos);
+  invalidateCache(m_item);
   if (m_item->type()==Atom::Type) dynamic_cast<Atom*>(m_item)->molecule()->rebuild();
   m_undone = true;
 }
 void MoveItem::redo()
 {
   m_item -> setPos(m_newPos);
+  invalidateCache(m_item);
   if (m_item->type()==Atom::Type) dynamic_cast<Atom*>(m_item)->molecule()->rebuild();
   m_undone = false;
 }
 
 
+MoveAtoms::MoveAtoms(Molecule* molecule, const QList<QPointF> & oldPositions, const QList<QPointF> & newPositions, const QString & text) : QUndoCommand(text), m_molecule(molecule), m_oldPositions(oldPositions), m_newPositions(newPositions)
+{
+  Q_ASSERT(oldPositions.size() == molecule->atoms().size());
+  Q_ASSERT(newPositions.size() == molecule->atoms().size());
+}
+void MoveAtoms::undo()
+{
+  setPositions(m_oldPositions);
+}
+void MoveAtoms::redo()
+{
+  setPositions(m_newPositions);
+}
+void MoveAtoms::setPositions(const QList<QPointF> & positions)
+{
+  {
+    Molecule::Batch batch(m_molecule);
+    QList<Atom*> atoms = m_molecule->atoms();
+    for (int i = 0; i < atoms.size() && i < positions.size(); ++i)
+      atoms.at(i)->setPos(positions.at(i));
+  }
+  m_molecule->invalidateCache();
+}
+
+
 RotateItem::RotateItem(QGraphicsItem* rotateItem, const QTransform & transform, const QString & text) : QUndoCommand(text), m_item(rotateItem), m_transform( transform )
 {}
 void RotateItem::undo()
 {
   m_item -> setTransform( m_transform.inverted(), true );
+  invalidateCache(m_item);
   m_undone = true;
 }
 void RotateItem::redo()
 {
   m_item -> setTransform( m_transform, true );
+  invalidateCache(m_item);
   m_undone = false;
 }
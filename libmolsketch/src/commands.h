@@ -37,6 +37,7 @@
 class QGraphicsItem;
 class QGraphicsScene;
 class QTransform;
+class QUndoStack;
 
 #include "bond.h"
 
@@ -415,6 +416,42 @@ class IncOrder : public  QUndoCommand
 
 // Molecule commands
 
+/**
+ * Command to begin or end a batch of edits on a molecule (see Molecule::beginBatch()).
+ * Push one with @p begin @c true at the start of a macro and one with @p begin @c false
+ * at its end, so the edits in between are batched both when doing and undoing the macro.
+ */
+class EditBatch : public QUndoCommand
+  {
+  public:
+    /**
+     * Constructor
+     *
+     * @param molecule the molecule to edit
+     * @param begin @c true for the command at the start of the macro, @c false for the one at its end
+     * @param text a description of the command
+     */
+    EditBatch(Molecule* molecule, bool begin, const QString & text = "");
+    /**
+     * Push a command for each of @p molecules on @p stack. Use the same list
+     * at the start and at the end of the macro.
+     */
+    static void push(QUndoStack *stack, const QList<Molecule*> &molecules, bool begin);
+    /**
+     * @return the molecules edited by a macro on @p items: the molecules among
+     * @p items and those of the atoms and bonds, each once
+     */
+    static QList<Molecule*> molecules(const QList<QGraphicsItem*> &items);
+    /** Undo this command. */
+    virtual void undo();
+    /** Redo this command. */
+    virtual void redo();
+  private:
+    /** The molecule of this command. */
+    Molecule* m_molecule;
+    /** Whether this command is at the start of the macro. */
+    bool m_begin;
+  };
 
 /**
  * Command to merge two molecules
@@ -480,7 +517,8 @@ class SplitMol : public QUndoCommand
      * Destructor
      *
      * Deletes the original molecule if destructed in a done state
-     * and the submolecules if destructed in an undone state.
+     * and the submolecules if destructed in an undone state. The atoms
+     * and bonds are always owned by the molecule they were last moved to.
      */
     ~SplitMol();
     /** Undo this command. */
@@ -492,8 +530,16 @@ class SplitMol : public QUndoCommand
     bool m_undone;
     /** The molecule before the split. */
     Molecule* m_oldMol;
+    /** The atoms of the molecule before the split. */
+    QList<Atom*> m_atomList;
+    /** The bonds of the molecule before the split. */
+    QList<Bond*> m_bondList;
     /** The list of molecules after the split. */
     QList<Molecule*> m_newMolList;
+    /** The atoms of each of the molecules after the split. */
+    QList<QList<Atom*> > m_newAtomLists;
+    /** The bonds of each of the molecules after the split. */
+    QList<QList<Bond*> > m_newBondLists;
     /** The scene of this command. */
     MolScene* m_scene;
   };
@@ -603,6 +649,37 @@ class MoveItem : public QUndoCommand
     QGraphicsItem* m_item;
   };
 
+/**
+ * Command to move all atoms of a molecule at once, e.g. to the result of a
+ * clean-up (see Minimise). The molecule is rebuilt once, not for each atom.
+ */
+class MoveAtoms : public QUndoCommand
+  {
+  public:
+    /**
+     * Constructor
+     *
+     * @param molecule the molecule to change
+     * @param oldPositions the positions before the move, in the order of Molecule::atoms()
+     * @param newPositions the positions after the move, in the same order
+     * @param text a description of the command
+     */
+    MoveAtoms(Molecule* molecule, const QList<QPointF> & oldPositions, const QList<QPointF> & newPositions, const QString & text = "");
+    /** Undo this command. */
+    virtual void undo();
+    /** Redo this command. */
+    virtual void redo();
+  private:
+    /** Move the atoms to @p positions. */
+    void setPositions(const QList<QPointF> & positions);
+    /** The molecule of this command. */
+    Molecule* m_molecule;
+    /** The positions of the atoms before the move. */
+    QList<QPointF> m_oldPositions;
+    /** The positions of the atoms after the move. */
+    QList<QPointF> m_newPositions;
+  };
+
 /**
  * Command to rotate an item on the scene
  *
@@ -23,220 +23,315 @@
 
 #include "element.h"
 
-#include <openbabel/data.h>
+namespace Molsketch {
 
-OpenBabel::OBElementTable eTable;
+  /**
+   * The data of an element, see elementTable.
+   */
+  struct ElementData
+  {
+    const char *symbol;
+    qreal mass; //!< standard atomic weight, or the mass number of the most stable isotope
+    int group;
+    int valenceElectrons;
+    int expectedValence;
+    QRgb color;
+  };
 
-namespace Molsketch {
+  /**
+   * The elements indexed by atomic number, entry 0 is the dummy atom. This is
+   * plain data, so it is set up at compile time and lookups are array indexing.
+   * The groups of the lanthanides and actinides are 3.
+   */
+  static constexpr ElementData elementTable[] = {
+    { "Xx",  0.0,           3,  1, 0, 0xff000000 }, // 0
+    { "H",   1.00794,       1,  1, 1, 0xffc8c8c8 }, // 1
+    { "He",  4.002602,     18,  2, 0, 0xff000000 }, // 2
+    { "Li",  6.941,         1,  1, 1, 0xff000000 }, // 3
+    { "Be",  9.012182,      2,  2, 2, 0xff000000 }, // 4
+    { "B",   10.811,       13,  3, 3, 0xff000000 }, // 5
+    { "C",   12.0107,      14,  4, 4, 0xff000000 }, // 6
+    { "N",   14.0067,      15,  5, 3, 0xff0000ff }, // 7
+    { "O",   15.9994,      16,  6, 2, 0xffff0000 }, // 8
+    { "F",   18.9984032,   17,  7, 1, 0xff000000 }, // 9
+    { "Ne",  20.1797,      18,  8, 0, 0xff000000 }, // 10
+    { "Na",  22.98976928,   1,  1, 1, 0xff000000 }, // 11
+    { "Mg",  24.3050,       2,  2, 2, 0xff000000 }, // 12
+    { "Al",  26.9815386,   13,  3, 3, 0xff000000 }, // 13
+    { "Si",  28.0855,      14,  4, 4, 0xff000000 }, // 14
+    { "P",   30.973762,    15,  5, 3, 0xff000000 }, // 15
+    { "S",   32.065,       16,  6, 2, 0xff000000 }, // 16
+    { "Cl",  35.453,       17,  7, 1, 0xff000000 }, // 17
+    { "Ar",  39.948,       18,  8, 0, 0xff000000 }, // 18
+    { "K",   39.0983,       1,  1, 1, 0xff000000 }, // 19
+    { "Ca",  40.078,        2,  2, 2, 0xff000000 }, // 20
+    { "Sc",  44.955912,     3,  1, 0, 0xff000000 }, // 21
+    { "Ti",  47.867,        4,  2, 0, 0xff000000 }, // 22
+    { "V",   50.9415,       5,  3, 0, 0xff000000 }, // 23
+    { "Cr",  51.9961,       6,  4, 0, 0xff000000 }, // 24
+    { "Mn",  54.938045,     7,  5, 0, 0xff000000 }, // 25
+    { "Fe",  55.845,        8,  6, 0, 0xff000000 }, // 26
+    { "Co",  58.933195,     9,  7, 0, 0xff000000 }, // 27
+    { "Ni",  58.6934,      10,  8, 0, 0xff000000 }, // 28
+    { "Cu",  63.546,       11,  9, 0, 0xff000000 }, // 29
+    { "Zn",  65.38,        12, 10, 0, 0xff000000 }, // 30
+    { "Ga",  69.723,       13,  3, 3, 0xff000000 }, // 31
+    { "Ge",  72.64,        14,  4, 4, 0xff000000 }, // 32
+    { "As",  74.92160,     15,  5, 3, 0xff000000 }, // 33
+    { "Se",  78.96,        16,  6, 2, 0xff000000 }, // 34
+    { "Br",  79.904,       17,  7, 1, 0xff000000 }, // 35
+    { "Kr",  83.798,       18,  8, 0, 0xff000000 }, // 36
+    { "Rb",  85.4678,       1,  1, 1, 0xff000000 }, // 37
+    { "Sr",  87.62,         2,  2, 2, 0xff000000 }, // 38
+    { "Y",   88.90585,      3,  1, 0, 0xff000000 }, // 39
+    { "Zr",  91.224,        4,  2, 0, 0xff000000 }, // 40
+    { "Nb",  92.90638,      5,  3, 0, 0xff000000 }, // 41
+    { "Mo",  95.96,         6,  4, 0, 0xff000000 }, // 42
+    { "Tc",  98.0,          7,  5, 0, 0xff000000 }, // 43
+    { "Ru",  101.07,        8,  6, 0, 0xff000000 }, // 44
+    { "Rh",  102.90550,     9,  7, 0, 0xff000000 }, // 45
+    { "Pd",  106.42,       10,  8, 0, 0xff000000 }, // 46
+    { "Ag",  107.8682,     11,  9, 0, 0xff000000 }, // 47
+    { "Cd",  112.411,      12, 10, 0, 0xff000000 }, // 48
+    { "In",  114.818,      13,  3, 3, 0xff000000 }, // 49
+    { "Sn",  118.710,      14,  4, 4, 0xff000000 }, // 50
+    { "Sb",  121.760,      15,  5, 3, 0xff000000 }, // 51
+    { "Te",  127.60,       16,  6, 2, 0xff000000 }, // 52
+    { "I",   126.90447,    17,  7, 1, 0xff000000 }, // 53
+    { "Xe",  131.293,      18,  8, 0, 0xff000000 }, // 54
+    { "Cs",  132.9054519,   1,  1, 1, 0xff000000 }, // 55
+    { "Ba",  137.327,       2,  2, 2, 0xff000000 }, // 56
+    { "La",  138.90547,     3,  1, 0, 0xff000000 }, // 57
+    { "Ce",  140.116,       3,  1, 0, 0xff000000 }, // 58
+    { "Pr",  140.90765,     3,  1, 0, 0xff000000 }, // 59
+    { "Nd",  144.242,       3,  1, 0, 0xff000000 }, // 60
+    { "Pm",  145.0,         3,  1, 0, 0xff000000 }, // 61
+    { "Sm",  150.36,        3,  1, 0, 0xff000000 }, // 62
+    { "Eu",  151.964,       3,  1, 0, 0xff000000 }, // 63
+    { "Gd",  157.25,        3,  1, 0, 0xff000000 }, // 64
+    { "Tb",  158.92535,     3,  1, 0, 0xff000000 }, // 65
+    { "Dy",  162.500,       3,  1, 0, 0xff000000 }, // 66
+    { "Ho",  164.93032,     3,  1, 0, 0xff000000 }, // 67
+    { "Er",  167.259,       3,  1, 0, 0xff000000 }, // 68
+    { "Tm",  168.93421,     3,  1, 0, 0xff000000 }, // 69
+    { "Yb",  173.054,       3,  1, 0, 0xff000000 }, // 70
+    { "Lu",  174.9668,      3,  1, 0, 0xff000000 }, // 71
+    { "Hf",  178.49,        4,  2, 0, 0xff000000 }, // 72
+    { "Ta",  180.94788,     5,  3, 0, 0xff000000 }, // 73
+    { "W",   183.84,        6,  4, 0, 0xff000000 }, // 74
+    { "Re",  186.207,       7,  5, 0, 0xff000000 }, // 75
+    { "Os",  190.23,        8,  6, 0, 0xff000000 }, // 76
+    { "Ir",  192.217,       9,  7, 0, 0xff000000 }, // 77
+    { "Pt",  195.084,      10,  8, 0, 0xff000000 }, // 78
+    { "Au",  196.966569,   11,  9, 0, 0xff000000 }, // 79
+    { "Hg",  200.59,       12, 10, 0, 0xff000000 }, // 80
+    { "Tl",  204.3833,     13,  3, 3, 0xff000000 }, // 81
+    { "Pb",  207.2,        14,  4, 4, 0xff000000 }, // 82
+    { "Bi",  208.98040,    15,  5, 3, 0xff000000 }, // 83
+    { "Po",  209.0,        16,  6, 2, 0xff000000 }, // 84
+    { "At",  210.0,        17,  7, 1, 0xff000000 }, // 85
+    { "Rn",  222.0,        18,  8, 0, 0xff000000 }, // 86
+    { "Fr",  223.0,         1,  1, 1, 0xff000000 }, // 87
+    { "Ra",  226.0,         2,  2, 2, 0xff000000 }, // 88
+    { "Ac",  227.0,         3,  1, 0, 0xff000000 }, // 89
+    { "Th",  232.03806,     3,  1, 0, 0xff000000 }, // 90
+    { "Pa",  231.03588,     3,  1, 0, 0xff000000 }, // 91
+    { "U",   238.02891,     3,  1, 0, 0xff000000 }, // 92
+    { "Np",  237.0,         3,  1, 0, 0xff000000 }, // 93
+    { "Pu",  244.0,         3,  1, 0, 0xff000000 }, // 94
+    { "Am",  243.0,         3,  1, 0, 0xff000000 }, // 95
+    { "Cm",  247.0,         3,  1, 0, 0xff000000 }, // 96
+    { "Bk",  247.0,         3,  1, 0, 0xff000000 }, // 97
+    { "Cf",  251.0,         3,  1, 0, 0xff000000 }, // 98
+    { "Es",  252.0,         3,  1, 0, 0xff000000 }, // 99
+    { "Fm",  257.0,         3,  1, 0, 0xff000000 }, // 100
+    { "Md",  258.0,         3,  1, 0, 0xff000000 }, // 101
+    { "No",  259.0,         3,  1, 0, 0xff000000 }, // 102
+    { "Lr",  262.0,         3,  1, 0, 0xff000000 }, // 103
+    { "Rf",  267.0,         4,  2, 0, 0xff000000 }, // 104
+    { "Db",  268.0,         5,  3, 0, 0xff000000 }, // 105
+    { "Sg",  271.0,         6,  4, 0, 0xff000000 }, // 106
+    { "Bh",  272.0,         7,  5, 0, 0xff000000 }, // 107
+    { "Hs",  270.0,         8,  6, 0, 0xff000000 }, // 108
+    { "Mt",  276.0,         9,  7, 0, 0xff000000 }, // 109
+    { "Ds",  281.0,        10,  8, 0, 0xff000000 }, // 110
+    { "Rg",  280.0,        11,  9, 0, 0xff000000 }, // 111
+    { "Uub", 285.0,        12, 10, 0, 0xff000000 }, // 112
+    { "Uut", 284.0,        13,  3, 3, 0xff000000 }, // 113
+  };
+
+  static constexpr int numElements = sizeof(elementTable) / sizeof(elementTable[0]);
+
+  /**
+   * Helper function to get the data of element @p number, or the dummy atom for
+   * an unknown number.
+   */
+  static inline const ElementData& elementData(int number)
+  {
+    if (number < 0 || number >= numElements)
+      number = 0;
+    return elementTable[number];
+  }
+
+  /**
+   * Helper function to pack the (up to three) characters of a symbol of the
+   * element table in one integer.
+   */
+  static constexpr quint32 symbolKey(const char *symbol)
+  {
+    return (quint32(symbol[0]) << 16) | (symbol[1] ? (quint32(symbol[1]) << 8) | quint32(symbol[2]) : 0);
+  }
+
+  /**
+   * Helper function to pack the (up to three) letters of @p symbol in one integer
+   * like symbolKey(const char*), with the first letter in upper case and the others
+   * in lower case. Returns 0 for strings that can not be a symbol, i.e. that are
+   * empty, longer than three characters or contain anything but the letters A-Z
+   * and a-z.
+   */
+  static quint32 symbolKey(const QString &symbol)
+  {
+    if (symbol.isEmpty() || symbol.size() > 3)
+      return 0;
+    quint32 key = 0;
+    for (int i = 0; i < 3; ++i) {
+      ushort c = (i < symbol.size()) ? symbol.at(i).unicode() : 0;
+      if (c >= 'a' && c <= 'z') {
+        if (i == 0)
+          c += 'A' - 'a';
+      } else if (c >= 'A' && c <= 'Z') {
+        if (i > 0)
+          c += 'a' - 'A';
+      } else if (i < symbol.size()) {
+        return 0;
+      }
+      key = (key << 8) | c;
+    }
+    return key;
+  }
+
+  /**
+   * Perfect hash of the symbol keys: multiplicative hashing with a multiplier
+   * picked so that the 113 symbols go to different slots of a 512 slot table.
+   */
+  static constexpr int symbolHash(quint32 key)
+  {
+    return (key * 0x1acf3e6dU) >> 23;
+  }
+
+  /**
+   * Helper function to get the atomic number of the element in @p slot of the
+   * symbol table, searching from @p number on, or 0 for an empty slot.
+   */
+  static constexpr unsigned char slotNumber(int slot, int number = 1)
+  {
+    return (number >= numElements) ? 0 :
+      (symbolHash(symbolKey(elementTable[number].symbol)) == slot) ? number :
+      slotNumber(slot, number + 1);
+  }
+
+  /**
+   * Helper function to check that no two symbols from @p number on share a slot.
+   */
+  static constexpr bool symbolHashIsPerfect(int number = 1)
+  {
+    return (number >= numElements) ||
+      ((slotNumber(symbolHash(symbolKey(elementTable[number].symbol))) == number) &&
+       symbolHashIsPerfect(number + 1));
+  }
+
+  static_assert(symbolHashIsPerfect(), "two element symbols have the same hash");
+
+  /**
+   * The atomic number of each symbol and its key, in the slot given by symbolHash().
+   */
+  struct SymbolTable
+  {
+    enum { NumSlots = 512 };
+
+    quint32 keys[NumSlots];
+    unsigned char numbers[NumSlots];
+  };
+
+  /**
+   * The slots 0, 1, ... of the symbol table. Doubled() appends as many slots
+   * again, so nine doublings of @c Slots<0> give the 512 slots.
+   */
+  template <int... Slot> struct Slots
+  {
+    typedef Slots<Slot..., (int(sizeof...(Slot)) + Slot)...> Doubled;
+  };
+
+  template <int Doublings> struct DoubledSlots
+  {
+    typedef typename DoubledSlots<Doublings - 1>::Type::Doubled Type;
+  };
+
+  template <> struct DoubledSlots<0>
+  {
+    typedef Slots<0> Type;
+  };
+
+  template <int... Slot>
+  static constexpr SymbolTable makeSymbolTable(Slots<Slot...>)
+  {
+    return SymbolTable {
+      { (slotNumber(Slot) ? symbolKey(elementTable[slotNumber(Slot)].symbol) : 0)... },
+      { slotNumber(Slot)... }
+    };
+  }
+
+  /**
+   * The symbol table, filled at compile time.
+   */
+  static constexpr SymbolTable symbolTable = makeSymbolTable(DoubledSlots<9>::Type());
 
   QColor elementColor(int element)
   {
     //@todo: Add more colors....
-    switch (element) {
-      case Element::H:
-        return QColor(200,200,200);
-      case Element::C:
-        return QColor(0, 0, 0);
-      case Element::N:
-        return QColor(0, 0, 255);
-      case Element::O:
-        return QColor(255, 0, 0);
-      default:
-        return QColor(0, 0, 0);    
-    }  
+    return QColor(elementData(element).color);
   }
 
   QString number2symbol( int number )
   {
-    return eTable.GetSymbol(number);
+    if (number < 0 || number >= numElements)
+      return QString();
+    return elementTable[number].symbol;
   }
 
   int symbol2number( const QString &symbol )
   {
-    return eTable.GetAtomicNum(symbol.toAscii());;
+    quint32 key = symbolKey(symbol);
+    if (!key)
+      return 0;
+    // deuterium and tritium
+    if (key == (quint32('D') << 16) || key == (quint32('T') << 16))
+      return Element::H;
+    int slot = symbolHash(key);
+    if (symbolTable.keys[slot] != key)
+      return 0;
+    return symbolTable.numbers[slot];
   }
 
   double weightOfElement( int number )
   {
-    return  eTable.GetMass(number);
+    return elementData(number).mass;
   }
 
   int elementGroup(int element)
   {
-    switch (element) {
-      case Element::H: 
-      case Element::Li:
-      case Element::Na:
-      case Element::K: 
-      case Element::Rb: 
-      case Element::Cs: 
-      case Element::Fr: 
-        return 1;
-      case Element::Be: 
-      case Element::Mg: 
-      case Element::Ca: 
-      case Element::Sr: 
-      case Element::Ba: 
-      case Element::Ra: 
-        return 2;
-      case Element::Ti: 
-      case Element::Zr: 
-      case Element::Hf: 
-      case Element::Rf: 
-        return 4;
-      case Element::V:
-      case Element::Nb:
-      case Element::Ta:
-      case Element::Db:
-        return 5;
-      case Element::Cr:
-      case Element::Mo:
-      case Element::W:
-      case Element::Sg:
-        return 6;
-      case Element::Mn:
-      case Element::Tc:
-      case Element::Re:
-      case Element::Bh:
-        return 7;
-      case Element::Fe:
-      case Element::Ru:
-      case Element::Os:
-      case Element::Hs:
-        return 8;
-      case Element::Co:
-      case Element::Rh:
-      case Element::Ir:
-      case Element::Mt:
-        return 9;
-      case Element::Ni:
-      case Element::Pd:
-      case Element::Pt:
-      case Element::Ds:
-        return 10;
-      case Element::Cu:
-      case Element::Ag:
-      case Element::Au:
-      case Element::Rg:
-        return 11;
-      case Element::Zn:
-      case Element::Cd:
-      case Element::Hg:
-      case Element::Uub:
-        return 12;
-      case Element::B: 
-      case Element::Al: 
-      case Element::Ga: 
-      case Element::In: 
-      case Element::Tl: 
-      case Element::Uut:
-        return 13;
-      case Element::C: 
-      case Element::Si: 
-      case Element::Ge: 
-      case Element::Sn: 
-      case Element::Pb: 
-        return 14;
-      case Element::N: 
-      case Element::P: 
-      case Element::As: 
-      case Element::Sb: 
-      case Element::Bi: 
-        return 15;
-      case Element::O: 
-      case Element::S: 
-      case Element::Se: 
-      case Element::Te: 
-      case Element::Po: 
-        return 16; 
-      case Element::F: 
-      case Element::Cl: 
-      case Element::Br: 
-      case Element::I: 
-      case Element::At: 
-        return 17;
-      case Element::He:
-      case Element::Ne:
-      case Element::Ar:
-      case Element::Kr:
-      case Element::Xe:
-      case Element::Rn:
-        return 18;
-      default:
-        return 3; // Lanthanides & Actinides
-    }
-
+    return elementData(element).group;
   }
 
   int numValenceElectrons(int element)
   {
     // @todo implement other elements
-    switch (elementGroup(element)) {
-      case 1:
-        return 1;
-      case 2:
-        return 2;
-      case 3:
-        return 1;
-      case 4:
-        return 2;
-      case 5:
-        return 3;
-      case 6:
-        return 4;
-      case 7:
-        return 5;
-      case 8:
-        return 6;
-      case 9:
-        return 7;
-      case 10:
-        return 8;
-      case 11:
-        return 9;
-      case 12:
-        return 10;
-      case 13:
-        return 3;
-      case 14:
-        return 4;
-      case 15:
-        return 5;
-      case 16:
-        return 6;
-      case 17:
-        return 7;
-      case 18:
-        // special case
-        if (element == Element::He)
-          return 2;
-        return 8;
-      default:
-        return 8; // makes charge 0
-    }
-
+    return elementData(element).valenceElectrons;
   }
 
   int expectedValence(int element)
   {
-    switch (elementGroup(element)) {
-      case 1:
-        return 1;
-      case 2:
-        return 2;
-      case 13:
-        return 3;  
-      case 14:
-        return 4;
-      case 15:
-        return 3;
-      case 16:
-        return 2;
-      case 17:
-        return 1; 
-      default:
-        return 0; // trasition metals + noble gases 
-    }
+    return elementData(element).expectedValence;
   }
 
 
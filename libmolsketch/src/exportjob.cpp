@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QFile>
+#include <QFontDatabase>
+#include <QThreadPool>
+#include <QtConcurrentRun>
+
+#include "exportjob.h"
+
+namespace Molsketch {
+
+  ExportJob::ExportJob(const TiledRenderer &renderer, const QString &fileName, QObject *parent)
+      : QObject(parent), m_renderer(renderer), m_fileName(fileName), m_cancelled(0)
+  {
+    connect(&m_watcher, SIGNAL(finished()), this, SLOT(saveFinished()));
+  }
+
+  ExportJob::~ExportJob()
+  {
+    cancel();
+    m_watcher.waitForFinished();
+  }
+
+  bool ExportJob::isCancelled() const
+  {
+    return m_cancelled != 0;
+  }
+
+  void ExportJob::cancel()
+  {
+    m_cancelled = 1;
+  }
+
+  void ExportJob::start()
+  {
+    // the tiles are drawn in the calling thread then, see TiledRenderer::render()
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+      emit finished(save());
+      return;
+    }
+    m_watcher.setFuture(QtConcurrent::run(this, &ExportJob::saveOnPool));
+  }
+
+  void ExportJob::saveFinished()
+  {
+    emit finished(m_watcher.result());
+  }
+
+  bool ExportJob::saveOnPool()
+  {
+    // the tiles are drawn on the same pool, don't keep a thread of it waiting for them
+    QThreadPool::globalInstance()->releaseThread();
+    bool ok = save();
+    QThreadPool::globalInstance()->reserveThread();
+    return ok;
+  }
+
+  bool ExportJob::save()
+  {
+    bool ok = m_renderer.save(m_fileName, this);
+    // don't leave half a file behind
+    if (isCancelled()) {
+      QFile::remove(m_fileName);
+      return false;
+    }
+    return ok;
+  }
+
+  bool ExportJob::rowsWritten(int done)
+  {
+    emit progress(done);
+    return !isCancelled();
+  }
+
+} // namespace
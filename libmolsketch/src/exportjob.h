@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_EXPORTJOB_H
+#define MSK_EXPORTJOB_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QString>
+
+#include <molsketch/tiledrenderer.h>
+
+namespace Molsketch {
+
+  /**
+   * Saves the image of a TiledRenderer on the global QThreadPool, so exporting
+   * a large image does not block the GUI. The renderer already holds a snapshot
+   * of the scene (see exportSnapshot()), so the scene can be edited while the
+   * file is written.
+   *
+   * Progress is reported after each row of tiles. If the font backend can only
+   * draw text in the GUI thread, start() saves the file right away.
+   */
+  class ExportJob : public QObject, private TiledRenderer::Progress
+  {
+    Q_OBJECT
+
+    public:
+      /**
+       * Creates a job to save the image of @p renderer as @p fileName.
+       */
+      ExportJob(const TiledRenderer &renderer, const QString &fileName, QObject *parent = 0);
+      /**
+       * Cancels the job and waits for it to stop.
+       */
+      ~ExportJob();
+
+      QString fileName() const
+      {
+        return m_fileName;
+      }
+      /**
+       * @return The number of rows of tiles, see progress().
+       */
+      int numRows() const
+      {
+        return m_renderer.numRows();
+      }
+      /**
+       * Start saving the file. finished() is emitted when it is written.
+       */
+      void start();
+      /**
+       * @return @c true while the file is being written.
+       */
+      bool isRunning() const
+      {
+        return m_watcher.isRunning();
+      }
+      /**
+       * @return @c true if cancel() was called.
+       */
+      bool isCancelled() const;
+
+    public slots:
+      /**
+       * Stop writing the file as soon as possible and remove it.
+       */
+      void cancel();
+
+    signals:
+      /**
+       * Emitted when @p done of the numRows() rows of tiles are written.
+       */
+      void progress(int done);
+      /**
+       * Emitted when the job is done. @p ok is @c false if the file could not
+       * be written or the job was cancelled.
+       */
+      void finished(bool ok);
+
+    private slots:
+      void saveFinished();
+
+    private:
+      /** Saves the file. */
+      bool save();
+      /** Runs save() on the thread pool. */
+      bool saveOnPool();
+      bool rowsWritten(int done);
+
+      TiledRenderer m_renderer;
+      QString m_fileName;
+      QFutureWatcher<bool> m_watcher;
+      QAtomicInt m_cancelled;
+  };
+
+} // namespace
+
+#endif
@@ -22,8 +22,10 @@
 #include <QtSvg>
 
 //#include <openbabel/obiter.h>
+#include <openbabel/fingerprint.h>
 #include <openbabel/mol.h>
 #include <openbabel/obconversion.h>
+#include <openbabel/ring.h>
 
 #include "fileio.h"
 #include "reactionarrow.h"
@@ -33,7 +35,10 @@
 #include "bond.h"
 #include "molecule.h"
 #include "element.h"
+#include "libraryindex.h"
 #include "molscene.h"
+#include "moleculerenderer.h"
+#include "tiledrenderer.h"
 
 namespace Molsketch
 {
@@ -213,6 +218,57 @@ namespace Molsketch
   }
 
 
+  /**
+   * Helper function to add the atoms and bonds of @p mol to @p obmol, between
+   * BeginModify() and EndModify().
+   */
+  static void addToOBMol(OpenBabel::OBMol &obmol, Molecule *mol)
+  {
+    using namespace OpenBabel;
+    QHash<Atom*,OpenBabel::OBAtom*> hash;
+
+    // creating OBAtoms...
+    foreach (Atom* atom, mol->atoms()) {
+      OpenBabel::OBAtom* obatom = obmol.NewAtom();
+      obatom->SetVector(atom->scenePos().x()/40,atom->scenePos().y()/40,0);
+      obatom->SetAtomicNum(atom->atomicNumber());
+      hash.insert(atom,obatom);
+    }
+
+    foreach (Bond* bond, mol->bonds()) {
+      Atom* a1 = bond->beginAtom();
+      Atom* a2 = bond->endAtom();
+
+      unsigned int beginIdx = hash.value(a1)->GetIdx();
+      unsigned int endIdx = hash.value(a2)->GetIdx();
+      unsigned int swapIdx = beginIdx;
+      int flags = 0;
+
+      // Setting bondtype
+      switch (bond->bondType()) {
+        case Bond::Wedge:
+          flags |= OB_WEDGE_BOND;
+          break;
+        case Bond::InvertedWedge:
+          flags |= OB_WEDGE_BOND;
+          beginIdx = endIdx;
+          endIdx = swapIdx;
+          break;
+        case Bond::Hash:
+          flags |= OB_HASH_BOND;
+          break;
+        case Bond::InvertedHash:
+          flags |= OB_HASH_BOND;
+          beginIdx = endIdx;
+          endIdx = swapIdx;
+          break;
+        default:
+          break;
+      }
+      obmol.AddBond(beginIdx, endIdx, bond->bondOrder(), flags);
+    }
+  }
+
   bool saveFile(const QString &fileName, QGraphicsScene* scene)
   {
     using namespace OpenBabel;
@@ -232,53 +288,8 @@ namespace Molsketch
       if (item->type() == Molecule::Type) {
         Molecule* mol = static_cast<Molecule*>(item);
 
-        QHash<Atom*,OpenBabel::OBAtom*> hash;
-
         obmol.BeginModify();
-        // creating OBAtoms...
-        qDebug() << "Creating OBAtom objects...";
-        foreach (Atom* atom, mol->atoms()) {
-          OpenBabel::OBAtom* obatom = obmol.NewAtom();
-          obatom->SetVector(atom->scenePos().x()/40,atom->scenePos().y()/40,0);
-          std::string element = atom->element().toStdString();
-          obatom->SetAtomicNum(Molsketch::symbol2number(atom->element()));
-          hash.insert(atom,obatom);
-          qDebug() << "  " << obatom->GetIdx() << "=" << obatom;
-        }
-
-        foreach (Bond* bond, mol->bonds()) {
-          Atom* a1 = bond->beginAtom();
-          Atom* a2 = bond->endAtom();
-
-          unsigned int beginIdx = hash.value(a1)->GetIdx();
-          unsigned int endIdx = hash.value(a2)->GetIdx();
-          unsigned int swapIdx = beginIdx;
-          int flags = 0;
-
-          // Setting bondtype
-          switch (bond->bondType()) {
-            case Bond::Wedge:
-              flags |= OB_WEDGE_BOND;
-              break;
-            case Bond::InvertedWedge:
-              flags |= OB_WEDGE_BOND;
-              beginIdx = endIdx;
-              endIdx = swapIdx;
-              break;
-            case Bond::Hash:
-              flags |= OB_HASH_BOND;
-              break;
-            case Bond::InvertedHash:
-              flags |= OB_HASH_BOND;
-              beginIdx = endIdx;
-              endIdx = swapIdx;
-              break;
-            default:
-              break;
-          }
-          obmol.AddBond(beginIdx, endIdx, bond->bondOrder(), flags);
-
-        }
+        addToOBMol(obmol, mol);
         obmol.EndModify();
       }
     }
@@ -326,7 +337,7 @@ namespace Molsketch
             obatom->SetVector(atom->scenePos().x(),-atom->scenePos().y(),0);
             std::string element = atom->element().toStdString();
             //                 obatom->SetType(element);
-            obatom->SetAtomicNum(Molsketch::symbol2number(atom->element()));
+            obatom->SetAtomicNum(atom->atomicNumber());
             //                 obmol->AddAtom(*obatom);
             hash.insert(atom,obatom);
             //                 cerr << hash.count() << "\n";
@@ -402,139 +413,245 @@ namespace Molsketch
     return true;
   }
 
-  Molecule* loadFile(const QString &fileName)
+  Molecule* fromOBMol(OpenBabel::OBMol &obmol, qreal scale, bool flipY)
   {
-    // Creating and setting conversion classes
     using namespace OpenBabel;
-    OBConversion * conversion = new OBConversion;
-    conversion->SetInFormat(conversion->FormatFromExt(fileName.toAscii()));
-    OBMol obmol;
-
-    // Try to load a file
-    if (!conversion->ReadFile(&obmol, fileName.toStdString())) {
-      return 0;
-    }
 
     // Create a new molecule
     Molecule* mol = new Molecule();
     mol->setPos(QPointF(0,0));
 
-    //       if(dynamic_cast<MolScene*>(scene) && dynamic_cast<MolScene*>(scene)->autoAddHydrogen())
-    //         obmol->AddHydrogens();
-    //       else
-    //         obmol->DelHydrogens();
-    //         cerr << "mol " << "x: " << mol->pos().x() << " y: " << mol->pos().y() << "\n";
-
-    // Initialize normalization factor
-    //       qreal factor = 1;
-    // molfile.GetInternalCoord(0,0,0);
-
-    // Add atoms one-by-ons
-    for (unsigned int i = 1; i <= obmol.NumAtoms();i++)
-      // 	FOR_ATOMS_OF_MOL(obatom,obmol)
-    {
-      OpenBabel::OBAtom *obatom = obmol.GetAtom(i);
-      //  			scene->addRect(QRectF(atom->GetX(),atom->GetY(),5,5));
-      //           Atom* atom =
-      mol->addAtom(Molsketch::number2symbol(obatom->GetAtomicNum()),QPointF(obatom->x()*40,obatom->y()*40), false);
+    // Defer the ring perception and label layout until all bonds are added
+    Molecule::Batch batch(mol);
 
+    // Create the atoms, atoms[i - 1] is the atom with OpenBabel index i
+    QVector<Atom*> atoms(obmol.NumAtoms());
+    for (unsigned int i = 1; i <= obmol.NumAtoms(); ++i) {
+      OBAtom *obatom = obmol.GetAtom(i);
+      QPointF position(obatom->x() * scale, (flipY ? -obatom->y() : obatom->y()) * scale);
+      atoms[i - 1] = mol->addAtom(new Atom(position, Molsketch::number2symbol(obatom->GetAtomicNum()), false));
     }
 
-    // Add bonds one-by-one
+    // Create the bonds
     /// Mind the numbering!
     for (unsigned int i = 0; i < obmol.NumBonds(); ++i) {
-      // Loading the OpenBabel objects
-      OpenBabel::OBBond *obbond = obmol.GetBond(i);
-      OBAtom *a1 = obbond->GetBeginAtom();
-      OBAtom *a2 = obbond->GetEndAtom();
-
-      // Creating their internal counterparts
-      Atom* atomA = mol->atomAt(QPointF(a1->x()*40,a1->y()*40));
-      Atom* atomB = mol->atomAt(QPointF(a2->x()*40,a2->y()*40));
-      Bond* bond  = mol->addBond(atomA,atomB,obbond->GetBondOrder());
+      OBBond *obbond = obmol.GetBond(i);
+      Atom *atomA = atoms.at(obbond->GetBeginAtomIdx() - 1);
+      Atom *atomB = atoms.at(obbond->GetEndAtomIdx() - 1);
+      Bond *bond = mol->addBond(atomA, atomB, obbond->GetBondOrder());
+      if (!bond)
+        continue;
 
       // Set special bond types
-      if (obbond->IsWedge()) 
+      if (obbond->IsWedge())
         bond->setType( Bond::Wedge );
-      if (obbond->IsHash()) 
+      if (obbond->IsHash())
         bond->setType( Bond::Hash );
     }
 
     return mol;
   }
-  
-  Molecule* loadFile3D(const QString &fileName)
+
+  // the OpenBabel formats are not guaranteed to be reentrant
+  Q_GLOBAL_STATIC(QMutex, openBabelMutex)
+
+  Molecule* loadFile(const QString &fileName)
   {
     // Creating and setting conversion classes
     using namespace OpenBabel;
-    OBConversion * conversion = new OBConversion;
-    conversion->SetInFormat(conversion->FormatFromExt(fileName.toAscii()));
+    QMutexLocker locker(openBabelMutex());
+    OBConversion conversion;
+    conversion.SetInFormat(conversion.FormatFromExt(fileName.toAscii()));
     OBMol obmol;
 
     // Try to load a file
-    if (conversion->ReadFile(&obmol, fileName.toStdString()))
-    {
-      // Create a new molecule
-      Molecule* mol = new Molecule();
-      mol->setPos(QPointF(0,0));
-
-      //       if(dynamic_cast<MolScene*>(scene) && dynamic_cast<MolScene*>(scene)->autoAddHydrogen())
-      //         obmol->AddHydrogens();
-      //       else
-      //         obmol->DelHydrogens();
-      //         cerr << "mol " << "x: " << mol->pos().x() << " y: " << mol->pos().y() << "\n";
-
-      // Initialize normalization factor
-      //       qreal factor = 1;
-      // molfile.GetInternalCoord(0,0,0);
-
-      // Add atoms one-by-ons
-      for (unsigned int i = 1; i <= obmol.NumAtoms();i++)
-        // 	FOR_ATOMS_OF_MOL(obatom,obmol)
-      {
-        OpenBabel::OBAtom *obatom = obmol.GetAtom(i);
-        //  			scene->addRect(QRectF(atom->GetX(),atom->GetY(),5,5));
-        //           Atom* atom =
-        mol->addAtom(Molsketch::number2symbol(obatom->GetAtomicNum()),QPointF(obatom->x(),-obatom->y()), false);
+    if (!conversion.ReadFile(&obmol, fileName.toStdString())) {
+      return 0;
+    }
+    locker.unlock();
 
-      }
+    return fromOBMol(obmol, 40.0, false);
+  }
 
-      // Add bonds one-by-one
-      /// Mind the numbering!
-      for (unsigned int i = 0; i < obmol.NumBonds();i++)
-        // 	FOR_BONDS_OF_MOL(obbond,obmol)
-      {
-        // Loading the OpenBabel objects
-        OpenBabel::OBBond *obbond = obmol.GetBond(i);
-        OBAtom *a1 = obbond->GetBeginAtom();
-        OBAtom *a2 = obbond->GetEndAtom();
-
-        // Creating their internal counterparts
-        Atom* atomA = mol->atomAt(QPointF(a1->x(),-a1->y()));
-        Atom* atomB = mol->atomAt(QPointF(a2->x(),-a2->y()));
-        Bond* bond  = mol->addBond(atomA,atomB,obbond->GetBondOrder());
-
-        // Set special bond types
-        if (obbond->IsWedge())
-          bond->setType( Bond::Wedge );
-        if (obbond->IsHash()) 
-          bond->setType( Bond::Hash );
-
-        // Normalizing
-        //             factor = scene->getBondLength()/obbond->GetLength();
+  /**
+   * Helper function to read the first molecule in @p fileName into @p obmol.
+   * The caller must hold the openBabelMutex().
+   */
+  static bool readOBMol(const QString &fileName, OpenBabel::OBMol &obmol)
+  {
+    OpenBabel::OBConversion conversion;
+    conversion.SetInFormat(conversion.FormatFromExt(fileName.toAscii()));
+    return conversion.ReadFile(&obmol, fileName.toStdString());
+  }
+
+  /**
+   * Helper function to copy the atoms and bonds of @p obmol for a MoleculeRenderer.
+   */
+  static void rendererData(OpenBabel::OBMol &obmol, QVector<MoleculeRenderer::AtomData> &atoms,
+      QVector<MoleculeRenderer::BondData> &bonds)
+  {
+    using namespace OpenBabel;
+
+    // the same atoms and bonds as fromOBMol(obmol, 40.0, false)
+    atoms.resize(obmol.NumAtoms());
+    for (unsigned int i = 1; i <= obmol.NumAtoms(); ++i) {
+      OBAtom *obatom = obmol.GetAtom(i);
+      atoms[i - 1].position = QPointF(obatom->x() * 40.0, obatom->y() * 40.0);
+      atoms[i - 1].element = Molsketch::number2symbol(obatom->GetAtomicNum());
+      atoms[i - 1].charge = obatom->GetFormalCharge();
+    }
+
+    // double bonds are drawn inside the ring with the most double bonds, see Molecule
+    std::vector<OBRing*> rings = obmol.GetSSSR();
+    QVector<int> numDoubleBonds(rings.size(), 0);
+    for (unsigned int i = 0; i < obmol.NumBonds(); ++i) {
+      OBBond *obbond = obmol.GetBond(i);
+      if (obbond->GetBondOrder() == 2)
+        for (unsigned int j = 0; j < rings.size(); ++j)
+          if (rings[j]->IsMember(obbond))
+            ++numDoubleBonds[j];
+    }
+
+    // the implicit hydrogens as Atom counts them, from the bond orders
+    QVector<int> bondOrderSums(atoms.size(), 0);
+    bonds.clear();
+    for (unsigned int i = 0; i < obmol.NumBonds(); ++i) {
+      OBBond *obbond = obmol.GetBond(i);
+      MoleculeRenderer::BondData bond;
+      bond.begin = obbond->GetBeginAtomIdx() - 1;
+      bond.end = obbond->GetEndAtomIdx() - 1;
+      bond.order = obbond->GetBondOrder();
+      bond.aromatic = obbond->IsAromatic();
+      bondOrderSums[bond.begin] += bond.order;
+      bondOrderSums[bond.end] += bond.order;
+      if (obbond->IsWedge())
+        bond.type = Bond::Wedge;
+      if (obbond->IsHash())
+        bond.type = Bond::Hash;
+
+      int best = -1;
+      for (unsigned int j = 0; j < rings.size(); ++j)
+        if (rings[j]->IsMember(obbond) && ((best < 0) || (numDoubleBonds[j] > numDoubleBonds[best])))
+          best = j;
+      if (best >= 0) {
+        bond.inRing = true;
+        for (unsigned int j = 0; j < rings[best]->_path.size(); ++j)
+          bond.ringCenter += atoms.at(rings[best]->_path[j] - 1).position;
+        bond.ringCenter /= rings[best]->_path.size();
       }
+      bonds.append(bond);
+    }
 
-      // // Normalizing molecule
-      // mol->scale(factor,factor);
-      // mol->setAtomSize(LABEL_SIZE/factor);
+    for (int i = 0; i < atoms.size(); ++i)
+      atoms[i].numImplicitHydrogens = Atom::implicitHydrogens(obmol.GetAtom(i + 1)->GetAtomicNum(), bondOrderSums.at(i));
+  }
 
-      return mol;
+  bool loadRenderer(const QString &fileName, MoleculeRenderer &renderer)
+  {
+    QMutexLocker locker(openBabelMutex());
+    OpenBabel::OBMol obmol;
+    if (!readOBMol(fileName, obmol))
+      return false;
+
+    QVector<MoleculeRenderer::AtomData> atoms;
+    QVector<MoleculeRenderer::BondData> bonds;
+    rendererData(obmol, atoms, bonds);
+    renderer.setAtoms(atoms);
+    renderer.setBonds(bonds);
+    return true;
+  }
+
+  /**
+   * Helper function to fill @p entry with everything but the file. The caller
+   * must hold the openBabelMutex().
+   */
+  static void fillEntry(OpenBabel::OBMol &obmol, LibraryEntry &entry)
+  {
+    using namespace OpenBabel;
+
+    entry.formula = QString::fromStdString(obmol.GetFormula());
+    entry.weight = obmol.GetMolWt();
+
+    // the canonical SMILES is followed by the title
+    OBConversion conversion;
+    entry.smiles.clear();
+    if (conversion.SetOutFormat("can"))
+      entry.smiles = QString::fromStdString(conversion.WriteString(&obmol, true)).section('\t', 0, 0).trimmed();
+
+    entry.fingerprint.clear();
+    std::vector<unsigned int> bits;
+    OBFingerprint *fingerprint = OBFingerprint::FindFingerprint("FP2");
+    if (fingerprint && fingerprint->GetFingerprint(&obmol, bits)) {
+      entry.fingerprint.resize(bits.size());
+      for (unsigned int i = 0; i < bits.size(); ++i)
+        entry.fingerprint[i] = bits[i];
     }
-    else
-    {
+
+    rendererData(obmol, entry.atoms, entry.bonds);
+  }
+
+  bool loadLibraryEntry(const QString &fileName, LibraryEntry &entry)
+  {
+    QFileInfo file(fileName);
+    QMutexLocker locker(openBabelMutex());
+    OpenBabel::OBMol obmol;
+    if (!readOBMol(fileName, obmol) || !obmol.NumAtoms())
+      return false;
+
+    entry.path = file.absoluteFilePath();
+    entry.modified = file.lastModified().toTime_t();
+    fillEntry(obmol, entry);
+    return true;
+  }
+
+  bool smilesEntry(const QString &smiles, LibraryEntry &entry)
+  {
+    using namespace OpenBabel;
+    QMutexLocker locker(openBabelMutex());
+    OBConversion conversion;
+    OBMol obmol;
+    if (!conversion.SetInFormat("smi") || !conversion.ReadString(&obmol, smiles.toStdString()) || !obmol.NumAtoms())
+      return false;
+
+    entry = LibraryEntry();
+    fillEntry(obmol, entry);
+    return true;
+  }
+
+  bool moleculeEntry(Molecule *molecule, LibraryEntry &entry)
+  {
+    Q_CHECK_PTR(molecule);
+    if (!molecule || molecule->atoms().isEmpty())
+      return false;
+
+    QMutexLocker locker(openBabelMutex());
+    OpenBabel::OBMol obmol;
+    obmol.SetDimension(2);
+    obmol.BeginModify();
+    addToOBMol(obmol, molecule);
+    obmol.EndModify();
+
+    entry = LibraryEntry();
+    fillEntry(obmol, entry);
+    return true;
+  }
+  
+  Molecule* loadFile3D(const QString &fileName)
+  {
+    // Creating and setting conversion classes
+    using namespace OpenBabel;
+    QMutexLocker locker(openBabelMutex());
+    OBConversion conversion;
+    conversion.SetInFormat(conversion.FormatFromExt(fileName.toAscii()));
+    OBMol obmol;
+
+    // Try to load a file
+    if (!conversion.ReadFile(&obmol, fileName.toStdString())) {
       return 0;
     }
+    locker.unlock();
 
+    return fromOBMol(obmol, 1.0, true);
   }
 
   void writeMskFile(const QString &fileName, MolScene *scene)
@@ -630,18 +747,25 @@ namespace Molsketch
   //     return mol;
   // }
 
-  bool exportFile(const QString &fileName, MolScene * scene)
+  bool exportFile(const QString &fileName, MolScene * scene, qreal scale)
+  {
+    return exportSnapshot(scene, scale).save(fileName);
+  }
+
+  TiledRenderer exportSnapshot(MolScene * scene, qreal scale)
   {
     // Clear selection
     QList<QGraphicsItem*> selList(scene->selectedItems());
     scene->clearSelection();
 
-    QImage image = scene->renderImage(scene->itemsBoundingRect());
+    // Take a snapshot of the scene, the tiles are drawn from it
+    QRectF rect(scene->itemsBoundingRect());
+    TiledRenderer renderer(scene, rect, QSize(int(scale * rect.width()), int(scale * rect.height())));
 
     // Restore selection
     foreach(QGraphicsItem* item, selList) item->setSelected(true);
 
-    return image.save(fileName);
+    return renderer;
   }
 
 
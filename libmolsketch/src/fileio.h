@@ -26,10 +26,18 @@
  * @since Hydrogen
  */
 
+namespace OpenBabel
+{
+class OBMol;
+}
+
 namespace Molsketch
 {
 class MolScene;
 class Molecule;
+class MoleculeRenderer;
+class TiledRenderer;
+struct LibraryEntry;
 
 /**
  * Load and save routines
@@ -47,6 +55,36 @@ Molecule* loadFile(const QString &fileName);
  * object. 
  */
 Molecule* loadFile3D(const QString &fileName);
+/**
+ * Creates a new Molecule from the atoms and bonds of @p obmol. The coordinates are
+ * multiplied by @p scale and the y axis is flipped if @p flipY is @c true. The bonds
+ * are connected through the OpenBabel atom indices, so this runs in O(atoms + bonds)
+ * and atoms sharing the same coordinates are kept apart.
+ */
+Molecule* fromOBMol(OpenBabel::OBMol &obmol, qreal scale = 1.0, bool flipY = false);
+/**
+ * Loads the file with @p fileName into @p renderer, the way loadFile() would
+ * load it but without creating a Molecule. Unlike loadFile(), this can be
+ * called from any thread. Returns @c false if the file could not be read.
+ */
+bool loadRenderer(const QString &fileName, MoleculeRenderer &renderer);
+/**
+ * Loads the file with @p fileName into @p entry of the molecule library index,
+ * with the formula, weight, canonical SMILES and fingerprint computed by
+ * OpenBabel. Like loadRenderer(), this can be called from any thread. Returns
+ * @c false if the file could not be read or has no atoms.
+ */
+bool loadLibraryEntry(const QString &fileName, LibraryEntry &entry);
+/**
+ * Fills @p entry with the molecule in @p smiles, without file or coordinates.
+ * Returns @c false if the SMILES can not be read.
+ */
+bool smilesEntry(const QString &smiles, LibraryEntry &entry);
+/**
+ * Fills @p entry with @p molecule, without file. Unlike smilesEntry(), this
+ * must be called from the GUI thread. Returns @c false for an empty molecule.
+ */
+bool moleculeEntry(Molecule *molecule, LibraryEntry &entry);
 /** 
  * Saves the current document under @p fileName and returns @c false if the
  * save failed.
@@ -59,9 +97,17 @@ bool saveFile(const QString &fileName, QGraphicsScene * scene);
 bool saveFile3D(const QString &fileName, QGraphicsScene * scene);
 /** 
  * Exports the document on MolScene @p scene as a bitmap with @p fileName 
- * and returns @c false if the export failed.
+ * and returns @c false if the export failed. The bitmap has @p scale pixels
+ * per unit of the scene. PNG and TIFF files are written in tiles, so their
+ * size is not limited by the memory.
+ */
+bool exportFile(const QString &fileName, MolScene * scene, qreal scale = 1.0);
+/**
+ * Takes a snapshot of the document on MolScene @p scene, without the selection,
+ * to export at @p scale pixels per unit of the scene. Pass it to an ExportJob
+ * to write the file without blocking the GUI.
  */
-bool exportFile(const QString &fileName, MolScene * scene);
+TiledRenderer exportSnapshot(MolScene * scene, qreal scale = 1.0);
 /** 
  * Prints the document on MolScene @p scene on QPrinter @p printer and 
  * returns @c false if the print failed.
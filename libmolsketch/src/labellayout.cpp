@@ -0,0 +1,226 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "labellayout.h"
+
+#include <QCache>
+#include <QFontMetrics>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPainter>
+
+namespace Molsketch {
+
+  /**
+   * The key of a layout in the cache.
+   */
+  struct LabelKey
+  {
+    QString label;
+    int alignment;
+    QString font; //!< QFont::key()
+
+    bool operator==(const LabelKey &other) const
+    {
+      return alignment == other.alignment && label == other.label && font == other.font;
+    }
+  };
+
+  static uint qHash(const LabelKey &key)
+  {
+    return ::qHash(key.label) ^ ::qHash(key.font) ^ uint(key.alignment);
+  }
+
+  typedef QCache<LabelKey, LabelLayout> LabelCache;
+  // a few hundred layouts cover the labels of even the largest drawings
+  Q_GLOBAL_STATIC_WITH_ARGS(LabelCache, labelCache, (1000))
+  // MoleculeRenderer lays out labels outside the GUI thread
+  Q_GLOBAL_STATIC(QMutex, labelCacheMutex)
+
+  LabelLayout::LabelLayout()
+  {
+  }
+
+  LabelLayout LabelLayout::layout(const QString &label, int alignment, const QFont &font)
+  {
+    LabelKey key;
+    key.label = label;
+    key.alignment = alignment;
+    key.font = font.key();
+
+    QMutexLocker locker(labelCacheMutex());
+    LabelLayout *layout = labelCache()->object(key);
+    if (!layout) {
+      layout = new LabelLayout(label, alignment, font);
+      labelCache()->insert(key, layout);
+    }
+    return *layout;
+  }
+
+  void LabelLayout::clearCache()
+  {
+    QMutexLocker locker(labelCacheMutex());
+    labelCache()->clear();
+  }
+
+  int LabelLayout::cacheSize()
+  {
+    QMutexLocker locker(labelCacheMutex());
+    return labelCache()->size();
+  }
+
+  LabelLayout::LabelLayout(const QString &lbl, int alignment, const QFont &font)
+  {
+    m_symbolFont = font;
+    m_subscriptFont = font;
+    m_subscriptFont.setPointSize(0.75 * font.pointSize());
+    QFontMetrics fmSymbol(m_symbolFont);
+    QFontMetrics fmScript(m_subscriptFont);
+
+    // compute the total width
+    qreal totalWidth = 0.0;
+    if ((alignment == Right) || (alignment == Left) || !lbl.contains("H")) {
+      for (int i = 0; i < lbl.size(); ++i) {
+        if (lbl[i].isDigit())
+          totalWidth += fmScript.width(lbl[i]);
+        else
+          totalWidth += fmSymbol.width(lbl[i]);
+      }
+    } else {
+      totalWidth = fmSymbol.width(lbl.left(lbl.indexOf("H")));
+      qreal width = 0.0; 
+      for (int i = lbl.indexOf("H"); i < lbl.size(); ++i) {
+        if (lbl[i].isDigit())
+          width += fmScript.width(lbl[i]);
+        else
+          width += fmSymbol.width(lbl[i]);
+      }
+
+      if (width > totalWidth)
+        totalWidth = width; 
+    }
+
+    // compute the horizontal starting position
+    qreal xOffset, yOffset, yOffsetSubscript;
+    switch (alignment) {
+      case Right:
+        xOffset = - 0.5 * fmSymbol.width(lbl.left(1));
+        break;
+      case Left:
+        xOffset = 0.5 * fmSymbol.width(lbl.right(1)) - totalWidth;
+        break;
+      case Up:
+      case Down:
+        if (lbl.contains("H"))
+          xOffset = - 0.5 * fmSymbol.width(lbl.left(lbl.indexOf("H")));
+        else
+          xOffset = - 0.5 * totalWidth;
+        break;
+      default:
+        xOffset = - 0.5 * totalWidth;
+        break;
+    }
+    // compute the vertical starting position
+    yOffset = 0.5 * (fmSymbol.ascent() - fmSymbol.descent());
+    yOffsetSubscript = yOffset + fmSymbol.descent();
+    qreal xInitial = xOffset;
+
+    // compute the shape
+    if ((alignment == Right) || (alignment == Left) || !lbl.contains("H"))
+      m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.height(), totalWidth, fmSymbol.height());
+    else {
+      if (alignment == Down)
+        m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.height(), totalWidth, fmSymbol.ascent() + fmSymbol.height());
+      else
+        m_shape = QRectF(xOffset, yOffsetSubscript - fmSymbol.ascent() - fmSymbol.height(), totalWidth, fmSymbol.ascent() + fmSymbol.height());
+    }
+
+    // split the label in runs
+    QString str, subscript;
+    Run run;
+    for (int i = 0; i < lbl.size(); ++i) {
+      if (lbl[i] == 'H') {
+        if ((alignment == Up) || (alignment == Down))
+          if (!str.isEmpty()) {
+            // the hydrogens go on the next line
+            run.position = QPointF(xOffset, yOffset);
+            run.text = str;
+            run.subscript = false;
+            m_runs.append(run);
+            if (alignment == Down) {
+              yOffset += fmSymbol.ascent();
+              yOffsetSubscript += fmSymbol.ascent();
+            } else {
+              yOffset -= fmSymbol.ascent();
+              yOffsetSubscript -= fmSymbol.ascent();
+            }
+            xOffset = xInitial;
+            str.clear();
+          }
+      }
+
+      if (lbl[i].isDigit()) {
+        if (!str.isEmpty()) {
+          run.position = QPointF(xOffset, yOffset);
+          run.text = str;
+          run.subscript = false;
+          m_runs.append(run);
+          xOffset += fmSymbol.width(str);
+          str.clear();
+        }
+
+        subscript += lbl.mid(i, 1);
+      } else {
+        if (!subscript.isEmpty()) {
+          run.position = QPointF(xOffset, yOffsetSubscript);
+          run.text = subscript;
+          run.subscript = true;
+          m_runs.append(run);
+          xOffset += fmScript.width(subscript);
+          subscript.clear();
+        }
+
+        str += lbl.mid(i, 1);
+      }
+    }
+    if (!str.isEmpty()) {
+      run.position = QPointF(xOffset, yOffset);
+      run.text = str;
+      run.subscript = false;
+      m_runs.append(run);
+    }
+    if (!subscript.isEmpty()) {
+      run.position = QPointF(xOffset, yOffsetSubscript);
+      run.text = subscript;
+      run.subscript = true;
+      m_runs.append(run);
+    }
+  }
+
+  void LabelLayout::draw(QPainter *painter) const
+  {
+    painter->save();
+    foreach (const Run &run, m_runs) {
+      painter->setFont(run.subscript ? m_subscriptFont : m_symbolFont);
+      painter->drawText(int(run.position.x()), int(run.position.y()), run.text);
+    }
+    painter->restore();
+  }
+
+} // namespace
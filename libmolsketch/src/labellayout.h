@@ -0,0 +1,120 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_LABELLAYOUT_H
+#define MSK_LABELLAYOUT_H
+
+#include <QFont>
+#include <QList>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+
+class QPainter;
+
+namespace Molsketch {
+
+  /**
+   * The layout of an atom label (e.g. "NH2", "H2N" or "OH") in a font: the
+   * pieces of text in the symbol and subscript font with their positions, and
+   * the shape of the label. Digits are written as subscripts.
+   *
+   * Layouts are cached by label, alignment and font, so the font metrics of a
+   * label are only measured once. The atoms of a molecule share a handful of
+   * labels, so laying out or drawing a label is nearly always a lookup.
+   */
+  class LabelLayout
+  {
+    public:
+      //                                        //
+      //     /    \      \   /      H           //
+      //   HN      NH      N        N           //
+      //     \    /        H      /   \         //
+      //                                        //
+      //   Left   Right   Down     Up           //
+      //                                        //
+      enum Alignment {
+        Left,
+        Right,
+        Up,
+        Down
+      };
+
+      /**
+       * A piece of the label written in one font.
+       */
+      struct Run
+      {
+        QPointF position; //!< The start of the base line.
+        QString text;
+        bool subscript;
+      };
+
+      /**
+       * Creates an empty layout.
+       */
+      LabelLayout();
+
+      /**
+       * @return The layout of @p label with @p alignment in @p font, from the
+       * cache if it was laid out before.
+       */
+      static LabelLayout layout(const QString &label, int alignment, const QFont &font);
+      /**
+       * Removes all layouts from the cache.
+       */
+      static void clearCache();
+      /**
+       * @return The number of cached layouts.
+       */
+      static int cacheSize();
+
+      /**
+       * @return The shape of the label, relative to the centre of the first
+       * letter of the element symbol.
+       */
+      QRectF shape() const
+      {
+        return m_shape;
+      }
+      /**
+       * @return The pieces of text of the label.
+       */
+      const QList<Run>& runs() const
+      {
+        return m_runs;
+      }
+
+      /**
+       * Draw the label with @p painter, using its current pen.
+       */
+      void draw(QPainter *painter) const;
+
+    private:
+      LabelLayout(const QString &label, int alignment, const QFont &font);
+
+      QRectF m_shape;
+      QList<Run> m_runs;
+      QFont m_symbolFont;
+      QFont m_subscriptFont;
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,314 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+
+#include "libraryindex.h"
+
+#include "atom.h"
+#include "fileio.h"
+#include "molecule.h"
+
+namespace Molsketch {
+
+  // "MSKI", followed by the version, which is increased when the format changes
+  static const quint32 indexMagic = 0x4d534b49;
+  static const quint32 indexVersion = 3;
+
+  bool LibraryEntry::isCurrent() const
+  {
+    QFileInfo file(path);
+    return file.exists() && (file.lastModified().toTime_t() == modified);
+  }
+
+  MoleculeRenderer LibraryEntry::renderer() const
+  {
+    MoleculeRenderer renderer;
+    renderer.setAtoms(atoms);
+    renderer.setBonds(bonds);
+    return renderer;
+  }
+
+  Molecule* LibraryEntry::toMolecule() const
+  {
+    // the same molecule as fromOBMol()
+    Molecule *molecule = new Molecule();
+    molecule->setPos(QPointF(0, 0));
+    Molecule::Batch batch(molecule);
+
+    QVector<Atom*> newAtoms(atoms.size());
+    for (int i = 0; i < atoms.size(); ++i)
+      newAtoms[i] = molecule->addAtom(new Atom(atoms.at(i).position, atoms.at(i).element, false));
+
+    foreach (const MoleculeRenderer::BondData &data, bonds) {
+      if ((data.begin < 0) || (data.begin >= atoms.size()) || (data.end < 0) || (data.end >= atoms.size()))
+        continue;
+      molecule->addBond(newAtoms.at(data.begin), newAtoms.at(data.end), data.order, data.type);
+    }
+
+    return molecule;
+  }
+
+  QDataStream& operator<<(QDataStream &stream, const LibraryEntry &entry)
+  {
+    stream << entry.path << quint32(entry.modified) << entry.formula << double(entry.weight) << entry.smiles;
+
+    // the colors are left out, they are always black
+    stream << qint32(entry.atoms.size());
+    foreach (const MoleculeRenderer::AtomData &atom, entry.atoms)
+      stream << atom.position << atom.element << qint32(atom.numImplicitHydrogens) << qint32(atom.charge);
+    stream << qint32(entry.bonds.size());
+    foreach (const MoleculeRenderer::BondData &bond, entry.bonds)
+      stream << qint32(bond.begin) << qint32(bond.end) << qint32(bond.order) << qint32(bond.type)
+          << bond.inRing << bond.ringCenter << bond.aromatic;
+
+    stream << entry.fingerprint;
+    return stream;
+  }
+
+  /**
+   * Helper function to read the number of the atoms or bonds of an entry, each written with at
+   * least @p itemSize bytes. A count that is negative or larger than the rest of the stream can
+   * hold marks the stream as corrupt, so a damaged index does not allocate huge vectors.
+   */
+  static int readCount(QDataStream &stream, qint64 itemSize)
+  {
+    qint32 count;
+    stream >> count;
+    if (stream.status() != QDataStream::Ok)
+      return 0;
+    QIODevice *device = stream.device();
+    if ((count < 0) || (device && (count > device->bytesAvailable() / itemSize))) {
+      stream.setStatus(QDataStream::ReadCorruptData);
+      return 0;
+    }
+    return count;
+  }
+
+  QDataStream& operator>>(QDataStream &stream, LibraryEntry &entry)
+  {
+    quint32 modified;
+    double weight;
+    stream >> entry.path >> modified >> entry.formula >> weight >> entry.smiles;
+    entry.modified = modified;
+    entry.weight = weight;
+
+    // position, element (at least its length), hydrogens and charge
+    entry.atoms.resize(readCount(stream, 16 + 4 + 4 + 4));
+    for (int i = 0; i < entry.atoms.size(); ++i) {
+      MoleculeRenderer::AtomData &atom = entry.atoms[i];
+      qint32 numImplicitHydrogens, charge;
+      stream >> atom.position >> atom.element >> numImplicitHydrogens >> charge;
+      atom.numImplicitHydrogens = numImplicitHydrogens;
+      atom.charge = charge;
+    }
+    // begin, end, order, type, inRing, ringCenter and aromatic
+    entry.bonds.resize(readCount(stream, 4 * 4 + 1 + 16 + 1));
+    for (int i = 0; i < entry.bonds.size(); ++i) {
+      MoleculeRenderer::BondData &bond = entry.bonds[i];
+      qint32 begin, end, order, type;
+      stream >> begin >> end >> order >> type >> bond.inRing >> bond.ringCenter >> bond.aromatic;
+      bond.begin = begin;
+      bond.end = end;
+      bond.order = order;
+      bond.type = type;
+    }
+
+    stream >> entry.fingerprint;
+    return stream;
+  }
+
+  LibraryIndex::LibraryIndex(const QString &fileName, QObject *parent) : QObject(parent),
+      m_fileName(fileName), m_watcher(new QFileSystemWatcher(this)), m_modified(false)
+  {
+    if (m_fileName.isEmpty())
+      m_fileName = QDir::homePath() + "/.molsketch/library.index";
+    connect(m_watcher, SIGNAL(directoryChanged(const QString&)), this, SIGNAL(directoryChanged(const QString&)));
+    load();
+  }
+
+  LibraryIndex::~LibraryIndex()
+  {
+    if (m_modified)
+      save();
+  }
+
+  bool LibraryIndex::load()
+  {
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly))
+      return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_5);
+    quint32 magic, version, size;
+    stream >> magic >> version;
+    if ((magic != indexMagic) || (version != indexVersion))
+      return false;
+
+    QHash<QString, LibraryEntry> entries;
+    stream >> size;
+    for (quint32 i = 0; (i < size) && (stream.status() == QDataStream::Ok); ++i) {
+      LibraryEntry entry;
+      stream >> entry;
+      entries.insert(entry.path, entry);
+    }
+    QHash<QString, uint> unreadable;
+    stream >> size;
+    for (quint32 i = 0; (i < size) && (stream.status() == QDataStream::Ok); ++i) {
+      QString path;
+      quint32 modified;
+      stream >> path >> modified;
+      unreadable.insert(path, modified);
+    }
+    // a truncated index is rebuilt
+    if (stream.status() != QDataStream::Ok)
+      return false;
+
+    m_entries = entries;
+    m_unreadable = unreadable;
+    m_modified = false;
+    return true;
+  }
+
+  bool LibraryIndex::save()
+  {
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+      return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << indexMagic << indexVersion << quint32(m_entries.size());
+    foreach (const LibraryEntry &entry, m_entries)
+      stream << entry;
+    stream << quint32(m_unreadable.size());
+    for (QHash<QString, uint>::const_iterator i = m_unreadable.constBegin(); i != m_unreadable.constEnd(); ++i)
+      stream << i.key() << quint32(i.value());
+    if (stream.status() != QDataStream::Ok)
+      return false;
+
+    m_modified = false;
+    return true;
+  }
+
+  LibraryEntry LibraryIndex::entry(const QString &path) const
+  {
+    return m_entries.value(QFileInfo(path).absoluteFilePath());
+  }
+
+  void LibraryIndex::insert(const LibraryEntry &entry)
+  {
+    Q_ASSERT(entry.isValid());
+    QHash<QString, LibraryEntry>::iterator i = m_entries.find(entry.path);
+    if ((i != m_entries.end()) && (i->modified != entry.modified))
+      emit entryRemoved(*i);
+    m_entries.insert(entry.path, entry);
+    m_unreadable.remove(entry.path);
+    m_modified = true;
+  }
+
+  void LibraryIndex::remove(const QString &path)
+  {
+    QString absolutePath = QFileInfo(path).absoluteFilePath();
+    if (m_unreadable.remove(absolutePath))
+      m_modified = true;
+    if (m_entries.contains(absolutePath)) {
+      emit entryRemoved(m_entries.take(absolutePath));
+      m_modified = true;
+    }
+  }
+
+  void LibraryIndex::insertUnreadable(const QString &path, uint modified)
+  {
+    QString absolutePath = QFileInfo(path).absoluteFilePath();
+    if (m_entries.contains(absolutePath))
+      emit entryRemoved(m_entries.take(absolutePath));
+    m_unreadable.insert(absolutePath, modified);
+    m_modified = true;
+  }
+
+  bool LibraryIndex::isUnreadable(const QString &path, uint modified) const
+  {
+    QHash<QString, uint>::const_iterator i = m_unreadable.constFind(QFileInfo(path).absoluteFilePath());
+    return (i != m_unreadable.constEnd()) && (i.value() == modified);
+  }
+
+  void LibraryIndex::prune(const QString &dirPath)
+  {
+    QString dir = QDir(dirPath).absolutePath();
+    QHash<QString, LibraryEntry>::iterator i = m_entries.begin();
+    while (i != m_entries.end()) {
+      QFileInfo file(i.key());
+      if ((file.absolutePath() == dir) && !file.exists()) {
+        LibraryEntry entry = i.value();
+        i = m_entries.erase(i);
+        emit entryRemoved(entry);
+        m_modified = true;
+      } else
+        ++i;
+    }
+    QHash<QString, uint>::iterator j = m_unreadable.begin();
+    while (j != m_unreadable.end()) {
+      QFileInfo file(j.key());
+      if ((file.absolutePath() == dir) && !file.exists()) {
+        j = m_unreadable.erase(j);
+        m_modified = true;
+      } else
+        ++j;
+    }
+  }
+
+  int LibraryIndex::update(const QString &dirPath)
+  {
+    int numParsed = 0;
+    foreach (const QFileInfo &file, QDir(dirPath).entryInfoList(QDir::Files)) {
+      QString path = file.absoluteFilePath();
+      uint modified = file.lastModified().toTime_t();
+      if (m_entries.contains(path) && (m_entries[path].modified == modified))
+        continue;
+      if (isUnreadable(path, modified))
+        continue;
+
+      LibraryEntry entry;
+      if (loadLibraryEntry(path, entry))
+        insert(entry);
+      else
+        insertUnreadable(path, modified);
+      ++numParsed;
+    }
+    prune(dirPath);
+    return numParsed;
+  }
+
+  void LibraryIndex::watch(const QString &dirPath)
+  {
+    // only the directories, a watch per file would run into the limits of
+    // the system for large libraries
+    if (QDir(dirPath).exists() && !m_watcher->directories().contains(dirPath))
+      m_watcher->addPath(dirPath);
+  }
+
+} // namespace
@@ -0,0 +1,226 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_LIBRARYINDEX_H
+#define MSK_LIBRARYINDEX_H
+
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <molsketch/moleculerenderer.h>
+
+class QFileSystemWatcher;
+
+namespace Molsketch {
+
+  class Molecule;
+
+  /**
+   * Everything the molecule library needs to know about a file, so it does
+   * not have to be parsed again. See loadLibraryEntry() in fileio.h.
+   */
+  struct LibraryEntry
+  {
+    LibraryEntry() : modified(0), weight(0.0)
+    {
+    }
+
+    /**
+     * @return @c false for an entry without file.
+     */
+    bool isValid() const
+    {
+      return !path.isEmpty();
+    }
+    /**
+     * @return @c true if the file was not modified since the entry was made.
+     */
+    bool isCurrent() const;
+    /**
+     * @return A renderer with the atoms and bonds.
+     */
+    MoleculeRenderer renderer() const;
+    /**
+     * @return A new Molecule with the atoms and bonds, as loadFile() would
+     * have created it.
+     */
+    Molecule* toMolecule() const;
+
+    /** The absolute path of the file. */
+    QString path;
+    /** The modification time of the file in seconds since the epoch. */
+    uint modified;
+    QString formula;
+    qreal weight;
+    /** The canonical SMILES. */
+    QString smiles;
+    /** The atoms and bonds, with their 2D coordinates. */
+    QVector<MoleculeRenderer::AtomData> atoms;
+    QVector<MoleculeRenderer::BondData> bonds;
+    /** The OpenBabel FP2 path fingerprint. */
+    QVector<quint32> fingerprint;
+  };
+
+  QDataStream& operator<<(QDataStream &stream, const LibraryEntry &entry);
+  QDataStream& operator>>(QDataStream &stream, LibraryEntry &entry);
+
+  /**
+   * An index of the molecule library files, kept in a binary file.
+   *
+   * The index has a LibraryEntry for each file. update() only parses the files
+   * that were added or modified since their entry was made, and drops the
+   * entries of removed files. Files that are not molecules are remembered with
+   * their modification time, so they are not parsed again until they change.
+   * Directories passed to watch() are monitored with a QFileSystemWatcher,
+   * see directoryChanged().
+   */
+  class LibraryIndex : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      /**
+       * Creates an index that is kept in @p fileName, which is read if it
+       * exists. By default this is ~/.molsketch/library.index.
+       */
+      LibraryIndex(const QString &fileName = QString(), QObject *parent = 0);
+      /**
+       * Saves the index if it was modified.
+       */
+      ~LibraryIndex();
+
+      /**
+       * @return The file the index is kept in.
+       */
+      QString fileName() const
+      {
+        return m_fileName;
+      }
+      /**
+       * @return @c true if the index was modified since it was read or saved.
+       */
+      bool isModified() const
+      {
+        return m_modified;
+      }
+      /**
+       * Read the index from fileName(). An index of another version is ignored.
+       *
+       * @return @c false if there was no index to read.
+       */
+      bool load();
+      /**
+       * Write the index to fileName().
+       *
+       * @return @c false if the file could not be written.
+       */
+      bool save();
+
+      /**
+       * @return The number of entries.
+       */
+      int size() const
+      {
+        return m_entries.size();
+      }
+      /**
+       * @return The entry of the file at @p path, which is invalid if the file
+       * is not in the index.
+       */
+      LibraryEntry entry(const QString &path) const;
+      /**
+       * @return All entries, in no particular order.
+       */
+      QList<LibraryEntry> entries() const
+      {
+        return m_entries.values();
+      }
+      /**
+       * Add @p entry, replacing the entry of the same file.
+       */
+      void insert(const LibraryEntry &entry);
+      /**
+       * Remove the entry of the file at @p path.
+       */
+      void remove(const QString &path);
+      /**
+       * Remember that the file at @p path, as it was at its modification time
+       * @p modified, is not a molecule. Removes the entry of the file.
+       */
+      void insertUnreadable(const QString &path, uint modified);
+      /**
+       * @return @c true if the file at @p path was found not to be a molecule
+       * when it was last modified at @p modified.
+       */
+      bool isUnreadable(const QString &path, uint modified) const;
+      /**
+       * @return The number of files that are not molecules.
+       */
+      int numUnreadable() const
+      {
+        return m_unreadable.size();
+      }
+      /**
+       * Remove the entries of the files in @p dirPath that no longer exist.
+       */
+      void prune(const QString &dirPath);
+      /**
+       * Parse the new and modified files in @p dirPath and prune() it.
+       *
+       * @return The number of parsed files.
+       */
+      int update(const QString &dirPath);
+
+      /**
+       * Watch @p dirPath for changes, see directoryChanged(). Only the
+       * directory is watched; files that are modified in place are found by
+       * their modification time on the next update().
+       */
+      void watch(const QString &dirPath);
+
+    signals:
+      /**
+       * Emitted when a file in a watched directory was added, modified or
+       * removed. Call update() or parse the files to bring the index up to
+       * date.
+       */
+      void directoryChanged(const QString &dirPath);
+      /**
+       * Emitted when @p entry is removed, or replaced by the entry of a newer
+       * version of its file.
+       */
+      void entryRemoved(const LibraryEntry &entry);
+
+    private:
+      QString m_fileName;
+      /** The entries by absolute path. */
+      QHash<QString, LibraryEntry> m_entries;
+      /** The modification times of the files that are not molecules, by absolute path. */
+      QHash<QString, uint> m_unreadable;
+      QFileSystemWatcher *m_watcher;
+      bool m_modified;
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,257 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFont>
+#include <QFontDatabase>
+#include <QListWidget>
+#include <QtConcurrentMap>
+
+#include "libraryloader.h"
+
+#include "fileio.h"
+#include "moleculerenderer.h"
+#include "mollibitem.h"
+
+namespace Molsketch {
+
+  // increase this when the thumbnails are drawn differently
+  static const int thumbnailVersion = 2;
+
+  /**
+   * Functor to parse the files and get the thumbnails with QtConcurrent::mapped().
+   */
+  struct LoadJob
+  {
+    typedef LibraryLoader::Job result_type;
+
+    LoadJob(const QString &cacheDir, bool draw) : cacheDir(cacheDir), draw(draw)
+    {
+    }
+    LibraryLoader::Job operator()(const LibraryLoader::Job &job) const
+    {
+      LibraryLoader::Job result = job;
+      if (!result.entry.isValid() && !loadLibraryEntry(job.fileName, result.entry))
+        return result;
+      result.thumbnail = LibraryLoader::thumbnail(result.entry, cacheDir, draw);
+      return result;
+    }
+
+    QString cacheDir;
+    bool draw;
+  };
+
+  LibraryLoader::LibraryLoader(QObject *parent, const QString &cacheDir, const QString &indexFile)
+      : QObject(parent), m_cacheDir(cacheDir), m_index(new LibraryIndex(indexFile, this))
+  {
+    if (m_cacheDir.isEmpty())
+      m_cacheDir = QDir::homePath() + "/.molsketch/thumbnails";
+    QDir().mkpath(m_cacheDir);
+    connect(m_index, SIGNAL(directoryChanged(const QString&)), this, SLOT(refreshDirectory(const QString&)));
+    connect(m_index, SIGNAL(entryRemoved(const LibraryEntry&)), this, SLOT(removeThumbnail(const LibraryEntry&)));
+  }
+
+  LibraryLoader::~LibraryLoader()
+  {
+    // the watchers are deleted with the loader
+    foreach (QFutureWatcher<Job> *watcher, m_batches.keys()) {
+      watcher->cancel();
+      watcher->waitForFinished();
+    }
+  }
+
+  void LibraryLoader::loadDirectory(const QString &path, QListWidget *list)
+  {
+    Q_CHECK_PTR(list);
+    if (!list)
+      return;
+    m_lists.insert(path, list);
+    m_index->watch(path);
+    refreshDirectory(path);
+  }
+
+  void LibraryLoader::refreshDirectory(const QString &path)
+  {
+    QListWidget *list = m_lists.value(path);
+    if (!list)
+      return;
+    QDir dir(path);
+
+    // the items of the directory, without those of removed files
+    QHash<QString, MolLibItem*> items;
+    for (int row = list->count() - 1; row >= 0; --row) {
+      MolLibItem *item = dynamic_cast<MolLibItem*>(list->item(row));
+      if (!item || (item->getFileName().absolutePath() != dir.absolutePath()))
+        continue;
+      if (item->getFileName().exists())
+        items.insert(item->getFileName().absoluteFilePath(), item);
+      else
+        delete list->takeItem(row);
+    }
+    m_index->prune(path);
+
+    // show the names at once
+    Batch batch;
+    batch.list = list;
+    foreach (const QFileInfo &file, dir.entryInfoList(QDir::Files, QDir::Name | QDir::IgnoreCase)) {
+      MolLibItem *item = items.value(file.absoluteFilePath());
+      uint modified = file.lastModified().toTime_t();
+      if (item && item->entry().isValid() && (item->entry().modified == modified))
+        continue;
+      // the file is not a molecule and was not modified since it was parsed
+      if (m_index->isUnreadable(file.filePath(), modified)) {
+        if (item)
+          delete list->takeItem(list->row(item));
+        continue;
+      }
+      int row;
+      if (item)
+        row = list->row(item);
+      else {
+        item = new MolLibItem(file.filePath());
+        row = list->count();
+        list->addItem(item);
+      }
+
+      Job job;
+      job.fileName = file.filePath();
+      job.modified = modified;
+      job.entry = m_index->entry(file.filePath());
+      // the file was modified since it was indexed
+      if (job.entry.modified != modified)
+        job.entry = LibraryEntry();
+      else
+        item->setEntry(job.entry);
+      batch.rows.append(row);
+      batch.items.append(item);
+      batch.jobs.append(job);
+    }
+    if (batch.jobs.isEmpty())
+      return;
+
+    // some font backends can only draw text in the GUI thread, see jobReady()
+    bool draw = QFontDatabase::supportsThreadedFontRendering();
+    QFutureWatcher<Job> *watcher = new QFutureWatcher<Job>(this);
+    connect(watcher, SIGNAL(resultReadyAt(int)), this, SLOT(jobReady(int)));
+    connect(watcher, SIGNAL(finished()), this, SLOT(batchFinished()));
+    m_batches.insert(watcher, batch);
+    watcher->setFuture(QtConcurrent::mapped(batch.jobs, LoadJob(m_cacheDir, draw)));
+  }
+
+  void LibraryLoader::waitForFinished()
+  {
+    while (!m_batches.isEmpty()) {
+      m_batches.begin().key()->waitForFinished();
+      // deliver the results to jobReady() and batchFinished()
+      QCoreApplication::processEvents();
+    }
+  }
+
+  /**
+   * Helper function to find the row of @p item in @p list, starting at the
+   * @p hint. The item may have been deleted, so only the pointer is used.
+   */
+  static int findItem(QListWidget *list, QListWidgetItem *item, int hint)
+  {
+    if ((hint < list->count()) && (list->item(hint) == item))
+      return hint;
+    for (int row = 0; row < list->count(); ++row)
+      if (list->item(row) == item)
+        return row;
+    return -1;
+  }
+
+  void LibraryLoader::jobReady(int index)
+  {
+    QFutureWatcher<Job> *watcher = static_cast<QFutureWatcher<Job>*>(sender());
+    if (!m_batches.contains(watcher))
+      return;
+    const Batch &batch = m_batches[watcher];
+
+    Job job = watcher->resultAt(index);
+    // the file is not a molecule
+    if (!job.entry.isValid())
+      m_index->insertUnreadable(job.fileName, job.modified);
+    else if (!batch.jobs.at(index).entry.isValid())
+      m_index->insert(job.entry);
+    if (job.entry.isValid() && job.thumbnail.isNull())
+      job.thumbnail = thumbnail(job.entry, m_cacheDir);
+
+    if (!batch.list)
+      return;
+    int row = findItem(batch.list, batch.items.at(index), batch.rows.at(index));
+    if (row < 0)
+      return;
+    MolLibItem *item = batch.items.at(index);
+    if (!job.entry.isValid()) {
+      delete batch.list->takeItem(row);
+      return;
+    }
+    item->setEntry(job.entry);
+    item->setThumbnail(job.thumbnail);
+  }
+
+  void LibraryLoader::batchFinished()
+  {
+    QFutureWatcher<Job> *watcher = static_cast<QFutureWatcher<Job>*>(sender());
+    m_batches.remove(watcher);
+    watcher->deleteLater();
+    if (m_batches.isEmpty()) {
+      if (m_index->isModified())
+        m_index->save();
+      emit finished();
+    }
+  }
+
+  void LibraryLoader::removeThumbnail(const LibraryEntry &entry)
+  {
+    QFile::remove(cacheFileName(entry, m_cacheDir));
+  }
+
+  QImage LibraryLoader::thumbnail(const LibraryEntry &entry, const QString &cacheDir, bool draw)
+  {
+    QString cacheFile = cacheFileName(entry, cacheDir);
+    QImage image;
+    if (image.load(cacheFile, "PNG") || !draw)
+      return image;
+
+    MoleculeRenderer renderer = entry.renderer();
+    image = MolLibItem::thumbnail(renderer);
+    image.save(cacheFile, "PNG");
+    return image;
+  }
+
+  QString LibraryLoader::cacheFileName(const LibraryEntry &entry, const QString &cacheDir)
+  {
+    // the time of the entry, not of the file, so the key can be found again when the file is gone
+    QByteArray key = entry.path.toUtf8();
+    key += '\n' + QByteArray::number(entry.modified);
+    // the labels are drawn in the default font
+    key += '\n' + QFont().key().toUtf8();
+    key += '\n' + QByteArray::number(thumbnailVersion);
+
+    return cacheDir + "/" + QString(QCryptographicHash::hash(key, QCryptographicHash::Md5).toHex()) + ".png";
+  }
+
+} // namespace
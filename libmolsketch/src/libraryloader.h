@@ -0,0 +1,174 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_LIBRARYLOADER_H
+#define MSK_LIBRARYLOADER_H
+
+#include <QFutureWatcher>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QListWidget>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+#include <molsketch/libraryindex.h>
+
+namespace Molsketch {
+
+  class MolLibItem;
+
+  /**
+   * Fills the molecule library lists without blocking the GUI.
+   *
+   * loadDirectory() adds a MolLibItem without icon for each file at once. The
+   * files are described by a LibraryIndex: only new and modified files are
+   * parsed, on the global QThreadPool, and their entries are added to the
+   * index as they finish. Files that can not be read are removed from the list
+   * again and remembered by the index, so they are only parsed again when they
+   * are modified. The items get the entry of their file, so the molecules are created
+   * from the index when they are added to the scene.
+   *
+   * The thumbnails are drawn from the entries and kept as PNG files in a cache
+   * directory, under a key of the path and modification time of the entry and
+   * the render settings. A library that was shown before is therefore loaded
+   * from the index and the cache, without reading any molecule file. The
+   * thumbnail of an entry is removed with it when its file is modified or removed.
+   *
+   * The directories are watched, so the lists and the index follow the files
+   * that are added, modified or removed while Molsketch runs.
+   */
+  class LibraryLoader : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      /**
+       * Creates a loader with its cache in @p cacheDir, which is created if
+       * needed, and its index in @p indexFile. By default these are
+       * ~/.molsketch/thumbnails and ~/.molsketch/library.index.
+       */
+      LibraryLoader(QObject *parent = 0, const QString &cacheDir = QString(),
+          const QString &indexFile = QString());
+      /**
+       * Cancels the thumbnails that are not drawn yet.
+       */
+      ~LibraryLoader();
+
+      /**
+       * @return The directory with the cached thumbnails.
+       */
+      QString cacheDir() const
+      {
+        return m_cacheDir;
+      }
+      /**
+       * @return The index of the library files.
+       */
+      LibraryIndex* index() const
+      {
+        return m_index;
+      }
+
+      /**
+       * Add an item for each file in @p path to @p list and draw their
+       * thumbnails in the background. The directory is watched for changes
+       * from then on.
+       */
+      void loadDirectory(const QString &path, QListWidget *list);
+      /**
+       * @return @c true while files are being loaded.
+       */
+      bool isLoading() const
+      {
+        return !m_batches.isEmpty();
+      }
+      /**
+       * Wait until all files are loaded.
+       */
+      void waitForFinished();
+
+      /**
+       * @return The thumbnail of @p entry from the cache in @p cacheDir. It is
+       * drawn and added to the cache if it is not there. If @p draw is @c false,
+       * only the cache is used. Can be called from any thread.
+       */
+      static QImage thumbnail(const LibraryEntry &entry, const QString &cacheDir, bool draw = true);
+      /**
+       * @return The name of the cached thumbnail of @p entry in @p cacheDir.
+       */
+      static QString cacheFileName(const LibraryEntry &entry, const QString &cacheDir);
+
+    signals:
+      /**
+       * Emitted when all files are loaded.
+       */
+      void finished();
+
+    public:
+      /**
+       * A file that is loaded in the background.
+       */
+      struct Job
+      {
+        QString fileName;
+        /** The modification time of the file when the job was queued. */
+        uint modified;
+        /** Invalid if the file has to be parsed. */
+        LibraryEntry entry;
+        QImage thumbnail;
+      };
+
+    private slots:
+      /**
+       * Bring the list of @p path up to date with the files: add items for new
+       * files, reload modified files and remove the items of removed files.
+       */
+      void refreshDirectory(const QString &path);
+      void jobReady(int index);
+      void batchFinished();
+      /**
+       * Remove the cached thumbnail of @p entry, which is no longer in the index.
+       */
+      void removeThumbnail(const LibraryEntry &entry);
+
+    private:
+      /**
+       * The items of a refreshDirectory() call.
+       */
+      struct Batch
+      {
+        QPointer<QListWidget> list;
+        QList<MolLibItem*> items;
+        /** The row of each item when it was added. */
+        QList<int> rows;
+        QList<Job> jobs;
+      };
+
+      QString m_cacheDir;
+      LibraryIndex *m_index;
+      /** The list of each loaded directory. */
+      QHash<QString, QPointer<QListWidget> > m_lists;
+      QHash<QFutureWatcher<Job>*, Batch> m_batches;
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,227 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <QCoreApplication>
+#include <QIcon>
+#include <QPixmap>
+#include <QtConcurrentFilter>
+#include <QtConcurrentRun>
+
+#include "librarysearch.h"
+
+#include "fileio.h"
+#include "libraryloader.h"
+#include "molecule.h"
+#include "moleculerenderer.h"
+#include "mollibitem.h"
+#include "similarity.h"
+#include "substructure.h"
+
+namespace Molsketch {
+
+  /**
+   * Functor to match the entries with QtConcurrent::filtered().
+   */
+  struct MatchEntry
+  {
+    typedef bool result_type;
+
+    MatchEntry(const LibraryEntry &query) : matcher(query)
+    {
+    }
+    bool operator()(const LibraryEntry &entry) const
+    {
+      return matcher.matches(entry);
+    }
+
+    SubstructureMatcher matcher;
+  };
+
+  /**
+   * Helper function to rank the @p entries and the @p molecules by their similarity
+   * to @p query with QtConcurrent::run(). The molecules are copies that are not on
+   * a scene, they are deleted when they are ranked.
+   */
+  static QList<LibrarySearch::Hit> rankEntries(const LibraryEntry &query, const QList<LibraryEntry> &entries,
+      const QList<Molecule*> &molecules, int count)
+  {
+    // the library entries first, then the molecules
+    QList<LibraryEntry> moleculeEntries;
+    FingerprintTable table(query.fingerprint.size());
+    table.reserve(entries.size() + molecules.size());
+    foreach (const LibraryEntry &entry, entries)
+      table.append(entry.fingerprint);
+    foreach (Molecule *molecule, molecules) {
+      LibraryEntry entry;
+      moleculeEntry(molecule, entry);
+      table.append(entry.fingerprint);
+      moleculeEntries.append(entry);
+      delete molecule;
+    }
+
+    QList<LibrarySearch::Hit> hits;
+    foreach (const FingerprintTable::Hit &hit, table.rank(query.fingerprint, count)) {
+      LibrarySearch::Hit result;
+      result.onScene = (hit.index >= entries.size());
+      result.entry = result.onScene ? moleculeEntries.at(hit.index - entries.size()) : entries.at(hit.index);
+      result.similarity = hit.similarity;
+      hits.append(result);
+    }
+    return hits;
+  }
+
+  LibrarySearch::LibrarySearch(LibraryLoader *loader, QObject *parent) : QObject(parent),
+      m_loader(loader), m_watcher(new QFutureWatcher<LibraryEntry>(this)),
+      m_rankWatcher(new QFutureWatcher<QList<Hit> >(this))
+  {
+    Q_CHECK_PTR(loader);
+    connect(m_watcher, SIGNAL(resultReadyAt(int)), this, SLOT(matchReady(int)));
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(searchFinished()));
+    connect(m_rankWatcher, SIGNAL(finished()), this, SLOT(rankFinished()));
+  }
+
+  LibrarySearch::~LibrarySearch()
+  {
+    cancel();
+  }
+
+  bool LibrarySearch::setQuery(const QString &smiles)
+  {
+    LibraryEntry query;
+    if (!smilesEntry(smiles.trimmed(), query))
+      return false;
+    m_query = query;
+    return true;
+  }
+
+  bool LibrarySearch::setQuery(Molecule *molecule)
+  {
+    LibraryEntry query;
+    if (!moleculeEntry(molecule, query))
+      return false;
+    m_query = query;
+    return true;
+  }
+
+  void LibrarySearch::start(QListWidget *list)
+  {
+    Q_CHECK_PTR(list);
+    cancel();
+    m_list = list;
+    if (!list)
+      return;
+    list->clear();
+
+    MatchEntry match(m_query);
+    if (!match.matcher.isValid()) {
+      emit finished();
+      return;
+    }
+    m_watcher->setFuture(QtConcurrent::filtered(m_loader->index()->entries(), match));
+  }
+
+  void LibrarySearch::rankSimilar(QListWidget *list, const QList<Molecule*> &molecules, int count)
+  {
+    Q_CHECK_PTR(list);
+    cancel();
+    m_list = list;
+    if (!list)
+      return;
+    list->clear();
+    if (m_query.fingerprint.isEmpty()) {
+      emit finished();
+      return;
+    }
+
+    // moleculeEntry() waits for OpenBabel, so the molecules are ranked in the
+    // background, from copies because the scene may change in the meantime
+    QList<Molecule*> copies;
+    foreach (Molecule *molecule, molecules)
+      copies.append(new Molecule(molecule));
+    m_rankWatcher->setFuture(QtConcurrent::run(rankEntries, m_query, m_loader->index()->entries(), copies, count));
+  }
+
+  void LibrarySearch::cancel()
+  {
+    // the ranking only works on copies, it is left to finish and its result is dropped
+    if (m_rankWatcher->isRunning())
+      m_rankWatcher->cancel();
+    if (!m_watcher->isRunning())
+      return;
+    // the results that are not delivered yet are dropped
+    m_watcher->cancel();
+    m_watcher->waitForFinished();
+  }
+
+  bool LibrarySearch::isRunning() const
+  {
+    return m_watcher->isRunning() || m_rankWatcher->isRunning();
+  }
+
+  void LibrarySearch::waitForFinished()
+  {
+    m_watcher->waitForFinished();
+    m_rankWatcher->waitForFinished();
+    // deliver the results to matchReady()
+    QCoreApplication::processEvents();
+  }
+
+  void LibrarySearch::matchReady(int index)
+  {
+    if (!m_list || m_watcher->isCanceled())
+      return;
+    LibraryEntry entry = m_watcher->resultAt(index);
+    MolLibItem *item = new MolLibItem(entry.path);
+    item->setEntry(entry);
+    item->setThumbnail(LibraryLoader::thumbnail(entry, m_loader->cacheDir()));
+    m_list->addItem(item);
+  }
+
+  void LibrarySearch::searchFinished()
+  {
+    if (!m_watcher->isCanceled())
+      emit finished();
+  }
+
+  void LibrarySearch::rankFinished()
+  {
+    if (m_rankWatcher->isCanceled())
+      return;
+    if (m_list) {
+      foreach (const Hit &hit, m_rankWatcher->result()) {
+        QString similarity = QString::number(hit.similarity, 'f', 2);
+        if (!hit.onScene) {
+          MolLibItem *item = new MolLibItem(hit.entry.path);
+          item->setEntry(hit.entry);
+          item->setThumbnail(LibraryLoader::thumbnail(hit.entry, m_loader->cacheDir()));
+          item->setText(QString("%1 (%2)").arg(item->text()).arg(similarity));
+          m_list->addItem(item);
+        } else {
+          MoleculeRenderer renderer = hit.entry.renderer();
+          QListWidgetItem *item = new QListWidgetItem(QIcon(QPixmap::fromImage(MolLibItem::thumbnail(renderer))),
+              tr("%1 on the scene (%2)").arg(hit.entry.formula).arg(similarity));
+          m_list->addItem(item);
+        }
+      }
+    }
+    emit finished();
+  }
+
+} // namespace
@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef MSK_LIBRARYSEARCH_H
+#define MSK_LIBRARYSEARCH_H
+
+#include <QFutureWatcher>
+#include <QList>
+#include <QListWidget>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+#include <molsketch/libraryindex.h>
+
+namespace Molsketch {
+
+  class LibraryLoader;
+  class Molecule;
+
+  /**
+   * Searches the molecule library for a substructure or similar molecules.
+   *
+   * The query is set as SMILES or as a molecule drawn on the scene. start()
+   * matches it against all entries of the LibraryIndex of a LibraryLoader on
+   * the global QThreadPool with a SubstructureMatcher, and adds a MolLibItem
+   * for each match to the result list as soon as it is found. rankSimilar()
+   * ranks the entries on the fingerprints in the index with a
+   * FingerprintTable, in the background as well.
+   */
+  class LibrarySearch : public QObject
+  {
+    Q_OBJECT
+
+    public:
+      /**
+       * Creates a search in the index of @p loader.
+       */
+      LibrarySearch(LibraryLoader *loader, QObject *parent = 0);
+      /**
+       * Cancels the search.
+       */
+      ~LibrarySearch();
+
+      /**
+       * Search for the molecule in @p smiles.
+       *
+       * @return @c false if the SMILES can not be read.
+       */
+      bool setQuery(const QString &smiles);
+      /**
+       * Search for @p molecule.
+       *
+       * @return @c false if the molecule is empty.
+       */
+      bool setQuery(Molecule *molecule);
+      /**
+       * @return The query, which is invalid until it is set.
+       */
+      const LibraryEntry& query() const
+      {
+        return m_query;
+      }
+
+      /**
+       * Clear @p list and fill it with the matching library entries. A search
+       * that is still running is cancelled.
+       */
+      void start(QListWidget *list);
+      /**
+       * Clear @p list and fill it with the @p count library entries and
+       * @p molecules most similar to the query, with their Tanimoto
+       * similarity. A search that is still running is cancelled.
+       */
+      void rankSimilar(QListWidget *list, const QList<Molecule*> &molecules = QList<Molecule*>(), int count = 25);
+      void cancel();
+      bool isRunning() const;
+      /**
+       * Wait until all matches are in the list.
+       */
+      void waitForFinished();
+
+    signals:
+      /**
+       * Emitted when the search is done.
+       */
+      void finished();
+
+    public:
+      /**
+       * A result of rankSimilar().
+       */
+      struct Hit
+      {
+        LibraryEntry entry;
+        qreal similarity;
+        /** @c true for the entry of a molecule on the scene, which has no file. */
+        bool onScene;
+      };
+
+    private slots:
+      void matchReady(int index);
+      void searchFinished();
+      void rankFinished();
+
+    private:
+      LibraryLoader *m_loader;
+      LibraryEntry m_query;
+      QPointer<QListWidget> m_list;
+      QFutureWatcher<LibraryEntry> *m_watcher;
+      QFutureWatcher<QList<Hit> > *m_rankWatcher;
+  };
+
+} // namespace
+
+#endif
@@ -18,9 +18,14 @@
  ***************************************************************************/
 
 #include "minimise.h"
-#include <queue>
 #include "ring.h"
 
+#include <algorithm>
+#include <climits>
+
+#include <QThread>
+#include <QtConcurrentMap>
+
 
 namespace Molsketch {
 	void Minimise::minimiseMolecule (Molecule *molecule) {
@@ -35,17 +40,20 @@ namespace Molsketch {
 		molecule ->numberAtoms ();
 		QList <Atom *> ats = molecule ->atoms ();
 		for (int i = 0; i < ats.size (); i++) {
-			atoms.push_back (new FFAtom (ats[i]));
+			atoms.push_back (ats[i]);
+			x.push_back (ats[i] ->pos ().x());
+			y.push_back (ats[i] ->pos ().y());
 		}
+		forceX.assign (atoms.size (), 0);
+		forceY.assign (atoms.size (), 0);
+		saveCurrentPose ();
+
 		QList <Bond *> bds = molecule ->bonds ();
 		for (int i = 0; i < bds.size (); i++) {
-			FFBond *b = new FFBond (bds[i]);
-			b ->at1 = atoms[bds[i]->beginAtom ()->number()];
-			b ->at2 = atoms[bds[i]->endAtom ()->number()];
-			bonds.push_back (b);
-			interactions.push_back (new FFBondstretch (b->at1, b->at2, bondLength));
-			rotations.push_back (new FFBondorient (b->at1, b->at2));
-
+			bonds.push_back (bds[i]);
+			bondBegin.push_back (bds[i]->beginAtom ()->number());
+			bondEnd.push_back (bds[i]->endAtom ()->number());
+			bondInRing.push_back (bds[i]->ring () != 0);
 		}	
 		
 		for (int i = 0; i < ats.size (); i++) {
@@ -59,46 +67,153 @@ namespace Molsketch {
 					Atom *at3 = nbr [k];
 					if (at2 == at) continue;
 					if (at3 == at) continue;
-					interactions.push_back (new FFAngleBend (atoms [at2 ->number()], atoms [at ->number()], atoms [at3 ->number()]));
+					angleBegin.push_back (at2 ->number());
+					angleCenter.push_back (at ->number());
+					angleEnd.push_back (at3 ->number());
 				}
 			}
 		}
 		
-		for (int i = 0; i < ats.size (); i++) {
-			for (int j = i; j < ats.size (); j++) {
-				bool add = true;
-				if (i==j) add = false;
-				if (add) {
-					Atom *a1 = atoms[i] ->atom;
-					Atom *a2 = atoms[j] ->atom;
-					foreach (Atom *n, a1 ->neighbours()) {
-						if (n == a2) {
-							add = false;
-							break;
-						}
-						foreach (Atom *n2, n ->neighbours ()) {
-							if (n2 == a2) {
-								add = false;
-								break;
-							}
-						}
-						if (!add) break;
+		// 1-2 and 1-3 pairs do not clash, see update_clashes ()
+		neighbours.resize (ats.size ());
+		for (unsigned int i = 0; i < bonds.size (); i++) {
+			neighbours [bondBegin[i]].push_back (bondEnd[i]);
+			neighbours [bondEnd[i]].push_back (bondBegin[i]);
+		}
+		update_clashes (true);
+
+		// for the incremental scores and mirror ()
+		atomBonds.resize (ats.size ());
+		for (unsigned int i = 0; i < bonds.size (); i++) {
+			atomBonds [bondBegin[i]].push_back (i);
+			atomBonds [bondEnd[i]].push_back (i);
+		}
+		isMoved.assign (ats.size (), false);
+		visitMarks.assign (ats.size (), 0);
+		visitMark = 0;
+		unsigned int head = 0;
+		sideA.clear ();
+		if (ats.size ()) {
+			visitMark = 2;
+			sideA.push_back (0);
+			visitMarks [0] = visitMark;
+			visitSide (sideA, head, visitMark, true);
+		}
+		m_connected = (sideA.size () == atoms.size ());
+
+		// the ring atoms on a circle around their ring, see fixRings ()
+		foreach (Ring *r, molecule ->rings ()) {
+			QList <Atom *> rats = r->atoms ();
+			QPointF c = r ->center ();
+			
+			for (int i = 0; i < rats.size(); i++) { 
+				Atom *a = rats[i];
+				QPointF rad= a ->pos () - c;
+				normalise (rad);
+				rad *= bondLength;
+				ringAtoms.push_back (a ->number ());
+				ringX.push_back (rad.x() + c.x());
+				ringY.push_back (rad.y() + c.y());
+			}
+		}
+		m_cancelled = 0;
+	}	
+	
+	void Minimise::update_clashes (bool force) {
+		qreal cutoff = bondLength * (0.75 + CLASH_SKIN);
+		qreal maxMove = bondLength * CLASH_SKIN / 2;
+		if (!force) {
+			// no pair can have come within the clash cutoff yet
+			bool moved = false;
+			for (unsigned int i = 0; !moved && i < atoms.size (); i++) {
+				qreal dx = x[i] - clashX[i];
+				qreal dy = y[i] - clashY[i];
+				moved = (dx*dx + dy*dy > maxMove*maxMove);
+			}
+			if (!moved) return;
+		}
+
+		clashBegin.clear ();
+		clashEnd.clear ();
+		clashX = x;
+		clashY = y;
+		if (atoms.empty ()) return;
+
+		// a grid of cells of at least the cutoff, with at most a few cells per atom
+		qreal xmin = x[0], xmax = xmin, ymin = y[0], ymax = ymin;
+		for (unsigned int i = 0; i < atoms.size (); i++) {
+			xmin = qMin (xmin, x[i]);
+			xmax = qMax (xmax, x[i]);
+			ymin = qMin (ymin, y[i]);
+			ymax = qMax (ymax, y[i]);
+		}
+		qreal cellSize = cutoff;
+		while ((std::floor ((xmax - xmin) / cellSize) + 1) * (std::floor ((ymax - ymin) / cellSize) + 1)
+				> 4.0 * atoms.size () + 16) {
+			cellSize *= 2;
+		}
+		int nx = int ((xmax - xmin) / cellSize) + 1;
+		int ny = int ((ymax - ymin) / cellSize) + 1;
+
+		// the atoms sorted by cell, those of cell c from cellStart[c] to cellStart[c + 1]
+		std::vector <int> cell (atoms.size ());
+		std::vector <int> cellStart (nx * ny + 1, 0);
+		for (unsigned int i = 0; i < atoms.size (); i++) {
+			// bounded, so even a degenerate pose can not leave the grid
+			int cx = qBound (0, int ((x[i] - xmin) / cellSize), nx - 1);
+			int cy = qBound (0, int ((y[i] - ymin) / cellSize), ny - 1);
+			cell[i] = cy * nx + cx;
+			cellStart [cell[i] + 1]++;
+		}
+		for (int c = 0; c < nx * ny; c++) cellStart [c + 1] += cellStart [c];
+		std::vector <int> cellAtoms (atoms.size ());
+		std::vector <int> fill (cellStart.begin (), cellStart.end () - 1);
+		for (unsigned int i = 0; i < atoms.size (); i++) cellAtoms [fill [cell[i]]++] = i;
+
+		std::vector <bool> excluded (atoms.size (), false);
+		for (unsigned int i = 0; i < atoms.size (); i++) {
+			// mark the 1-2 and 1-3 neighbours of i
+			for (unsigned int j = 0; j < neighbours[i].size (); j++) {
+				int n = neighbours[i][j];
+				excluded [n] = true;
+				for (unsigned int k = 0; k < neighbours[n].size (); k++) excluded [neighbours[n][k]] = true;
+			}
+
+			int cx = cell[i] % nx;
+			int cy = cell[i] / nx;
+			for (int gy = qMax (cy - 1, 0); gy <= qMin (cy + 1, ny - 1); gy++) {
+				for (int gx = qMax (cx - 1, 0); gx <= qMin (cx + 1, nx - 1); gx++) {
+					int c = gy * nx + gx;
+					for (int k = cellStart [c]; k < cellStart [c + 1]; k++) {
+						unsigned int j = cellAtoms [k];
+						if (j <= i || excluded [j]) continue;
+						qreal dx = x[j] - x[i];
+						qreal dy = y[j] - y[i];
+						if (dx*dx + dy*dy > cutoff*cutoff) continue;
+						clashBegin.push_back (i);
+						clashEnd.push_back (j);
 					}
 				}
-				if (add) interactions.push_back (new FFclash (atoms[i], atoms[j], bondLength));
-	
+			}
+
+			for (unsigned int j = 0; j < neighbours[i].size (); j++) {
+				int n = neighbours[i][j];
+				excluded [n] = false;
+				for (unsigned int k = 0; k < neighbours[n].size (); k++) excluded [neighbours[n][k]] = false;
 			}
 		}
-	}	
+	}
 	
 	void Minimise::run (int n) {
 		for (int i = 0; i < n; i++) {
+			if (isCancelled ()) return;
 			score_interactions ();
 			//	std::cerr << "interactions  " <<total_score()<<std::endl;
 			
 			if (!move_atoms ()) break;
 		}
 		for (int j = 0; j < 5; j++) {
+			if (isCancelled ()) return;
 			for (unsigned int i = 0; i < 500; i++) {
 				score_rotations ();
 				//	std::cerr << total_score()<<std::endl;
@@ -124,157 +239,339 @@ namespace Molsketch {
 	}
 	
 	void Minimise::loadBestPose () {
-		for (unsigned int i = 0; i < atoms.size (); i++) {
-			atoms[i] ->load_pose ();
+		// only the moved atoms differ from the best pose while the scores are valid
+		if (m_scoresValid) {
+			restoreMoved ();
+			return;
 		}
+		x = bestX;
+		y = bestY;
+		for (unsigned int i = 0; i < movedAtoms.size (); i++) isMoved [movedAtoms[i]] = false;
+		movedAtoms.clear ();
 	}
 	
 	
 	void Minimise::saveCurrentPose () {
-		for (unsigned int i = 0; i < atoms.size (); i++) {
-			atoms[i] ->save_pose ();
+		bestX = x;
+		bestY = y;
+		for (unsigned int i = 0; i < movedAtoms.size (); i++) isMoved [movedAtoms[i]] = false;
+		movedAtoms.clear ();
+		m_scoresValid = false;
+	}
+
+	void Minimise::markMoved (int a) {
+		if (isMoved[a]) return;
+		isMoved[a] = true;
+		movedAtoms.push_back (a);
+	}
+
+	void Minimise::restoreMoved () {
+		for (unsigned int i = 0; i < movedAtoms.size (); i++) {
+			int a = movedAtoms[i];
+			moveAtom (a, bestX[a], bestY[a]);
+			isMoved[a] = false;
+		}
+		movedAtoms.clear ();
+		if (m_scoresValid) {
+			// exactly the sums of the best pose, so they do not drift
+			m_sumX = m_bestSumX; m_sumXX = m_bestSumXX;
+			m_sumY = m_bestSumY; m_sumYY = m_bestSumYY;
+			// the grid was left behind by the moves that were not scored
+			if (!m_deltaValid) buildGrid ();
+			m_deltaValid = true;
+			m_scoreDelta = 0;
+			m_scoredMoves = 0;
 		}
 	}
+
+	void Minimise::moveAtom (int a, qreal nx, qreal ny) {
+		// only the scored moves keep the grid and the sums up to date
+		if (m_scoresValid && m_deltaValid) {
+			qreal ox = x[a] - m_originX, oy = y[a] - m_originY;
+			qreal dx = nx - m_originX, dy = ny - m_originY;
+			m_sumX += dx - ox; m_sumXX += dx*dx - ox*ox;
+			m_sumY += dy - oy; m_sumYY += dy*dy - oy*oy;
+			gridRemove (a);
+			x[a] = nx;
+			y[a] = ny;
+			gridInsert (a);
+			return;
+		}
+		x[a] = nx;
+		y[a] = ny;
+	}
 	
 	void Minimise::rotate (qreal angle, QPointF center) {
+		// all atoms move, so mutatedScore () takes the total_score ()
+		m_deltaValid = false;
+		qreal c = cos(angle);
+		qreal s = sin(angle);
 		for (unsigned int i = 0; i < atoms.size (); i++) {
-			qreal x = atoms[i] ->x () - center.x ();
-			qreal y = atoms[i] ->y () - center.y ();
-			qreal nx = cos(angle) * x - sin(angle) * y;
-			qreal ny = sin(angle) * x + cos(angle) * y;
-			atoms [i] ->x () = center.x() + nx;
-			atoms [i] ->y () = center.y() + ny;
+			qreal dx = x[i] - center.x ();
+			qreal dy = y[i] - center.y ();
+			moveAtom (i, center.x() + c * dx - s * dy, center.y() + s * dx + c * dy);
+			markMoved (i);
 		}
 	}
 	
-	void Minimise::mirror (FFAtom *at1, FFAtom*at2) {
-		for (unsigned int i = 0; i < atoms.size (); i++) {
-			atoms[i] ->visited = false;
-		}
-		unsigned int nvisited = 1;
-		std::queue <FFAtom *> queue;
-		Atom *a1 = at1 ->atom;
-		Atom *a2 = at2 ->atom;		
-		Bond *b = a1 ->molecule ()->bondBetween (a1, a2);
-		if (b ->ring ()) return;
-		at1 ->visited = true;
-		at2 ->visited = true;
-
-		queue.push (at1);
-		while (queue.size ()) {
-			FFAtom *a = queue.front ();
-			queue.pop ();
-			Atom *at = a ->atom;
-			foreach (Atom *na, at ->neighbours()) {
-				FFAtom *ffna = atoms [na ->number()];
-				if (!ffna ->visited) {
-					nvisited++;
-					ffna ->visited = true;
-					queue.push (ffna);
-				}
-			}
+	// The side of at1 and the side of at2 are searched in turns, so the
+	// smaller side is found after visiting about twice its atoms. The side of
+	// at1, with at2, is mirrored if it has at most half of the atoms, and
+	// else all other atoms.
+	void Minimise::mirror (int bond) {
+		if (bondInRing[bond]) return;
+		int at1 = bondBegin[bond];
+		int at2 = bondEnd[bond];
+		// a new mark for each side and for the mirrored atoms, so the marks
+		// need not be cleared
+		if (visitMark > UINT_MAX - 3) {
+			visitMarks.assign (atoms.size (), 0);
+			visitMark = 0;
 		}
-		bool targetVisited = true;
-		if (nvisited > atoms.size () /2) targetVisited = false;
+		unsigned int markA = ++visitMark;
+		unsigned int markB = ++visitMark;
+		sideA.assign (1, at1);
+		sideB.assign (1, at2);
+		visitMarks[at1] = markA;
+		visitMarks[at2] = markB;
+		unsigned int headA = 0, headB = 0;
+		while (headA < sideA.size () && headB < sideB.size ()) {
+			visitSide (sideA, headA, markA, false);
+			visitSide (sideB, headB, markB, false);
+		}
+		// without all atoms connected, only the side of at1 tells the sizes
+		if (headA < sideA.size () && !m_connected) visitSide (sideA, headA, markA, true);
+
+		unsigned int half = atoms.size () /2;
+		bool mirrorA;
+		if (headA == sideA.size ()) mirrorA = (sideA.size () <= half);
+		else mirrorA = (atoms.size () - sideB.size () <= half);
 	//	std::cerr << "mutate "<<nvisited<<std::endl;
 
-		for (unsigned int i =0; i < atoms.size (); i++) {
-			if (atoms [i] ->visited == targetVisited) {
-				mirrorAtom (atoms [i], at1, at2);
+		if (mirrorA) {
+			visitSide (sideA, headA, markA, true);
+			mirrored = sideA;
+			mirrored.push_back (at2);
+		}
+		else if (m_connected) {
+			visitSide (sideB, headB, markB, true);
+			mirrored.assign (sideB.begin () + 1, sideB.end ());
+		}
+		else {
+			mirrored.clear ();
+			for (unsigned int i = 0; i < atoms.size (); i++) {
+				if (visitMarks[i] != markA && (int) i != at2) mirrored.push_back (i);
 			}
 		}
 
+		// The change of the score is that of the terms of the mirrored atoms.
+		// Once the mirrors moved more atoms than the molecule has, scoring
+		// them costs more than the total_score () does.
+		bool scored = m_scoresValid && m_deltaValid && m_scoredMoves + mirrored.size () <= atoms.size ();
+		if (!scored) m_deltaValid = false;
+		unsigned int mark = ++visitMark;
+		for (unsigned int i = 0; i < mirrored.size (); i++) visitMarks [mirrored[i]] = mark;
+		if (scored) m_scoreDelta -= local_score (mirrored, mark);
+
+		QPointF p1 (qpoint (at1));
+		QPointF p2 (qpoint (at2));
+		for (unsigned int i = 0; i < mirrored.size (); i++) mirrorAtom (mirrored[i], p1, p2);
+
+		if (scored) {
+			m_scoreDelta += local_score (mirrored, mark);
+			m_scoredMoves += mirrored.size ();
+		}
+	}
+
+	void Minimise::visitSide (std::vector <int> &side, unsigned int &head, unsigned int mark, bool all) {
+		// one atom at a time, or all atoms
+		unsigned int end = all ? UINT_MAX : head + 1;
+		for (; head < side.size () && head < end; head++) {
+			int a = side[head];
+			for (unsigned int i = 0; i < neighbours[a].size (); i++) {
+				int na = neighbours[a][i];
+				// both sides of the last mirror () are visited
+				if (visitMarks[na] < visitMark - 1) {
+					visitMarks[na] = mark;
+					side.push_back (na);
+				}
+			}
+		}
 	}
 	
-	void Minimise::mirrorAtom (FFAtom *at, FFAtom *at1, FFAtom *at2) {
-		QPointF p (at ->qpoint());
-		p = symmetric(p, at1 ->qpoint(), at2 ->qpoint());
-		at ->x() = p.x();
-		at ->y() = p.y ();
-		
+	void Minimise::mirrorAtom (int at, const QPointF &p1, const QPointF &p2) {
+		QPointF p (qpoint (at));
+		p = symmetric(p, p1, p2);
+		moveAtom (at, p.x (), p.y ());
+		markMoved (at);
 	}
 	
 	void Minimise::mutate () {
 
-		qreal r1 = (((qreal) rand()) / RAND_MAX);
+		qreal r1 = random ();
 		int numberofMutations = r1 * bonds.size () * 0.6;
 
 		if (!numberofMutations) {
 			numberofMutations = 1;
-			qreal r2 = (((qreal) rand()) / RAND_MAX);
+			qreal r2 = random ();
 			int ang = r2 * 12;
 			qreal angle = ang * M_PI / 6;
-			if (atoms.size ()) rotate (angle, atoms[0] ->qpoint ());
+			if (atoms.size ()) rotate (angle, qpoint (0));
 		}
-		for (int i = 0; i < numberofMutations; i++) {
-			qreal r2 = (((qreal) rand()) / RAND_MAX);
+		for (int i = 0; i < numberofMutations && bonds.size (); i++) {
+			qreal r2 = random ();
 
 			//int bond = r2 * bonds.size ();
 
 			int n = r2 *bonds.size ();
 		//	std::cerr << "mutate bond" <<n<<"  ";
 
-			mirror (bonds[n]->at1, bonds[n] ->at2);
+			mirror (n);
 		}		
 	//	std::cerr << std::endl;
 	}
 	
 	
-	void Minimise::fixRings (Molecule *mol) {
-		foreach (Ring *r, mol ->rings ()) {
-			QList <Atom *> ats = r->atoms ();
-			QPointF c = r ->center ();
-			
-			for (int i = 0; i < ats.size(); i++) { 
-				Atom *a = ats[i];
-				QPointF rad= a ->pos () - c;
-				normalise (rad);
-				rad *= bondLength;
-				atoms [a ->number()] ->x() = rad.x() + c.x();
-				atoms [a ->number()] ->y() = rad.y() + c.y();
-			}
+	void Minimise::fixRings () {
+		m_scoresValid = false;
+		for (unsigned int i = 0; i < ringAtoms.size (); i++) {
+			x [ringAtoms[i]] = ringX[i];
+			y [ringAtoms[i]] = ringY[i];
 		}
 	}
 	
 	void Minimise::conformationalSearchMolecule (Molecule *molecule) {
 		initialise (molecule);
+		conformationalSearch (500, QThread::idealThreadCount ());
+		finaliseBest ();
+		clear ();
+	}
+
+	void Minimise::conformationalSearch (int n) {
+		startSearch ();
+		for (int i = 0; i < n && !isCancelled (); i++) {
+			searchStep ();
+		}
+	}
+
+	void Minimise::startSearch () {
 		run ();
-		fixRings (molecule);
+		fixRings ();
 		run ();
 		saveCurrentPose();
-		bestScore = total_score ();
-		for (unsigned int i = 0; i < 500; i++) {
-			loadBestPose ();
-			mutate ();
-			qreal s = total_score();
-			//run (5);
+		resetScores ();
+		bestScore = m_poseScore;
+	}
+
+	bool Minimise::searchStep () {
+		restoreMoved ();
+		mutate ();
+		qreal s = mutatedScore ();
+		//run (5);
 
 	//		std::cerr<<s<<"    "<<bestScore<<std::endl;
-			if (s < bestScore) {
-				run ();
+		if (s < bestScore) {
+			run ();
 
-				bestScore = s;
-				saveCurrentPose ();
+			bestScore = s;
+			saveCurrentPose ();
+			resetScores ();
+			return true;
+		}
+		return false;
+	}
+
+	void Minimise::conformationalSearch (int n, int chains) {
+		if (chains <= 1) {
+			conformationalSearch (n);
+			return;
+		}
+		startSearch ();
+		startChains (chains);
+		chainSteps ((n + chains - 1) / chains);
+		deleteChains ();
+	}
+
+	void Minimise::startChains (int count) {
+		deleteChains ();
+		for (int i = 0; i < count; i++)
+			m_chains.append (new Minimise (*this, m_seed + 0x9e3779b9u * (i + 1)));
+	}
+
+	Minimise::Minimise (const Minimise &search, quint32 seed) : MinimiseData (search), m_cancelled (0),
+			m_cancelFlag (search.m_cancelFlag) {
+		setSeed (seed);
+	}
+
+	/**
+	 * Functor to run the steps of the chains with QtConcurrent::blockingMap ().
+	 */
+	struct ChainSteps
+	{
+		ChainSteps (int n) : n (n) {}
+		void operator() (Minimise *chain) const {
+			for (int i = 0; i < n && !chain ->isCancelled (); i++) {
+				chain ->searchStep ();
 			}
 		}
-	 
-		finaliseBest ();
-		clear ();
+		int n;
+	};
+
+	bool Minimise::chainSteps (int n) {
+		QtConcurrent::blockingMap (m_chains, ChainSteps (n));
+
+		// the first of the best chains, so the result does not depend on the timing
+		bool changed = false;
+		for (int i = 0; i < m_chains.size (); i++) {
+			if (m_chains[i] ->bestScore < bestScore) {
+				bestScore = m_chains[i] ->bestScore;
+				bestX = m_chains[i] ->bestX;
+				bestY = m_chains[i] ->bestY;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	void Minimise::deleteChains () {
+		qDeleteAll (m_chains);
+		m_chains.clear ();
+	}
+
+	void Minimise::setSeed (quint32 seed) {
+		m_seed = seed;
+		// xorshift needs a state that is not 0
+		m_random = seed * 2654435761u ^ 0x5bd1e995u;
+		if (!m_random) m_random = 1;
+	}
+
+	qreal Minimise::random () {
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		return (m_random >> 8) / 16777216.0;
+	}
+
+	QList <QPointF> Minimise::bestPositions () const {
+		QList <QPointF> positions;
+		for (unsigned int i = 0; i < bestX.size (); i++) {
+			positions.append (QPointF (bestX[i], bestY[i]));
+		}
+		return positions;
 	}
-	
 	
 	void Minimise::mirrorBondInMolecule (Molecule *molecule, Bond *bo) {
 		initialise (molecule);
 		int n = -1;
 		for (unsigned int i = 0; i < bonds.size (); i++) {
-			if (bonds[i]->bond == bo) {
+			if (bonds[i] == bo) {
 				n = i;
 				break;
 			}
 
 		}
 		if (n != -1) {
-			mirror (bonds[n]->at1, bonds[n] ->at2);
+			mirror (n);
 
 		}
 		
@@ -284,27 +581,34 @@ namespace Molsketch {
 
 	
 	qreal Minimise::total_score () {
-		qreal e = 0;
-		for (unsigned int i = 0; i < interactions.size (); i++) {
-			interactions[i] ->score (e);
-		}
-		for (unsigned int i = 0; i < rotations.size (); i++) {
-			rotations[i] ->score (e);
-		}
+		// the bends do not score
+		qreal e = stretch_score ();
+		e += clash_score ();
+		e += orientation_score ();
 		e+= elongation_score ();
 		return e;
 	}
 	
+	/**
+	 * Helper function for the elongation of @p n atoms from the sums of their
+	 * coordinates and squared coordinates. The sum of dx^2 over all pairs is
+	 * n sxx - sx^2, and likewise for dy^2.
+	 */
+	static inline qreal elongation (unsigned int n, qreal sx, qreal sxx, qreal sy, qreal syy) {
+		return - ((n*sxx - sx*sx) * 2 + (n*syy - sy*sy) * KXSIZE);
+	}
+
 	qreal Minimise::elongation_score () {
-		qreal score = 0;
+		if (atoms.empty ()) return 0;
+		// relative to the first atom, for the precision of the sums
+		qreal sx = 0, sxx = 0, sy = 0, syy = 0;
 		for (unsigned int i = 0; i < atoms.size (); i++) {
-				for (unsigned int j = i; j < atoms.size (); j++) {
-					if (i == j) continue;
-					qreal x = atoms[i] ->x() - atoms[j] ->x();
-					qreal y = atoms[i] ->y() - atoms[j] ->y();
-					score -= x*x* 2 + y*y * KXSIZE;
-				}
+			qreal dx = x[i] - x[0];
+			qreal dy = y[i] - y[0];
+			sx += dx; sxx += dx*dx;
+			sy += dy; syy += dy*dy;
 		}
+		qreal score = elongation (atoms.size (), sx, sxx, sy, syy);
 		/*
 		qreal xmin = 999999;
 		qreal xmax = -999999;
@@ -338,49 +642,334 @@ namespace Molsketch {
 		return score;
 	}
 	
-	void Minimise::score_rotations () {
-		for (unsigned int i = 0; i < rotations.size (); i++) {
-			rotations[i] ->apply ();
+	void Minimise::add_forces (const std::vector <int> &first, const std::vector <int> &second) {
+		for (unsigned int t = 0; t < first.size (); t++) {
+			forceX[first[t]] += termForceX[t];
+			forceY[first[t]] += termForceY[t];
+			forceX[second[t]] -= termForceX[t];
+			forceY[second[t]] -= termForceY[t];
+		}
+	}
+
+	// The directions are taken between truncated positions and the distances
+	// between exact ones, as in the FF classes.
+
+	void Minimise::apply_stretches () {
+		unsigned int n = bondBegin.size ();
+		termForceX.resize (n);
+		termForceY.resize (n);
+		for (unsigned int t = 0; t < n; t++) {
+			int i = bondBegin[t], j = bondEnd[t];
+			qreal dx = x[j] - x[i];
+			qreal dy = y[j] - y[i];
+			qreal d = std::sqrt (dx*dx + dy*dy) - bondLength;
+			qreal vx = int (x[j]) - int (x[i]);
+			qreal vy = int (y[j]) - int (y[i]);
+			qreal k = d * KSTRETCH / std::sqrt (vx*vx + vy*vy);
+			termForceX[t] = vx * k;
+			termForceY[t] = vy * k;
+		}
+		add_forces (bondBegin, bondEnd);
+	}
+
+	qreal Minimise::stretch_term (int t) const {
+		qreal dx = x[bondEnd[t]] - x[bondBegin[t]];
+		qreal dy = y[bondEnd[t]] - y[bondBegin[t]];
+		qreal d = std::sqrt (dx*dx + dy*dy) - bondLength;
+		return d*d*KSTRETCH;
+	}
+
+	qreal Minimise::stretch_score () {
+		qreal tot = 0;
+		for (unsigned int t = 0; t < bondBegin.size (); t++) {
+			tot += stretch_term (t);
+		}
+		return tot;
+	}
+
+	void Minimise::apply_bends () {
+		unsigned int n = angleCenter.size ();
+		termForceX.resize (n);
+		termForceY.resize (n);
+		bendForceX.resize (n);
+		bendForceY.resize (n);
+		for (unsigned int t = 0; t < n; t++) {
+			int c = angleCenter[t];
+			qreal v1x = int (x[angleBegin[t]]) - int (x[c]);
+			qreal v1y = int (y[angleBegin[t]]) - int (y[c]);
+			qreal v2x = int (x[angleEnd[t]]) - int (x[c]);
+			qreal v2y = int (y[angleEnd[t]]) - int (y[c]);
+			qreal a = (2* M_PI / 3) - std::fabs (std::atan2 (v1x * v2y - v1y * v2x, v1x * v2x + v1y * v2y));
+			qreal k1 = 1 / std::sqrt (v1x*v1x + v1y*v1y);
+			qreal k2 = 1 / std::sqrt (v2x*v2x + v2y*v2y);
+			v1x *= k1; v1y *= k1;
+			v2x *= k2; v2y *= k2;
+			qreal dirx = v1x + v2x;
+			qreal diry = v1y + v2y;
+			// the normals point away from the bisector
+			qreal s1 = (v1y * dirx - v1x * diry > 0) ? -a * KBEND : a * KBEND;
+			qreal s2 = (v2y * dirx - v2x * diry > 0) ? -a * KBEND : a * KBEND;
+			termForceX[t] = v1y * s1;
+			termForceY[t] = -v1x * s1;
+			bendForceX[t] = v2y * s2;
+			bendForceY[t] = -v2x * s2;
+		}
+		add_forces (angleBegin, angleCenter);
+		termForceX.swap (bendForceX);
+		termForceY.swap (bendForceY);
+		add_forces (angleEnd, angleCenter);
+	}
+
+	void Minimise::apply_clashes () {
+		unsigned int n = clashBegin.size ();
+		termForceX.resize (n);
+		termForceY.resize (n);
+		for (unsigned int t = 0; t < n; t++) {
+			int i = clashBegin[t], j = clashEnd[t];
+			qreal dx = x[j] - x[i];
+			qreal dy = y[j] - y[i];
+			qreal d = bondLength - std::sqrt (dx*dx + dy*dy);
+			qreal vx = int (x[j]) - int (x[i]);
+			qreal vy = int (y[j]) - int (y[i]);
+			// pushed apart within three quarters of a bond length
+			qreal k = (d < bondLength / 4) ? 0 : d * KCLASH / std::sqrt (vx*vx + vy*vy);
+			termForceX[t] = vx * k;
+			termForceY[t] = vy * k;
+		}
+		add_forces (clashEnd, clashBegin);
+	}
+
+	qreal Minimise::clash_score () {
+		update_clashes ();
+		qreal tot = 0;
+		for (unsigned int t = 0; t < clashBegin.size (); t++) {
+			qreal dx = x[clashEnd[t]] - x[clashBegin[t]];
+			qreal dy = y[clashEnd[t]] - y[clashBegin[t]];
+			qreal d = bondLength - std::sqrt (dx*dx + dy*dy);
+			if (d >= bondLength / 4) tot += d*d*KCLASH*10;
+		}
+		return tot;
+	}
+
+	/**
+	 * Helper function for the angle between @p ang, in [0, 2 pi), and the
+	 * nearest multiple of 30 degrees, as FFBondorient computes it.
+	 */
+	static inline qreal orientation (qreal ang) {
+		int n = ang / (M_PI / 6);
+		qreal targetang = n * (M_PI / 6);
+		if ((ang - targetang) > (M_PI / 12)) targetang = (n+1) * (M_PI / 6);
+		return targetang - ang;
+	}
+
+	void Minimise::apply_orientations () {
+		unsigned int n = bondBegin.size ();
+		termForceX.resize (n);
+		termForceY.resize (n);
+		for (unsigned int t = 0; t < n; t++) {
+			qreal vx = int (x[bondEnd[t]]) - int (x[bondBegin[t]]);
+			qreal vy = int (y[bondEnd[t]]) - int (y[bondBegin[t]]);
+			qreal ang = std::atan2 (vy, vx);
+			if (ang < 0) ang = 2 * M_PI + ang;
+			qreal k = orientation (ang) * KORIENT / std::sqrt (vx*vx + vy*vy);
+			termForceX[t] = vy * k;
+			termForceY[t] = -vx * k;
+		}
+		add_forces (bondBegin, bondEnd);
+	}
+
+	qreal Minimise::orientation_term (int t) const {
+		qreal vx = int (x[bondEnd[t]]) - int (x[bondBegin[t]]);
+		qreal vy = int (y[bondEnd[t]]) - int (y[bondBegin[t]]);
+		qreal ang = std::atan2 (vy, vx);
+		if (ang < 0) ang = 2 * M_PI + ang;
+		qreal a = orientation (ang);
+		return a*a*KORIENT;
+	}
+
+	qreal Minimise::orientation_score () {
+		qreal tot = 0;
+		for (unsigned int t = 0; t < bondBegin.size (); t++) {
+			tot += orientation_term (t);
+		}
+		return tot;
+	}
+
+	/**
+	 * Helper function for the score of a clash between atoms @p dx, @p dy
+	 * apart, as in clash_score ().
+	 */
+	static inline qreal clash_term (qreal dx, qreal dy, qreal len) {
+		qreal d = len - std::sqrt (dx*dx + dy*dy);
+		return (d >= len / 4) ? d*d*KCLASH*10 : 0;
+	}
+
+	/**
+	 * Helper function for the key of cell (@p cx, @p cy).
+	 */
+	static inline qint64 cellKey (int cx, int cy) {
+		return qint64 (cx) * Q_INT64_C (4294967296) + cy;
+	}
+
+	/**
+	 * Helper function for the cell of coordinate @p v, for cells of @p size.
+	 * Bounded, so even a degenerate pose gives a valid key.
+	 */
+	static inline int cellIndex (qreal v, qreal size) {
+		return int (qBound (qreal (-1e9), std::floor (v / size), qreal (1e9)));
+	}
+
+	/**
+	 * Helper function for the key of the cell of (@p x, @p y), for cells of
+	 * @p size.
+	 */
+	static inline qint64 cellKey (qreal x, qreal y, qreal size) {
+		return cellKey (cellIndex (x, size), cellIndex (y, size));
+	}
+
+	bool Minimise::excluded (int i, int j) const {
+		for (unsigned int k = 0; k < neighbours[i].size (); k++) {
+			int n = neighbours[i][k];
+			if (n == j) return true;
+			for (unsigned int l = 0; l < neighbours[n].size (); l++) {
+				if (neighbours[n][l] == j) return true;
+			}
+		}
+		return false;
+	}
+
+	void Minimise::resetScores () {
+		// the scores are only kept up to date from here on
+		m_scoresValid = false;
+		qreal e = stretch_score () + orientation_score () + clash_score ();
+
+		m_originX = atoms.size () ? x[0] : 0;
+		m_originY = atoms.size () ? y[0] : 0;
+		m_sumX = m_sumXX = m_sumY = m_sumYY = 0;
+		for (unsigned int i = 0; i < atoms.size (); i++) {
+			qreal dx = x[i] - m_originX;
+			qreal dy = y[i] - m_originY;
+			m_sumX += dx; m_sumXX += dx*dx;
+			m_sumY += dy; m_sumYY += dy*dy;
 		}
+		m_bestSumX = m_sumX; m_bestSumXX = m_sumXX;
+		m_bestSumY = m_sumY; m_bestSumYY = m_sumYY;
+		m_poseElongation = elongation (atoms.size (), m_sumX, m_sumXX, m_sumY, m_sumYY);
+		buildGrid ();
+
+		m_poseScore = e + m_poseElongation;
+		m_scoreDelta = 0;
+		m_scoredMoves = 0;
+		m_deltaValid = true;
+		m_scoresValid = true;
+	}
+
+	qreal Minimise::mutatedScore () {
+		if (!m_scoresValid || !m_deltaValid) return total_score ();
+		return m_poseScore + m_scoreDelta
+			+ elongation (atoms.size (), m_sumX, m_sumXX, m_sumY, m_sumYY) - m_poseElongation;
+	}
+
+	// The clashes of an atom are found in the grid of the current pose, which
+	// moveAtom () keeps up to date.
+	qreal Minimise::local_score (const std::vector <int> &set, unsigned int mark) {
+		qreal e = 0;
+		for (unsigned int k = 0; k < set.size (); k++) {
+			int i = set[k];
+			for (unsigned int b = 0; b < atomBonds[i].size (); b++) {
+				int t = atomBonds[i][b];
+				int other = (bondBegin[t] == i) ? bondEnd[t] : bondBegin[t];
+				// the bonds within the set once
+				if (visitMarks[other] == mark && other < i) continue;
+				e += stretch_term (t) + orientation_term (t);
+			}
+			gridFind (x[i], y[i]);
+			for (unsigned int f = 0; f < found.size (); f++) {
+				int j = found[f];
+				if (j == i || (visitMarks[j] == mark && j < i) || excluded (i, j)) continue;
+				e += clash_term (x[j] - x[i], y[j] - y[i], bondLength);
+			}
+		}
+		return e;
+	}
+
+	void Minimise::buildGrid () {
+		// a power of two of about two buckets per atom
+		unsigned int size = 16;
+		while (size < 2 * atoms.size ()) size *= 2;
+		gridHead.assign (size, -1);
+		gridNext.assign (atoms.size (), -1);
+		gridCell.assign (atoms.size (), 0);
+		for (unsigned int i = 0; i < atoms.size (); i++) gridInsert (i);
+	}
+
+	int Minimise::gridBucket (qint64 key) const {
+		quint64 h = quint64 (key) * Q_UINT64_C (0x9e3779b97f4a7c15);
+		return int (h >> 32) & int (gridHead.size () - 1);
+	}
+
+	void Minimise::gridInsert (int a) {
+		gridCell[a] = cellKey (x[a], y[a], bondLength * 0.75);
+		int b = gridBucket (gridCell[a]);
+		gridNext[a] = gridHead[b];
+		gridHead[b] = a;
+	}
+
+	void Minimise::gridRemove (int a) {
+		int *link = &gridHead [gridBucket (gridCell[a])];
+		while (*link != a) link = &gridNext [*link];
+		*link = gridNext[a];
+	}
+
+	void Minimise::gridFind (qreal px, qreal py) {
+		found.clear ();
+		qreal size = bondLength * 0.75;
+		int cx = cellIndex (px, size);
+		int cy = cellIndex (py, size);
+		for (int gx = cx - 1; gx <= cx + 1; gx++) {
+			for (int gy = cy - 1; gy <= cy + 1; gy++) {
+				qint64 key = cellKey (gx, gy);
+				for (int j = gridHead [gridBucket (key)]; j >= 0; j = gridNext[j]) {
+					if (gridCell[j] == key) found.push_back (j);
+				}
+			}
+		}
+	}
+
+	void Minimise::score_rotations () {
+		apply_orientations ();
 	}
 	
 	void Minimise::score_interactions () {
-		for (unsigned int i = 0; i < interactions.size (); i++) {
-		//	std::cerr << "applying interaction "<<i<<std::endl;
-			interactions[i] ->apply ();
-		}
+		apply_stretches ();
+		apply_bends ();
+		update_clashes ();
+		apply_clashes ();
 	}
 	
 	bool Minimise::move_atoms () {
-		qreal x = 0;
-		qreal y = 0;
+		m_scoresValid = false;
 		qreal f = 0;
 		for (unsigned int i = 0; i < atoms.size (); i++) {
-			atoms[i] ->x () += atoms[i] ->force_x ();
-			atoms[i] ->y () += atoms[i] ->force_y ();
-			x = atoms [i] ->force_x ();
-			y = atoms [i] ->force_y ();	
-			f += x*x + y*y;
-		//	std::cerr << atoms[i] ->force_x () << "  " << atoms[i] -> force_y () << std::endl;
-
-			atoms [i] ->force_x () = 0;
-			atoms [i] ->force_y () = 0;
-			
-
+			x[i] += forceX[i];
+			y[i] += forceY[i];
+			f += forceX[i]*forceX[i] + forceY[i]*forceY[i];
+			forceX[i] = 0;
+			forceY[i] = 0;
 		}
 
 		return (f > 0.0005);
 	}
 	void Minimise::finalise () {
 		for (unsigned int i = 0; i < atoms.size (); i++) {
-			QPointF point (atoms[i]->x(), atoms[i]->y());
-			atoms[i] ->atom ->setPos (point);
+			QPointF point (x[i], y[i]);
+			atoms[i] ->setPos (point);
 		}
 	}
 	void Minimise::finaliseBest () {
 		for (unsigned int i = 0; i < atoms.size (); i++) {
-			QPointF point (atoms[i]->xbest(), atoms[i]->ybest());
-			atoms[i] ->atom ->setPos (point);
+			QPointF point (bestX[i], bestY[i]);
+			atoms[i] ->setPos (point);
 		}
 	}
 	
@@ -23,6 +23,8 @@
 
 #define KSTRETCH 0.2
 #define KCLASH 1
+// the clashes are listed up to (0.75 + CLASH_SKIN) bond lengths apart
+#define CLASH_SKIN 0.5
 #define ELONGATION_INCREMENT -5
 #define KXSIZE -0.1
 
@@ -40,6 +42,10 @@
 #include <assert.h>
 #include <cmath>
 #include <cfloat>
+#include <vector>
+
+#include <QAtomicInt>
+#include <QList>
 
 
 #ifndef M_PI
@@ -371,14 +377,150 @@ namespace Molsketch {
 
 	};
 	
+	/**
+	 * The force field and the poses of a Minimise, which the chains of a search
+	 * copy from it, see Minimise::startChains ().
+	 */
+	struct MinimiseData {
+		MinimiseData (qreal bl) : bondLength (bl), m_scoresValid (false), m_deltaValid (false), visitMark (0), m_connected (true) {}
+
+		qreal bestScore;
+		qreal bondLength;
+
+		std::vector <Atom *> atoms;
+		std::vector <qreal> x, y;
+		std::vector <qreal> forceX, forceY;
+		std::vector <qreal> bestX, bestY;
+
+		//a stretch and an orientation for each bond
+		std::vector <Bond *> bonds;
+		std::vector <int> bondBegin, bondEnd;
+		std::vector <bool> bondInRing;
+		//a bend for each pair of neighbours of angleCenter
+		std::vector <int> angleBegin, angleCenter, angleEnd;
+		// The clashes are only kept for the pairs of atoms within the clash
+		// cutoff plus a skin, so they grow linearly with the number of atoms.
+		std::vector <int> clashBegin, clashEnd;
+
+		/** The indices of the bonded neighbours of each atom. */
+		std::vector <std::vector <int> > neighbours;
+		/** The positions of the atoms when the clashes were built. */
+		std::vector <qreal> clashX, clashY;
+		/** Scratch arrays for the forces of the terms, and the second force of a bend. */
+		std::vector <qreal> termForceX, termForceY;
+		std::vector <qreal> bendForceX, bendForceY;
+		/** The atoms of the rings, with their positions on a regular ring. */
+		std::vector <int> ringAtoms;
+		std::vector <qreal> ringX, ringY;
+
+		/** The atoms that moved since the best pose, see mutatedScore (). */
+		std::vector <int> movedAtoms;
+		std::vector <bool> isMoved;
+		/** The bonds of each atom. */
+		std::vector <std::vector <int> > atomBonds;
+		/**
+		 * The score of the best pose, valid from resetScores () on until the
+		 * atoms are moved other than by mutate (), restoreMoved () or
+		 * loadBestPose ().
+		 */
+		bool m_scoresValid;
+		qreal m_poseScore, m_poseElongation;
+		/**
+		 * The change of the bond and clash terms since the best pose, from the
+		 * mirrors of mutate (), and the number of atoms these mirrors moved.
+		 * Not valid after a move that was not scored. The sums and the grid
+		 * below only follow the current pose while it is valid.
+		 */
+		bool m_deltaValid;
+		qreal m_scoreDelta;
+		unsigned int m_scoredMoves;
+		/** The sums of the coordinates relative to m_originX/Y, for the elongation. */
+		qreal m_originX, m_originY;
+		qreal m_sumX, m_sumXX, m_sumY, m_sumYY;
+		qreal m_bestSumX, m_bestSumXX, m_bestSumY, m_bestSumYY;
+		/**
+		 * The atoms of the current pose hashed by their cell, with cells as
+		 * large as the clash cutoff: gridHead holds the first atom of each
+		 * bucket and gridNext the next atom in the same bucket, or -1.
+		 */
+		std::vector <int> gridHead, gridNext;
+		std::vector <qint64> gridCell;
+		/** Scratch data of mirror () and local_score (). */
+		std::vector <int> sideA, sideB, mirrored, found;
+		std::vector <unsigned int> visitMarks;
+		unsigned int visitMark;
+		/** Whether all atoms are connected, see mirror (). */
+		bool m_connected;
+	};
+	
+
 	//class to adjust the geometry of 2D molecules and scenes
-	class Minimise  {
+	//
+	//The force field is kept as arrays: the coordinates and forces of the atoms
+	//and the atom indices of each kind of term. The terms are evaluated in one
+	//loop per kind, which first computes the forces of all terms into scratch
+	//arrays without branches or calls, and then adds them to the atoms. The
+	//FF classes above compute the same terms one object at a time.
+	class Minimise : private MinimiseData {
 	public:
-		Minimise (qreal bl=40) : bondLength (bl) { srand((unsigned)time(0)); };
+		/**
+		 * The random numbers of mutate () are seeded from the time, see
+		 * setSeed ().
+		 */
+		Minimise (qreal bl=40) : MinimiseData (bl), m_cancelled (0), m_cancelFlag (&m_cancelled) { setSeed ((quint32)time(0)); };
 		~Minimise () {clear ();}
+		/**
+		 * Seed the random numbers of mutate (). The search gives the same result
+		 * for the same seed and number of chains.
+		 */
+		void setSeed (quint32 seed);
+		/**
+		 * Copy the positions, bonds and rings of @p molecule. The other methods,
+		 * up to finalise () or finaliseBest (), only use this copy, so they can
+		 * run in another thread while the molecule stays on the scene.
+		 */
 		void initialise (Molecule *molecule);
 		void minimiseMolecule (Molecule *molecule);
 		void conformationalSearchMolecule (Molecule *molecule);
+		/**
+		 * The search of conformationalSearchMolecule () on the initialised
+		 * molecule: startSearch () and @p n searchStep () calls.
+		 */
+		void conformationalSearch (int n = 500);
+		/**
+		 * The search with @p chains independent chains of mutations on the
+		 * global QThreadPool, of @p n / @p chains steps each. The best pose of
+		 * all chains is kept.
+		 */
+		void conformationalSearch (int n, int chains);
+		void startSearch ();
+		/**
+		 * Start @p count chains from the current best pose, each with its own
+		 * seed derived from the seed of this search. Call after startSearch ().
+		 */
+		void startChains (int count);
+		/**
+		 * Run @p n searchStep () calls in each chain, in parallel, and keep the
+		 * best pose of the chains if it is better.
+		 *
+		 * @return true if the best pose changed.
+		 */
+		bool chainSteps (int n);
+		/**
+		 * Mirror some bonds of the best pose and keep the result if it scores
+		 * better.
+		 *
+		 * @return true if the best pose changed.
+		 */
+		bool searchStep ();
+		/** The best pose, in the order of Molecule::atoms (). */
+		QList <QPointF> bestPositions () const;
+		/**
+		 * Make run () and conformationalSearch () return as soon as possible.
+		 * Can be called from any thread.
+		 */
+		void cancel () {m_cancelled = 1;}
+		bool isCancelled () const {return *m_cancelFlag != 0;}
 		void mirrorBondInMolecule (Molecule *molecule, Bond *bo);
 		void run (int n = 500);
 		void mutate ();
@@ -392,37 +534,110 @@ namespace Molsketch {
 		bool move_atoms ();
 		qreal total_score ();
 		qreal elongation_score ();
+		qreal clash_score ();
+		/**
+		 * @return The total_score () of the current pose, from the score of the
+		 * best pose and the change that each mirror of mutate () made to the
+		 * terms of the atoms it moved. The cost grows with the number of moved
+		 * atoms, not with the size of the molecule. Once the mirrors moved more
+		 * atoms than the molecule has, or after a rotation, the total_score ()
+		 * is taken, which is cheaper by then.
+		 */
+		qreal mutatedScore ();
 		
 
 	private:
-		void fixRings (Molecule *mol);
-
-		void mirror (FFAtom *at1, FFAtom*at2);
+		Q_DISABLE_COPY (Minimise)
+		/**
+		 * A chain of @p search, see startChains (): a copy of its force field
+		 * and poses, seeded with @p seed. The chain has no chains of its own
+		 * and shares the cancel flag of @p search.
+		 */
+		Minimise (const Minimise &search, quint32 seed);
+
+		void fixRings ();
+		/** @return A random number in [0, 1). */
+		qreal random ();
+		void deleteChains ();
+
+		void mirror (int bond);
+		/** Add the atoms reached from the end of @p side to @p side, for mirror (). */
+		void visitSide (std::vector <int> &side, unsigned int &head, unsigned int mark, bool all);
 		void rotate (qreal angle, QPointF center);
-		void mirrorAtom (FFAtom *a, FFAtom *at1, FFAtom *at2);
-		qreal bestScore;
-		qreal bondLength;
-		void clear() {
-			for (unsigned int i=0; i < atoms.size (); i++) delete atoms[i];
-			for (unsigned int i=0; i < bonds.size (); i++) delete bonds[i];
-
-			for (unsigned int i=0; i < interactions.size (); i++) delete interactions[i];	
-			for (unsigned int i=0; i < rotations.size (); i++) delete rotations[i];	
+		void mirrorAtom (int a, const QPointF &p1, const QPointF &p2);
+		/** Move atom @p a to (@p nx, @p ny), keeping the grid and the sums up to date. */
+		void moveAtom (int a, qreal nx, qreal ny);
+
+		//the incremental scores of mutatedScore ()
+		/** Note that mutate () moved atom @p a away from its best position. */
+		void markMoved (int a);
+		/** Move the atoms that mutate () moved back to their best position. */
+		void restoreMoved ();
+		/** Score the best pose, which must be the current pose, and hash its atoms. */
+		void resetScores ();
+		/**
+		 * @return The bond and clash terms of the atoms in @p set, which have
+		 * visit mark @p mark, each term once.
+		 */
+		qreal local_score (const std::vector <int> &set, unsigned int mark);
+		//the grid of the atoms, see gridHead
+		void buildGrid ();
+		int gridBucket (qint64 key) const;
+		void gridInsert (int a);
+		void gridRemove (int a);
+		/** Put the atoms in the cells around (@p px, @p py) in found. */
+		void gridFind (qreal px, qreal py);
+		/** @return true for 1-2 and 1-3 pairs, which do not clash. */
+		bool excluded (int i, int j) const;
+		/**
+		 * Rebuild the clashes from a cell list if an atom moved more than half
+		 * the skin since they were built, or if @p force is true.
+		 */
+		void update_clashes (bool force = false);
+
+		//the terms, see FFBondstretch, FFAngleBend, FFclash and FFBondorient
+		void apply_stretches ();
+		void apply_bends ();
+		void apply_clashes ();
+		void apply_orientations ();
+		qreal stretch_score ();
+		qreal orientation_score ();
+		qreal stretch_term (int bond) const;
+		qreal orientation_term (int bond) const;
+		/** Add the forces in termForceX/Y to atoms @p first and subtract them from atoms @p second. */
+		void add_forces (const std::vector <int> &first, const std::vector <int> &second);
+
+		/** The position of atom @p i, truncated like FFAtom::qpoint (). */
+		QPoint qpoint (int i) const {return QPoint (x[i], y[i]);}
 
+		void clear() {
 			atoms.clear ();
+			x.clear (); y.clear ();
+			forceX.clear (); forceY.clear ();
+			bestX.clear (); bestY.clear ();
 			bonds.clear ();
-			interactions.clear ();
-			rotations.clear ();
+			bondBegin.clear (); bondEnd.clear (); bondInRing.clear ();
+			angleBegin.clear (); angleCenter.clear (); angleEnd.clear ();
+			clashBegin.clear (); clashEnd.clear ();
+			neighbours.clear ();
+			clashX.clear (); clashY.clear ();
+			ringAtoms.clear (); ringX.clear (); ringY.clear ();
+			movedAtoms.clear (); isMoved.clear ();
+			atomBonds.clear ();
+			gridHead.clear (); gridNext.clear (); gridCell.clear ();
+			visitMarks.clear ();
+			m_scoresValid = false;
+			deleteChains ();
 		}
 			
-		std::vector <FFAtom *> atoms;
-		std::vector <FFBond *> bonds;
-
-		std::vector <FFInteraction *> interactions;
-		std::vector <FFInteraction *> rotations;
-
-		
-		
+		QAtomicInt m_cancelled;
+		/** The flag of the search the chain belongs to, or else m_cancelled. */
+		const QAtomicInt *m_cancelFlag;
+		/** The state of the xorshift generator of random (). */
+		quint32 m_random;
+		quint32 m_seed;
+		/** The chains of conformationalSearch (), which share our m_cancelFlag. */
+		QList <Minimise *> m_chains;
 	};
 	
 	
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QMetaType>
+#include <QTime>
+
+#include "minimisethread.h"
+
+#include "minimise.h"
+#include "molecule.h"
+
+namespace Molsketch {
+
+  MinimiseThread::MinimiseThread(Molecule *molecule, qreal bondLength, int iterations, QObject *parent)
+      : QThread(parent), m_minimise(new Minimise(bondLength)), m_molecule(molecule), m_iterations(iterations),
+      m_chains(QThread::idealThreadCount()), m_maximumFrameRate(20)
+  {
+    // the poses are sent to the GUI thread in queued connections
+    qRegisterMetaType<QList<QPointF> >("QList<QPointF>");
+    m_minimise->initialise(molecule);
+  }
+
+  MinimiseThread::~MinimiseThread()
+  {
+    cancel();
+    wait();
+    delete m_minimise;
+  }
+
+  bool MinimiseThread::isCancelled() const
+  {
+    return m_minimise->isCancelled();
+  }
+
+  void MinimiseThread::setSeed(quint32 seed)
+  {
+    m_minimise->setSeed(seed);
+  }
+
+  void MinimiseThread::cancel()
+  {
+    m_minimise->cancel();
+  }
+
+  void MinimiseThread::run()
+  {
+    m_minimise->startSearch();
+    if (m_chains > 1)
+      m_minimise->startChains(m_chains);
+    QTime frame;
+    frame.start();
+    bool changed = true;
+    int steps = (m_iterations + m_chains - 1) / m_chains;
+    // rounds of several steps, so the chains that take longer even out
+    int round = (m_chains > 1) ? qMax(1, steps / 20) : 1;
+    for (int i = 0; (i < steps) && !m_minimise->isCancelled(); i += round) {
+      int n = qMin(round, steps - i);
+      if (m_chains > 1)
+        changed = m_minimise->chainSteps(n) || changed;
+      else
+        changed = m_minimise->searchStep() || changed;
+      emit progress(i + n, steps);
+      if (changed && (frame.elapsed() >= 1000 / m_maximumFrameRate)) {
+        emit poseChanged(m_minimise->bestPositions());
+        changed = false;
+        frame.restart();
+      }
+    }
+    m_positions = m_minimise->bestPositions();
+  }
+
+} // namespace
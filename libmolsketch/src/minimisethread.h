@@ -0,0 +1,143 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_MINIMISETHREAD_H
+#define MSK_MINIMISETHREAD_H
+
+#include <QList>
+#include <QPointF>
+#include <QThread>
+
+namespace Molsketch {
+
+  class Minimise;
+  class Molecule;
+
+  /**
+   * Runs the conformational search of Minimise on a worker thread, so the 2D
+   * clean-up does not block the GUI. The search runs chains() independent
+   * chains of mutations on the global QThreadPool, one per core by default.
+   *
+   * The constructor takes a copy of the atom positions and bonds of the
+   * molecule; the thread itself never touches the molecule. Progress is
+   * reported after each step of the search, and the best pose so far is sent
+   * with poseChanged() at most maximumFrameRate() times a second, so it can
+   * be shown on the scene while the search runs. After finished(),
+   * positions() has the result.
+   */
+  class MinimiseThread : public QThread
+  {
+    Q_OBJECT
+
+    public:
+      /**
+       * Creates a search of @p iterations steps for @p molecule, with bonds
+       * of @p bondLength. The steps are divided over the chains. Must be
+       * called in the thread of the molecule.
+       */
+      MinimiseThread(Molecule *molecule, qreal bondLength = 40, int iterations = 500, QObject *parent = 0);
+      /**
+       * Cancels the search and waits for it to stop.
+       */
+      ~MinimiseThread();
+
+      /**
+       * @return The molecule that is cleaned up.
+       */
+      Molecule* molecule() const
+      {
+        return m_molecule;
+      }
+      /**
+       * @return The number of steps of the search.
+       */
+      int iterations() const
+      {
+        return m_iterations;
+      }
+      int chains() const
+      {
+        return m_chains;
+      }
+      /**
+       * Set the number of chains of the search. Call before start().
+       */
+      void setChains(int chains)
+      {
+        m_chains = qMax(1, chains);
+      }
+      /**
+       * Seed the search, so it gives the same result each time. Call before
+       * start().
+       */
+      void setSeed(quint32 seed);
+      int maximumFrameRate() const
+      {
+        return m_maximumFrameRate;
+      }
+      void setMaximumFrameRate(int fps)
+      {
+        m_maximumFrameRate = qMax(1, fps);
+      }
+      /**
+       * @return The best pose, in the order of Molecule::atoms(). Only valid
+       * after the thread finished.
+       */
+      QList<QPointF> positions() const
+      {
+        return m_positions;
+      }
+      /**
+       * @return @c true if cancel() was called.
+       */
+      bool isCancelled() const;
+
+    public slots:
+      /**
+       * Stop the search as soon as possible. The best pose so far is kept in
+       * positions().
+       */
+      void cancel();
+
+    signals:
+      /**
+       * Emitted when @p done of the @p total steps of each chain are done.
+       */
+      void progress(int done, int total);
+      /**
+       * Emitted when the search found a better pose, at most
+       * maximumFrameRate() times a second.
+       */
+      void poseChanged(const QList<QPointF> &positions);
+
+    protected:
+      void run();
+
+    private:
+      Minimise *m_minimise;
+      Molecule *m_molecule;
+      int m_iterations;
+      int m_chains;
+      int m_maximumFrameRate;
+      QList<QPointF> m_positions;
+  };
+
+} // namespace
+
+#endif
@@ -43,8 +43,18 @@ namespace Molsketch {
   Molecule::Molecule(QGraphicsItem* parent, MolScene* scene) : QGraphicsItemGroup(parent,scene)
   {
     m_electronSystemsUpdate = true;
+    m_batchDepth = 0;
+    m_ringsOutdated = false;
+    m_geometryOutdated = false;
+    m_collapsed = false;
+    m_bondPathsValid = false;
+    m_cacheIdle = false;
+    m_cached = false;
     // Setting properties
     setFlags(QGraphicsItem::ItemIsFocusable);
+#if QT_VERSION >= 0x040600
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges);
+#endif
     setAcceptedMouseButtons(Qt::LeftButton|Qt::MidButton);
     setAcceptsHoverEvents(true);
     setHandlesChildEvents(false);
@@ -56,53 +66,50 @@ namespace Molsketch {
                      QGraphicsItem* parent, MolScene* scene) : QGraphicsItemGroup(parent,scene)
   {
     m_electronSystemsUpdate = true;
+    m_batchDepth = 0;
+    m_ringsOutdated = false;
+    m_geometryOutdated = false;
+    m_collapsed = false;
+    m_bondPathsValid = false;
+    m_cacheIdle = false;
+    m_cached = false;
     // Setting properties
     setFlags(QGraphicsItem::ItemIsFocusable);
+#if QT_VERSION >= 0x040600
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges);
+#endif
     setAcceptedMouseButtons(Qt::LeftButton|Qt::MidButton);
     setAcceptsHoverEvents(true);
     setHandlesChildEvents(false);
     if (scene) setFlag(QGraphicsItem::ItemIsSelectable, scene->editMode()==MolScene::MoveMode);
 
-    // Add the new atoms
-    foreach(Atom* atom, atomSet) {
-      Atom *a = new Atom(atom->scenePos(), atom->element(), atom->hasImplicitHydrogens(), this);
-      a ->setColor (atom ->getColor ());
-      addAtom(a);
-    }
-
-    // ...and bonds
-    foreach(Bond* bond, bondSet) {
-      Bond *b = new Bond(atomAt(bond->beginAtom()->scenePos()),atomAt(bond->endAtom()->scenePos()),bond->bondOrder(),bond->bondType());
-      b ->setColor (bond ->getColor ());
-      addBond(b);
-    }
+    // Add the new atoms and bonds
+    addCopies(atomSet.toList(), bondSet.toList(), true);
   }
 
   Molecule::Molecule(Molecule* mol, QGraphicsItem* parent, MolScene* scene) : QGraphicsItemGroup(parent,scene)
   {
     m_electronSystemsUpdate = true;
+    m_batchDepth = 0;
+    m_ringsOutdated = false;
+    m_geometryOutdated = false;
+    m_collapsed = false;
+    m_bondPathsValid = false;
+    m_cacheIdle = false;
+    m_cached = false;
     // Setting properties
     setFlags(QGraphicsItem::ItemIsFocusable);
+#if QT_VERSION >= 0x040600
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges);
+#endif
     setAcceptedMouseButtons(Qt::LeftButton|Qt::MidButton);
     setAcceptsHoverEvents(true);
     setHandlesChildEvents(false);
     if (scene)
       setFlag(QGraphicsItem::ItemIsSelectable, scene->editMode()==MolScene::MoveMode);
 
-    // Add the new atoms
-    foreach(Atom* atom, mol->atoms())
-    {
-      Atom *a = new Atom(atom->pos(),atom->element(), atom->hasImplicitHydrogens(), this);
-      a ->setColor(atom ->getColor ());
-      addAtom(a);
-    }
-    // ...and bonds
-    foreach(Bond* bond, mol->bonds())
-    {
-      Bond *b = new Bond(atomAt(bond->beginAtom()->pos()),atomAt(bond->endAtom()->pos()),bond->bondOrder(),bond->bondType());
-      b ->setColor (bond ->getColor ());
-      addBond(b);
-    }
+    // Add the new atoms and bonds
+    addCopies(mol->atoms(), mol->bonds(), false);
 
     // Set the position
     setPos(mol->pos());
@@ -115,6 +122,52 @@ namespace Molsketch {
     }
   }
 
+  // Batches
+
+  void Molecule::beginBatch()
+  {
+    ++m_batchDepth;
+  }
+
+  void Molecule::endBatch()
+  {
+    Q_ASSERT(m_batchDepth > 0);
+    if (--m_batchDepth > 0)
+      return;
+
+    // do the deferred work once
+    QSet<Atom*> labels = m_outdatedLabels;
+    m_outdatedLabels.clear();
+    foreach (Atom *atom, labels)
+      atom->layoutLabel();
+    if (m_ringsOutdated) {
+      m_ringsOutdated = false;
+      perceiveRings();
+    }
+    if (m_geometryOutdated) {
+      m_geometryOutdated = false;
+      rebuild();
+    }
+  }
+
+  void Molecule::invalidateRings()
+  {
+    if (m_batchDepth) {
+      m_ringsOutdated = true;
+      return;
+    }
+    perceiveRings();
+  }
+
+  void Molecule::invalidateLabel(Atom *atom)
+  {
+    if (m_batchDepth) {
+      m_outdatedLabels.insert(atom);
+      return;
+    }
+    atom->layoutLabel();
+  }
+
   // Manipulation methods
 
   Atom* Molecule::addAtom(const QString &element, const QPointF &point, bool implicitHydrogen, QColor c)
@@ -135,6 +188,8 @@ namespace Molsketch {
 
     // Add the atom to the molecule
     m_atomList.append(atom);
+    if (!m_atomBonds.contains(atom))
+      m_atomBonds.insert(atom, QList<Bond*>());
     addToGroup(atom);
     if (scene ()) {
       atom ->setColor (dynamic_cast<MolScene *> (scene ()) ->color());
@@ -142,7 +197,7 @@ namespace Molsketch {
 
     //  /// Work-around qt-bug
     //   if (scene()) scene()->addItem(atom);
-    m_electronSystemsUpdate = true;
+    invalidateElectronSystems(atom);
 
     return atom;
   }
@@ -150,8 +205,8 @@ namespace Molsketch {
   Bond* Molecule::addBond(Atom* atomA, Atom* atomB, int order, int type, QColor c)
   {
     //pre: atomA and atomB are existing different atoms in the molecule
-    Q_ASSERT (m_atomList.contains(atomA));
-    Q_ASSERT (m_atomList.contains(atomB));
+    Q_ASSERT (m_atomBonds.contains(atomA));
+    Q_ASSERT (m_atomBonds.contains(atomB));
     //Q_ASSERT (atomA != atomB);
     if (atomA == atomB)
       return 0;
@@ -169,14 +224,19 @@ namespace Molsketch {
     //pre(1): bond is a valid pointer to a bond
     Q_CHECK_PTR(bond);
     //pre(2): the bond is between two atoms of this molecule
-    Q_ASSERT(m_atomList.contains(bond->beginAtom()));
-    Q_ASSERT(m_atomList.contains(bond->endAtom()));
+    Q_ASSERT(m_atomBonds.contains(bond->beginAtom()));
+    Q_ASSERT(m_atomBonds.contains(bond->endAtom()));
 
     if (scene ())	bond ->setColor (dynamic_cast<MolScene *> (scene ()) ->color());
     // Checking if and altering when a bond exists
     Bond* bondX = bondBetween(bond->beginAtom(), bond->endAtom());
     if (bondX) {
-      delete bond;
+      if (bondX != bond) {
+        // don't leave a dangling pointer in the bond lists of the atoms
+        bond->beginAtom()->removeBond(bond);
+        bond->endAtom()->removeBond(bond);
+        delete bond;
+      }
       if (scene ())	bondX ->setColor (dynamic_cast<MolScene *> (scene ()) ->color());
       return bondX;
     }
@@ -191,33 +251,39 @@ namespace Molsketch {
 
     // Adding the bond the the molecule
     m_bondList.append(bond);
+    indexBond(bond);
     addToGroup(bond);
+    invalidateBondPaths();
 
     //  /// Work-around qt-bug
     //  if (scene()) scene()->addItem(bond);
 
-    m_electronSystemsUpdate = true;
-    perceiveRings();
+    invalidateElectronSystems(bond->beginAtom());
+    invalidateElectronSystems(bond->endAtom());
+    invalidateRings();
     return bond;
   }
 
   QList<Bond*> Molecule::delAtom(Atom* atom)
   {
     //pre: atom is an existing atom in the molecule
-    Q_ASSERT(m_atomList.contains(atom));
+    Q_ASSERT(m_atomBonds.contains(atom));
 
     //post: atom has been removed from the molecule and all bonds to this atom have been removed
     //ret: the former bonds of this atom
 
     // Remove all connected bonds from the molecule
     QList<Bond*> delList = bonds(atom);
+    invalidateElectronSystems(atom);
     foreach(Bond* bond, delList) {
+      invalidateElectronSystems(bond->otherAtom(atom));
       //delBond(bond);
       Q_ASSERT(m_bondList.contains(bond));
       m_bondList.removeAll(bond);
+      unindexBond(bond);
       removeFromGroup(bond);
       Atom *begin = bond->beginAtom();
-      Atom *end = bond->beginAtom();
+      Atom *end = bond->endAtom();
       if (begin)
         begin->removeBond(bond);
       if (end)
@@ -228,11 +294,17 @@ namespace Molsketch {
 
     // Remove the atom
     m_atomList.removeAll(atom);
+    m_atomBonds.remove(atom);
+    if (m_outdatedLabels.remove(atom))
+      atom->layoutLabel();
     removeFromGroup(atom);
     if (scene())
       scene()->removeItem(atom);
 
-    m_electronSystemsUpdate = true;
+    if (!delList.isEmpty()) {
+      invalidateBondPaths();
+      invalidateRings();
+    }
     // Return the list of bonds that were connected for undo
     return delList;
   }
@@ -246,7 +318,7 @@ namespace Molsketch {
     //post: bond has been removed from the molecule
 
     Atom *begin = bond->beginAtom();
-    Atom *end = bond->beginAtom();
+    Atom *end = bond->endAtom();
     if (begin)
       begin->removeBond(bond);
     if (end)
@@ -254,12 +326,17 @@ namespace Molsketch {
 
     // Removing the bond
     m_bondList.removeAll(bond);
+    unindexBond(bond);
     removeFromGroup(bond);
+    invalidateBondPaths();
     if (scene()) 
       scene()->removeItem(bond);
 
-    m_electronSystemsUpdate = true;
-    perceiveRings();
+    if (begin)
+      invalidateElectronSystems(begin);
+    if (end)
+      invalidateElectronSystems(end);
+    invalidateRings();
     //  bond->undoValency();
     //  /// Superseded by undo
     //delete bond;
@@ -269,57 +346,153 @@ namespace Molsketch {
   QList<Molecule*> Molecule::split()
   {
     //pre: CanSplit
-    //post:
-    //ret: a list with the two parts of the split molecule
+    //post: the atoms and bonds have been moved to the new molecules
+    //ret: a list with the parts of the split molecule
 
-    // Create the return list
-    QList<Molecule*> molList;
+    QHash<const Atom*, int> components;
+    int numComponents = labelComponents(&components);
 
-    // Create sets with the bonds and molcules
-    QSet<Atom*> atomSet(m_atomList.toSet());
-    QSet<Bond*> bondSet(m_bondList.toSet());
-    QSet<Atom*> atomSubSet;
-    QSet<Bond*> bondSubSet;
+    // Sort the atoms and bonds by component, keeping their order
+    QVector<QList<Atom*> > atomLists(numComponents);
+    QVector<QList<Bond*> > bondLists(numComponents);
+    foreach (Atom *atom, m_atomList)
+      atomLists[components.value(atom)].append(atom);
+    foreach (Bond *bond, m_bondList)
+      bondLists[components.value(bond->beginAtom())].append(bond);
 
-    // Declarations
-    int lastSize;
-    Atom* atom;
-    Bond* bond;
+    // Move them to the new molecules
+    releaseAtomsAndBonds();
+    QList<Molecule*> molList;
+    for (int i = 0; i < numComponents; ++i) {
+      Molecule *mol = new Molecule;
+      mol->addAtomsAndBonds(atomLists.at(i), bondLists.at(i));
+      molList.append(mol);
+    }
 
-    // Main loop
-    while (!atomSet.isEmpty())
-    {
-      lastSize = 0;
-      atomSubSet.clear();
-      bondSubSet.clear();
+    return molList;
+  }
 
-      // Load the first atom
-      atomSubSet << atomSet.toList().first();
+  void Molecule::addAtomsAndBonds(const QList<Atom*> &atoms, const QList<Bond*> &bonds)
+  {
+    Batch batch(this);
+    foreach (Atom *atom, atoms)
+      addAtom(atom);
+    foreach (Bond *bond, bonds)
+      addBond(bond);
+  }
 
-      while (atomSubSet.size() != lastSize)
-      {
-        lastSize = atomSubSet.size();
-        foreach (atom,atomSubSet)
-        {
-          foreach(bond,bondSet)
-            if (bond->hasAtom(atom)) bondSubSet << bond;
-          foreach(bond,bondSubSet)
-            atomSubSet << bond->beginAtom() << bond->endAtom();
-        }
-      }
+  QHash<const Atom*, Atom*> Molecule::addCopies(const QList<Atom*> &atoms, const QList<Bond*> &bonds, bool scenePositions)
+  {
+    QHash<const Atom*, Atom*> copies;
+    copies.reserve(atoms.size());
+    QList<Atom*> newAtoms;
+    foreach (Atom *atom, atoms) {
+      Atom *a = new Atom(scenePositions ? atom->scenePos() : atom->pos(), atom->element(), atom->hasImplicitHydrogens());
+      a->setColor(atom->getColor());
+      copies.insert(atom, a);
+      newAtoms.append(a);
+    }
+
+    // map the bonds to the copies directly, atoms sharing a position are kept apart
+    QList<Bond*> newBonds;
+    foreach (Bond *bond, bonds) {
+      Atom *begin = copies.value(bond->beginAtom());
+      Atom *end = copies.value(bond->endAtom());
+      if (!begin || !end || begin == end)
+        continue;
+      Bond *b = new Bond(begin, end, bond->bondOrder(), bond->bondType());
+      b->setColor(bond->getColor());
+      newBonds.append(b);
+    }
 
-      atomSet -= atomSubSet;
-      bondSet -= bondSubSet;
+    addAtomsAndBonds(newAtoms, newBonds);
+    return copies;
+  }
 
-      molList.append(new Molecule(atomSubSet,bondSubSet));
+  void Molecule::releaseAtomsAndBonds()
+  {
+    // the atoms leave the batch
+    foreach (Atom *atom, m_outdatedLabels)
+      atom->layoutLabel();
+    m_outdatedLabels.clear();
+    m_ringsOutdated = false;
+    m_geometryOutdated = false;
 
+    foreach (Bond *bond, m_bondList) {
+      bond->setRing(0);
+      removeFromGroup(bond);
     }
+    foreach (Atom *atom, m_atomList)
+      removeFromGroup(atom);
 
-    return molList;
+    m_atomList.clear();
+    m_bondList.clear();
+    m_atomBonds.clear();
+    m_bondIndex.clear();
+    m_bondPaths.clear();
+    invalidateBondPaths();
 
+    foreach (Ring *ring, m_rings)
+      delete ring;
+    m_rings.clear();
+    foreach (ElectronSystem *es, m_electronSystems)
+      delete es;
+    m_electronSystems.clear();
+    m_electronSystemsUpdate = true;
+    m_outdatedElectronSystems.clear();
   }
 
+  /**
+   * Helper function for union-find: get the root of @p i and halve the path to it.
+   */
+  static inline int findRoot(QVector<int> &parent, int i)
+  {
+    while (parent.at(i) != i) {
+      parent[i] = parent.at(parent.at(i));
+      i = parent.at(i);
+    }
+    return i;
+  }
+
+  int Molecule::labelComponents(QHash<const Atom*, int> *components) const
+  {
+    int numAtoms = m_atomList.size();
+
+    QHash<const Atom*, int> index;
+    index.reserve(numAtoms);
+    for (int i = 0; i < numAtoms; ++i)
+      index.insert(m_atomList.at(i), i);
+
+    // join the atoms of each bond, the root is always the lowest index
+    QVector<int> parent(numAtoms);
+    for (int i = 0; i < numAtoms; ++i)
+      parent[i] = i;
+    foreach (Bond *bond, m_bondList) {
+      int a = findRoot(parent, index.value(bond->beginAtom()));
+      int b = findRoot(parent, index.value(bond->endAtom()));
+      if (a < b)
+        parent[b] = a;
+      else if (b < a)
+        parent[a] = b;
+    }
+
+    // number the components
+    QVector<int> label(numAtoms, -1);
+    int numComponents = 0;
+    if (components) {
+      components->clear();
+      components->reserve(numAtoms);
+    }
+    for (int i = 0; i < numAtoms; ++i) {
+      int root = findRoot(parent, i);
+      if (label.at(root) < 0)
+        label[root] = numComponents++;
+      if (components)
+        components->insert(m_atomList.at(i), label.at(root));
+    }
 
+    return numComponents;
+  }
 
   // Query methods
 
@@ -493,50 +666,23 @@ namespace Molsketch {
 
   bool Molecule::canSplit() const
   {
-    /// TODO Needs improvement
-    // Create the return list
-    QList<Molecule*> molList;
-
-    // Return false if molecule is empty
-    if (m_atomList.isEmpty()) return false;
-    // Create sets with the bonds and molcules
-    QSet<Atom*> atomSet(m_atomList.toSet());
-    QSet<Bond*> bondSet(m_bondList.toSet());
-    QSet<Atom*> atomSubSet;
-    QSet<Bond*> bondSubSet;
-
-    // Declarations
-    int lastSize = 0;
-    Atom* atom;
-    Bond* bond;
-
-    atomSubSet.clear();
-    bondSubSet.clear();
-
-    // Load the first atom
-    atomSubSet << atomSet.toList().first();
-
-    while (atomSubSet.size() != lastSize)
-    {
-      foreach (atom,atomSubSet)
-      {
-        lastSize = atomSubSet.size();
-        foreach(bond,bondSet)
-          if (bond->hasAtom(atom)) bondSubSet << bond;
-        foreach(bond,bondSubSet)
-          atomSubSet << bond->beginAtom() << bond->endAtom();
-      }
-    }
-
-    atomSet -= atomSubSet;
-    bondSet -= bondSubSet;
-
-    return !atomSet.isEmpty();
+    return labelComponents() > 1;
   }
 
   QVariant Molecule::itemChange(GraphicsItemChange change, const QVariant &value)
   {
     if (change == ItemTransformHasChanged) rebuild();
+    if (change == ItemSelectedHasChanged) invalidateCache();
+    // the views of another scene are not watched
+    if (change == ItemSceneHasChanged) {
+      invalidateCache();
+      m_collapsedViews.clear();
+    }
+
+    // the atoms and bonds move along with the molecule
+    if (change == ItemPositionHasChanged || change == ItemTransformHasChanged)
+      foreach (Atom *atom, m_atomList)
+        atom->updateSpatialIndex();
 
     return QGraphicsItem::itemChange(change, value);
   }
@@ -546,6 +692,13 @@ namespace Molsketch {
     //pre: true
     //post: the molecule has been rebuild
 
+    m_lodPixmap = QPixmap();
+    invalidateBondPaths();
+    if (m_batchDepth) {
+      m_geometryOutdated = true;
+      return;
+    }
+
     // Remove and then readd all elements
     prepareGeometryChange();
 
@@ -565,14 +718,47 @@ namespace Molsketch {
   }
 
 
-  Bond* Molecule::bondBetween(Atom* atomA, Atom* atomB) const
+  /**
+   * Helper function to get the key of a bond in the adjacency index. The key
+   * does not depend on the direction of the bond.
+   */
+  static inline QPair<const Atom*, const Atom*> atomPair(const Atom *atomA, const Atom *atomB)
   {
-    //     for (int i = 0; i < countBonds(); i++)
-    foreach(Bond* bond, m_bondList)
-      if (((bond->beginAtom() == atomA) || (bond->beginAtom() == atomB )) && ((bond->endAtom() == atomA) || (bond->endAtom() == atomB )))
-        return bond;
+    return (atomA < atomB) ? qMakePair(atomA, atomB) : qMakePair(atomB, atomA);
+  }
 
-    return 0;
+  void Molecule::indexBond(Bond* bond)
+  {
+    Atom *begin = bond->beginAtom();
+    Atom *end = bond->endAtom();
+
+    m_atomBonds[begin].append(bond);
+    m_atomBonds[end].append(bond);
+    m_bondIndex.insert(atomPair(begin, end), bond);
+
+    // keep the bond lists of the atoms in sync (e.g. when undoing a removal)
+    if (!begin->bonds().contains(bond))
+      begin->addBond(bond);
+    if (!end->bonds().contains(bond))
+      end->addBond(bond);
+  }
+
+  void Molecule::unindexBond(Bond* bond)
+  {
+    const Atom *begin = bond->beginAtom();
+    const Atom *end = bond->endAtom();
+
+    if (m_atomBonds.contains(begin))
+      m_atomBonds[begin].removeAll(bond);
+    if (m_atomBonds.contains(end))
+      m_atomBonds[end].removeAll(bond);
+    if (m_bondIndex.value(atomPair(begin, end)) == bond)
+      m_bondIndex.remove(atomPair(begin, end));
+  }
+
+  Bond* Molecule::bondBetween(const Atom* atomA, const Atom* atomB) const
+  {
+    return m_bondIndex.value(atomPair(atomA, atomB), 0);
   }
 
   // Event handlers
@@ -607,21 +793,71 @@ namespace Molsketch {
   //     return QGraphicsItem::itemChange(change, value);
   // }
 
-  QList< Bond * > Molecule::bonds(const Atom * atom)
+  QList< Bond * > Molecule::bonds(const Atom * atom) const
   {
-    QList<Bond*> bondList;
+    return m_atomBonds.value(atom);
+  }
 
-    foreach(Bond* bond, m_bondList)
-      if (bond->hasAtom(atom)) 
-        bondList << bond;
+  // a molecule collapses below this size in pixels, and expands again above the second one
+  static const qreal collapseBelow = 48.0;
+  static const qreal expandAbove = 64.0;
 
-    return bondList;
+  void Molecule::paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget)
+  {
+    // the data kept for the view is dropped with it, see removeView()
+    if (widget && scene())
+      scene()->watchView(widget);
+
+    // collapse when zoomed out and the molecule is only a few pixels wide
+    QRectF rect = boundingRect();
+    qreal size = qMax(rect.width(), rect.height()) * MolScene::levelOfDetail(option, painter);
+    MolScene::DetailLevel detail = scene() ? scene()->detailLevel(option, painter, widget) : MolScene::FullDetail;
+    if (detail != MolScene::ReducedDetail)
+      m_collapsed = false;
+    else if (!widget)
+      m_collapsed = size < collapseBelow;
+    else
+      // each view zooms on its own, the size is checked against the last state in this view
+      m_collapsed = m_collapsedViews.contains(widget) ? (size <= expandAbove) : (size < collapseBelow);
+    if (widget) {
+      if (m_collapsed)
+        m_collapsedViews.insert(widget);
+      else
+        m_collapsedViews.remove(widget);
+    }
+    m_cached = false;
+    if (m_collapsed && !rect.isEmpty()) {
+      if (m_lodPixmap.isNull())
+        renderLodPixmap();
+      painter->save();
+      painter->setRenderHint(QPainter::SmoothPixmapTransform);
+      painter->drawPixmap(rect, m_lodPixmap, m_lodPixmap.rect());
+      painter->restore();
+      if (isSelected()) {
+        painter->setPen(Qt::blue);
+        painter->drawRect(rect);
+      }
+      return;
+    }
+
+    // in a view, draw the molecule from the cache once it is not edited any more
+    // (exported images are drawn without it); the electron systems are not cached
+    if (widget && scene() && scene()->moleculeCaching() && !scene()->electronSystemsVisible()) {
+      if (m_cacheIdle && drawCache(painter, widget, detail == MolScene::FullDetail)) {
+        m_cached = true;
+        return;
+      }
+      m_cacheIdle = true;
+    }
+
+    paintContents(painter, detail == MolScene::FullDetail);
   }
 
-  void Molecule::paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget)
+  void Molecule::paintContents(QPainter *painter, bool fullDetail)
   {
-    Q_UNUSED(option)
-        Q_UNUSED(widget)
+    // the plain bonds don't draw themselves, see Bond::paint()
+    if (scene() && scene()->batchedBondRendering() && fullDetail)
+      drawBondPaths(painter);
 
         // draw a yellow rectangle if this molecule is selected
         if(isSelected()) {
@@ -745,6 +981,163 @@ namespace Molsketch {
 
   }
   
+  // the largest cache in pixels, zoomed in further the molecule is drawn directly
+  static const int maxCachePixels = 1024 * 1024;
+
+  /**
+   * Helper function to paint @p item and its children with @p painter as the
+   * scene would, for the molecule cache.
+   */
+  static void paintItem(QGraphicsItem *item, QPainter *painter)
+  {
+    if (!item->isVisible())
+      return;
+
+    painter->save();
+    painter->translate(item->pos());
+    painter->setTransform(item->transform(), true);
+    QStyleOptionGraphicsItem option;
+    option.state = item->isSelected() ? QStyle::State_Selected : QStyle::State_None;
+    option.exposedRect = item->boundingRect();
+    option.rect = option.exposedRect.toRect();
+    option.matrix = painter->worldMatrix();
+#if QT_VERSION < 0x040600
+    option.levelOfDetail = MolScene::levelOfDetail(&option, painter);
+#endif
+    item->paint(painter, &option, 0);
+    foreach (QGraphicsItem *child, item->childItems())
+      paintItem(child, painter);
+    painter->restore();
+  }
+
+  void Molecule::invalidateCache()
+  {
+    if (!m_caches.isEmpty() || m_cacheIdle) {
+      m_caches.clear();
+      m_cacheIdle = false;
+      update();
+    }
+  }
+
+  void Molecule::removeView(const QWidget *widget)
+  {
+    m_caches.remove(widget);
+    m_collapsedViews.remove(widget);
+  }
+
+  bool Molecule::drawCache(QPainter *painter, const QWidget *widget, bool fullDetail)
+  {
+    // the cache is drawn without the translation of the view, so it can be scrolled
+    QTransform device = painter->worldTransform();
+    QTransform scale(device.m11(), device.m12(), device.m21(), device.m22(), 0.0, 0.0);
+    Cache &cache = m_caches[widget];
+    if (cache.pixmap.isNull() || (scale != cache.transform) || (fullDetail != cache.fullDetail)) {
+      // leave room for the pens and antialiasing
+      QRect rect = scale.mapRect(boundingRect()).toAlignedRect().adjusted(-2, -2, 2, 2);
+      if (rect.width() * rect.height() > maxCachePixels) {
+        m_caches.remove(widget);
+        return false;
+      }
+
+      cache.pixmap = QPixmap(rect.size());
+      cache.pixmap.fill(Qt::transparent);
+      cache.transform = scale;
+      cache.origin = rect.topLeft();
+      cache.fullDetail = fullDetail;
+
+      QPainter cachePainter(&cache.pixmap);
+      cachePainter.setRenderHints(painter->renderHints());
+      cachePainter.setFont(painter->font());
+      cachePainter.translate(-rect.topLeft());
+      cachePainter.setTransform(scale, true);
+      cachePainter.setPen(painter->pen());
+      cachePainter.setBrush(painter->brush());
+      paintContents(&cachePainter, fullDetail);
+      foreach (QGraphicsItem *child, childItems())
+        paintItem(child, &cachePainter);
+    }
+
+    // align the cache to the pixels
+    QPointF origin = device.map(QPointF(0.0, 0.0));
+    painter->save();
+    painter->setWorldTransform(QTransform());
+    painter->drawPixmap(QPoint(qRound(origin.x()), qRound(origin.y())) + cache.origin, cache.pixmap);
+    painter->restore();
+    return true;
+  }
+
+  void Molecule::renderLodPixmap()
+  {
+    // the pixmap is never shown larger than expandAbove pixels
+    QRectF rect = boundingRect();
+    qreal scale = expandAbove / qMax(rect.width(), rect.height());
+    m_lodPixmap = QPixmap(qMax(1, int(ceil(rect.width() * scale))), qMax(1, int(ceil(rect.height() * scale))));
+    m_lodPixmap.fill(Qt::transparent);
+
+    QPainter painter(&m_lodPixmap);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.scale(scale, scale);
+    painter.translate(-rect.topLeft());
+
+    // one line per bond and a dot for each heteroatom
+    QPen pen;
+    pen.setWidthF(1.5 / scale);
+    pen.setCapStyle(Qt::RoundCap);
+    foreach (Bond *bond, m_bondList) {
+      pen.setColor(bond->getColor());
+      painter.setPen(pen);
+      painter.drawLine(QLineF(bond->beginAtom()->pos(), bond->endAtom()->pos()));
+    }
+    painter.setPen(Qt::NoPen);
+    foreach (Atom *atom, m_atomList) {
+      if ((atom->atomicNumber() == Element::C) && atom->numBonds())
+        continue;
+      painter.setBrush(elementColor(atom->atomicNumber()));
+      painter.drawEllipse(atom->pos(), 2.0 / scale, 2.0 / scale);
+    }
+  }
+
+  void Molecule::invalidateBondPaths()
+  {
+    m_bondPathsValid = false;
+    invalidateCache();
+  }
+
+  void Molecule::drawBondPaths(QPainter *painter)
+  {
+    if (!m_bondPathsValid) {
+      // one path for each pen
+      m_bondPaths.clear();
+      QHash<QPair<QRgb, int>, int> paths;
+      foreach (Bond *bond, m_bondList) {
+        if (!bond->drawnAsLines())
+          continue;
+        QPen pen = bond->pen();
+        QPair<QRgb, int> key(pen.color().rgba(), pen.style());
+        int index = paths.value(key, -1);
+        if (index < 0) {
+          index = m_bondPaths.size();
+          paths.insert(key, index);
+          m_bondPaths.append(qMakePair(pen, QPainterPath()));
+        }
+        QPainterPath &path = m_bondPaths[index].second;
+        foreach (const QLineF &line, bond->lines()) {
+          path.moveTo(bond->mapToParent(line.p1()));
+          path.lineTo(bond->mapToParent(line.p2()));
+        }
+      }
+      m_bondPathsValid = true;
+    }
+
+    painter->save();
+    painter->setBrush(Qt::NoBrush);
+    for (int i = 0; i < m_bondPaths.size(); ++i) {
+      painter->setPen(m_bondPaths.at(i).first);
+      painter->drawPath(m_bondPaths.at(i).second);
+    }
+    painter->restore();
+  }
+
   QRectF Molecule::boundingRect() const
   {
     return childrenBoundingRect();
@@ -768,7 +1161,7 @@ namespace Molsketch {
       OpenBabel::OBAtom* obatom = obmol->NewAtom();
       obatom->SetVector(atom->scenePos().x()/40,atom->scenePos().y()/40,0);
       std::string element = atom->element().toStdString();
-      obatom->SetAtomicNum(Molsketch::symbol2number(atom->element()));
+      obatom->SetAtomicNum(atom->atomicNumber());
       hash.insert(atom,obatom);
     }
     foreach (Bond* bond, m_bondList) {
@@ -810,6 +1203,7 @@ namespace Molsketch {
 
   void Molecule::readXML(QXmlStreamReader &xml)
   {
+    Batch batch(this);
     QHash<QString, Atom*> atomHash;
     while (!xml.atEnd()) {
       xml.readNext();
@@ -992,11 +1386,263 @@ namespace Molsketch {
     return count;
   }
 
-  using OpenBabel::OBRing;
+  /**
+   * The bonds of a molecule as a graph of atom and bond indices, used for ring perception.
+   */
+  struct MolGraph
+  {
+    QVector<int> begin; //!< The begin atom of each bond.
+    QVector<int> end; //!< The end atom of each bond.
+    QVector<QVector<int> > atomBonds; //!< The bonds of each atom.
+
+    int other(int bond, int atom) const
+    {
+      return (begin.at(bond) == atom) ? end.at(bond) : begin.at(bond);
+    }
+  };
+
+  /**
+   * A cycle in a MolGraph: its bonds, sorted by index, and its atoms in ring order.
+   */
+  struct Cycle
+  {
+    QVector<int> bonds;
+    QVector<int> atoms;
+  };
+
+  static bool cycleLessThan(const Cycle &c1, const Cycle &c2)
+  {
+    return c1.bonds.size() < c2.bonds.size();
+  }
+
+  /**
+   * Helper function to find the bonds that are part of a ring, i.e. the bonds that
+   * are not bridges. Uses an iterative version of Tarjan's algorithm, O(atoms + bonds).
+   */
+  static QVector<bool> findRingBonds(const MolGraph &graph)
+  {
+    int numAtoms = graph.atomBonds.size();
+    QVector<bool> ringBond(graph.begin.size(), true);
+    QVector<int> order(numAtoms, -1);
+    QVector<int> low(numAtoms, 0);
+    int counter = 0;
+
+    // depth-first search stack: atom, bond used to reach it and next bond to visit
+    QVector<int> stackAtom, stackBond, stackPos;
+    for (int root = 0; root < numAtoms; ++root) {
+      if (order.at(root) >= 0)
+        continue;
+      order[root] = low[root] = counter++;
+      stackAtom.append(root);
+      stackBond.append(-1);
+      stackPos.append(0);
+
+      while (!stackAtom.isEmpty()) {
+        int top = stackAtom.size() - 1;
+        int atom = stackAtom.at(top);
+        if (stackPos.at(top) < graph.atomBonds.at(atom).size()) {
+          int bond = graph.atomBonds.at(atom).at(stackPos[top]++);
+          if (bond == stackBond.at(top))
+            continue;
+          int nbr = graph.other(bond, atom);
+          if (order.at(nbr) < 0) {
+            order[nbr] = low[nbr] = counter++;
+            stackAtom.append(nbr);
+            stackBond.append(bond);
+            stackPos.append(0);
+          } else {
+            low[atom] = qMin(low.at(atom), order.at(nbr));
+          }
+          continue;
+        }
+
+        // all bonds visited, go back to the parent
+        int bond = stackBond.at(top);
+        stackAtom.pop_back();
+        stackBond.pop_back();
+        stackPos.pop_back();
+        if (bond < 0)
+          continue;
+        int parent = stackAtom.last();
+        low[parent] = qMin(low.at(parent), low.at(atom));
+        if (low.at(atom) > order.at(parent))
+          ringBond[bond] = false;
+      }
+    }
+
+    return ringBond;
+  }
+
+  /**
+   * Helper function to find the shortest cycle through @p bond with a breadth-first
+   * search over the ring bonds. The search stops as soon as the cycle is closed, so it
+   * only visits the neighbourhood of the bond.
+   */
+  static bool shortestCycle(const MolGraph &graph, const QVector<bool> &ringBond, int bond, Cycle &cycle)
+  {
+    int first = graph.begin.at(bond);
+    int last = graph.end.at(bond);
+
+    QHash<int, int> parentBond;
+    parentBond.insert(first, -1);
+    QVector<int> queue;
+    queue.append(first);
+    for (int head = 0; head < queue.size() && !parentBond.contains(last); ++head) {
+      int atom = queue.at(head);
+      foreach (int b, graph.atomBonds.at(atom)) {
+        if (b == bond || !ringBond.at(b))
+          continue;
+        int nbr = graph.other(b, atom);
+        if (parentBond.contains(nbr))
+          continue;
+        parentBond.insert(nbr, b);
+        queue.append(nbr);
+        if (nbr == last)
+          break;
+      }
+    }
+    if (!parentBond.contains(last))
+      return false;
+
+    // walk back to the first atom
+    cycle.bonds.clear();
+    cycle.atoms.clear();
+    cycle.bonds.append(bond);
+    for (int atom = last; atom != first; ) {
+      cycle.atoms.append(atom);
+      int b = parentBond.value(atom);
+      cycle.bonds.append(b);
+      atom = graph.other(b, atom);
+    }
+    cycle.atoms.append(first);
+    qSort(cycle.bonds);
+    return true;
+  }
+
+  /**
+   * Helper function to add the Horton candidate cycles: for each ring atom r and ring
+   * bond (x, y), the shortest paths r-x and r-y closed by the bond, if they only share
+   * r. This set always contains a minimum cycle basis, but it is a lot larger than the
+   * set of shortest cycles through each bond. Only used when the latter is not enough.
+   */
+  static void addHortonCycles(const MolGraph &graph, const QVector<bool> &ringBond, QList<Cycle> &cycles)
+  {
+    int numAtoms = graph.atomBonds.size();
+    for (int root = 0; root < numAtoms; ++root) {
+      // shortest path tree from root over the ring bonds
+      QVector<int> parentBond(numAtoms, -2);
+      parentBond[root] = -1;
+      QVector<int> queue;
+      queue.append(root);
+      for (int head = 0; head < queue.size(); ++head) {
+        int atom = queue.at(head);
+        foreach (int b, graph.atomBonds.at(atom)) {
+          int nbr = graph.other(b, atom);
+          if (!ringBond.at(b) || parentBond.at(nbr) != -2)
+            continue;
+          parentBond[nbr] = b;
+          queue.append(nbr);
+        }
+      }
+      if (queue.size() < 3)
+        continue;
+
+      for (int bond = 0; bond < graph.begin.size(); ++bond) {
+        int x = graph.begin.at(bond);
+        int y = graph.end.at(bond);
+        if (!ringBond.at(bond) || parentBond.at(x) == -2 || parentBond.at(y) == -2)
+          continue;
+        if (parentBond.at(x) == bond || parentBond.at(y) == bond)
+          continue;
+
+        // the paths to the root, excluding the root
+        QVector<int> pathX, pathY;
+        for (int atom = x; atom != root; atom = graph.other(parentBond.at(atom), atom))
+          pathX.append(atom);
+        for (int atom = y; atom != root; atom = graph.other(parentBond.at(atom), atom))
+          pathY.append(atom);
+        bool disjoint = true;
+        foreach (int atom, pathY)
+          if (pathX.contains(atom))
+            disjoint = false;
+        if (!disjoint)
+          continue;
+
+        // root, path to x, path from y back to the root
+        Cycle cycle;
+        cycle.atoms.append(root);
+        for (int i = pathX.size() - 1; i >= 0; --i)
+          cycle.atoms.append(pathX.at(i));
+        cycle.atoms += pathY;
+        cycle.bonds.append(bond);
+        foreach (int atom, pathX)
+          cycle.bonds.append(parentBond.at(atom));
+        foreach (int atom, pathY)
+          cycle.bonds.append(parentBond.at(atom));
+        qSort(cycle.bonds);
+        cycles.append(cycle);
+      }
+    }
+  }
+
+  /**
+   * Helper function to get the symmetric difference of two sorted lists of bonds.
+   */
+  static QVector<int> symmetricDifference(const QVector<int> &a, const QVector<int> &b)
+  {
+    QVector<int> result;
+    int i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+      if (a.at(i) < b.at(j))
+        result.append(a.at(i++));
+      else if (b.at(j) < a.at(i))
+        result.append(b.at(j++));
+      else {
+        ++i;
+        ++j;
+      }
+    }
+    while (i < a.size())
+      result.append(a.at(i++));
+    while (j < b.size())
+      result.append(b.at(j++));
+    return result;
+  }
+
+  /**
+   * Helper function to pick the smallest cycles from @p candidates that are linearly
+   * independent (over GF(2), as sets of bonds), until there are @p numRings of them.
+   * The basis is kept in echelon form, keyed on the highest bond of each vector.
+   */
+  static QList<Cycle> independentCycles(QList<Cycle> candidates, int numRings)
+  {
+    qStableSort(candidates.begin(), candidates.end(), cycleLessThan);
+
+    QHash<int, QVector<int> > basis;
+    QList<Cycle> rings;
+    foreach (const Cycle &cycle, candidates) {
+      if (rings.size() == numRings)
+        break;
+      QVector<int> bonds = cycle.bonds;
+      while (!bonds.isEmpty()) {
+        QHash<int, QVector<int> >::const_iterator pivot = basis.constFind(bonds.last());
+        if (pivot == basis.constEnd())
+          break;
+        bonds = symmetricDifference(bonds, pivot.value());
+      }
+      if (bonds.isEmpty())
+        continue;
+      basis.insert(bonds.last(), bonds);
+      rings.append(cycle);
+    }
+
+    return rings;
+  }
 
   void Molecule::perceiveRings()
   {
-    OpenBabel::OBMol *obmol = OBMol();
+    // double bonds in rings are drawn differently
+    invalidateBondPaths();
 
     // clear ring info
     foreach (Bond *bond, m_bondList)
@@ -1005,33 +1651,49 @@ namespace Molsketch {
       delete ring;
     m_rings.clear();
 
-    QHash<Bond*, QList<Ring*> > ringBonds;
-
-    std::vector<OBRing*> rings = obmol->GetSSSR();
-    for (std::vector<OBRing*>::iterator r = rings.begin(); r != rings.end(); ++r) {
-      unsigned int ringSize = (*r)->_path.size();
-      Ring *ring = new Ring;
-      QList<Atom*> atoms;
-      for (unsigned int i = 0; i < ringSize; ++i) {
-        Atom *ringAtom = m_atomList.at((*r)->_path[i] - 1);
-
-        Bond *ringBond; 
-        if (i+1 < ringSize) {
-          ringBond = bondBetween(ringAtom, m_atomList.at((*r)->_path[i+1] - 1));
-        } else {
-          ringBond = bondBetween(ringAtom, m_atomList.at((*r)->_path[0] - 1));
-        }
-        
-        if (!ringBonds.contains(ringBond))
-          ringBonds[ringBond] = QList<Ring*>();
-        if (!ringBonds[ringBond].contains(ring))
-          ringBonds[ringBond].append(ring);
-        
-        atoms.append(ringAtom);
+    // the number of rings in the SSSR
+    int numRings = m_bondList.size() - m_atomList.size() + labelComponents();
+    if (numRings <= 0)
+      return;
 
+    // build the graph
+    QHash<const Atom*, int> index;
+    index.reserve(m_atomList.size());
+    for (int i = 0; i < m_atomList.size(); ++i)
+      index.insert(m_atomList.at(i), i);
+    MolGraph graph;
+    graph.begin.resize(m_bondList.size());
+    graph.end.resize(m_bondList.size());
+    graph.atomBonds.resize(m_atomList.size());
+    for (int i = 0; i < m_bondList.size(); ++i) {
+      graph.begin[i] = index.value(m_bondList.at(i)->beginAtom());
+      graph.end[i] = index.value(m_bondList.at(i)->endAtom());
+      graph.atomBonds[graph.begin.at(i)].append(i);
+      graph.atomBonds[graph.end.at(i)].append(i);
+    }
 
-      }
+    // the shortest cycle through each ring bond is nearly always enough
+    QVector<bool> ringBond = findRingBonds(graph);
+    QList<Cycle> candidates;
+    for (int i = 0; i < m_bondList.size(); ++i) {
+      Cycle cycle;
+      if (ringBond.at(i) && shortestCycle(graph, ringBond, i, cycle))
+        candidates.append(cycle);
+    }
+    QList<Cycle> cycles = independentCycles(candidates, numRings);
+    if (cycles.size() < numRings) {
+      addHortonCycles(graph, ringBond, candidates);
+      cycles = independentCycles(candidates, numRings);
+    }
 
+    QHash<Bond*, QList<Ring*> > ringBonds;
+    foreach (const Cycle &cycle, cycles) {
+      Ring *ring = new Ring;
+      QList<Atom*> atoms;
+      foreach (int atom, cycle.atoms)
+        atoms.append(m_atomList.at(atom));
+      foreach (int bond, cycle.bonds)
+        ringBonds[m_bondList.at(bond)].append(ring);
       ring->setAtoms(atoms);
       m_rings.append(ring);
     }
@@ -1068,115 +1730,195 @@ namespace Molsketch {
 
 
 
-  bool NumAtomsLessThan(const ElectronSystem *es1, const ElectronSystem *es2)
+  /**
+   * Helper function to check if @p atom has pi or non-bonding electrons that can be
+   * part of a conjugated system.
+   */
+  static bool hasConjugatingElectrons(const Molecule *mol, const Atom *atom)
   {
-    return es1->numAtoms() < es2->numAtoms();
+    if (atom->numNonBondingElectrons() > 0)
+      return true;
+    foreach (Bond *bond, mol->bonds(atom))
+      if (bond->bondOrder() >= 2)
+        return true;
+    return false;
   }
 
-  bool canMerge(const Molecule *mol, const ElectronSystem *es1, const ElectronSystem *es2)
+  /**
+   * Helper function to create a PiElectrons instance on @p atoms with @p numElectrons.
+   */
+  static ElectronSystem* newPiElectrons(const QList<Atom*> &atoms, int numElectrons)
   {
-    bool result = false;
-
-    foreach (Atom *a1, es1->atoms()) {
-      foreach (Atom *a2, es2->atoms()) {
-        if (a1 == a2)
-          return false; // may not share an atom
-        if (mol->bondBetween(a1, a2)) {
-          result = true; // can be merged if two atoms in the electron system are next to each other
-        }
-      }
-    }
+    PiElectrons *piEle = new PiElectrons;
+    piEle->setAtoms(atoms);
+    piEle->setNumElectrons(numElectrons);
+    return piEle;
+  }
 
-    return result;
+  void Molecule::invalidateElectronSystems()
+  {
+    m_lodPixmap = QPixmap();
+    invalidateCache();
+    m_electronSystemsUpdate = true;
+    m_outdatedElectronSystems.clear();
   }
 
-  void merge(QList<ElectronSystem*> &electronSystems, ElectronSystem *es1, ElectronSystem *es2)
+  void Molecule::invalidateElectronSystems(Atom *atom)
   {
-    es1->setAtoms(es1->atoms() + es2->atoms());
-    es1->setNumElectrons(es1->numElectrons() + es2->numElectrons());
-    electronSystems.removeAll(es2);
-    delete es2;
+    m_lodPixmap = QPixmap();
+    invalidateCache();
+    if (!m_electronSystemsUpdate)
+      m_outdatedElectronSystems.insert(atom);
   }
-  
-  void Molecule::invalidateElectronSystems()
+
+  const QList<ElectronSystem*>& Molecule::electronSystems()
   {
-    m_electronSystemsUpdate = true;
+    updateElectronSystems();
+    return m_electronSystems;
   }
 
   void Molecule::updateElectronSystems()
   {
-    if (!m_electronSystemsUpdate)
+    if (!m_electronSystemsUpdate && m_outdatedElectronSystems.isEmpty())
       return;
-    m_electronSystemsUpdate = false;
-
-    foreach (ElectronSystem *es, m_electronSystems)
-      delete es;
-    m_electronSystems.clear();
 
-    foreach (Bond *bond, m_bondList) {
-      int order = bond->bondOrder();
-      QList<Atom*> atoms;
-      atoms.append(bond->beginAtom());
-      atoms.append(bond->endAtom());
-
-      if (order >= 2) {
-        PiElectrons *piEle = new PiElectrons;
-        piEle->setAtoms(atoms);
-        piEle->setNumElectrons(2);
-        m_electronSystems.append(piEle);
+    // the atoms to recompute, in a fixed order
+    QList<Atom*> atoms;
+    QHash<Atom*, int> index;
+    if (m_electronSystemsUpdate) {
+      atoms = m_atomList;
+      foreach (ElectronSystem *es, m_electronSystems)
+        delete es;
+      m_electronSystems.clear();
+    } else {
+      // the outdated atoms and their neighbours, plus all atoms conjugated with them
+      foreach (Atom *atom, m_outdatedElectronSystems) {
+        if (!m_atomBonds.contains(atom))
+          continue; // deleted
+        if (!index.contains(atom)) {
+          index.insert(atom, atoms.size());
+          atoms.append(atom);
+        }
+        foreach (Bond *bond, bonds(atom)) {
+          Atom *nbr = bond->otherAtom(atom);
+          if (!index.contains(nbr)) {
+            index.insert(nbr, atoms.size());
+            atoms.append(nbr);
+          }
+        }
+      }
+      for (int head = 0; head < atoms.size(); ++head) {
+        Atom *atom = atoms.at(head);
+        if (!hasConjugatingElectrons(this, atom))
+          continue;
+        foreach (Bond *bond, bonds(atom)) {
+          Atom *nbr = bond->otherAtom(atom);
+          if (!index.contains(nbr) && hasConjugatingElectrons(this, nbr)) {
+            index.insert(nbr, atoms.size());
+            atoms.append(nbr);
+          }
+        }
       }
 
-      if (order == 3) {
-        PiElectrons *piEle = new PiElectrons;
-        piEle->setAtoms(atoms);
-        piEle->setNumElectrons(2);
-        m_electronSystems.append(piEle);
+      // Remove the old systems of these atoms. An old system can not reach beyond
+      // them: it was connected through atoms that only changed if they were outdated,
+      // so every part of it is next to an outdated atom.
+      QList<ElectronSystem*> electronSystems;
+      foreach (ElectronSystem *es, m_electronSystems) {
+        bool outdated = false;
+        foreach (Atom *atom, es->atoms())
+          if (index.contains(atom) || m_outdatedElectronSystems.contains(atom)) {
+            outdated = true;
+            break;
+          }
+        if (outdated)
+          delete es;
+        else
+          electronSystems.append(es);
       }
+      m_electronSystems = electronSystems;
     }
-    
-    foreach (Atom *atom, m_atomList) {
-      int unboundElectrons = atom->numNonBondingElectrons();
-      QList<Atom*> atoms;
-      atoms.append(atom);
-
-      for (int i = 2; i <= unboundElectrons; i+=2) {
-        PiElectrons *piEle = new PiElectrons;
-        piEle->setAtoms(atoms);
-        piEle->setNumElectrons(2);
-        m_electronSystems.append(piEle);
-        qDebug() << "adding lone pair";
+    m_electronSystemsUpdate = false;
+    m_outdatedElectronSystems.clear();
+    if (index.isEmpty())
+      for (int i = 0; i < atoms.size(); ++i)
+        index.insert(atoms.at(i), i);
+
+    // Create the pi bonds, lone pairs and radicals. Each atom conjugates with at most
+    // one of them (its owner), the others stay on their own.
+    QList<QList<Atom*> > unitAtoms;
+    QList<int> unitElectrons;
+    QVector<int> owner(atoms.size(), -1);
+    for (int i = 0; i < atoms.size(); ++i)
+      foreach (Bond *bond, bonds(atoms.at(i))) {
+        if (bond->beginAtom() != atoms.at(i) || bond->bondOrder() < 2)
+          continue;
+        int j = index.value(bond->endAtom(), -1);
+        Q_ASSERT(j >= 0);
+        QList<Atom*> bondAtoms;
+        bondAtoms << bond->beginAtom() << bond->endAtom();
+        for (int k = 1; k < bond->bondOrder(); ++k) {
+          if (owner.at(i) < 0 && owner.at(j) < 0)
+            owner[i] = owner[j] = unitAtoms.size();
+          unitAtoms.append(bondAtoms);
+          unitElectrons.append(2);
+        }
       }
-
-      if (unboundElectrons % 2 == 1) {
-        PiElectrons *piEle = new PiElectrons;
-        piEle->setAtoms(atoms);
-        piEle->setNumElectrons(1);
-        m_electronSystems.append(piEle);
-        qDebug() << "adding radical";
+    for (int i = 0; i < atoms.size(); ++i) {
+      int unboundElectrons = atoms.at(i)->numNonBondingElectrons();
+      QList<Atom*> atom;
+      atom.append(atoms.at(i));
+      for (int numElectrons = unboundElectrons; numElectrons > 0; numElectrons -= 2) {
+        if (owner.at(i) < 0)
+          owner[i] = unitAtoms.size();
+        unitAtoms.append(atom);
+        unitElectrons.append(qMin(numElectrons, 2)); // radical for an odd number
       }
     }
 
-    qSort(m_electronSystems.begin(), m_electronSystems.end(), NumAtomsLessThan);
-
-    for (int i = 0; i < 1000; ++i) {
-      bool restart = false;
-      foreach (ElectronSystem *es1, m_electronSystems) {
-        foreach (ElectronSystem *es2, m_electronSystems) {
-          if (canMerge(this, es1, es2)) {
-            merge(m_electronSystems, es1, es2);
-            restart = true;
-            break;
-          }
-        }
-
-        if (restart)
-          break;
+    // merge the owners of bonded atoms
+    QVector<int> parent(unitAtoms.size());
+    for (int u = 0; u < parent.size(); ++u)
+      parent[u] = u;
+    for (int i = 0; i < atoms.size(); ++i) {
+      if (owner.at(i) < 0)
+        continue;
+      foreach (Bond *bond, bonds(atoms.at(i))) {
+        int j = index.value(bond->otherAtom(atoms.at(i)), -1);
+        if (j < 0 || owner.at(j) < 0)
+          continue;
+        int a = findRoot(parent, owner.at(i));
+        int b = findRoot(parent, owner.at(j));
+        if (a < b)
+          parent[b] = a;
+        else if (b < a)
+          parent[a] = b;
       }
     }
 
-
-    qDebug() << "# ElectronSystem =" << m_electronSystems.size();
-
+    // one system for each set of merged units
+    QVector<bool> isOwner(unitAtoms.size(), false);
+    foreach (int u, owner)
+      if (u >= 0)
+        isOwner[u] = true;
+    QHash<int, int> systemOf;
+    QList<QList<Atom*> > systemAtoms;
+    QList<int> systemElectrons;
+    for (int u = 0; u < unitAtoms.size(); ++u) {
+      int root = isOwner.at(u) ? findRoot(parent, u) : -1;
+      if (root >= 0 && systemOf.contains(root)) {
+        int system = systemOf.value(root);
+        systemAtoms[system] += unitAtoms.at(u);
+        systemElectrons[system] += unitElectrons.at(u);
+        continue;
+      }
+      if (root >= 0)
+        systemOf.insert(root, systemAtoms.size());
+      systemAtoms.append(unitAtoms.at(u));
+      systemElectrons.append(unitElectrons.at(u));
+    }
+    for (int i = 0; i < systemAtoms.size(); ++i)
+      m_electronSystems.append(newPiElectrons(systemAtoms.at(i), systemElectrons.at(i)));
   }
 
 
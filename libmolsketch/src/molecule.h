@@ -31,6 +31,13 @@
 #include <molsketch/graphicsitemtypes.h>
 
 #include <QList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QPixmap>
+#include <QPen>
+#include <QPainterPath>
+#include <QTransform>
 #include <QGraphicsItemGroup>
 
 class QString;
@@ -82,8 +89,55 @@ class Molecule : public QGraphicsItemGroup
 
     QRectF boundingRect() const;
 
-    /** Paint method to draw the atom onto a QPainter. Needed for Qt painting.*/
+    /**
+     * Paint method to draw the atom onto a QPainter. Needed for Qt painting.
+     *
+     * When the molecule is only a few pixels wide at the current zoom level, it
+     * is collapsed: it draws a small cached pixmap of itself and its atoms and
+     * bonds do not paint themselves. Each view collapses and expands the
+     * molecule on its own.
+     *
+     * With MolScene::batchedBondRendering(), the molecule also draws its plain
+     * bonds with one path per pen, see invalidateBondPaths().
+     *
+     * With MolScene::moleculeCaching(), a molecule that is not being edited is
+     * drawn in a view from a pixmap of itself, its atoms and bonds, see
+     * invalidateCache().
+     */
     void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget);
+    /**
+     * @return @c true if the molecule was painted collapsed the last time, see paint().
+     */
+    bool collapsed() const
+    {
+      return m_collapsed;
+    }
+    /**
+     * @return @c true if the molecule drew its atoms and bonds the last time it
+     * was painted, because it is collapsed or cached. They don't paint
+     * themselves then.
+     */
+    bool drawsChildren() const
+    {
+      return m_collapsed || m_cached;
+    }
+    /**
+     * Drop the cached pixmap of the molecule. Called when the molecule, its
+     * atoms or bonds change, or their selection or hover state. The molecule is
+     * drawn directly until it is painted again without changes in between.
+     */
+    void invalidateCache();
+    /**
+     * Drop the cache and the collapsed state kept for the view @p widget, which
+     * is destroyed. Called by the scene, see MolScene::watchView().
+     */
+    void removeView(const QWidget *widget);
+    /**
+     * Mark the cached paths of the plain bonds as outdated. Called when the
+     * atoms move or the bonds, their orders, types, colours or the labels of
+     * their atoms change. The paths are rebuilt on the next paint().
+     */
+    void invalidateBondPaths();
 
 
     // Manipulation methods
@@ -130,12 +184,36 @@ class Molecule : public QGraphicsItemGroup
 
     /**
       * Splits the molecule up in different seperate molecules. Used to clean up the molecule after removing the connection 
-    * between two or more parts of the molecule. 
+    * between two or more parts of the molecule. The atoms and bonds are moved (not copied) to the new molecules, this
+    * molecule is left empty.
     *
     * @return a list of the submolecules of which this molecule exists.
     */
     QList<Molecule*> split();
 
+    /**
+     * Adds existing @p atoms and the @p bonds between them to the molecule, e.g. after
+     * taking them from another molecule with releaseAtomsAndBonds().
+     */
+    void addAtomsAndBonds(const QList<Atom*> &atoms, const QList<Bond*> &bonds);
+    /**
+     * Adds copies of @p atoms and of the @p bonds between them to the molecule. The bonds
+     * are connected to the copies through their source atoms, not their positions, so this
+     * runs in O(atoms + bonds) and atoms sharing a position are kept apart. Bonds to atoms
+     * that are not in @p atoms are skipped.
+     *
+     * @param scenePositions place the copies at the scene positions of @p atoms instead of
+     *        their positions in their molecule
+     * @return the copy of each atom in @p atoms
+     */
+    QHash<const Atom*, Atom*> addCopies(const QList<Atom*> &atoms, const QList<Bond*> &bonds, bool scenePositions);
+    /**
+     * Removes all atoms and bonds from the molecule without deleting them. Used to move
+     * the atoms and bonds to other molecules while keeping pointers to them valid (e.g.
+     * for undo).
+     */
+    void releaseAtomsAndBonds();
+
 
     /**
     * This method rebuilds the atom by removing all atoms and bonds from the molecule and consequently readding them. 
@@ -161,10 +239,10 @@ class Molecule : public QGraphicsItemGroup
     Bond* bondAt(const QPointF &pos) const;
 //    /** Returns a pointer to bond with @p id. */
 //     Bond* bond(int id) const;
-    /** Returns a list of the bonds connected to @p atom. */
-    QList<Bond*> bonds(const Atom* atom);
+    /** Returns a list of the bonds connected to @p atom. Runs in O(1) using the adjacency index. */
+    QList<Bond*> bonds(const Atom* atom) const;
     /** Returns a pointer to the bond between @p atomA and @p atomB, or a NULL if none. */
-    Bond* bondBetween(Atom* atomA, Atom* atomB) const;
+    Bond* bondBetween(const Atom* atomA, const Atom* atomB) const;
 
     /**
      * @return @c true if the molecule exists of two seperate submolecules, and @c false otherwise.
@@ -187,6 +265,11 @@ class Molecule : public QGraphicsItemGroup
     {
       return m_rings;
     }
+    /**
+     * Get a list of the electron systems in the molecule. The outdated electron
+     * systems are updated first.
+     */
+    const QList<ElectronSystem*>& electronSystems();
 
 
     /** Returns the MolScene of the molecule. */
@@ -208,6 +291,57 @@ class Molecule : public QGraphicsItemGroup
 
     OpenBabel::OBMol* OBMol() const;
     void perceiveRings();
+    /**
+     * Perceive the rings, or mark them as outdated while in a batch. To be called
+     * when bonds are added, removed or change their order.
+     */
+    void invalidateRings();
+    /**
+     * Lay out the label of @p atom, or mark it as outdated while in a batch. To be
+     * called when the element or the bonds of the atom change.
+     */
+    void invalidateLabel(Atom *atom);
+
+    //@name Batches
+    //@{
+    /**
+     * Start a batch of edits. Until the matching endBatch(), perceiving the rings,
+     * laying out the atom labels and updating the bounding rect are deferred, and
+     * then done once. Batches can be nested, the deferred work is done when the
+     * outermost batch ends.
+     */
+    void beginBatch();
+    /**
+     * End a batch started with beginBatch().
+     */
+    void endBatch();
+    /**
+     * @return @c true between beginBatch() and the matching endBatch().
+     */
+    bool inBatch() const
+    {
+      return m_batchDepth > 0;
+    }
+
+    /**
+     * Keeps a batch open on a molecule for the lifetime of the object.
+     */
+    class Batch
+    {
+      public:
+        Batch(Molecule *molecule) : m_molecule(molecule)
+        {
+          m_molecule->beginBatch();
+        }
+        ~Batch()
+        {
+          m_molecule->endBatch();
+        }
+      private:
+        Q_DISABLE_COPY(Batch)
+        Molecule *m_molecule;
+    };
+    //@}
 
 
     /**
@@ -224,6 +358,12 @@ class Molecule : public QGraphicsItemGroup
      * change.
      */
     void invalidateElectronSystems();
+    /**
+     * Invalidate the electron systems around @p atom. To be called when the
+     * element, bonds or bond orders of @p atom change. Only the conjugated
+     * systems that contain @p atom or one of its neighbours are recomputed.
+     */
+    void invalidateElectronSystems(Atom *atom);
 
 
   protected:
@@ -240,12 +380,19 @@ class Molecule : public QGraphicsItemGroup
     * Update the internal ElectronSystem representation based on the current
     * bond orders.
     *
-    * 1. create a SigmaElectrons instance for each bond
-    * 2. create a PiElectrons instance for each 
+    * 1. create a PiElectrons instance for each pi bond, lone pair and radical
+    * 2. give each atom at most one of them that can conjugate, preferring pi bonds
+    * 3. merge the conjugating instances of bonded atoms with union-find
+    *
+    * Only the atoms passed to invalidateElectronSystems(Atom*) and their
+    * conjugated systems are recomputed, unless all electron systems were
+    * invalidated.
     */
    void updateElectronSystems();
    
    bool m_electronSystemsUpdate;
+   /** The atoms with outdated electron systems, see invalidateElectronSystems(Atom*). */
+   QSet<Atom*> m_outdatedElectronSystems;
    QList<ElectronSystem*> m_electronSystems;
 
 
@@ -256,8 +403,78 @@ class Molecule : public QGraphicsItemGroup
     QList<Atom*> m_atomList;
     /** A list of pointers to the bonds of the molecule. Used as internal representation. */
     QList<Bond*> m_bondList;
+
+    /** Registers @p bond in the adjacency index. */
+    void indexBond(Bond* bond);
+    /** Removes @p bond from the adjacency index. */
+    void unindexBond(Bond* bond);
+    /**
+     * Labels the connected components of the molecule using union-find in O(atoms + bonds).
+     * Components are numbered in the order of their first atom in atoms().
+     *
+     * @param components if not NULL, receives the component number of each atom
+     * @return the number of components
+     */
+    int labelComponents(QHash<const Atom*, int> *components = 0) const;
+
+    /** The bonds incident to each atom of the molecule. Kept up to date by addAtom(), addBond(), delBond() and delAtom(). */
+    QHash<const Atom*, QList<Bond*> > m_atomBonds;
+    /** The bond between each pair of bonded atoms, keyed on the (lower, higher) atom pointers. */
+    QHash<QPair<const Atom*, const Atom*>, Bond*> m_bondIndex;
     
     QList<Ring*> m_rings;
+
+    /** The number of open batches, see beginBatch(). */
+    int m_batchDepth;
+    /** Stores whether the rings have to be perceived at the end of the batch. */
+    bool m_ringsOutdated;
+    /** Stores whether the molecule has to be rebuilt at the end of the batch. */
+    bool m_geometryOutdated;
+
+    /** Draws the atoms and bonds in m_lodPixmap, for painting the molecule collapsed. */
+    void renderLodPixmap();
+    /** Stores whether the molecule was painted collapsed the last time, see paint(). */
+    bool m_collapsed;
+    /** The views in which the molecule is collapsed, see paint(). */
+    QSet<const QWidget*> m_collapsedViews;
+    /** The molecule at low detail, or a null pixmap if it has to be drawn again. */
+    QPixmap m_lodPixmap;
+    /** Draws the molecule itself, without its atoms and bonds. */
+    void paintContents(QPainter *painter, bool fullDetail);
+    /**
+     * Draws the molecule and its children from the cache of @p widget in m_caches,
+     * rendering it first if needed. @return @c false if the cache would be too
+     * large at this zoom level.
+     */
+    bool drawCache(QPainter *painter, const QWidget *widget, bool fullDetail);
+    /**
+     * The molecule in device pixels as drawn in one view.
+     */
+    struct Cache
+    {
+      /** The molecule in device pixels. */
+      QPixmap pixmap;
+      /** The device transform of the pixmap, without the translation. */
+      QTransform transform;
+      /** The position of the pixmap relative to the origin of the molecule in device pixels. */
+      QPoint origin;
+      /** Stores whether the pixmap is drawn at MolScene::FullDetail. */
+      bool fullDetail;
+    };
+    /** The cache of each view, views may be zoomed differently. */
+    QHash<const QWidget*, Cache> m_caches;
+    /** Stores whether the molecule was painted without changes since the last invalidateCache(). */
+    bool m_cacheIdle;
+    /** Stores whether the molecule was drawn from m_caches the last time, see paint(). */
+    bool m_cached;
+    /** Draws the bonds in m_bondPaths, building them first if needed. */
+    void drawBondPaths(QPainter *painter);
+    /** The lines of the plain bonds, one path per pen. */
+    QList<QPair<QPen, QPainterPath> > m_bondPaths;
+    /** Stores whether m_bondPaths is up to date. */
+    bool m_bondPathsValid;
+    /** The atoms with a label to lay out at the end of the batch. */
+    QSet<Atom*> m_outdatedLabels;
   };
 
 } // namespace
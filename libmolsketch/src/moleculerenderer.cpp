@@ -0,0 +1,459 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QFontMetrics>
+#include <QHash>
+#include <QPainter>
+#include <math.h>
+
+#include "moleculerenderer.h"
+
+#include "atom.h"
+#include "bond.h"
+#include "element.h"
+#include "labellayout.h"
+#include "math2d.h"
+#include "molecule.h"
+#include "molscene.h"
+#include "ring.h"
+
+namespace Molsketch {
+
+  MoleculeRenderer::MoleculeRenderer() : m_carbonVisible(false), m_chargeVisible(true),
+      m_renderMode(MolScene::RenderLabels)
+  {
+  }
+
+  MoleculeRenderer::MoleculeRenderer(Molecule *molecule) : m_carbonVisible(false),
+      m_chargeVisible(true), m_renderMode(MolScene::RenderLabels)
+  {
+    setMolecule(molecule);
+  }
+
+  void MoleculeRenderer::setMolecule(Molecule *molecule)
+  {
+    Q_CHECK_PTR(molecule);
+
+    // draw the molecule as it is drawn on its scene
+    MolScene *molScene = molecule->scene();
+    if (molScene) {
+      m_font = molScene->atomSymbolFont();
+      m_carbonVisible = molScene->carbonVisible();
+      m_chargeVisible = molScene->chargeVisible();
+      m_renderMode = molScene->renderMode();
+    }
+
+    m_atoms.clear();
+    m_bonds.clear();
+    QHash<Atom*, int> index;
+    foreach (Atom *atom, molecule->atoms()) {
+      AtomData data;
+      data.position = atom->pos();
+      data.element = atom->element();
+      data.numImplicitHydrogens = atom->numImplicitHydrogens();
+      data.charge = atom->charge();
+      data.color = atom->getColor();
+      index.insert(atom, m_atoms.size());
+      m_atoms.append(data);
+    }
+    foreach (Bond *bond, molecule->bonds()) {
+      BondData data;
+      data.begin = index.value(bond->beginAtom());
+      data.end = index.value(bond->endAtom());
+      data.order = bond->bondOrder();
+      data.type = bond->bondType();
+      if (bond->ring()) {
+        data.inRing = true;
+        data.ringCenter = bond->ring()->center();
+      }
+      data.color = bond->getColor();
+      m_bonds.append(data);
+    }
+    updateNeighbours();
+  }
+
+  void MoleculeRenderer::setAtoms(const QVector<AtomData> &atoms)
+  {
+    m_atoms = atoms;
+    updateNeighbours();
+  }
+
+  void MoleculeRenderer::setBonds(const QVector<BondData> &bonds)
+  {
+    m_bonds = bonds;
+    updateNeighbours();
+  }
+
+  void MoleculeRenderer::updateNeighbours()
+  {
+    m_neighbours = QVector<QVector<int> >(m_atoms.size());
+    foreach (const BondData &bond, m_bonds) {
+      if ((bond.begin >= m_atoms.size()) || (bond.end >= m_atoms.size()))
+        continue;
+      m_neighbours[bond.begin].append(bond.end);
+      m_neighbours[bond.end].append(bond.begin);
+    }
+  }
+
+  bool MoleculeRenderer::hasLabel(int index) const
+  {
+    const AtomData &atom = m_atoms.at(index);
+    if ((atom.element == "C") && !m_carbonVisible && (m_neighbours.at(index).size() > 1) &&
+        ((atom.charge == 0) || !m_chargeVisible))
+      return false;
+
+    return true;
+  }
+
+  int MoleculeRenderer::alignment(int index) const
+  {
+    QPointF direction(0.0, 0.0);
+    foreach (int nbr, m_neighbours.at(index))
+      direction += m_atoms.at(index).position - m_atoms.at(nbr).position;
+    return labelAlignment(direction, m_neighbours.at(index).size());
+  }
+
+  QRectF MoleculeRenderer::boundingRect() const
+  {
+    // the bond lines and the coloured squares stick out of the atoms
+    qreal margin = (m_renderMode == MolScene::RenderLabels) ? 5.0 : 10.0;
+
+    QRectF rect;
+    for (int i = 0; i < m_atoms.size(); ++i) {
+      QPointF position = m_atoms.at(i).position;
+      rect |= QRectF(position.x() - margin, position.y() - margin, 2.0 * margin, 2.0 * margin);
+      if ((m_renderMode == MolScene::RenderLabels) && hasLabel(i)) {
+        int align = alignment(i);
+        QString label = labelText(m_atoms.at(i).element, m_atoms.at(i).numImplicitHydrogens, align);
+        rect |= LabelLayout::layout(label, align, m_font).shape().translated(position);
+      }
+    }
+    return rect;
+  }
+
+  void MoleculeRenderer::paint(QPainter *painter) const
+  {
+    painter->save();
+    foreach (const BondData &bond, m_bonds)
+      drawBond(painter, bond);
+    for (int i = 0; i < m_atoms.size(); ++i)
+      drawAtom(painter, i);
+    painter->restore();
+  }
+
+  QImage MoleculeRenderer::toImage(qreal scale) const
+  {
+    QRectF rect = boundingRect();
+    QImage image(int(ceil(scale * rect.width())), int(ceil(scale * rect.height())), QImage::Format_RGB32);
+    image.fill(QColor(Qt::white).rgb());
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.scale(scale, scale);
+    painter.translate(-rect.topLeft());
+    paint(&painter);
+
+    return image;
+  }
+
+  void MoleculeRenderer::drawBond(QPainter *painter, const BondData &bond) const
+  {
+    if ((bond.begin >= m_atoms.size()) || (bond.end >= m_atoms.size()))
+      return;
+
+    QPointF begin = m_atoms.at(bond.begin).position;
+    QPointF end = m_atoms.at(bond.end).position;
+    bool beginLabel = hasLabel(bond.begin);
+    bool endLabel = hasLabel(bond.end);
+
+    painter->setPen(bondPen(bond.type, bond.color));
+    switch (bond.type) {
+      case Bond::Hash:
+        painter->drawLines(hashBondLines(begin, end, endLabel));
+        break;
+      case Bond::InvertedHash:
+        painter->drawLines(hashBondLines(end, begin, endLabel));
+        break;
+      case Bond::Wedge:
+      case Bond::InvertedWedge:
+        painter->setBrush(bond.color);
+        painter->drawConvexPolygon(wedgeBondPolygon(begin, end, beginLabel, endLabel,
+            bond.type == Bond::InvertedWedge));
+        break;
+      case Bond::InPlane:
+      case Bond::WedgeOrHash:
+      case Bond::CisOrTrans:
+        painter->drawLines(bondLines(begin, end, bond.order, bond.type, beginLabel, endLabel,
+            bond.inRing ? &bond.ringCenter : 0));
+        break;
+      default:
+        break;
+    }
+  }
+
+  void MoleculeRenderer::drawAtom(QPainter *painter, int index) const
+  {
+    const AtomData &atom = m_atoms.at(index);
+    int element = symbol2number(atom.element);
+
+    switch (m_renderMode) {
+      case MolScene::RenderColoredSquares:
+      case MolScene::RenderColoredCircles:
+        if (element != Element::C) {
+          QColor color = elementColor(element);
+          painter->setPen(color);
+          painter->setBrush(color);
+          QRectF rect(atom.position.x() - 10.0, atom.position.y() - 10.0, 20.0, 20.0);
+          if (m_renderMode == MolScene::RenderColoredSquares)
+            painter->drawRect(rect);
+          else
+            painter->drawEllipse(rect);
+        }
+        return;
+      case MolScene::RenderColoredWireframe:
+        return;
+      default:
+        break;
+    }
+
+    if (!hasLabel(index))
+      return;
+
+    painter->save();
+    painter->translate(atom.position);
+    painter->setPen(atom.color);
+    int align = alignment(index);
+    LabelLayout layout = LabelLayout::layout(labelText(atom.element, atom.numImplicitHydrogens, align),
+        align, m_font);
+    layout.draw(painter);
+
+    if (m_chargeVisible && atom.charge) {
+      QFont superscriptFont = m_font;
+      superscriptFont.setPointSize(0.5 * superscriptFont.pointSize());
+      QFontMetrics fmSymbol(superscriptFont);
+      int offset = 0.5 * fmSymbol.width("+");
+      QRectF shape = layout.shape();
+      painter->drawText(shape.right() - offset, shape.top() + offset, chargeString(atom.charge));
+    }
+    painter->restore();
+  }
+
+  int MoleculeRenderer::labelAlignment(const QPointF &direction, int numBonds)
+  {
+    int alignment = LabelLayout::Left;
+    if ((numBonds == 2) && (qAbs(direction.y()) > qAbs(direction.x()))) {
+      if (direction.y() <= 0.0)
+        alignment = LabelLayout::Up;
+      else
+        alignment = LabelLayout::Down;
+    } else {
+      if (direction.x() < -0.1) // hack to make almost vertical lines align Right
+        alignment = LabelLayout::Left;
+      else
+        alignment = LabelLayout::Right;
+    }
+
+    return alignment;
+  }
+
+  QString MoleculeRenderer::labelText(const QString &element, int hCount, int alignment)
+  {
+    bool leftAligned = (alignment == LabelLayout::Left);
+
+    QString lbl;
+    if (hCount && leftAligned)
+      lbl += "H";
+    if ((hCount > 1) && leftAligned)
+      lbl += QString::number(hCount);
+
+    lbl += element;
+
+    if (hCount && !leftAligned)
+      lbl += "H";
+    if ((hCount > 1) && !leftAligned)
+      lbl += QString::number(hCount);
+
+    return lbl;
+  }
+
+  QString MoleculeRenderer::chargeString(int c)
+  {
+    QString string;
+    string.setNum(c);
+    if (c < -1) // ..., "3-", "2-"
+      string =  string.remove(0,1) + "-";
+    if (c == -1) // "-"
+      string = "-";
+    if (c == 0) // ""
+      string = "";
+    if (c == 1) // "+"
+      string = "+";
+    if (c > 1) // "2+", "3+", ...
+      string = string + "+";
+
+    return string;
+  }
+
+  QVector<QLineF> MoleculeRenderer::bondLines(const QPointF &beginAtom, const QPointF &endAtom, int order,
+      int type, bool beginLabel, bool endLabel, const QPointF *ringCenter)
+  {
+    QVector<QLineF> lines;
+    if (type == Bond::WedgeOrHash) {
+      lines << QLineF(beginAtom, endAtom);
+      return lines;
+    }
+
+    qreal bondSpacing = 4.0;
+
+    QPointF begin = beginAtom;
+    QPointF end = endAtom;
+    QPointF vb = end - begin;
+    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
+    QPointF orthogonal(uvb.y(), -uvb.x());
+
+    if (ringCenter && (order == 2)) {
+      // double bond inside ring
+      QPointF spacing = orthogonal * bondSpacing;
+      QPointF offset = uvb * bondSpacing;
+      QPointF offset2 = 0.20 * uvb * 40/*molScene->bondLength()*/; //FIXME
+
+      if (length(begin + spacing - *ringCenter) > length(begin - spacing - *ringCenter))
+        spacing *= -1.0;
+
+      if (!beginLabel && !endLabel) {
+        lines << QLineF(begin, end);
+        lines << QLineF(begin + spacing + offset, end + spacing - offset);
+      } else if (beginLabel && endLabel) {
+        lines << QLineF(begin + offset2, end - offset2);
+        lines << QLineF(begin + spacing + offset2, end + spacing - offset2);
+      } else if (beginLabel) {
+        lines << QLineF(begin + offset2, end);
+        lines << QLineF(begin + spacing + offset2, end + spacing - offset);
+      } else {
+        lines << QLineF(begin, end - offset2);
+        lines << QLineF(begin + spacing + offset, end + spacing - offset2);
+      }
+      return lines;
+    }
+
+    if (beginLabel)
+      begin += 0.20 * uvb * 40/*molScene->bondLength()*/; // FIXME
+    if (endLabel)
+      end -= 0.20 * uvb * 40/*molScene->bondLength()*/; // FIXME
+
+    switch (order) {
+      case 1:
+        lines << QLineF(begin, end);
+        break;
+      case 2:
+      {
+        QPointF offset = orthogonal * 0.5 * bondSpacing;
+        if (type == Bond::CisOrTrans) {
+          lines << QLineF(begin + offset, end - offset);
+          lines << QLineF(begin - offset, end + offset);
+        } else {
+          lines << QLineF(begin + offset, end + offset);
+          lines << QLineF(begin - offset, end - offset);
+        }
+        break;
+      }
+      case 3:
+      {
+        QPointF offset = orthogonal * bondSpacing;
+        lines << QLineF(begin, end);
+        lines << QLineF(begin + offset, end + offset);
+        lines << QLineF(begin - offset, end - offset);
+        break;
+      }
+    }
+    return lines;
+  }
+
+  QVector<QLineF> MoleculeRenderer::hashBondLines(const QPointF &begin, const QPointF &end, bool shortened)
+  {
+    qreal bondSpacing = 4.0;
+
+    QPointF vb = end - begin;
+    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
+    QPointF orthogonal(uvb.y(), -uvb.x());
+    orthogonal *= bondSpacing;
+
+    qreal positions[5] = { 0.25, 0.40, 0.55, 0.70, 0.90 };
+    int last = shortened ? 4 : 5;
+
+    QVector<QLineF> lines;
+    for (int i = 0; i < last; ++i) {
+      qreal w = positions[i];
+      lines << QLineF(begin + w * (vb + orthogonal), begin + w * (vb - orthogonal));
+    }
+    return lines;
+  }
+
+  QPolygonF MoleculeRenderer::wedgeBondPolygon(const QPointF &begin, const QPointF &end, bool beginLabel,
+      bool endLabel, bool inverted)
+  {
+    qreal bondSpacing = 4.0;
+
+    QPointF vb = end - begin;
+    QPointF uvb = vb / sqrt(vb.x()*vb.x() + vb.y()*vb.y());
+    QPointF orthogonal(uvb.y(), -uvb.x());
+    orthogonal *= bondSpacing;
+
+    QPolygonF points;
+    if (beginLabel) {
+      if (!inverted)
+        points << begin + 0.25 * (vb - orthogonal) << begin + 0.25 * (vb + orthogonal);
+      else
+        points << begin + 0.25 * vb + 0.75 * orthogonal << begin + 0.25 * vb - 0.75 * orthogonal;
+    } else {
+      if (!inverted)
+        points << begin;
+      else
+        points << begin + orthogonal << begin - orthogonal;
+    }
+    if (endLabel) {
+      if (inverted)
+        points << end - 0.25 * (vb + orthogonal) << end - 0.25 * (vb - orthogonal);
+      else
+        points << end - 0.25 * vb + 0.75 * orthogonal << end - 0.25 * vb - 0.75 * orthogonal;
+    } else {
+      if (inverted)
+        points << end;
+      else
+        points << end + orthogonal << end - orthogonal;
+    }
+    return points;
+  }
+
+  QPen MoleculeRenderer::bondPen(int type, const QColor &color)
+  {
+    QPen pen;
+    pen.setWidthF(2/*molScene->bondWidth()*/); // FIXME
+    pen.setCapStyle(Qt::RoundCap);
+    pen.setColor(color);
+    // dotted line
+    if (type == Bond::WedgeOrHash) {
+      QVector<qreal> dash;
+      dash << 2 << 5;
+      pen.setDashPattern(dash);
+    }
+    return pen;
+  }
+
+} // namespace
@@ -0,0 +1,243 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_MOLECULERENDERER_H
+#define MSK_MOLECULERENDERER_H
+
+#include <QColor>
+#include <QFont>
+#include <QImage>
+#include <QLineF>
+#include <QPen>
+#include <QPointF>
+#include <QPolygonF>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+class QPainter;
+
+namespace Molsketch {
+
+  class Molecule;
+
+  /**
+   * Draws a molecule with a QPainter, without a MolScene or any graphics items.
+   * This is used for the thumbnails in the molecule library, where creating a
+   * scene for each molecule is far too slow.
+   *
+   * The renderer works on a plain copy of the atoms and bonds, taken from a
+   * Molecule with setMolecule() or given directly with setAtoms() and
+   * setBonds(). Since the copy does not refer to the Molecule, paint() and
+   * toImage() can be called from any thread, as long as
+   * QFontDatabase::supportsThreadedFontRendering() is @c true.
+   *
+   * The static methods compute the labels and bond lines for Atom and Bond as
+   * well, so the thumbnails look the same as the molecules on the scene.
+   * Lone pairs and selections are not drawn.
+   */
+  class MoleculeRenderer
+  {
+    public:
+      /**
+       * An atom to draw.
+       */
+      struct AtomData
+      {
+        AtomData() : numImplicitHydrogens(0), charge(0), color(Qt::black)
+        {
+        }
+
+        QPointF position;
+        QString element;
+        int numImplicitHydrogens;
+        int charge;
+        QColor color;
+      };
+
+      /**
+       * A bond between two atoms, given by their index.
+       */
+      struct BondData
+      {
+        BondData() : begin(0), end(0), order(1), type(0), inRing(false), aromatic(false), color(Qt::black)
+        {
+        }
+
+        int begin;
+        int end;
+        int order;
+        int type; //!< A Bond::BondType
+        /** A double bond in a ring is drawn with its second line inside the ring. */
+        bool inRing;
+        QPointF ringCenter;
+        /** Only known for molecules that were read with OpenBabel. */
+        bool aromatic;
+        QColor color;
+      };
+
+      /**
+       * Creates a renderer without atoms.
+       */
+      MoleculeRenderer();
+      /**
+       * Creates a renderer for @p molecule, see setMolecule().
+       */
+      explicit MoleculeRenderer(Molecule *molecule);
+
+      /**
+       * Copy the atoms and bonds of @p molecule, in the coordinates of the
+       * molecule. Later changes to the molecule are not drawn.
+       */
+      void setMolecule(Molecule *molecule);
+      void setAtoms(const QVector<AtomData> &atoms);
+      void setBonds(const QVector<BondData> &bonds);
+      const QVector<AtomData>& atoms() const
+      {
+        return m_atoms;
+      }
+      const QVector<BondData>& bonds() const
+      {
+        return m_bonds;
+      }
+
+      //@name Options, with the same defaults as MolScene
+      //@{
+      QFont font() const
+      {
+        return m_font;
+      }
+      void setFont(const QFont &font)
+      {
+        m_font = font;
+      }
+      bool carbonVisible() const
+      {
+        return m_carbonVisible;
+      }
+      void setCarbonVisible(bool value)
+      {
+        m_carbonVisible = value;
+      }
+      bool chargeVisible() const
+      {
+        return m_chargeVisible;
+      }
+      void setChargeVisible(bool value)
+      {
+        m_chargeVisible = value;
+      }
+      /**
+       * @return The MolScene::RenderMode.
+       */
+      int renderMode() const
+      {
+        return m_renderMode;
+      }
+      void setRenderMode(int mode)
+      {
+        m_renderMode = mode;
+      }
+      //@}
+
+      /**
+       * @return The rect containing all atoms and their labels.
+       */
+      QRectF boundingRect() const;
+      /**
+       * Draw the molecule with @p painter.
+       */
+      void paint(QPainter *painter) const;
+      /**
+       * @return The boundingRect() drawn on a white background, @p scale pixels
+       * per unit.
+       */
+      QImage toImage(qreal scale = 1.0) const;
+
+      //@name Drawing code shared with Atom and Bond
+      //@{
+      /**
+       * @return The LabelLayout::Alignment of the label of an atom with
+       * @p numBonds bonds, where @p direction is the sum of the vectors from
+       * its neighbours to the atom.
+       */
+      static int labelAlignment(const QPointF &direction, int numBonds);
+      /**
+       * @return The label of an atom: its @p element symbol with the implicit
+       * hydrogens on the side given by @p alignment.
+       */
+      static QString labelText(const QString &element, int numImplicitHydrogens, int alignment);
+      /**
+       * @return The text for @p charge, e.g. "2+" or "-".
+       */
+      static QString chargeString(int charge);
+      /**
+       * @return The lines of a bond from @p begin to @p end, of a bond type that
+       * is drawn as lines (see Bond::drawnAsLines()). The lines stop short of
+       * the atoms with a label. Double bonds in a ring get their second line on
+       * the side of @p ringCenter, if it is given.
+       */
+      static QVector<QLineF> bondLines(const QPointF &begin, const QPointF &end, int order, int type,
+          bool beginLabel, bool endLabel, const QPointF *ringCenter = 0);
+      /**
+       * @return The lines of a hash bond, getting wider from @p begin to
+       * @p end. With @p shortened the last line is left out.
+       */
+      static QVector<QLineF> hashBondLines(const QPointF &begin, const QPointF &end, bool shortened);
+      /**
+       * @return The polygon of a wedge bond, getting wider from @p begin to
+       * @p end or the other way round if @p inverted.
+       */
+      static QPolygonF wedgeBondPolygon(const QPointF &begin, const QPointF &end, bool beginLabel,
+          bool endLabel, bool inverted);
+      /**
+       * @return The pen for a bond of @p type in @p color.
+       */
+      static QPen bondPen(int type, const QColor &color);
+      //@}
+
+    private:
+      /**
+       * @return @c true if atom @p index is drawn with a label.
+       */
+      bool hasLabel(int index) const;
+      /**
+       * @return The label alignment of atom @p index.
+       */
+      int alignment(int index) const;
+      /**
+       * Fill m_neighbours from m_bonds.
+       */
+      void updateNeighbours();
+      void drawBond(QPainter *painter, const BondData &bond) const;
+      void drawAtom(QPainter *painter, int index) const;
+
+      QVector<AtomData> m_atoms;
+      QVector<BondData> m_bonds;
+      /** The indices of the neighbours of each atom. */
+      QVector<QVector<int> > m_neighbours;
+      QFont m_font;
+      bool m_carbonVisible;
+      bool m_chargeVisible;
+      int m_renderMode;
+  };
+
+} // namespace
+
+#endif
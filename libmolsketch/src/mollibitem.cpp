@@ -23,6 +23,7 @@
 #include "molecule.h"
 #include "bond.h"
 #include "molscene.h"
+#include "moleculerenderer.h"
 #include "mollibitem.h"
 #include "fileio.h"
 
@@ -39,21 +40,8 @@ namespace Molsketch {
     m_molecule->setPos(0, 0);
 
     // Creating pixmap
-    MolScene renderScene;
-    if (molecule->atoms().size() > 20)
-      renderScene.setRenderMode(MolScene::RenderColoredSquares);
-    renderScene.addItem(m_molecule);
-    renderScene.setChargeVisible(false);
-    renderScene.setSceneRect(m_molecule->boundingRect());
-    QPixmap pixmap(int(renderScene.width()), int(renderScene.height()));
-    pixmap.fill();
-
-    // Creating and setting the painter
-    QPainter painter(&pixmap);
-    painter.setRenderHint(QPainter::Antialiasing);
-    renderScene.render(&painter);
-
-    setIcon(QIcon(pixmap));
+    MoleculeRenderer renderer(m_molecule);
+    setThumbnail(thumbnail(renderer));
 
     // Checking dir
     QDir dir;
@@ -69,14 +57,20 @@ namespace Molsketch {
    */
     if (!m_fileName.exists()) {
       m_fileName.setFile(QDir::homePath() + "/.molsketch/library/custom/" + name + ".mol");
-      Molsketch::saveFile(m_fileName.filePath(),&renderScene);
+      // saveFile() writes the molecules on a scene
+      MolScene saveScene;
+      saveScene.addItem(m_molecule);
+      Molsketch::saveFile(m_fileName.filePath(),&saveScene);
+      // Remove the molecule before destroying the scene
+      saveScene.removeItem(m_molecule);
     }
 
     setText(m_fileName.baseName());
+  }
 
-    // Remove the molecule before destroying the scene
-    renderScene.removeItem(m_molecule);
-
+  MolLibItem::MolLibItem( const QString & fileName ) : m_molecule(0), m_fileName(fileName)
+  {
+    setText(m_fileName.baseName());
   }
 
   MolLibItem::~MolLibItem( )
@@ -86,8 +80,43 @@ namespace Molsketch {
 
   Molecule* MolLibItem::getMolecule( )
   {
+    if (!m_molecule) {
+      if (m_entry.isValid())
+        m_molecule = m_entry.toMolecule();
+      else
+        m_molecule = Molsketch::loadFile(m_fileName.filePath());
+      if (!m_molecule)
+        return 0;
+      m_molecule->setPos(0, 0);
+    }
+
     // Return a copy of the m_molecule
     return new Molecule(m_molecule);
   }
 
+  void MolLibItem::setEntry(const LibraryEntry &entry)
+  {
+    // the file was modified since the molecule was loaded
+    if (m_entry.isValid() && (m_entry.modified != entry.modified)) {
+      delete m_molecule;
+      m_molecule = 0;
+    }
+    m_entry = entry;
+    setToolTip(QString("%1\n%2 (%3 g/mol)").arg(m_fileName.fileName()).arg(entry.formula)
+        .arg(entry.weight, 0, 'f', 2));
+  }
+
+  void MolLibItem::setThumbnail(const QImage &image)
+  {
+    setIcon(QIcon(QPixmap::fromImage(image)));
+  }
+
+  QImage MolLibItem::thumbnail(MoleculeRenderer &renderer)
+  {
+    if (renderer.atoms().size() > 20)
+      renderer.setRenderMode(MolScene::RenderColoredSquares);
+    renderer.setChargeVisible(false);
+    return renderer.toImage();
+  }
+
 } // namespace
@@ -23,6 +23,9 @@
 
 #include <QListWidgetItem>
 #include <QFileInfo>
+#include <QImage>
+
+#include <molsketch/libraryindex.h>
 
 namespace Molsketch {
 
@@ -44,6 +47,11 @@ class MolLibItem : public QListWidgetItem
    * @param name the name of the library item
    */
   MolLibItem(Molecule* molecule, const QString & name);
+  /** Creates a library item for the molecule in @p fileName without a
+   * thumbnail. The molecule is loaded when getMolecule() is first called.
+   * This is used by LibraryLoader, which sets the thumbnail later.
+   */
+  explicit MolLibItem(const QString & fileName);
   
   /** Destructor of the library item. */
   virtual ~MolLibItem();
@@ -51,8 +59,21 @@ class MolLibItem : public QListWidgetItem
   /** Sets a copy of @p molecule as the molecule of the library item */
   //void setMolecule(Molecule* molecule);
 
-  /** Returns a pointer to copy of molecule of the library item. */
+  /** Returns a pointer to copy of molecule of the library item, or 0 if
+   * the file could not be loaded. */
   Molecule* getMolecule();
+
+  /** Sets the index entry of the file. getMolecule() then creates the
+   * molecule from the entry instead of reading the file. */
+  void setEntry(const LibraryEntry &entry);
+  /** Returns the index entry of the file, which is invalid if there is none. */
+  const LibraryEntry& entry() const { return m_entry; }
+
+  /** Sets @p image as the icon of the library item. */
+  void setThumbnail(const QImage &image);
+  /** Draws a thumbnail for the library with @p renderer: without charges
+   * and large molecules as coloured squares. */
+  static QImage thumbnail(MoleculeRenderer &renderer);
   
   /** Returns the filename of the library item. */
   QFileInfo getFileName() { return m_fileName; };
@@ -62,6 +83,8 @@ private:
   Molecule* m_molecule;
   /** Stores the filename of the library item. */
   QFileInfo m_fileName;
+  /** Stores the index entry of the file. */
+  LibraryEntry m_entry;
 };
 
 } // namespace
@@ -25,7 +25,9 @@
 
 #include <QGraphicsSceneMouseEvent>
 #include <QPainter>
+#include <QStyleOptionGraphicsItem>
 #include <QClipboard>
+#include <QMimeData>
 #include <QApplication>
 #include <QListWidgetItem>
 #include <QTableWidgetItem>
@@ -53,6 +55,8 @@
 #include "toolgroup.h"
 #include "math2d.h"
 #include "osra.h"
+#include "tiledrenderer.h"
+#include "moleculerenderer.h"
 
 #include <openbabel/mol.h>
 #include <openbabel/atom.h>
@@ -99,12 +103,15 @@ namespace Molsketch {
     m_electronSystemsVisible = false;
     m_autoAddHydrogen = true;
     m_renderMode = RenderLabels;
+    m_batchedBondRendering = false;
+    m_moleculeCaching = true;
 
     // Prepare undo m_stack
     m_stack = new QUndoStack(this);
     connect(m_stack, SIGNAL(indexChanged(int)), this, SIGNAL(documentChange()));
     connect(m_stack, SIGNAL(indexChanged(int)), this, SIGNAL(selectionChange()));
     connect(m_stack, SIGNAL(indexChanged(int)), this, SLOT(update()));
+    connect(this, SIGNAL(atomSymbolFontChanged(const QFont &)), this, SLOT(updateAtomLabels()));
 
     // Set initial size
     QRectF sizerect(-5000,-5000,10000,10000);
@@ -151,26 +158,36 @@ namespace Molsketch {
   void MolScene::setCarbonVisible(bool value)
   {
     m_carbonVisible = value;
+    // the bonds end before the labels
+    updateAtomLabels();
   }
 
   void MolScene::setHydrogenVisible(bool value)
   {
     m_hydrogenVisible = value;
+    invalidateMoleculeCaches();
   }
 
   void MolScene::setAtomSize( qreal size )
   {
     m_atomSize = size;
+    invalidateMoleculeCaches();
   }
 	
 
 
   void MolScene::alignToGrid()
   {
-    m_stack->beginMacro(tr("aligning to grid"));
+    QList<QGraphicsItem*> molecules;
     foreach(QGraphicsItem* item,items()) 
       if (item->type() == Molecule::Type) 
-        m_stack->push(new MoveItem(item,toGrid(item->scenePos()) - item->scenePos()));
+        molecules.append(item);
+    QList<Molecule*> batch = EditBatch::molecules(molecules);
+    m_stack->beginMacro(tr("aligning to grid"));
+    EditBatch::push(m_stack, batch, true);
+    foreach(QGraphicsItem* item, molecules)
+      m_stack->push(new MoveItem(item,toGrid(item->scenePos()) - item->scenePos()));
+    EditBatch::push(m_stack, batch, false);
     m_stack->endMacro();
     update();
   }
@@ -203,12 +220,50 @@ namespace Molsketch {
     copy();
 
     // Finally delete the selected items
+    QList<Molecule*> batch = EditBatch::molecules(selectedItems());
     m_stack->beginMacro(tr("cutting items"));
+    EditBatch::push(m_stack, batch, true);
     foreach (QGraphicsItem* item, selectedItems())
       if (item->type() == Molecule::Type) m_stack->push(new DelItem(item));
+    EditBatch::push(m_stack, batch, false);
     m_stack->endMacro();
   }
 
+  /**
+   * Clipboard data with the image of a snapshot of the scene. The image is
+   * only drawn when an application asks for it, not when it is copied.
+   */
+  class SnapshotMimeData : public QMimeData
+  {
+    public:
+      SnapshotMimeData(const TiledRenderer &renderer) : m_renderer(renderer)
+      {
+      }
+
+      QStringList formats() const
+      {
+        return QStringList("application/x-qt-image");
+      }
+      bool hasFormat(const QString &mimeType) const
+      {
+        return mimeType == "application/x-qt-image";
+      }
+
+    protected:
+      QVariant retrieveData(const QString &mimeType, QVariant::Type type) const
+      {
+        if (!hasFormat(mimeType))
+          return QMimeData::retrieveData(mimeType, type);
+        if (m_image.isNull())
+          m_image = m_renderer.toImage();
+        return m_image;
+      }
+
+    private:
+      TiledRenderer m_renderer;
+      mutable QImage m_image;
+  };
+
   void MolScene::copy()
   {
     // Check if something is selected
@@ -237,9 +292,10 @@ namespace Molsketch {
     QList<QGraphicsItem*> selList(selectedItems());
     clearSelection();
 
-    // Choose the datatype
+    // Choose the datatype, the image is drawn from a snapshot when it is pasted
     //   clipboard->setText("Test");
-    clipboard->setImage(renderImage(totalRect));
+    clipboard->setMimeData(new SnapshotMimeData(TiledRenderer(this, totalRect,
+        QSize(int(totalRect.width()), int(totalRect.height())))));
     //   clipboard->mimeData( );
 
     // Restore selection
@@ -256,8 +312,12 @@ namespace Molsketch {
     /* TODO Using the system clipboard*/
 
     // Paste all items on the internal clipboard
+    QList<Molecule*> batch;
+    foreach(Molecule* item, m_clipItems) batch.append(new Molecule(item));
     m_stack->beginMacro(tr("pasting items"));
-    foreach(Molecule* item, m_clipItems) m_stack->push(new AddItem(new Molecule(item),this));
+    EditBatch::push(m_stack, batch, true);
+    foreach(Molecule* item, batch) m_stack->push(new AddItem(item,this));
+    EditBatch::push(m_stack, batch, false);
     m_stack->endMacro();
   }
 
@@ -271,8 +331,12 @@ namespace Molsketch {
       QString tmpimg = QDesktopServices::storageLocation(QDesktopServices::TempLocation) + QDir::separator() + "osra.png";
       img.save(tmpimg, "PNG", 100);
       Molecule* mol = call_osra(tmpimg);
-      if (mol) 
-        m_stack->push(new AddItem(new Molecule(mol), this));
+      if (mol) {
+        Molecule *copy = new Molecule(mol);
+        m_stack->push(new EditBatch(copy, true));
+        m_stack->push(new AddItem(copy, this));
+        m_stack->push(new EditBatch(copy, false));
+      }
       QFile::remove(tmpimg);
       m_stack->endMacro();
     }
@@ -283,6 +347,8 @@ namespace Molsketch {
     // Purge the undom_stack
     m_stack->clear();
 
+    // Drop the index before the items are deleted one by one
+    m_spatialIndex.clear();
     QGraphicsScene::clear();
 
     // Reinitialize the scene
@@ -299,34 +365,18 @@ namespace Molsketch {
 
   QImage MolScene::renderMolToImage (Molecule *mol)
   {
-		QRectF rect = mol ->boundingRect();
-		QImage image(int(rect.width()),int(rect.height()),QImage::Format_RGB32);
-		image.fill(QColor("white").rgb());
-		
-		// Creating and setting the painter
-		QPainter painter(&image);
-		painter.setRenderHint(QPainter::Antialiasing);
-		
-		// Rendering in the image and saving to file
-		render(&painter,QRectF(0,0,rect.width(),rect.height()),QRectF (mol ->mapToScene (rect.topLeft ()), mol ->mapToScene (rect.bottomRight ())));
-		return image;
-	}
-	
-	
+    // draw the molecule by itself, it doesn't have to be on the scene
+    MoleculeRenderer renderer(mol);
+    renderer.setFont(atomSymbolFont());
+    renderer.setCarbonVisible(carbonVisible());
+    renderer.setChargeVisible(chargeVisible());
+    renderer.setRenderMode(renderMode());
+    return renderer.toImage();
+  }
+
   QImage MolScene::renderImage(const QRectF &rect)
   {
-    // Creating an image
-    QImage image(int(rect.width()),int(rect.height()),QImage::Format_RGB32);
-    image.fill(QColor("white").rgb());
-
-    // Creating and setting the painter
-    QPainter painter(&image);
-    painter.setRenderHint(QPainter::Antialiasing);
-
-    // Rendering in the image and saving to file
-    render(&painter,QRectF(0,0,rect.width(),rect.height()),rect);
-
-    return image;
+    return TiledRenderer(this, rect, QSize(int(rect.width()), int(rect.height()))).toImage();
   }
 
   void MolScene::addMolecule(Molecule* mol)
@@ -334,8 +384,10 @@ namespace Molsketch {
     Q_CHECK_PTR(mol);
     if (!mol) return;
     m_stack->beginMacro(tr("add molecule"));
+    m_stack->push(new EditBatch(mol, true));
     m_stack->push(new AddItem(mol,this)); 
     if (mol->canSplit()) m_stack->push(new SplitMol(mol));
+    m_stack->push(new EditBatch(mol, false));
     m_stack->endMacro();
   }
 
@@ -399,9 +451,76 @@ namespace Molsketch {
     return m_renderMode;
   }
 
+  // below this level of detail the labels are too small to read
+  static const qreal reducedDetailBelow = 0.4;
+  static const qreal fullDetailAbove = 0.5;
+
+  MolScene::DetailLevel MolScene::detailLevel(const QStyleOptionGraphicsItem *option, QPainter *painter, const QWidget *widget)
+  {
+    // the other render modes have their own simplified drawing
+    if (m_renderMode != RenderLabels)
+      return FullDetail;
+    qreal lod = levelOfDetail(option, painter);
+    if (!widget)
+      return (lod < reducedDetailBelow) ? ReducedDetail : FullDetail;
+
+    // the views are zoomed independently, the level is dropped with the view
+    watchView(widget);
+    DetailLevel &level = m_detailLevels[widget];
+    if (level == FullDetail && lod < reducedDetailBelow)
+      level = ReducedDetail;
+    else if (level == ReducedDetail && lod > fullDetailAbove)
+      level = FullDetail;
+    return level;
+  }
+
+  void MolScene::watchView(const QWidget *widget)
+  {
+    if (!widget || m_views.contains(widget))
+      return;
+    m_views.insert(widget, widget);
+    connect(widget, SIGNAL(destroyed(QObject*)), this, SLOT(viewDestroyed(QObject*)));
+  }
+
+  void MolScene::viewDestroyed(QObject *object)
+  {
+    // the widget is half destroyed, only its address is used
+    const QWidget *widget = m_views.take(object);
+    if (!widget)
+      return;
+    m_detailLevels.remove(widget);
+    foreach (QGraphicsItem *item, items())
+      if (item->type() == Molecule::Type)
+        static_cast<Molecule*>(item)->removeView(widget);
+  }
+
+  qreal MolScene::levelOfDetail(const QStyleOptionGraphicsItem *option, QPainter *painter)
+  {
+#if QT_VERSION >= 0x040600
+    return option->levelOfDetailFromTransform(painter->worldTransform());
+#else
+    Q_UNUSED(painter);
+    return option->levelOfDetail;
+#endif
+  }
+
   void MolScene::setRenderMode(MolScene::RenderMode mode)
   {
     m_renderMode = mode;
+    invalidateMoleculeCaches();
+  }
+
+  void MolScene::setBatchedBondRendering(bool value)
+  {
+    m_batchedBondRendering = value;
+    invalidateMoleculeCaches();
+    update();
+  }
+
+  void MolScene::setMoleculeCaching(bool value)
+  {
+    m_moleculeCaching = value;
+    invalidateMoleculeCaches();
   }
 
   QPointF MolScene::toGrid(const QPointF &position)
@@ -417,6 +536,14 @@ namespace Molsketch {
 
   Molecule* MolScene::moleculeAt(const QPointF &pos)
   {
+    // Check the atoms and bonds near this position first
+    Atom *atom = atomAt(pos);
+    if (atom && atom->molecule())
+      return atom->molecule();
+    Bond *bond = bondAt(pos);
+    if (bond && bond->molecule())
+      return bond->molecule();
+
     // Check if there is a molecule at this position
     foreach(QGraphicsItem* item,items(pos))
       if (item->type() == Molecule::Type) return dynamic_cast<Molecule*>(item);
@@ -435,22 +562,41 @@ namespace Molsketch {
 
   Atom* MolScene::atomAt(const QPointF &pos)
   {
-    // Check if there is a atom at this position
-    foreach(QGraphicsItem* item,items(pos))
-      if (item->type() == Atom::Type) return dynamic_cast<Atom*>(item);
+    // Check the atoms with a label that could contain this position
+    Atom *nearest = 0;
+    qreal nearestDistance = 0.0;
+    foreach (Atom *atom, m_spatialIndex.atomsNear(pos, m_spatialIndex.atomReach())) {
+      if (!atom->isVisible() || !atom->contains(atom->mapFromScene(pos)))
+        continue;
+      QLineF line(atom->scenePos(), pos);
+      if (!nearest || line.length() < nearestDistance) {
+        nearest = atom;
+        nearestDistance = line.length();
+      }
+    }
 
-    // Can't find an atom at that location
-    return 0;
+    // NULL if there is no atom at that location
+    return nearest;
   }
 
   Bond* MolScene::bondAt(const QPointF &pos)
   {
-    // Check if there is a bond at this position
-    foreach( QGraphicsItem* item,items(pos))
-      if (item->type() == Bond::Type) return dynamic_cast<Bond*>(item);
+    // Check the bonds with a shape that could contain this position
+    Bond *nearest = 0;
+    qreal nearestDistance = 0.0;
+    foreach (Bond *bond, m_spatialIndex.bondsNear(pos, Bond::shapeHalfWidth())) {
+      if (!bond->isVisible() || !bond->contains(bond->mapFromScene(pos)))
+        continue;
+      qreal distance = SpatialIndex::distanceToSegment(pos,
+          QLineF(bond->beginAtom()->scenePos(), bond->endAtom()->scenePos()));
+      if (!nearest || distance < nearestDistance) {
+        nearest = bond;
+        nearestDistance = distance;
+      }
+    }
 
-    // Else return NULL
-    return 0;
+    // NULL if there is no bond at that location
+    return nearest;
   }
 
   // Event handlers
@@ -585,11 +731,14 @@ namespace Molsketch {
     //   Bond* bond;
     //   Molecule* mol;
     QSet<Molecule*> molSet;
+    QList<Molecule*> batch;
 
     switch (keyEvent->key())
     {
       case Qt::Key_Delete:
+        batch = EditBatch::molecules(selectedItems());
         m_stack->beginMacro(tr("removing item(s)"));
+        EditBatch::push(m_stack, batch, true);
         // First delete all selected molecules
         foreach (item, selectedItems())
           if (item->type() == Molecule::Type)
@@ -625,11 +774,14 @@ namespace Molsketch {
         // Finally delete all the residues
         foreach (item, selectedItems()) m_stack->push(new DelItem(item));
 
+        EditBatch::push(m_stack, batch, false);
         m_stack->endMacro();
         keyEvent->accept();
         break;
 		case Qt::Key_Backspace:
+			batch = EditBatch::molecules(selectedItems());
 			m_stack->beginMacro(tr("removing item(s)"));
+			EditBatch::push(m_stack, batch, true);
 			// First delete all selected molecules
 			foreach (item, selectedItems())
 			if (item->type() == Molecule::Type)
@@ -665,36 +817,49 @@ namespace Molsketch {
 			// Finally delete all the residues
 			foreach (item, selectedItems()) m_stack->push(new DelItem(item));
 			
+			EditBatch::push(m_stack, batch, false);
 			m_stack->endMacro();
 			keyEvent->accept();
 			break;
 			
 			
       case Qt::Key_Up:
+        batch = EditBatch::molecules(selectedItems());
         m_stack->beginMacro("moving item(s)");
+        EditBatch::push(m_stack, batch, true);
         foreach (item, selectedItems())
           m_stack->push(new MoveItem(item,QPointF(0,-10)));
+        EditBatch::push(m_stack, batch, false);
         m_stack->endMacro();
         keyEvent->accept();
         break;
       case Qt::Key_Down:
+        batch = EditBatch::molecules(selectedItems());
         m_stack->beginMacro("moving item(s)");
+        EditBatch::push(m_stack, batch, true);
         foreach (item, selectedItems())
           m_stack->push(new MoveItem(item,QPointF(0,10)));
+        EditBatch::push(m_stack, batch, false);
         m_stack->endMacro();
         keyEvent->accept();
         break;
       case Qt::Key_Left:
+        batch = EditBatch::molecules(selectedItems());
         m_stack->beginMacro("moving item(s)");
+        EditBatch::push(m_stack, batch, true);
         foreach (item, selectedItems())
           m_stack->push(new MoveItem(item,QPointF(-10,0)));
+        EditBatch::push(m_stack, batch, false);
         m_stack->endMacro();
         keyEvent->accept();
         break;
       case Qt::Key_Right:
+        batch = EditBatch::molecules(selectedItems());
         m_stack->beginMacro("moving item(s)");
+        EditBatch::push(m_stack, batch, true);
         foreach (item, selectedItems())
           m_stack->push(new MoveItem(item,QPointF(10,0)));
+        EditBatch::push(m_stack, batch, false);
         m_stack->endMacro();
         keyEvent->accept();
         break;
@@ -713,9 +878,8 @@ namespace Molsketch {
   QImage MolScene::toImage (OpenBabel::OBMol *obmol)
   {
     Molecule *mol = toMol(obmol);
-		QImage im = renderMolToImage (mol);
-		removeItem (mol);
-		delete mol;
+    QImage im = renderMolToImage (mol);
+    delete mol;
 		return im;
 	}
 
@@ -725,6 +889,8 @@ namespace Molsketch {
     qreal k = 40/*bondLength()*/ / 1.5; // FIXME
 		Molecule *mol = new Molecule ();
 		mol->setPos(QPointF(0,0));
+		// defer the ring perception and label layout until all bonds are added
+		mol->beginBatch();
 		qreal x = 0;
 		qreal y = 0;
 		OpenBabel::OBAtom *first_atom = obmol ->GetAtom (1);
@@ -796,6 +962,7 @@ namespace Molsketch {
 			if (a2 ->element () == "H") continue;
 			mol ->addBond (bonds[i]);
 		}		
+		mol->endBatch();
 		//int nu = 0;
 		//QList <Atom *> atts = mol ->atoms ();
 
@@ -825,7 +992,24 @@ namespace Molsketch {
 
   void MolScene::setAtomSymbolFont(const QFont & font)
   {
+    if (font == m_atomSymbolFont)
+      return;
     m_atomSymbolFont = font;
+    emit atomSymbolFontChanged(font);
+  }
+
+  void MolScene::updateAtomLabels()
+  {
+    foreach (QGraphicsItem *item, items())
+      if (item->type() == Atom::Type)
+        dynamic_cast<Atom*>(item)->updateLabel();
+  }
+
+  void MolScene::invalidateMoleculeCaches()
+  {
+    foreach (QGraphicsItem *item, items())
+      if (item->type() == Molecule::Type)
+        dynamic_cast<Molecule*>(item)->invalidateCache();
   }
 
 
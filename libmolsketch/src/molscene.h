@@ -24,11 +24,15 @@
 
 #include <QGraphicsScene>
 #include <QUndoCommand>
+#include <QHash>
 
 #include <molsketch/bond.h>
+#include <molsketch/spatialindex.h>
 
 class QString;
 class QImage;
+class QPainter;
+class QStyleOptionGraphicsItem;
 class QListWidgetItem;
 class QTableWidgetItem;
 class QUndoStack;
@@ -88,6 +92,16 @@ namespace Molsketch {
         RenderColoredWireframe,
       };
 
+      /**
+       * The level of detail of the atoms and bonds in RenderLabels mode. It
+       * follows the zoom level, see detailLevel().
+       */
+      enum DetailLevel
+      {
+        FullDetail, //!< labels, hydrogens, charges and all lines of multiple bonds
+        ReducedDetail, //!< element coloured dots for the labels and one line per bond
+      };
+
       /**
        * Creates a new MolScene with @p toolGroup and @p parent. ToolGroup may be 0 if
        * the scene is only used for rendering. When interactive behaviour is required,
@@ -151,9 +165,60 @@ namespace Molsketch {
        * Set the RenderMode.
        */
       void setRenderMode(RenderMode mode);
+      /**
+       * @return The level of detail to paint at with @p painter and the @p option
+       * and @p widget passed to QGraphicsItem::paint(). In a view, the level only
+       * changes once the zoom level is past the threshold by a margin, so items
+       * do not flicker between the levels when zooming around it. Each view keeps
+       * its own level. Without a @p widget, e.g. when rendering to an image, the
+       * level follows the zoom level directly.
+       */
+      DetailLevel detailLevel(const QStyleOptionGraphicsItem *option, QPainter *painter, const QWidget *widget = 0);
+      /**
+       * Watch the view @p widget that items were painted in, so its level of
+       * detail and the data the molecules keep for it are dropped when it is
+       * destroyed, see Molecule::removeView().
+       */
+      void watchView(const QWidget *widget);
+      /**
+       * @return The size of one unit of item coordinates in pixels when painting
+       * with @p painter and the @p option passed to QGraphicsItem::paint().
+       */
+      static qreal levelOfDetail(const QStyleOptionGraphicsItem *option, QPainter *painter);
+      /**
+       * @return @c true if the molecules draw their plain bonds, see setBatchedBondRendering().
+       */
+      bool batchedBondRendering() const
+      {
+        return m_batchedBondRendering;
+      }
+      /**
+       * Set whether each molecule draws its plain single, double and triple bonds
+       * at once from cached paths instead of letting every bond draw itself. This
+       * is faster for large drawings. The bonds are still used for selecting them.
+       * Disabled by default.
+       */
+      void setBatchedBondRendering(bool value);
+      /**
+       * @return @c true if the molecules are cached in the views, see setMoleculeCaching().
+       */
+      bool moleculeCaching() const
+      {
+        return m_moleculeCaching;
+      }
+      /**
+       * Set whether each molecule is drawn in the views from a pixmap of itself
+       * while it is not edited, so scrolling does not draw all atoms and bonds
+       * again. Enabled by default.
+       */
+      void setMoleculeCaching(bool value);
 
       // Commands  
-      /** Renders the @p rect on the scene in a image. */
+      /**
+       * Renders the @p rect on the scene in a image. The whole image is kept in
+       * memory and drawn in the calling thread; to write large images to a file
+       * use exportSnapshot() with an ExportJob instead.
+       */
       QImage renderImage(const QRectF &rect);
 
       QImage renderMolToImage (Molecule *mol);
@@ -167,6 +232,7 @@ namespace Molsketch {
       void setChargeVisible(bool value)
       {
         m_chargeVisible = value;
+        updateAtomLabels();
       }
       /**
        * Set whether electron systems are drawn.
@@ -174,6 +240,7 @@ namespace Molsketch {
       void setElectronSystemsVisible(bool value)
       {
         m_electronSystemsVisible = value;
+        invalidateMoleculeCaches();
       }
       /** Sets whether hydrogens are automaticly added. */
       void setAutoAddHydrogen(bool value) { m_autoAddHydrogen = value; };
@@ -191,12 +258,21 @@ namespace Molsketch {
         return m_toolGroup;
       }
 
+      /**
+       * The spatial index of the atoms and bonds on the scene, used by atomAt(),
+       * bondAt() and moleculeAt(). Kept up to date by the atoms and bonds.
+       */
+      SpatialIndex* spatialIndex()
+      {
+        return &m_spatialIndex;
+      }
+
       // Advanced queries
-      /** Returns the first molecule at position @p pos or NULL if none. */
+      /** Returns the molecule at position @p pos or NULL if none. */
       Molecule* moleculeAt(const QPointF &pos);
-      /** Returns the first atom at position @p pos or NULL if none. */
+      /** Returns the atom at position @p pos or NULL if none. If the labels of several atoms contain @p pos, the one with the nearest centre is returned. */
       Atom* atomAt(const QPointF &pos);
-      /** Returns the first bond at position @p pos or NULL if none. */
+      /** Returns the bond at position @p pos or NULL if none. If several bonds contain @p pos, the nearest one is returned. */
       Bond* bondAt(const QPointF &pos);
 
       bool textEditItemAt (const QPointF &pos) ;
@@ -215,6 +291,8 @@ namespace Molsketch {
       void documentChange( );
       /** Signal emitted if the selection on the scene changes. */
       void selectionChange( );
+      /** Signal emitted if the atom symbol font changes. */
+      void atomSymbolFontChanged(const QFont &font);
       //  /** Signal emitted if a new molecule is added to the scene. */
       //   void newMolecule(QPointF,QString);
       /** 
@@ -273,6 +351,14 @@ namespace Molsketch {
       QColor color() const;
 
 
+    private slots:
+      /** Slot to lay out the labels of all atoms again, e.g. in a new font. */
+      void updateAtomLabels();
+      /** Slot to drop the caches of all molecules, after changing how they are drawn. */
+      void invalidateMoleculeCaches();
+      /** Slot to drop the data of a view passed to watchView() when @p object is destroyed. */
+      void viewDestroyed(QObject *object);
+
     private:
 
       // Global properties
@@ -312,6 +398,10 @@ namespace Molsketch {
       bool m_electronSystemsVisible; //!< Stores whether electron systems should be visible.
 
       RenderMode m_renderMode;
+      QHash<const QWidget*, DetailLevel> m_detailLevels; //!< The level of detail of each view, see detailLevel().
+      QHash<const QObject*, const QWidget*> m_views; //!< The watched views by their QObject, see watchView().
+      bool m_batchedBondRendering; //!< Stores whether the molecules draw their plain bonds.
+      bool m_moleculeCaching; //!< Stores whether the molecules are cached in the views.
 
       QColor m_color;
 
@@ -324,6 +414,9 @@ namespace Molsketch {
       /** The undo stack of the commands used to edit the scene. */
       QUndoStack * m_stack;
 
+      /** Grid of the atom centres and bond segments for hit-testing. */
+      SpatialIndex m_spatialIndex;
+
       // Event handlers
 
       /** Event handler for mouse presses in text mode. */
@@ -0,0 +1,214 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include "similarity.h"
+
+namespace Molsketch {
+
+  // the smallest number of rows worth a block of its own
+  static const int minBlockSize = 4096;
+  // the size of a cache line in words
+  static const int cacheLineWords = 64 / sizeof(quint32);
+
+  /**
+   * Functor to rank the blocks of a FingerprintTable with QtConcurrent::mapped().
+   */
+  struct RankBlock
+  {
+    typedef QList<FingerprintTable::Hit> result_type;
+
+    RankBlock(const FingerprintTable *table, const QVector<quint32> &query, int count)
+        : table(table), query(query), queryBits(FingerprintTable::popCount(query.constData(), query.size())),
+        count(count)
+    {
+    }
+    QList<FingerprintTable::Hit> operator()(const QPair<int, int> &rows) const
+    {
+      return table->rankRows(query.constData(), queryBits, rows.first, rows.second, count);
+    }
+
+    const FingerprintTable *table;
+    QVector<quint32> query;
+    int queryBits;
+    int count;
+  };
+
+  /**
+   * Helper function to keep the @p count best hits in @p heap. The worst of
+   * them is at the front, so a hit only has to beat that one to get in.
+   */
+  static void offer(QVector<FingerprintTable::Hit> &heap, const FingerprintTable::Hit &hit, int count)
+  {
+    if (heap.size() < count) {
+      heap.append(hit);
+      std::push_heap(heap.begin(), heap.end());
+    } else if (hit < heap.first()) {
+      std::pop_heap(heap.begin(), heap.end());
+      heap.last() = hit;
+      std::push_heap(heap.begin(), heap.end());
+    }
+  }
+
+  /**
+   * Helper function to get the hits of @p heap, best first.
+   */
+  static QList<FingerprintTable::Hit> sorted(QVector<FingerprintTable::Hit> &heap)
+  {
+    std::sort_heap(heap.begin(), heap.end());
+    QList<FingerprintTable::Hit> result;
+    for (int i = 0; i < heap.size(); ++i)
+      result.append(heap.at(i));
+    return result;
+  }
+
+  FingerprintTable::FingerprintTable(int numWords) : m_numWords(numWords),
+      m_stride((numWords + cacheLineWords - 1) / cacheLineWords * cacheLineWords), m_capacity(0),
+      m_memory(0), m_rows(0)
+  {
+    Q_ASSERT(numWords > 0);
+  }
+
+  FingerprintTable::~FingerprintTable()
+  {
+    std::free(m_memory);
+  }
+
+  void FingerprintTable::clear()
+  {
+    m_bitCounts.clear();
+  }
+
+  void FingerprintTable::reserve(int size)
+  {
+    if (size <= m_capacity)
+      return;
+    // one cache line more, to start the rows at the next one
+    quint32 *memory = static_cast<quint32*>(std::malloc((size * m_stride + cacheLineWords) * sizeof(quint32)));
+    Q_CHECK_PTR(memory);
+    quint32 *rows = memory + (cacheLineWords - quintptr(memory) / sizeof(quint32) % cacheLineWords) % cacheLineWords;
+    if (m_rows)
+      std::memcpy(rows, m_rows, this->size() * m_stride * sizeof(quint32));
+    std::free(m_memory);
+    m_memory = memory;
+    m_rows = rows;
+    m_capacity = size;
+    m_bitCounts.reserve(size);
+  }
+
+  int FingerprintTable::append(const QVector<quint32> &fingerprint)
+  {
+    if (size() == m_capacity)
+      reserve(qMax(64, 2 * m_capacity));
+    quint32 *row = m_rows + size() * m_stride;
+    // the padding is cleared as well
+    std::memset(row, 0, m_stride * sizeof(quint32));
+    if (fingerprint.size() == m_numWords) {
+      std::memcpy(row, fingerprint.constData(), m_numWords * sizeof(quint32));
+      m_bitCounts.append(popCount(row, m_numWords));
+    } else
+      m_bitCounts.append(0);
+    return m_bitCounts.size() - 1;
+  }
+
+  int FingerprintTable::popCount(const quint32 *words, int numWords)
+  {
+    int count = 0;
+    for (int i = 0; i < numWords; ++i)
+      count += popCount(words[i]);
+    return count;
+  }
+
+  qreal FingerprintTable::tanimoto(const QVector<quint32> &a, const QVector<quint32> &b)
+  {
+    if (a.size() != b.size())
+      return 0.0;
+    int common = 0, either = 0;
+    for (int i = 0; i < a.size(); ++i) {
+      common += popCount(a.at(i) & b.at(i));
+      either += popCount(a.at(i) | b.at(i));
+    }
+    return either ? qreal(common) / either : 0.0;
+  }
+
+  qreal FingerprintTable::similarity(int index, const QVector<quint32> &query) const
+  {
+    Q_ASSERT((index >= 0) && (index < size()));
+    if (query.size() != m_numWords)
+      return 0.0;
+    const quint32 *words = row(index);
+    int common = 0;
+    for (int i = 0; i < m_numWords; ++i)
+      common += popCount(words[i] & query.at(i));
+    // |a or b| = |a| + |b| - |a and b|
+    int either = m_bitCounts.at(index) + popCount(query.constData(), m_numWords) - common;
+    return either ? qreal(common) / either : 0.0;
+  }
+
+  QList<FingerprintTable::Hit> FingerprintTable::rankRows(const quint32 *query, int queryBits, int begin,
+      int end, int count) const
+  {
+    QVector<Hit> heap;
+    heap.reserve(count);
+    const int *bitCounts = m_bitCounts.constData();
+    for (int index = begin; index < end; ++index) {
+      const quint32 *words = row(index);
+      int common = 0;
+      for (int i = 0; i < m_numWords; ++i)
+        common += popCount(words[i] & query[i]);
+      if (common)
+        offer(heap, Hit(index, qreal(common) / (bitCounts[index] + queryBits - common)), count);
+    }
+
+    return sorted(heap);
+  }
+
+  QList<FingerprintTable::Hit> FingerprintTable::rank(const QVector<quint32> &query, int count) const
+  {
+    if ((query.size() != m_numWords) || (count <= 0) || !size())
+      return QList<Hit>();
+
+    // a block per thread, unless the table is small
+    int numBlocks = qBound(1, size() / minBlockSize, qMax(1, QThread::idealThreadCount()));
+    RankBlock rankBlock(this, query, count);
+    if (numBlocks == 1)
+      return rankBlock(qMakePair(0, size()));
+
+    QList<QPair<int, int> > blocks;
+    for (int i = 0; i < numBlocks; ++i)
+      blocks.append(qMakePair(i * size() / numBlocks, (i + 1) * size() / numBlocks));
+    QList<QList<Hit> > blockHits = QtConcurrent::blockingMapped<QList<QList<Hit> > >(blocks, rankBlock);
+
+    // the best of the best of each block
+    QVector<Hit> heap;
+    heap.reserve(count);
+    foreach (const QList<Hit> &block, blockHits)
+      foreach (const Hit &hit, block)
+        offer(heap, hit, count);
+    return sorted(heap);
+  }
+
+} // namespace
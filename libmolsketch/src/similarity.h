@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef MSK_SIMILARITY_H
+#define MSK_SIMILARITY_H
+
+#include <QList>
+#include <QVector>
+
+namespace Molsketch {
+
+  struct RankBlock;
+
+  /**
+   * A table of fingerprints to rank by Tanimoto similarity.
+   *
+   * The fingerprints are stored one after the other in a single array, with
+   * the number of bits set in each counted when it is appended. The array and
+   * each row start at a cache line, so a row of the 1024 bit FP2 fingerprint
+   * takes exactly two lines. Comparing a query to a row then takes one pass
+   * over numWords() words, counting the bits the two have in common. rank()
+   * splits the table in blocks that are ranked on the global QThreadPool,
+   * each keeping only its best hits.
+   */
+  class FingerprintTable
+  {
+    public:
+      /**
+       * A row of the table and its similarity to the query.
+       */
+      struct Hit
+      {
+        Hit(int index = -1, qreal similarity = 0.0) : index(index), similarity(similarity)
+        {
+        }
+        /**
+         * Order by descending similarity, then by index.
+         */
+        bool operator<(const Hit &other) const
+        {
+          if (similarity != other.similarity)
+            return similarity > other.similarity;
+          return index < other.index;
+        }
+
+        int index;
+        qreal similarity;
+      };
+
+      /**
+       * Creates a table of fingerprints of @p numWords 32 bit words. The
+       * default is the 1024 bits of the OpenBabel FP2 fingerprint.
+       */
+      explicit FingerprintTable(int numWords = 32);
+      ~FingerprintTable();
+
+      int numWords() const
+      {
+        return m_numWords;
+      }
+      /**
+       * @return The number of fingerprints.
+       */
+      int size() const
+      {
+        return m_bitCounts.size();
+      }
+      void clear();
+      void reserve(int size);
+      /**
+       * Append @p fingerprint. A fingerprint of another size is appended
+       * without bits, so it is never similar.
+       *
+       * @return The index of the fingerprint.
+       */
+      int append(const QVector<quint32> &fingerprint);
+
+      /**
+       * @return The Tanimoto similarity of fingerprint @p index to @p query.
+       */
+      qreal similarity(int index, const QVector<quint32> &query) const;
+      /**
+       * @return The @p count fingerprints most similar to @p query, most
+       * similar first. Fingerprints without bits in common with the query
+       * are left out.
+       */
+      QList<Hit> rank(const QVector<quint32> &query, int count) const;
+
+      /**
+       * @return The number of bits set in @p word.
+       *
+       * GCC and Clang use their builtin, which is the popcnt instruction when
+       * it is enabled for the target (ENABLE_POPCNT, i.e. -mpopcnt, or an
+       * -march with SSE4.2) and a library call otherwise. Other compilers get
+       * the portable bit counting below.
+       */
+      static int popCount(quint32 word)
+      {
+#if defined(__GNUC__)
+        return __builtin_popcount(word);
+#else
+        word = word - ((word >> 1) & 0x55555555);
+        word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+        return (((word + (word >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+      }
+      /**
+       * @return The number of bits set in the @p numWords words of @p words.
+       */
+      static int popCount(const quint32 *words, int numWords);
+      /**
+       * @return The Tanimoto similarity of @p a and @p b: the number of bits
+       * set in both over the number of bits set in either. This is 0 if
+       * neither has a bit set or if their sizes differ.
+       */
+      static qreal tanimoto(const QVector<quint32> &a, const QVector<quint32> &b);
+
+    private:
+      Q_DISABLE_COPY(FingerprintTable)
+      friend struct RankBlock;
+
+      /**
+       * @return The words of row @p index.
+       */
+      const quint32* row(int index) const
+      {
+        return m_rows + index * m_stride;
+      }
+
+      /**
+       * @return The @p count rows from @p begin to @p end most similar to
+       * @p query, which has @p queryBits bits set, sorted.
+       */
+      QList<Hit> rankRows(const quint32 *query, int queryBits, int begin, int end, int count) const;
+
+      int m_numWords;
+      /** The words from one row to the next, numWords() rounded up to whole cache lines. */
+      int m_stride;
+      /** The number of rows there is room for. */
+      int m_capacity;
+      /** The allocated memory, m_rows is the first cache line in it. */
+      quint32 *m_memory;
+      /** The words of all fingerprints, size() times m_stride. */
+      quint32 *m_rows;
+      /** The number of bits set in each fingerprint. */
+      QVector<int> m_bitCounts;
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cmath>
+
+#include "spatialindex.h"
+
+#include "atom.h"
+#include "bond.h"
+
+namespace Molsketch {
+
+  SpatialIndex::SpatialIndex(qreal cellSize) : m_cellSize(cellSize)
+  {
+    Q_ASSERT(cellSize > 0.0);
+  }
+
+  void SpatialIndex::clear()
+  {
+    m_atomCells.clear();
+    m_atomPositions.clear();
+    m_atomReaches.clear();
+    m_reachCounts.clear();
+    m_bondCells.clear();
+    m_bondLines.clear();
+  }
+
+  SpatialIndex::Cell SpatialIndex::cellAt(const QPointF &pos) const
+  {
+    return qMakePair(static_cast<int>(floor(pos.x() / m_cellSize)),
+                     static_cast<int>(floor(pos.y() / m_cellSize)));
+  }
+
+  /**
+   * Helper function for the largest distance from @p center to a corner of
+   * @p rect.
+   */
+  static qreal reach(const QPointF &center, const QRectF &rect)
+  {
+    qreal dx = qMax(qAbs(rect.left() - center.x()), qAbs(rect.right() - center.x()));
+    qreal dy = qMax(qAbs(rect.top() - center.y()), qAbs(rect.bottom() - center.y()));
+    return sqrt(dx * dx + dy * dy);
+  }
+
+  void SpatialIndex::setAtomReach(Atom *atom, qreal value)
+  {
+    QHash<Atom*, qreal>::iterator old = m_atomReaches.find(atom);
+    if (old != m_atomReaches.end()) {
+      if (old.value() == value)
+        return;
+      QMap<qreal, int>::iterator count = m_reachCounts.find(old.value());
+      if (!--count.value())
+        m_reachCounts.erase(count);
+      old.value() = value;
+    } else {
+      m_atomReaches.insert(atom, value);
+    }
+    ++m_reachCounts[value];
+  }
+
+  void SpatialIndex::updateAtom(Atom *atom)
+  {
+    QPointF pos = atom->scenePos();
+    setAtomReach(atom, reach(pos, atom->sceneBoundingRect()));
+
+    QHash<Atom*, QPointF>::iterator old = m_atomPositions.find(atom);
+    if (old != m_atomPositions.end()) {
+      if (old.value() == pos)
+        return;
+      Cell oldCell = cellAt(old.value());
+      Cell newCell = cellAt(pos);
+      old.value() = pos;
+      // moving within a cell is the common case while dragging
+      if (oldCell == newCell)
+        return;
+      QHash<Cell, QList<Atom*> >::iterator cell = m_atomCells.find(oldCell);
+      cell.value().removeOne(atom);
+      if (cell.value().isEmpty())
+        m_atomCells.erase(cell);
+      m_atomCells[newCell].append(atom);
+      return;
+    }
+
+    m_atomPositions.insert(atom, pos);
+    m_atomCells[cellAt(pos)].append(atom);
+  }
+
+  void SpatialIndex::removeAtom(Atom *atom)
+  {
+    QHash<Atom*, QPointF>::iterator old = m_atomPositions.find(atom);
+    if (old == m_atomPositions.end())
+      return;
+
+    QHash<Cell, QList<Atom*> >::iterator cell = m_atomCells.find(cellAt(old.value()));
+    cell.value().removeOne(atom);
+    if (cell.value().isEmpty())
+      m_atomCells.erase(cell);
+    m_atomPositions.erase(old);
+
+    QMap<qreal, int>::iterator count = m_reachCounts.find(m_atomReaches.take(atom));
+    if (!--count.value())
+      m_reachCounts.erase(count);
+  }
+
+  void SpatialIndex::setBondCells(Bond *bond, const QLineF &line, bool add)
+  {
+    Cell first = cellAt(QPointF(qMin(line.x1(), line.x2()), qMin(line.y1(), line.y2())));
+    Cell last = cellAt(QPointF(qMax(line.x1(), line.x2()), qMax(line.y1(), line.y2())));
+
+    for (int i = first.first; i <= last.first; ++i)
+      for (int j = first.second; j <= last.second; ++j) {
+        if (add) {
+          m_bondCells[qMakePair(i, j)].append(bond);
+          continue;
+        }
+        QHash<Cell, QList<Bond*> >::iterator cell = m_bondCells.find(qMakePair(i, j));
+        if (cell == m_bondCells.end())
+          continue;
+        cell.value().removeOne(bond);
+        if (cell.value().isEmpty())
+          m_bondCells.erase(cell);
+      }
+  }
+
+  void SpatialIndex::updateBond(Bond *bond)
+  {
+    QLineF line(bond->beginAtom()->scenePos(), bond->endAtom()->scenePos());
+
+    QHash<Bond*, QLineF>::iterator old = m_bondLines.find(bond);
+    if (old != m_bondLines.end()) {
+      if (old.value() == line)
+        return;
+      setBondCells(bond, old.value(), false);
+      old.value() = line;
+    } else {
+      m_bondLines.insert(bond, line);
+    }
+    setBondCells(bond, line, true);
+  }
+
+  void SpatialIndex::removeBond(Bond *bond)
+  {
+    QHash<Bond*, QLineF>::iterator old = m_bondLines.find(bond);
+    if (old == m_bondLines.end())
+      return;
+
+    setBondCells(bond, old.value(), false);
+    m_bondLines.erase(old);
+  }
+
+  qreal SpatialIndex::distanceToSegment(const QPointF &pos, const QLineF &line)
+  {
+    QPointF d = line.p2() - line.p1();
+    qreal lengthSquared = d.x() * d.x() + d.y() * d.y();
+    qreal t = 0.0;
+    if (lengthSquared > 0.0) {
+      t = ((pos.x() - line.x1()) * d.x() + (pos.y() - line.y1()) * d.y()) / lengthSquared;
+      t = qBound(qreal(0.0), t, qreal(1.0));
+    }
+    QPointF v = pos - (line.p1() + t * d);
+    return sqrt(v.x() * v.x() + v.y() * v.y());
+  }
+
+  QList<Atom*> SpatialIndex::atomsNear(const QPointF &pos, qreal radius) const
+  {
+    QList<Atom*> result;
+    Cell first = cellAt(pos - QPointF(radius, radius));
+    Cell last = cellAt(pos + QPointF(radius, radius));
+    qreal radiusSquared = radius * radius;
+
+    for (int i = first.first; i <= last.first; ++i)
+      for (int j = first.second; j <= last.second; ++j) {
+        QHash<Cell, QList<Atom*> >::const_iterator cell = m_atomCells.constFind(qMakePair(i, j));
+        if (cell == m_atomCells.constEnd())
+          continue;
+        foreach (Atom *atom, cell.value()) {
+          QPointF v = m_atomPositions.value(atom) - pos;
+          if (v.x() * v.x() + v.y() * v.y() <= radiusSquared)
+            result.append(atom);
+        }
+      }
+
+    return result;
+  }
+
+  QList<Bond*> SpatialIndex::bondsNear(const QPointF &pos, qreal radius) const
+  {
+    QList<Bond*> result;
+    Cell first = cellAt(pos - QPointF(radius, radius));
+    Cell last = cellAt(pos + QPointF(radius, radius));
+
+    for (int i = first.first; i <= last.first; ++i)
+      for (int j = first.second; j <= last.second; ++j) {
+        QHash<Cell, QList<Bond*> >::const_iterator cell = m_bondCells.constFind(qMakePair(i, j));
+        if (cell == m_bondCells.constEnd())
+          continue;
+        foreach (Bond *bond, cell.value()) {
+          // a bond can be in several of the cells
+          if (result.contains(bond))
+            continue;
+          if (distanceToSegment(pos, m_bondLines.value(bond)) <= radius)
+            result.append(bond);
+        }
+      }
+
+    return result;
+  }
+
+  Atom* SpatialIndex::nearestAtom(const QPointF &pos, qreal radius) const
+  {
+    Atom *nearest = 0;
+    qreal nearestDistance = radius * radius;
+    foreach (Atom *atom, atomsNear(pos, radius)) {
+      QPointF v = m_atomPositions.value(atom) - pos;
+      qreal distance = v.x() * v.x() + v.y() * v.y();
+      if (!nearest || distance < nearestDistance) {
+        nearest = atom;
+        nearestDistance = distance;
+      }
+    }
+    return nearest;
+  }
+
+  Bond* SpatialIndex::nearestBond(const QPointF &pos, qreal radius) const
+  {
+    Bond *nearest = 0;
+    qreal nearestDistance = radius;
+    foreach (Bond *bond, bondsNear(pos, radius)) {
+      qreal distance = distanceToSegment(pos, m_bondLines.value(bond));
+      if (!nearest || distance < nearestDistance) {
+        nearest = bond;
+        nearestDistance = distance;
+      }
+    }
+    return nearest;
+  }
+
+} // namespace
@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_SPATIALINDEX_H
+#define MSK_SPATIALINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QPointF>
+#include <QLineF>
+
+namespace Molsketch {
+
+  class Atom;
+  class Bond;
+
+  /**
+   * Uniform grid of the atom centres and bond segments on a MolScene, used
+   * for hit-testing. The cells are about one bond length wide, so a query
+   * within a radius of one bond length only has to look at a few cells and
+   * takes O(1) time on average, independent of the number of atoms.
+   *
+   * The index works in scene coordinates. It is kept up to date by Atom, Bond
+   * and Molecule when they are added to or removed from a MolScene, or when
+   * they are moved.
+   */
+  class SpatialIndex
+  {
+    public:
+      /**
+       * Creates an empty index with cells of @p cellSize x @p cellSize.
+       */
+      SpatialIndex(qreal cellSize = 40.0);
+
+      /**
+       * @return The width of the cells.
+       */
+      qreal cellSize() const
+      {
+        return m_cellSize;
+      }
+
+      /**
+       * Removes all atoms and bonds from the index.
+       */
+      void clear();
+
+      /**
+       * Adds @p atom at its current scene position, or moves it there if it
+       * was already indexed. The reach of its bounding rect is updated as
+       * well, so call this when its label changes.
+       */
+      void updateAtom(Atom *atom);
+      /**
+       * Removes @p atom from the index. Does nothing if it is not indexed.
+       */
+      void removeAtom(Atom *atom);
+      /**
+       * Adds @p bond between the current scene positions of its atoms, or
+       * moves it there if it was already indexed.
+       */
+      void updateBond(Bond *bond);
+      /**
+       * Removes @p bond from the index. Does nothing if it is not indexed.
+       */
+      void removeBond(Bond *bond);
+
+      /**
+       * @return The number of indexed atoms.
+       */
+      int numAtoms() const
+      {
+        return m_atomPositions.size();
+      }
+      /**
+       * @return The number of indexed bonds.
+       */
+      int numBonds() const
+      {
+        return m_bondLines.size();
+      }
+
+      /**
+       * @return The largest distance from the centre of an indexed atom to a
+       * corner of its bounding rect. An atom can only contain points within
+       * this distance of its centre.
+       */
+      qreal atomReach() const
+      {
+        return m_reachCounts.isEmpty() ? 0.0 : (--m_reachCounts.constEnd()).key();
+      }
+
+      /**
+       * @return The atoms with their centre within @p radius of @p pos.
+       */
+      QList<Atom*> atomsNear(const QPointF &pos, qreal radius) const;
+      /**
+       * @return The bonds with their segment within @p radius of @p pos.
+       */
+      QList<Bond*> bondsNear(const QPointF &pos, qreal radius) const;
+      /**
+       * @return The atom with its centre nearest to @p pos, or NULL if there
+       * is no atom within @p radius.
+       */
+      Atom* nearestAtom(const QPointF &pos, qreal radius) const;
+      /**
+       * @return The bond with its segment nearest to @p pos, or NULL if there
+       * is no bond within @p radius.
+       */
+      Bond* nearestBond(const QPointF &pos, qreal radius) const;
+
+      /**
+       * @return The distance between @p pos and the segment @p line.
+       */
+      static qreal distanceToSegment(const QPointF &pos, const QLineF &line);
+
+    private:
+      typedef QPair<int, int> Cell;
+
+      /** Returns the cell containing @p pos. */
+      Cell cellAt(const QPointF &pos) const;
+      /** Sets the reach of @p atom to @p value, see atomReach(). */
+      void setAtomReach(Atom *atom, qreal value);
+      /** Adds @p bond to or removes it from all cells of the bounding box of @p line. */
+      void setBondCells(Bond *bond, const QLineF &line, bool add);
+
+      qreal m_cellSize;
+      /** The atoms in each non-empty cell. */
+      QHash<Cell, QList<Atom*> > m_atomCells;
+      /** The position at which each atom was indexed. */
+      QHash<Atom*, QPointF> m_atomPositions;
+      /** The reach of the bounding rect of each atom, see atomReach(). */
+      QHash<Atom*, qreal> m_atomReaches;
+      /** The number of atoms with each reach, so the largest is known after removals. */
+      QMap<qreal, int> m_reachCounts;
+      /** The bonds in each non-empty cell. A bond is in all cells its bounding box overlaps. */
+      QHash<Cell, QList<Bond*> > m_bondCells;
+      /** The segment at which each bond was indexed. */
+      QHash<Bond*, QLineF> m_bondLines;
+  };
+
+} // namespace
+
+#endif
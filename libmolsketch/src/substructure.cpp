@@ -0,0 +1,165 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include "substructure.h"
+
+namespace Molsketch {
+
+  SubstructureMatcher::SubstructureMatcher(const LibraryEntry &query) : m_query(graph(query)),
+      m_fingerprint(query.fingerprint)
+  {
+    // breadth first, so each atom but the first of a fragment follows a neighbour
+    int numAtoms = m_query.elements.size();
+    QVector<bool> ordered(numAtoms, false);
+    for (int start = 0; start < numAtoms; ++start) {
+      if (ordered.at(start))
+        continue;
+      ordered[start] = true;
+      m_atomOrder.append(start);
+      m_parents.append(-1);
+      for (int i = m_atomOrder.size() - 1; i < m_atomOrder.size(); ++i) {
+        int atom = m_atomOrder.at(i);
+        foreach (int neighbour, m_query.neighbours.at(atom))
+          if (!ordered.at(neighbour)) {
+            ordered[neighbour] = true;
+            m_atomOrder.append(neighbour);
+            m_parents.append(atom);
+          }
+      }
+    }
+  }
+
+  bool SubstructureMatcher::screen(const QVector<quint32> &query, const QVector<quint32> &fingerprint)
+  {
+    if (query.isEmpty() || (query.size() != fingerprint.size()))
+      return false;
+    const quint32 *q = query.constData();
+    const quint32 *f = fingerprint.constData();
+    for (int i = 0; i < query.size(); ++i)
+      if ((q[i] & f[i]) != q[i])
+        return false;
+    return true;
+  }
+
+  bool SubstructureMatcher::matches(const LibraryEntry &entry) const
+  {
+    if (!isValid())
+      return false;
+    // fingerprints that can not be compared do not screen the entry out
+    bool comparable = !m_fingerprint.isEmpty() && (m_fingerprint.size() == entry.fingerprint.size());
+    if (comparable && !screen(m_fingerprint, entry.fingerprint))
+      return false;
+
+    Graph target = graph(entry);
+    if (target.elements.size() < m_query.elements.size())
+      return false;
+    QVector<int> mapping(m_query.elements.size(), -1);
+    QVector<bool> used(target.elements.size(), false);
+    return match(target, mapping, used, 0);
+  }
+
+  SubstructureMatcher::Graph SubstructureMatcher::graph(const LibraryEntry &entry)
+  {
+    Graph graph;
+    // the index of each atom in the graph, -1 for the hydrogens
+    QVector<int> index(entry.atoms.size(), -1);
+    for (int i = 0; i < entry.atoms.size(); ++i)
+      if (entry.atoms.at(i).element != "H") {
+        index[i] = graph.elements.size();
+        graph.elements.append(entry.atoms.at(i).element);
+      }
+    graph.neighbours.resize(graph.elements.size());
+    graph.bonds.resize(graph.elements.size());
+
+    foreach (const MoleculeRenderer::BondData &bond, entry.bonds) {
+      if ((bond.begin < 0) || (bond.begin >= index.size()) || (bond.end < 0) || (bond.end >= index.size()))
+        continue;
+      int begin = index.at(bond.begin);
+      int end = index.at(bond.end);
+      if ((begin < 0) || (end < 0) || (begin == end))
+        continue;
+      graph.neighbours[begin].append(end);
+      graph.bonds[begin].append(graph.orders.size());
+      graph.neighbours[end].append(begin);
+      graph.bonds[end].append(graph.orders.size());
+      graph.orders.append(bond.order);
+      graph.aromatic.append(bond.aromatic);
+    }
+
+    return graph;
+  }
+
+  int SubstructureMatcher::bond(const Graph &graph, int atom, int neighbour)
+  {
+    const QVector<int> &neighbours = graph.neighbours.at(atom);
+    for (int i = 0; i < neighbours.size(); ++i)
+      if (neighbours.at(i) == neighbour)
+        return graph.bonds.at(atom).at(i);
+    return -1;
+  }
+
+  bool SubstructureMatcher::bondMatches(int queryBond, const Graph &target, int targetBond) const
+  {
+    if (m_query.aromatic.at(queryBond) && target.aromatic.at(targetBond))
+      return true;
+    return m_query.orders.at(queryBond) == target.orders.at(targetBond);
+  }
+
+  bool SubstructureMatcher::match(const Graph &target, QVector<int> &mapping, QVector<bool> &used, int depth) const
+  {
+    if (depth == m_atomOrder.size())
+      return true;
+
+    int atom = m_atomOrder.at(depth);
+    int parent = m_parents.at(depth);
+    const QVector<int> &queryNeighbours = m_query.neighbours.at(atom);
+
+    // the candidates are the neighbours of the mapped parent, or all atoms
+    int numCandidates = (parent < 0) ? target.elements.size() : target.neighbours.at(mapping.at(parent)).size();
+    for (int c = 0; c < numCandidates; ++c) {
+      int candidate = (parent < 0) ? c : target.neighbours.at(mapping.at(parent)).at(c);
+      if (used.at(candidate) || (target.elements.at(candidate) != m_query.elements.at(atom))
+          || (target.neighbours.at(candidate).size() < queryNeighbours.size()))
+        continue;
+
+      // the bonds to the mapped neighbours must be there
+      bool bondsMatch = true;
+      for (int i = 0; bondsMatch && (i < queryNeighbours.size()); ++i) {
+        int neighbour = queryNeighbours.at(i);
+        if (mapping.at(neighbour) < 0)
+          continue;
+        int targetBond = bond(target, candidate, mapping.at(neighbour));
+        bondsMatch = (targetBond >= 0) && bondMatches(m_query.bonds.at(atom).at(i), target, targetBond);
+      }
+      if (!bondsMatch)
+        continue;
+
+      mapping[atom] = candidate;
+      used[candidate] = true;
+      if (match(target, mapping, used, depth + 1))
+        return true;
+      mapping[atom] = -1;
+      used[candidate] = false;
+    }
+
+    return false;
+  }
+
+} // namespace
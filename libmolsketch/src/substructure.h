@@ -0,0 +1,111 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef MSK_SUBSTRUCTURE_H
+#define MSK_SUBSTRUCTURE_H
+
+#include <QString>
+#include <QVector>
+
+#include <molsketch/libraryindex.h>
+
+namespace Molsketch {
+
+  /**
+   * Finds a query molecule in the entries of a LibraryIndex.
+   *
+   * An entry is first screened on its fingerprint: every path of the query is
+   * a path of the entry as well, so the fingerprint of the entry must have all
+   * bits of the query set. Only the entries that pass are matched atom by atom
+   * on their heavy atoms, with the elements and bond orders compared. Entries
+   * without a fingerprint of the same size as the query are not screened but
+   * matched right away. Since an aromatic ring can be drawn in more than one
+   * Kekulé structure, an aromatic bond matches any aromatic bond, whatever
+   * their orders; all other bonds must have the same order.
+   *
+   * The matcher only reads the entries, so matches() can be called from any
+   * thread.
+   */
+  class SubstructureMatcher
+  {
+    public:
+      /**
+       * Creates a matcher for @p query, e.g. from smilesEntry() or
+       * moleculeEntry().
+       */
+      explicit SubstructureMatcher(const LibraryEntry &query);
+
+      /**
+       * @return @c false for a query without heavy atoms.
+       */
+      bool isValid() const
+      {
+        return !m_query.elements.isEmpty();
+      }
+      /**
+       * @return @c true if the query is a substructure of @p entry.
+       */
+      bool matches(const LibraryEntry &entry) const;
+
+      /**
+       * @return @c true if every bit of @p query is set in @p fingerprint,
+       * @c false if either is empty or their sizes differ.
+       */
+      static bool screen(const QVector<quint32> &query, const QVector<quint32> &fingerprint);
+
+    private:
+      /**
+       * The heavy atoms and the bonds between them.
+       */
+      struct Graph
+      {
+        QVector<QString> elements;
+        /** The neighbours of each atom, with the bond to each in bonds. */
+        QVector<QVector<int> > neighbours;
+        QVector<QVector<int> > bonds;
+        QVector<int> orders;
+        /** @c true for each aromatic bond. */
+        QVector<bool> aromatic;
+      };
+      static Graph graph(const LibraryEntry &entry);
+      /**
+       * @return The bond between @p atom and @p neighbour in @p graph, or -1.
+       */
+      static int bond(const Graph &graph, int atom, int neighbour);
+      /**
+       * @return @c true if @p queryBond of m_query matches @p targetBond of @p target.
+       */
+      bool bondMatches(int queryBond, const Graph &target, int targetBond) const;
+      /**
+       * Map the query atoms from m_atomOrder[@p depth] on.
+       */
+      bool match(const Graph &target, QVector<int> &mapping, QVector<bool> &used, int depth) const;
+
+      Graph m_query;
+      QVector<quint32> m_fingerprint;
+      /** The query atoms in the order they are mapped, each next to an earlier one if possible. */
+      QVector<int> m_atomOrder;
+      /** An earlier neighbour of each atom in m_atomOrder, or -1. */
+      QVector<int> m_parents;
+  };
+
+} // namespace
+
+#endif
@@ -0,0 +1,452 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstring>
+
+#include <QDataStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QFontDatabase>
+#include <QPainter>
+#include <QPicture>
+#include <QtConcurrentMap>
+#include <QtEndian>
+
+#include <zlib.h>
+
+#include "tiledrenderer.h"
+
+#include "molscene.h"
+
+namespace Molsketch {
+
+  TiledRenderer::TiledRenderer(MolScene *scene, const QRectF &source, const QSize &size, int tileSize)
+    : m_size(size), m_tileSize(tileSize), m_columns(0)
+  {
+    Q_CHECK_PTR(scene);
+    Q_ASSERT(tileSize > 0);
+    if (size.isEmpty() || source.isEmpty())
+      return;
+
+    m_columns = (size.width() + tileSize - 1) / tileSize;
+    int rows = (size.height() + tileSize - 1) / tileSize;
+    qreal scaleX = source.width() / size.width();
+    qreal scaleY = source.height() / size.height();
+
+    // record the items on each tile, the scene only draws the items in the rect
+    m_pictures.resize(m_columns * rows);
+    for (int i = 0; i < m_pictures.size(); ++i) {
+      QRect rect = tileRect(i);
+      QRectF tileSource(source.x() + rect.x() * scaleX, source.y() + rect.y() * scaleY,
+                        rect.width() * scaleX, rect.height() * scaleY);
+      QPicture picture;
+      QPainter painter(&picture);
+      painter.setRenderHint(QPainter::Antialiasing);
+      scene->render(&painter, QRectF(QPointF(0.0, 0.0), rect.size()), tileSource, Qt::IgnoreAspectRatio);
+      painter.end();
+      m_pictures[i] = QByteArray(picture.data(), picture.size());
+    }
+  }
+
+  QRect TiledRenderer::tileRect(int index) const
+  {
+    QRect rect((index % m_columns) * m_tileSize, (index / m_columns) * m_tileSize, m_tileSize, m_tileSize);
+    return rect & QRect(QPoint(0, 0), m_size);
+  }
+
+  QImage TiledRenderer::tile(int index) const
+  {
+    QRect rect = tileRect(index);
+    QImage image(rect.size(), QImage::Format_RGB32);
+    image.fill(QColor(Qt::white).rgb());
+
+    // playing a picture is not thread-safe, every tile gets its own copy
+    QPicture picture;
+    picture.setData(m_pictures.at(index).constData(), m_pictures.at(index).size());
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.drawPicture(0, 0, picture);
+
+    return image;
+  }
+
+  /**
+   * Functor to draw the tiles of a TiledRenderer with QtConcurrent::mapped().
+   */
+  struct DrawTile
+  {
+    typedef QImage result_type;
+
+    DrawTile(const TiledRenderer *renderer) : renderer(renderer)
+    {
+    }
+    QImage operator()(int index) const
+    {
+      return renderer->tile(index);
+    }
+
+    const TiledRenderer *renderer;
+  };
+
+  bool TiledRenderer::render(Writer &writer, Progress *progress) const
+  {
+    if (m_pictures.isEmpty())
+      return true;
+
+    // the tiles are numbered row by row
+    int rows = m_pictures.size() / m_columns;
+    QList<QList<int> > rowTiles;
+    for (int row = 0; row < rows; ++row) {
+      QList<int> tiles;
+      for (int column = 0; column < m_columns; ++column)
+        tiles.append(row * m_columns + column);
+      rowTiles.append(tiles);
+    }
+
+    // some font backends can only draw text in the GUI thread
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+      for (int row = 0; row < rows; ++row) {
+        QList<QImage> images;
+        foreach (int index, rowTiles.at(row))
+          images.append(tile(index));
+        if (!writer.writeRow(images) || (progress && !progress->rowsWritten(row + 1)))
+          return false;
+      }
+      return true;
+    }
+
+    QFuture<QImage> next = QtConcurrent::mapped(rowTiles.at(0), DrawTile(this));
+    for (int row = 0; row < rows; ++row) {
+      QFuture<QImage> current = next;
+      if (row + 1 < rows)
+        next = QtConcurrent::mapped(rowTiles.at(row + 1), DrawTile(this));
+      if (!writer.writeRow(current.results()) || (progress && !progress->rowsWritten(row + 1))) {
+        next.waitForFinished();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Copies the rows of tiles into one image.
+   */
+  class ImageWriter : public TiledRenderer::Writer
+  {
+    public:
+      ImageWriter(const QSize &size) : m_image(size, QImage::Format_RGB32), m_y(0)
+      {
+      }
+
+      bool writeRow(const QList<QImage> &tiles)
+      {
+        int x = 0;
+        foreach (const QImage &tile, tiles) {
+          for (int y = 0; y < tile.height(); ++y)
+            memcpy(m_image.scanLine(m_y + y) + 4 * x, tile.scanLine(y), 4 * tile.width());
+          x += tile.width();
+        }
+        if (!tiles.isEmpty())
+          m_y += tiles.first().height();
+        return true;
+      }
+
+      QImage image() const
+      {
+        return m_image;
+      }
+
+    private:
+      QImage m_image;
+      /** The first line of the next row. */
+      int m_y;
+  };
+
+  QImage TiledRenderer::toImage() const
+  {
+    if (m_pictures.isEmpty())
+      return QImage();
+
+    ImageWriter writer(m_size);
+    render(writer);
+    return writer.image();
+  }
+
+  /**
+   * Helper function to copy line @p y of a row of @p tiles to @p rgb as 8 bit
+   * red, green and blue samples.
+   */
+  static void rgbLine(const QList<QImage> &tiles, int y, uchar *rgb)
+  {
+    foreach (const QImage &tile, tiles) {
+      const QRgb *pixel = reinterpret_cast<const QRgb*>(tile.scanLine(y));
+      for (int x = 0; x < tile.width(); ++x) {
+        *rgb++ = qRed(pixel[x]);
+        *rgb++ = qGreen(pixel[x]);
+        *rgb++ = qBlue(pixel[x]);
+      }
+    }
+  }
+
+  /**
+   * Writes the rows of tiles to a PNG file, compressing the lines as they come
+   * in. Call finish() after the last row.
+   */
+  class PngWriter : public TiledRenderer::Writer
+  {
+    public:
+      PngWriter(QIODevice *device, const QSize &size) : m_device(device),
+          m_line(1 + 3 * size.width(), 0), m_buffer(65536, 0)
+      {
+        memset(&m_stream, 0, sizeof(m_stream));
+        m_ok = (deflateInit(&m_stream, Z_DEFAULT_COMPRESSION) == Z_OK);
+        m_ok = m_ok && (m_device->write("\x89PNG\r\n\x1a\n", 8) == 8);
+
+        // 8 bit RGB, the compression, filter and interlace methods are 0
+        QByteArray header(13, 0);
+        qToBigEndian<quint32>(size.width(), reinterpret_cast<uchar*>(header.data()));
+        qToBigEndian<quint32>(size.height(), reinterpret_cast<uchar*>(header.data()) + 4);
+        header[8] = 8;
+        header[9] = 2;
+        m_ok = m_ok && writeChunk("IHDR", header);
+      }
+      ~PngWriter()
+      {
+        deflateEnd(&m_stream);
+      }
+
+      bool writeRow(const QList<QImage> &tiles)
+      {
+        uchar *line = reinterpret_cast<uchar*>(m_line.data());
+        for (int y = 0; m_ok && !tiles.isEmpty() && (y < tiles.first().height()); ++y) {
+          rgbLine(tiles, y, line + 1);
+          // the Sub filter, most pixels are equal to their left neighbour
+          line[0] = 1;
+          for (int i = m_line.size() - 1; i > 3; --i)
+            line[i] -= line[i - 3];
+          m_stream.next_in = line;
+          m_stream.avail_in = m_line.size();
+          m_ok = deflateLines(Z_NO_FLUSH);
+        }
+        return m_ok;
+      }
+
+      /**
+       * Write the rest of the compressed data and the end of the file.
+       */
+      bool finish()
+      {
+        m_ok = m_ok && deflateLines(Z_FINISH);
+        return m_ok && writeChunk("IEND", QByteArray());
+      }
+
+    private:
+      /**
+       * Compress the input of m_stream and write the output in IDAT chunks.
+       */
+      bool deflateLines(int flush)
+      {
+        do {
+          m_stream.next_out = reinterpret_cast<Bytef*>(m_buffer.data());
+          m_stream.avail_out = m_buffer.size();
+          if (deflate(&m_stream, flush) == Z_STREAM_ERROR)
+            return false;
+          int length = m_buffer.size() - m_stream.avail_out;
+          if (length && !writeChunk("IDAT", QByteArray::fromRawData(m_buffer.constData(), length)))
+            return false;
+        } while (m_stream.avail_out == 0);
+        return true;
+      }
+
+      bool writeChunk(const char *type, const QByteArray &data)
+      {
+        uchar length[4];
+        qToBigEndian<quint32>(data.size(), length);
+        quint32 crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(data.constData()), data.size());
+        uchar check[4];
+        qToBigEndian<quint32>(crc, check);
+
+        return (m_device->write(reinterpret_cast<const char*>(length), 4) == 4) &&
+            (m_device->write(type, 4) == 4) &&
+            (m_device->write(data) == data.size()) &&
+            (m_device->write(reinterpret_cast<const char*>(check), 4) == 4);
+      }
+
+      QIODevice *m_device;
+      z_stream m_stream;
+      /** The filter type and samples of the current line. */
+      QByteArray m_line;
+      /** The compressed data for the next IDAT chunk. */
+      QByteArray m_buffer;
+      bool m_ok;
+  };
+
+  /**
+   * Writes the rows of tiles to a TIFF file, each as a deflate compressed strip.
+   * The image file directory with the offsets of the strips follows them. Call
+   * finish() after the last row.
+   */
+  class TiffWriter : public TiledRenderer::Writer
+  {
+    public:
+      TiffWriter(QIODevice *device, const QSize &size, int rowsPerStrip) : m_device(device),
+          m_size(size), m_rowsPerStrip(rowsPerStrip)
+      {
+        // the offset of the directory is filled in by finish()
+        m_ok = (m_device->write("II\x2a\0\0\0\0\0", 8) == 8);
+      }
+
+      bool writeRow(const QList<QImage> &tiles)
+      {
+        if (!m_ok || tiles.isEmpty())
+          return m_ok;
+
+        int height = tiles.first().height();
+        int lineLength = 3 * m_size.width();
+        QByteArray strip(lineLength * height, 0);
+        for (int y = 0; y < height; ++y)
+          rgbLine(tiles, y, reinterpret_cast<uchar*>(strip.data()) + y * lineLength);
+
+        uLongf length = compressBound(strip.size());
+        QByteArray compressed(length, 0);
+        m_ok = (compress2(reinterpret_cast<Bytef*>(compressed.data()), &length,
+            reinterpret_cast<const Bytef*>(strip.constData()), strip.size(), Z_DEFAULT_COMPRESSION) == Z_OK);
+        m_stripOffsets.append(m_device->pos());
+        m_stripByteCounts.append(length);
+        m_ok = m_ok && (m_device->write(compressed.constData(), length) == qint64(length));
+        return m_ok;
+      }
+
+      /**
+       * Write the image file directory.
+       */
+      bool finish()
+      {
+        if (!m_ok)
+          return false;
+
+        QByteArray bitsPerSample;
+        appendShort(bitsPerSample, 8);
+        appendShort(bitsPerSample, 8);
+        appendShort(bitsPerSample, 8);
+        QByteArray resolution;
+        appendLong(resolution, 72);
+        appendLong(resolution, 1);
+        QByteArray stripOffsets, stripByteCounts;
+        for (int i = 0; i < m_stripOffsets.size(); ++i) {
+          appendLong(stripOffsets, m_stripOffsets.at(i));
+          appendLong(stripByteCounts, m_stripByteCounts.at(i));
+        }
+
+        // the entries are sorted on their tag
+        QByteArray directory;
+        appendShort(directory, 13);
+        appendEntry(directory, 256, Long, 1, m_size.width());
+        appendEntry(directory, 257, Long, 1, m_size.height());
+        appendEntry(directory, 258, Short, 3, writeValues(bitsPerSample));
+        appendEntry(directory, 259, Short, 1, 8); // deflate
+        appendEntry(directory, 262, Short, 1, 2); // RGB
+        appendEntry(directory, 273, Long, m_stripOffsets.size(), (m_stripOffsets.size() > 1) ?
+            writeValues(stripOffsets) : m_stripOffsets.first());
+        appendEntry(directory, 277, Short, 1, 3);
+        appendEntry(directory, 278, Long, 1, m_rowsPerStrip);
+        appendEntry(directory, 279, Long, m_stripByteCounts.size(), (m_stripByteCounts.size() > 1) ?
+            writeValues(stripByteCounts) : m_stripByteCounts.first());
+        appendEntry(directory, 282, Rational, 1, writeValues(resolution));
+        appendEntry(directory, 283, Rational, 1, writeValues(resolution));
+        appendEntry(directory, 284, Short, 1, 1); // chunky
+        appendEntry(directory, 296, Short, 1, 2); // inch
+        appendLong(directory, 0);
+
+        quint32 offset = writeValues(directory);
+        QByteArray header;
+        appendLong(header, offset);
+        return m_ok && m_device->seek(4) && (m_device->write(header) == 4);
+      }
+
+    private:
+      enum FieldType { Short = 3, Long = 4, Rational = 5 };
+
+      static void appendShort(QByteArray &data, quint16 value)
+      {
+        uchar bytes[2];
+        qToLittleEndian<quint16>(value, bytes);
+        data.append(reinterpret_cast<const char*>(bytes), 2);
+      }
+      static void appendLong(QByteArray &data, quint32 value)
+      {
+        uchar bytes[4];
+        qToLittleEndian<quint32>(value, bytes);
+        data.append(reinterpret_cast<const char*>(bytes), 4);
+      }
+      /**
+       * Append a directory entry. A single Short or Long is stored in @p value
+       * itself, otherwise @p value is the offset of the values.
+       */
+      static void appendEntry(QByteArray &data, quint16 tag, FieldType type, quint32 count, quint32 value)
+      {
+        appendShort(data, tag);
+        appendShort(data, type);
+        appendLong(data, count);
+        appendLong(data, value);
+      }
+      /**
+       * Write @p data at the next word boundary. @return Its offset.
+       */
+      quint32 writeValues(const QByteArray &data)
+      {
+        if (m_device->pos() % 2)
+          m_ok = m_ok && (m_device->write("", 1) == 1);
+        quint32 offset = m_device->pos();
+        m_ok = m_ok && (m_device->write(data) == data.size());
+        return offset;
+      }
+
+      QIODevice *m_device;
+      QSize m_size;
+      int m_rowsPerStrip;
+      QList<quint32> m_stripOffsets;
+      QList<quint32> m_stripByteCounts;
+      bool m_ok;
+  };
+
+  bool TiledRenderer::save(const QString &fileName, Progress *progress) const
+  {
+    if (m_pictures.isEmpty())
+      return false;
+
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    if ((suffix != "png") && (suffix != "tif") && (suffix != "tiff")) {
+      ImageWriter writer(m_size);
+      return render(writer, progress) && writer.image().save(fileName);
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+      return false;
+    if (suffix == "png") {
+      PngWriter writer(&file, m_size);
+      return render(writer, progress) && writer.finish();
+    }
+    TiffWriter writer(&file, m_size, m_tileSize);
+    return render(writer, progress) && writer.finish();
+  }
+
+} // namespace
@@ -0,0 +1,161 @@
+/***************************************************************************
+ *   Copyright (C) 2009 by Tim Vandermeersch                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef MSK_TILEDRENDERER_H
+#define MSK_TILEDRENDERER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QList>
+#include <QRect>
+#include <QRectF>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+namespace Molsketch {
+
+  class MolScene;
+
+  /**
+   * Renders a rect of a MolScene into an image of any size, in tiles.
+   *
+   * The constructor records the items on each tile in a QPicture. This is the
+   * only step that touches the scene, so the scene can be changed again as soon
+   * as the renderer is created. The tiles are then drawn from these snapshots
+   * on the global QThreadPool, a row of tiles at a time, and written to the
+   * image or file from top to bottom. Only two rows of tiles are kept in memory
+   * when saving, so the size of an exported file is not limited by the memory.
+   */
+  class TiledRenderer
+  {
+    public:
+      /**
+       * Takes a snapshot of the @p source rect of @p scene to render at @p size
+       * pixels, in tiles of @p tileSize x @p tileSize pixels.
+       */
+      TiledRenderer(MolScene *scene, const QRectF &source, const QSize &size, int tileSize = 512);
+
+      /**
+       * @return The size of the image in pixels.
+       */
+      QSize size() const
+      {
+        return m_size;
+      }
+      /**
+       * @return The width and height of the tiles in pixels.
+       */
+      int tileSize() const
+      {
+        return m_tileSize;
+      }
+      /**
+       * @return The number of tiles.
+       */
+      int numTiles() const
+      {
+        return m_pictures.size();
+      }
+      /**
+       * @return The number of rows of tiles.
+       */
+      int numRows() const
+      {
+        return m_columns ? m_pictures.size() / m_columns : 0;
+      }
+      /**
+       * @return The rect of tile @p index in the image. The tiles are numbered
+       * row by row; the last ones of each row and column may be smaller.
+       */
+      QRect tileRect(int index) const;
+      /**
+       * @return Tile @p index drawn on a white background. Can be called from
+       * any thread.
+       */
+      QImage tile(int index) const;
+
+      /**
+       * @return The whole image.
+       */
+      QImage toImage() const;
+      /**
+       * Receives the progress of render() and save().
+       */
+      class Progress
+      {
+        public:
+          virtual ~Progress()
+          {
+          }
+          /**
+           * Called when @p done of the numRows() rows of tiles are written.
+           *
+           * @return @c false to stop rendering.
+           */
+          virtual bool rowsWritten(int done) = 0;
+      };
+
+      /**
+       * Save the image as @p fileName, reporting to @p progress. PNG and TIFF
+       * files are written a row of tiles at a time, other formats are saved
+       * from toImage().
+       *
+       * @return @c false if the file could not be written or @p progress stopped.
+       */
+      bool save(const QString &fileName, Progress *progress = 0) const;
+
+      /**
+       * Receives the image from render(), a row of tiles at a time.
+       */
+      class Writer
+      {
+        public:
+          virtual ~Writer()
+          {
+          }
+          /**
+           * Write the @p tiles of the next row, from left to right.
+           *
+           * @return @c false to stop rendering.
+           */
+          virtual bool writeRow(const QList<QImage> &tiles) = 0;
+      };
+
+      /**
+       * Draws the rows of tiles from top to bottom and passes them to @p writer,
+       * reporting to @p progress after each row. The tiles of the next row are
+       * drawn while the current one is written.
+       *
+       * @return @c false if the writer or @p progress stopped.
+       */
+      bool render(Writer &writer, Progress *progress = 0) const;
+
+    private:
+      QSize m_size;
+      int m_tileSize;
+      /** The number of tiles in a row. */
+      int m_columns;
+      /** The QPicture data of each tile. */
+      QVector<QByteArray> m_pictures;
+  };
+
+} // namespace
+
+#endif
@@ -260,10 +260,12 @@ namespace Molsketch {
           mol->setPos(downPos);
           undostack->beginMacro("Add Molecule");
           undostack->push(new AddItem(mol, scene()));
+          undostack->push(new EditBatch(mol, true));
 
           Q_CHECK_PTR(m_hintMolecule);
           foreach (Atom *hintAtom, m_hintMolecule->atoms())
             undostack->push(new AddAtom(new Atom( hintAtom->scenePos(), hintAtom->element(), m_autoAddHydrogen), mol));
+          undostack->push(new EditBatch(mol, false));
           undostack->endMacro();
         }
 
@@ -318,7 +320,6 @@ namespace Molsketch {
     // Check possible targets
     Atom* a1 = scene()->atomAt(downPos);
     Atom* a2 = scene()->atomAt(upPos);
-    Bond* b = scene()->bondAt(downPos);
     Molecule* m1 = a1 ? a1->molecule() : 0;
     Molecule* m2 = a2 ? a2->molecule() : 0;
 
@@ -328,6 +329,9 @@ namespace Molsketch {
       return;
     }
 
+    // nothing to draw from, and no macro left open
+    if (!a1) return;
+
     if (a1 != a2)
       undostack->beginMacro("Draw");
 
@@ -342,9 +346,6 @@ namespace Molsketch {
       undostack->push(new AddAtom(a1, m1));
     }
 
-    if (!a1 && !b) return;
-    if (b && !a1) return;
-
     // Check for atom release
     if (a2) {
 
@@ -374,12 +375,14 @@ namespace Molsketch {
         m1->setFocus();
       } 
 
-      // Adding bond
+      // Adding bond, the merged molecule perceives its rings once
+      if (m1) undostack->push(new EditBatch(m1, true));
       Bond* bond = new Bond(a1,a2);
       undostack->push(new AddBond(bond));
       for (int i = 0; i < m_bondOrder - 1; i++) 
         undostack->push(new IncOrder(bond));
       undostack->push(new SetBondType(bond, m_bondType));
+      if (m1) undostack->push(new EditBatch(m1, false));
 
       // End adding macro
       undostack->endMacro();
@@ -394,6 +397,7 @@ namespace Molsketch {
       undostack->push(new AddAtom(a1,m1));
     }
 
+    undostack->push(new EditBatch(m1, true));
     Atom* atom = new Atom(upPos,m_currentElementSymbol,m_autoAddHydrogen);
     undostack->push(new AddAtom(atom,m1));
     Bond* bond = new Bond(a1,atom);
@@ -401,6 +405,7 @@ namespace Molsketch {
     for (int i = 0; i < m_bondOrder - 1; i++) 
       undostack->push(new IncOrder(bond));
     undostack->push(new SetBondType(bond, m_bondType));
+    undostack->push(new EditBatch(m1, false));
 
     undostack->endMacro();
 
@@ -484,6 +489,7 @@ namespace Molsketch {
       }
       if (new_atom_pos != downPos) {
         stack->beginMacro("Add Bond");
+        stack->push(new EditBatch(at1->molecule(), true));
         Atom* atom = new Atom(new_atom_pos,m_currentElementSymbol,m_autoAddHydrogen);
         stack->push(new AddAtom(atom,at1 ->molecule()));
         Bond* bond = new Bond(at1,atom);
@@ -492,6 +498,7 @@ namespace Molsketch {
           stack->push(new IncOrder(bond));
 
         stack->push(new SetBondType(bond, m_bondType));
+        stack->push(new EditBatch(at1->molecule(), false));
         stack->endMacro();
       }
     }
@@ -512,11 +519,13 @@ namespace Molsketch {
     {
       mol = a->molecule();
       stack->beginMacro(tr("removing atom"));
+      stack->push(new EditBatch(mol, true));
       stack->push(new DelAtom(a));
       if (mol->canSplit())
         stack->push(new SplitMol(mol));
       if (mol->atoms().isEmpty())
         stack->push(new DelItem(mol));
+      stack->push(new EditBatch(mol, false));
       stack->endMacro();
       return;
     }
@@ -526,9 +535,11 @@ namespace Molsketch {
     {
       mol = b->molecule();
       stack->beginMacro(tr("removing bond"));
+      stack->push(new EditBatch(mol, true));
       stack->push(new DelBond(b));
       if (mol->canSplit())
         stack->push(new SplitMol(mol));
+      stack->push(new EditBatch(mol, false));
       stack->endMacro();
       return;
     }
@@ -690,6 +701,8 @@ namespace Molsketch {
       undostack->push(new AddItem(mergedMol, scene()));
       molecules[0] = mergedMol;
     }
+    // perceive the rings once for the whole ring
+    undostack->push(new EditBatch(molecules[0], true));
     // add the atoms and bonds
     QList<Bond*> bonds;
     int indexOfFirstDoubleBond = -1;
@@ -756,6 +769,7 @@ namespace Molsketch {
 	  undostack->push(new IncOrder(bonds.at(i)));
     }
 
+    undostack->push(new EditBatch(molecules[0], false));
     molecules[0]->setFocus();
     undostack->endMacro();
   }
@@ -850,24 +864,8 @@ namespace Molsketch {
     Molecule* molC = new Molecule;
 
     // Adding the bonds and atoms of the first two molecules
-    foreach (Atom* a, molA->atoms())
-    {
-      Atom* a2 = new Atom(a->scenePos(),a->element(),a->hasImplicitHydrogens());
-		a2 ->setColor( a->getColor ());
-      molC->addAtom(a2);
-    }
-    foreach (Bond* b, molA->bonds())
-    {
-      molC->addBond( molC->atomAt(b->beginAtom()->scenePos()), molC->atomAt(b->endAtom()->scenePos()), b->bondOrder(), b->bondType(), b->getColor ());
-    }
-    foreach (Atom* a, molB->atoms())
-    {
-      molC->addAtom( a->element(), a->scenePos(), a->hasImplicitHydrogens(), a->getColor ());
-    }
-    foreach (Bond* b, molB->bonds())
-    {
-      molC->addBond( molC->atomAt(b->beginAtom()->scenePos()), molC->atomAt(b->endAtom()->scenePos()), b->bondOrder(), b->bondType(), b->getColor ());
-    }
+    molC->addCopies(molA->atoms(), molA->bonds(), true);
+    molC->addCopies(molB->atoms(), molB->bonds(), true);
 
     //         molC->setPos(molA->scenePos());
 
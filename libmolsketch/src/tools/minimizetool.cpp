@@ -5,13 +5,45 @@
 #include "../bond.h"
 #include "../molscene.h"
 #include "../minimise.h"
+#include "../minimisethread.h"
+#include "../commands.h"
 #include "../math2d.h"
 
 #include <cmath>
 #include <QDebug>
+#include <QGraphicsView>
+#include <QProgressDialog>
 
 namespace Molsketch {
 
+  using namespace Commands;
+
+  /**
+   * Helper function to get the positions of the atoms of @p mol.
+   */
+  static QList<QPointF> atomPositions(Molecule *mol)
+  {
+    QList<QPointF> positions;
+    foreach (Atom *atom, mol->atoms())
+      positions.append(atom->pos());
+    return positions;
+  }
+
+  /**
+   * Helper function to move the atoms of @p mol to @p positions, without
+   * undo command.
+   */
+  static void setAtomPositions(Molecule *mol, const QList<QPointF> &positions)
+  {
+    {
+      Molecule::Batch batch(mol);
+      QList<Atom*> atoms = mol->atoms();
+      for (int i = 0; i < atoms.size() && i < positions.size(); ++i)
+        atoms.at(i)->setPos(positions.at(i));
+    }
+    mol->invalidateCache();
+  }
+
   MinimizeTool::MinimizeTool(MolScene *scene) : QObject(0), Tool(scene)
   {
     m_action = 0;
@@ -19,6 +51,8 @@ namespace Molsketch {
 
   MinimizeTool::~MinimizeTool()
   {
+    // the thread is cancelled when it is deleted with the tool
+    delete m_progress;
   }
 
   QList<QAction*> MinimizeTool::actions()
@@ -45,6 +79,10 @@ namespace Molsketch {
 
   void MinimizeTool::mousePressEvent(QGraphicsSceneMouseEvent *event)
   {
+    // one clean-up at a time
+    if (m_thread)
+      return;
+
     Bond *bond = scene()->bondAt (event ->scenePos());
     if (bond) {
       Molecule *molecule = bond ->molecule();
@@ -59,16 +97,60 @@ namespace Molsketch {
 
   void MinimizeTool::mirrorBondInMolecule (Molecule *mol, Bond *bo)
   {
-    Minimise *minimise = new Minimise (40 /*m_bondLength*/); // FIXME
-    //minimise ->minimiseMolecule (mol);
-    minimise ->mirrorBondInMolecule(mol, bo);
+    QList<QPointF> oldPositions = atomPositions(mol);
+    Minimise minimise (40 /*m_bondLength*/); // FIXME
+    minimise.mirrorBondInMolecule(mol, bo);
+    scene()->stack()->push(new MoveAtoms(mol, oldPositions, atomPositions(mol), tr("mirror bond")));
   }
 
   void MinimizeTool::minimiseMolecule (Molecule *mol)
   {
-    Minimise *minimise = new Minimise (40 /*m_bondLength*/); // FIXME
-    //minimise ->minimiseMolecule (mol);
-    minimise ->conformationalSearchMolecule(mol);
+    m_oldPositions = atomPositions(mol);
+    m_thread = new MinimiseThread(mol, 40 /*m_bondLength*/, 500, this); // FIXME
+
+    // window modal, so the molecule can not be edited during the search
+    QWidget *parent = scene()->views().isEmpty() ? 0 : scene()->views().first()->window();
+    m_progress = new QProgressDialog(tr("Cleaning up the molecule..."), tr("Cancel"), 0, m_thread->iterations(), parent);
+    m_progress->setWindowModality(Qt::WindowModal);
+    m_progress->setMinimumDuration(0);
+    connect(m_progress, SIGNAL(canceled()), m_thread, SLOT(cancel()));
+
+    connect(m_thread, SIGNAL(progress(int, int)), this, SLOT(showProgress(int, int)));
+    connect(m_thread, SIGNAL(poseChanged(const QList<QPointF>&)), this, SLOT(showPose(const QList<QPointF>&)));
+    connect(m_thread, SIGNAL(finished()), this, SLOT(minimiseFinished()));
+    m_thread->start();
+  }
+
+  void MinimizeTool::showProgress(int done, int total)
+  {
+    if (!m_progress || !m_thread || m_thread->isCancelled())
+      return;
+    m_progress->setMaximum(total);
+    m_progress->setValue(done);
+  }
+
+  void MinimizeTool::showPose(const QList<QPointF> &positions)
+  {
+    if (m_thread && !m_thread->isCancelled())
+      setAtomPositions(m_thread->molecule(), positions);
+  }
+
+  void MinimizeTool::minimiseFinished()
+  {
+    if (!m_thread)
+      return;
+    Molecule *mol = m_thread->molecule();
+    // the poses that were shown are not part of the undo history
+    setAtomPositions(mol, m_oldPositions);
+    if (!m_thread->isCancelled())
+      scene()->stack()->push(new MoveAtoms(mol, m_oldPositions, m_thread->positions(), tr("clean up")));
+
+    m_thread->deleteLater();
+    m_thread = 0;
+    if (m_progress)
+      m_progress->deleteLater();
+    m_progress = 0;
+    m_oldPositions.clear();
   }
 
   void MinimizeTool::actionClicked()
@@ -4,12 +4,23 @@
 #include "../tool.h"
 
 #include <QGraphicsItemGroup>
+#include <QPointer>
+
+class QProgressDialog;
 
 namespace Molsketch {
 
   class Molecule;
   class Bond;
-
+  class MinimiseThread;
+
+  /**
+   * Tool to clean up the 2D coordinates of a molecule. Clicking a bond
+   * mirrors one side of it. Clicking elsewhere on a molecule runs the
+   * conformational search of Minimise on a MinimiseThread, with a progress
+   * dialog to cancel it. The better poses are shown while the search runs,
+   * and the result is applied as one undoable command.
+   */
   class MinimizeTool : public QObject, public Tool
   {
     Q_OBJECT
@@ -27,6 +38,11 @@ namespace Molsketch {
     public slots:
       void actionClicked();
 
+    private slots:
+      void showProgress(int done, int total);
+      void showPose(const QList<QPointF> &positions);
+      void minimiseFinished();
+
     private:
       void mirrorBondInMolecule (Molecule *mol, Bond *bo);
       void minimiseMolecule (Molecule *mol);
@@ -34,6 +50,12 @@ namespace Molsketch {
       // QActions
       QAction *m_action;
 
+      /** The running clean-up, if any. */
+      QPointer<MinimiseThread> m_thread;
+      QPointer<QProgressDialog> m_progress;
+      /** The positions of the atoms before the clean-up. */
+      QList<QPointF> m_oldPositions;
+
   };
 
 }
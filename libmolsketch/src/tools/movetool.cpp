@@ -102,7 +102,9 @@ namespace Molsketch {
 
     QUndoStack *stack = scene()->stack();
 
+    QList<Molecule*> molecules = EditBatch::molecules(scene()->selectedItems());
     stack->beginMacro(tr("moving item(s)"));
+    EditBatch::push(stack, molecules, true);
     foreach(QGraphicsItem* item, scene()->selectedItems()) {
       // reset the movement
       item->moveBy(-moveVector.x(), -moveVector.y());
@@ -111,6 +113,7 @@ namespace Molsketch {
         stack->push(new MoveItem(item, moveVector, tr("moving item(s)")));
       item->setFlag(QGraphicsItem::ItemIsMovable, false);
     }
+    EditBatch::push(stack, molecules, false);
     stack->endMacro();
 
     scene()->clearFocus();
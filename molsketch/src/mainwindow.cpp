@@ -28,7 +28,10 @@
 #include <molsketch/molscene.h>
 #include <molsketch/element.h>
 #include <molsketch/fileio.h>
+#include <molsketch/exportjob.h>
 #include <molsketch/mollibitem.h>
+#include <molsketch/libraryloader.h>
+#include <molsketch/librarysearch.h>
 #include <molsketch/itemplugin.h>
 #include <molsketch/osra.h>
 
@@ -218,6 +221,8 @@ void MainWindow::open()
                 {
                   QList<Molecule*> molList = mol->split();
                   foreach(Molecule* mol,molList) m_scene->addItem(mol);
+                  // the atoms have been moved to the new molecules
+                  delete mol;
                 }
               else
                 {
@@ -343,6 +348,7 @@ bool MainWindow::saveAs()
           QList<Molecule*> molList = mol->split();
           foreach(Molecule* mol,molList) 
             m_scene->addItem(mol);
+          delete mol;
         } else {
           m_scene->addItem(mol);          
         }
@@ -401,15 +407,27 @@ bool MainWindow::exportDoc()
   // Try to export the file
   if (fileName.endsWith(".svg")) return Molsketch::saveToSVG(fileName, m_scene);
 
-  if (Molsketch::exportFile(fileName,m_scene))
-    {
-      return true;
-    }
-  else
-    {
-      QMessageBox::critical(this,tr(PROGRAM_NAME),tr("Error while exporting file"),QMessageBox::Ok,QMessageBox::Ok);
-      return false;
-    }
+  // The file is written on a worker thread from a snapshot of the scene
+  Molsketch::ExportJob *job = new Molsketch::ExportJob(Molsketch::exportSnapshot(m_scene), fileName, this);
+  QProgressDialog *progress = new QProgressDialog(tr("Exporting %1...").arg(QFileInfo(fileName).fileName()),
+      tr("Cancel"), 0, job->numRows(), this);
+  progress->setMinimumDuration(500);
+  connect(job, SIGNAL(progress(int)), progress, SLOT(setValue(int)));
+  connect(progress, SIGNAL(canceled()), job, SLOT(cancel()));
+  connect(job, SIGNAL(finished(bool)), this, SLOT(exportFinished(bool)));
+  connect(job, SIGNAL(destroyed()), progress, SLOT(deleteLater()));
+  job->start();
+  return true;
+}
+
+void MainWindow::exportFinished(bool ok)
+{
+  Molsketch::ExportJob *job = qobject_cast<Molsketch::ExportJob*>(sender());
+  if (!job)
+    return;
+  if (!ok && !job->isCancelled())
+    QMessageBox::critical(this,tr(PROGRAM_NAME),tr("Error while exporting file"),QMessageBox::Ok,QMessageBox::Ok);
+  job->deleteLater();
 }
 
 void MainWindow::changeColor () {
@@ -797,69 +815,20 @@ void MainWindow::createToolBoxes()
   customLib->setAlternatingRowColors(true);
   customLib->setIconSize(QSize(128,128));
 
-  // Declaring variables
-  QDir dir;
-  Molecule* mol;
+  // Loading the libraries, the thumbnails are drawn in the background
+  m_libraryLoader = new LibraryLoader(this);
 
   // Loading generic molecules
-  dir.setPath(ALT_LIB_PATH);
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) genericLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-  
-  dir.setPath(QDir::homePath() + "/.molsketch/library");
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) genericLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-
-  dir.setPath(QApplication::applicationDirPath() + "/../share/molsketch/library");
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) genericLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-
-  dir.setPath(QApplication::applicationDirPath() + "/library");
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) genericLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
+  m_libraryLoader->loadDirectory(ALT_LIB_PATH, genericLib);
+  m_libraryLoader->loadDirectory(QDir::homePath() + "/.molsketch/library", genericLib);
+  m_libraryLoader->loadDirectory(QApplication::applicationDirPath() + "/../share/molsketch/library", genericLib);
+  m_libraryLoader->loadDirectory(QApplication::applicationDirPath() + "/library", genericLib);
 
   // Loading custom molecules
-  dir.setPath(ALT_CUSTOM_LIB_PATH);
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) customLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-  
-  dir.setPath(QDir::homePath() + "/.molsketch/library/custom");
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) customLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-
-  dir.setPath(QApplication::applicationDirPath() + "/../share/molsketch/library/custom");
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) customLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-
-  dir.setPath(QApplication::applicationDirPath() + "/library/custom");
-  for (unsigned int i = 0; i < dir.count(); i++)
-    {
-      mol = Molsketch::loadFile(dir.filePath(dir[i]));
-      if (mol) customLib->addItem(new MolLibItem(mol,dir.filePath(dir[i])));
-    }
-
-
+  m_libraryLoader->loadDirectory(ALT_CUSTOM_LIB_PATH, customLib);
+  m_libraryLoader->loadDirectory(QDir::homePath() + "/.molsketch/library/custom", customLib);
+  m_libraryLoader->loadDirectory(QApplication::applicationDirPath() + "/../share/molsketch/library/custom", customLib);
+  m_libraryLoader->loadDirectory(QApplication::applicationDirPath() + "/library/custom", customLib);
 
   // Composing customLib
   QHBoxLayout* hLayoutCL = new QHBoxLayout;
@@ -872,11 +841,34 @@ void MainWindow::createToolBoxes()
   QFrame* frameCustomLib = new QFrame;
   frameCustomLib->setLayout(vLayoutCL);
 
+  // Composing the substructure search
+  m_librarySearch = new LibrarySearch(m_libraryLoader, this);
+  m_searchEdit = new QLineEdit;
+  m_searchEdit->setToolTip(tr("Enter the SMILES of a substructure"));
+  m_searchResults = new QListWidget;
+  m_searchResults->setAlternatingRowColors(true);
+  m_searchResults->setIconSize(QSize(64,64));
+  QPushButton* searchButton = new QPushButton(tr("Search"));
+  QPushButton* selectionButton = new QPushButton(tr("Search Selection"));
+  QPushButton* similarButton = new QPushButton(tr("Find Similar"));
+  QHBoxLayout* hLayoutSearch = new QHBoxLayout;
+  hLayoutSearch->addWidget(searchButton);
+  hLayoutSearch->addWidget(selectionButton);
+  hLayoutSearch->addWidget(similarButton);
+  QVBoxLayout* vLayoutSearch = new QVBoxLayout;
+  vLayoutSearch->addWidget(m_searchEdit);
+  vLayoutSearch->addLayout(hLayoutSearch);
+  vLayoutSearch->addWidget(m_searchResults);
+
+  QFrame* frameSearch = new QFrame;
+  frameSearch->setLayout(vLayoutSearch);
+
   // Create a library toolbox and add the libraries
   toolBox = new QToolBox;
 //   toolBox->addItem(elementLib,tr("Elements"));
   toolBox->addItem(genericLib, tr("Generic Molecules"));
   toolBox->addItem(frameCustomLib,tr("Custom Molecules"));
+  toolBox->addItem(frameSearch,tr("Search"));
   toolBoxDock->setWidget(toolBox);
 
   // Placing the dockwidgets in their default position
@@ -890,6 +882,11 @@ void MainWindow::createToolBoxes()
   connect(customLib,SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(addMolecule(QListWidgetItem*)));
   connect(addButton, SIGNAL(released()), this, SLOT(addCustomMol()));
   connect(delButton, SIGNAL(released()), this, SLOT(delCustomMol()));
+  connect(m_searchResults,SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(addMolecule(QListWidgetItem*)));
+  connect(m_searchEdit, SIGNAL(returnPressed()), this, SLOT(searchLibrary()));
+  connect(searchButton, SIGNAL(released()), this, SLOT(searchLibrary()));
+  connect(selectionButton, SIGNAL(released()), this, SLOT(searchSelection()));
+  connect(similarButton, SIGNAL(released()), this, SLOT(findSimilar()));
 }
 
 void MainWindow::addMolecule(QListWidgetItem *item)
@@ -898,7 +895,9 @@ void MainWindow::addMolecule(QListWidgetItem *item)
   MolLibItem *libItem = dynamic_cast<MolLibItem*>(item);
   if (!libItem)
     return;
-  m_scene->addMolecule(libItem->getMolecule());
+  Molecule *mol = libItem->getMolecule();
+  if (mol)
+    m_scene->addMolecule(mol);
 }
  
 void MainWindow::addCustomMol()
@@ -914,6 +913,54 @@ void MainWindow::addCustomMol()
   }
 }
 
+void MainWindow::searchLibrary()
+{
+  if (m_searchEdit->text().trimmed().isEmpty())
+    return;
+  if (!m_librarySearch->setQuery(m_searchEdit->text())) {
+    statusBar()->showMessage(tr("Could not read the SMILES \"%1\"").arg(m_searchEdit->text()), 5000);
+    return;
+  }
+  m_librarySearch->start(m_searchResults);
+}
+
+void MainWindow::searchSelection()
+{
+  foreach(QGraphicsItem* item, m_scene->selectedItems())
+  {
+    if (item->type() == Molecule::Type && m_librarySearch->setQuery(static_cast<Molecule*>(item)))
+      {
+        m_searchEdit->setText(m_librarySearch->query().smiles);
+        m_librarySearch->start(m_searchResults);
+        return;
+      }
+  }
+  statusBar()->showMessage(tr("Select a molecule to search for"), 5000);
+}
+
+void MainWindow::findSimilar()
+{
+  Molecule* query = 0;
+  QList<Molecule*> others;
+  foreach(QGraphicsItem* item, m_scene->items())
+  {
+    if (item->type() != Molecule::Type)
+      continue;
+    Molecule* mol = static_cast<Molecule*>(item);
+    if (!query && mol->isSelected())
+      query = mol;
+    else
+      others.append(mol);
+  }
+
+  if (!query || !m_librarySearch->setQuery(query)) {
+    statusBar()->showMessage(tr("Select a molecule to search for"), 5000);
+    return;
+  }
+  m_searchEdit->setText(m_librarySearch->query().smiles);
+  m_librarySearch->rankSimilar(m_searchResults, others);
+}
+
 void MainWindow::delCustomMol()
 {
   //Check whether an item is selected
@@ -36,6 +36,7 @@ class QToolBox;
 class QDockWidget;
 class QTextEdit;
 class QUndoStack;
+class QLineEdit;
 class QListWidget;
 class QListWidgetItem;
 class QTableWidget;
@@ -46,6 +47,8 @@ class QTimer;
 class OBMol;
 
 namespace Molsketch {
+  class LibraryLoader;
+  class LibrarySearch;
   class Molecule;
   class MolScene;
   class MolView;
@@ -92,6 +95,8 @@ private slots:
   bool importDoc();
   /** Export the current document as a picture. */
   bool exportDoc();
+  /** Report the result of the export started by exportDoc(). */
+  void exportFinished(bool ok);
   /** Prints the current document. */
   bool print();
 
@@ -116,6 +121,12 @@ private slots:
   /** Removes the selected item from the custom library. */
   void delCustomMol();
   void addMolecule(QListWidgetItem *item);
+  /** Search the libraries for the SMILES in the search box. */
+  void searchLibrary();
+  /** Search the libraries for the selected molecule. */
+  void searchSelection();
+  /** Rank the library and scene molecules by similarity to the selected molecule. */
+  void findSimilar();
   
   /** Mark the current document as modified. */
   void documentWasModified( );
@@ -204,6 +215,14 @@ protected:
   QListWidget* customLib;
   /** The library widget with common molecules. */
   QListWidget* genericLib;
+  /** Draws the thumbnails of the libraries in the background. */
+  Molsketch::LibraryLoader* m_libraryLoader;
+  /** The SMILES of the substructure to search for. */
+  QLineEdit* m_searchEdit;
+  /** The library molecules that contain the substructure. */
+  QListWidget* m_searchResults;
+  /** Searches the libraries for a substructure. */
+  Molsketch::LibrarySearch* m_librarySearch;
 
   Molsketch::ToolGroup *m_toolGroup;
 
@@ -0,0 +1,679 @@
+/***************************************************************************
+ *   Copyright (C) 2009 Tim Vandermeersch                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QObject>
+#include <QtTest>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QListWidget>
+#include <QTextStream>
+
+#include <molsketch/fileio.h>
+#include <molsketch/exportjob.h>
+#include <molsketch/libraryindex.h>
+#include <molsketch/libraryloader.h>
+#include <molsketch/librarysearch.h>
+#include <molsketch/mollibitem.h>
+#include <molsketch/molscene.h>
+#include <molsketch/molecule.h>
+#include <molsketch/moleculerenderer.h>
+#include <molsketch/similarity.h>
+#include <molsketch/substructure.h>
+#include <molsketch/atom.h>
+#include <molsketch/bond.h>
+#include <molsketch/tiledrenderer.h>
+
+using namespace Molsketch;
+
+/**
+ * Write @p smiles to a temporary SMILES file and return its name.
+ */
+QString writeSmilesFile(const QString &smiles)
+{
+  QString fileName = QDir::tempPath() + QDir::separator() + "molsketch-fileiotest.smi";
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    return QString();
+  QTextStream out(&file);
+  out << smiles << endl;
+  return fileName;
+}
+
+/**
+ * Add a carbon chain with an oxygen at both ends to @p scene.
+ */
+void addChain(MolScene &scene, int numAtoms)
+{
+  Molecule *mol = new Molecule;
+  Atom *previous = 0;
+  for (int i = 0; i < numAtoms; ++i) {
+    QString element = (i == 0 || i == numAtoms - 1) ? "O" : "C";
+    Atom *atom = mol->addAtom(element, QPointF(i * 35.0, (i % 2) * 20.0), false);
+    if (previous)
+      mol->addBond(previous, atom, (i % 3) ? 1 : 2);
+    previous = atom;
+  }
+  scene.addItem(mol);
+}
+
+class FileIOTest : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    /**
+     * Called before the first test function is executed.
+     */
+    void initTestCase();
+
+    /**
+     * Called after the last test function is executed.
+     */
+    void cleanupTestCase();
+
+    /**
+     * Called before each test function is executed.
+     */
+    void init();
+
+    /**
+     * Called after every test function.
+     */
+    void cleanup();
+
+    void loadCoincidentAtoms();
+    void thumbnailHydrogens();
+    void tiledRendering();
+    void exportTiled_data();
+    void exportTiled();
+    void exportJob();
+    void libraryIndex();
+    void libraryLoader();
+    void substructureSearch();
+    void similarity();
+
+    void benchmarkLoad_data();
+    void benchmarkLoad();
+
+};
+
+void FileIOTest::initTestCase()
+{
+}
+
+void FileIOTest::cleanupTestCase()
+{
+  QFile::remove(QDir::tempPath() + QDir::separator() + "molsketch-fileiotest.smi");
+  QFile::remove(QDir::tempPath() + QDir::separator() + "molsketch-fileiotest.png");
+  QFile::remove(QDir::tempPath() + QDir::separator() + "molsketch-fileiotest.tif");
+}
+
+void FileIOTest::init()
+{
+}
+
+void FileIOTest::cleanup()
+{
+}
+
+/**
+ * SMILES files have no coordinates, all atoms end up at the same position.
+ * The bonds should still connect the right atoms.
+ */
+void FileIOTest::loadCoincidentAtoms()
+{
+  Molecule *mol = loadFile(writeSmilesFile("CC(C)C"));
+  QVERIFY( mol );
+  QCOMPARE( mol->atoms().size(), 4 );
+  QCOMPARE( mol->bonds().size(), 3 );
+
+  Atom *center = mol->atoms().at(1);
+  QCOMPARE( mol->bonds(center).size(), 3 );
+  foreach (Atom *atom, mol->atoms())
+    if (atom != center)
+      QVERIFY( mol->bondBetween(atom, center) );
+
+  delete mol;
+}
+
+/**
+ * The thumbnails label the atoms with the same implicit hydrogens as the
+ * molecule on the scene, e.g. OH and NH2.
+ */
+void FileIOTest::thumbnailHydrogens()
+{
+  QString fileName = writeSmilesFile("NCC(=O)O");
+  MoleculeRenderer renderer;
+  QVERIFY( loadRenderer(fileName, renderer) );
+  Molecule *mol = loadFile(fileName);
+  QVERIFY( mol );
+  QCOMPARE( renderer.atoms().size(), mol->atoms().size() );
+  for (int i = 0; i < mol->atoms().size(); ++i)
+    QCOMPARE( renderer.atoms().at(i).numImplicitHydrogens, mol->atoms().at(i)->numImplicitHydrogens() );
+  QCOMPARE( renderer.atoms().at(0).numImplicitHydrogens, 2 );
+  QCOMPARE( renderer.atoms().at(3).numImplicitHydrogens, 0 );
+  QCOMPARE( renderer.atoms().at(4).numImplicitHydrogens, 1 );
+  delete mol;
+}
+
+/**
+ * Helper function to compare two images of the same size, allowing each
+ * channel of a pixel to differ by @p tolerance, e.g. for antialiased edges
+ * drawn in different tiles.
+ */
+static bool fuzzyCompare(const QImage &image, const QImage &expected, int tolerance)
+{
+  if (image.size() != expected.size())
+    return false;
+  const QImage a = image.convertToFormat(QImage::Format_RGB32);
+  const QImage b = expected.convertToFormat(QImage::Format_RGB32);
+  for (int y = 0; y < a.height(); ++y) {
+    const QRgb *lineA = reinterpret_cast<const QRgb*>(a.scanLine(y));
+    const QRgb *lineB = reinterpret_cast<const QRgb*>(b.scanLine(y));
+    for (int x = 0; x < a.width(); ++x)
+      if ((qAbs(qRed(lineA[x]) - qRed(lineB[x])) > tolerance) ||
+          (qAbs(qGreen(lineA[x]) - qGreen(lineB[x])) > tolerance) ||
+          (qAbs(qBlue(lineA[x]) - qBlue(lineB[x])) > tolerance))
+        return false;
+  }
+  return true;
+}
+
+/**
+ * The tiles should fit together without visible seams.
+ */
+void FileIOTest::tiledRendering()
+{
+  MolScene scene;
+  addChain(scene, 20);
+  QRectF rect = scene.itemsBoundingRect();
+  QSize size(2 * int(rect.width()), 2 * int(rect.height()));
+
+  TiledRenderer tiled(&scene, rect, size, 64);
+  TiledRenderer whole(&scene, rect, size, 4096);
+  QVERIFY( tiled.numTiles() > 2 );
+  QCOMPARE( whole.numTiles(), 1 );
+  QCOMPARE( tiled.tileRect(tiled.numTiles() - 1).bottomRight(), QPoint(size.width() - 1, size.height() - 1) );
+
+  QImage image = tiled.toImage();
+  QCOMPARE( image.size(), size );
+  QVERIFY( fuzzyCompare(image, whole.toImage(), 8) );
+}
+
+void FileIOTest::exportTiled_data()
+{
+  QTest::addColumn<QString>("format");
+
+  QTest::newRow("PNG") << "png";
+  QTest::newRow("TIFF") << "tif";
+}
+
+/**
+ * PNG and TIFF files are written by the TiledRenderer itself, a row of tiles
+ * at a time. They should read back as the same image.
+ */
+void FileIOTest::exportTiled()
+{
+  QFETCH(QString, format);
+  if (!QImageReader::supportedImageFormats().contains(format.toLatin1()))
+    QSKIP("Qt can not read this format", SkipSingle);
+
+  MolScene scene;
+  addChain(scene, 40);
+  QString fileName = QDir::tempPath() + QDir::separator() + "molsketch-fileiotest." + format;
+  QVERIFY( exportFile(fileName, &scene, 3.0) );
+
+  QRectF rect = scene.itemsBoundingRect();
+  TiledRenderer renderer(&scene, rect, QSize(int(3.0 * rect.width()), int(3.0 * rect.height())));
+  QImage expected = renderer.toImage();
+  QImage image = QImage(fileName).convertToFormat(QImage::Format_RGB32);
+  QCOMPARE( image.size(), expected.size() );
+  QVERIFY( image == expected );
+}
+
+/**
+ * An ExportJob writes the same file as exportFile(), reporting each row of
+ * tiles, and a cancelled one leaves no file behind.
+ */
+void FileIOTest::exportJob()
+{
+  MolScene scene;
+  addChain(scene, 40);
+  QString fileName = QDir::tempPath() + QDir::separator() + "molsketch-exportjob.png";
+  QFile::remove(fileName);
+
+  TiledRenderer snapshot = exportSnapshot(&scene, 3.0);
+  ExportJob job(snapshot, fileName);
+  QVERIFY( job.numRows() > 1 );
+  QSignalSpy progress(&job, SIGNAL(progress(int)));
+  QSignalSpy finished(&job, SIGNAL(finished(bool)));
+  job.start();
+  // the scene can be changed while the file is written
+  addChain(scene, 5);
+  for (int i = 0; (i < 500) && finished.isEmpty(); ++i)
+    QTest::qWait(20);
+  QCOMPARE( finished.count(), 1 );
+  QVERIFY( finished.first().first().toBool() );
+  QCOMPARE( progress.count(), job.numRows() );
+  QCOMPARE( progress.last().first().toInt(), job.numRows() );
+
+  QVERIFY( QImage(fileName).convertToFormat(QImage::Format_RGB32) == snapshot.toImage() );
+  QFile::remove(fileName);
+
+  ExportJob cancelled(snapshot, fileName);
+  QSignalSpy cancelledFinished(&cancelled, SIGNAL(finished(bool)));
+  cancelled.cancel();
+  cancelled.start();
+  for (int i = 0; (i < 500) && cancelledFinished.isEmpty(); ++i)
+    QTest::qWait(20);
+  QCOMPARE( cancelledFinished.count(), 1 );
+  QVERIFY( !cancelledFinished.first().first().toBool() );
+  QVERIFY( !QFile::exists(fileName) );
+}
+
+/**
+ * Write @p contents to @p fileName.
+ */
+static void writeFile(const QString &fileName, const QString &contents)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    return;
+  QTextStream out(&file);
+  out << contents << endl;
+}
+
+/**
+ * Only new and modified files are parsed, and the index survives a restart.
+ */
+void FileIOTest::libraryIndex()
+{
+  QString path = QDir::tempPath() + QDir::separator() + "molsketch-fileiotest";
+  QString libraryPath = path + QDir::separator() + "library";
+  QString indexFile = path + QDir::separator() + "library.index";
+  QDir().mkpath(libraryPath);
+  QString water = libraryPath + QDir::separator() + "water.smi";
+  QString benzene = libraryPath + QDir::separator() + "benzene.smi";
+  writeFile(water, "O");
+  writeFile(benzene, "c1ccccc1");
+
+  {
+    LibraryIndex index(indexFile);
+    QCOMPARE( index.size(), 0 );
+    QCOMPARE( index.update(libraryPath), 2 );
+    QCOMPARE( index.update(libraryPath), 0 );
+
+    LibraryEntry entry = index.entry(benzene);
+    QVERIFY( entry.isValid() );
+    QVERIFY( entry.isCurrent() );
+    QCOMPARE( entry.formula, QString("C6H6") );
+    QVERIFY( qAbs(entry.weight - 78.11) < 0.01 );
+    QVERIFY( !entry.smiles.isEmpty() );
+    QVERIFY( !entry.fingerprint.isEmpty() );
+    QCOMPARE( entry.atoms.size(), 6 );
+    QCOMPARE( entry.bonds.size(), 6 );
+
+    Molecule *molecule = entry.toMolecule();
+    QCOMPARE( molecule->atoms().size(), 6 );
+    QCOMPARE( molecule->bonds().size(), 6 );
+    delete molecule;
+
+    // an entry that is older than its file is parsed again
+    entry.modified -= 1;
+    index.insert(entry);
+    QCOMPARE( index.update(libraryPath), 1 );
+    QVERIFY( index.entry(benzene).isCurrent() );
+  }
+
+  // the index was saved when it was destroyed
+  LibraryIndex index(indexFile);
+  QCOMPARE( index.size(), 2 );
+  QVERIFY( !index.isModified() );
+  QCOMPARE( index.entry(water).formula, QString("H2O") );
+  QCOMPARE( index.entry(benzene).atoms.size(), 6 );
+  QCOMPARE( index.update(libraryPath), 0 );
+
+  // removed files are dropped
+  QFile::remove(water);
+  QCOMPARE( index.update(libraryPath), 0 );
+  QCOMPARE( index.size(), 1 );
+  QVERIFY( !index.entry(water).isValid() );
+
+  // files that are not molecules are remembered and only parsed again when modified
+  QString notes = libraryPath + QDir::separator() + "notes.unknownformat";
+  writeFile(notes, "not a molecule");
+  uint modified = QFileInfo(notes).lastModified().toTime_t();
+  QCOMPARE( index.update(libraryPath), 1 );
+  QCOMPARE( index.numUnreadable(), 1 );
+  QVERIFY( index.isUnreadable(notes, modified) );
+  QVERIFY( !index.isUnreadable(notes, modified - 1) );
+  QCOMPARE( index.update(libraryPath), 0 );
+  index.insertUnreadable(notes, modified - 1);
+  QCOMPARE( index.update(libraryPath), 1 );
+  QVERIFY( index.save() );
+  {
+    LibraryIndex reloaded(indexFile);
+    QCOMPARE( reloaded.numUnreadable(), 1 );
+    QVERIFY( reloaded.isUnreadable(notes, modified) );
+    QCOMPARE( reloaded.update(libraryPath), 0 );
+  }
+
+  QFile::remove(notes);
+  index.prune(libraryPath);
+  QCOMPARE( index.numUnreadable(), 0 );
+
+  // an entry with a count that the file cannot hold makes the index be rebuilt
+  QVERIFY( index.save() );
+  {
+    QFile file(indexFile);
+    QVERIFY( file.open(QIODevice::ReadOnly) );
+    QByteArray header = file.read(8); // the magic and the version
+    file.close();
+    QVERIFY( file.open(QIODevice::WriteOnly | QIODevice::Truncate) );
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream.writeRawData(header.constData(), header.size());
+    stream << quint32(1) << benzene << quint32(0) << QString("C6H6") << double(78.11) << QString("c1ccccc1")
+        << qint32(0x7fffffff);
+  }
+  {
+    LibraryIndex corrupt(indexFile);
+    QCOMPARE( corrupt.size(), 0 );
+    QCOMPARE( corrupt.update(libraryPath), 1 );
+    QCOMPARE( corrupt.entry(benzene).atoms.size(), 6 );
+  }
+
+  QFile::remove(benzene);
+  QFile::remove(indexFile);
+  QDir(path).rmdir("library");
+  QDir().rmdir(path);
+}
+
+/**
+ * The library items are added at once, the thumbnails follow. Files that
+ * are not molecules are removed again.
+ */
+void FileIOTest::libraryLoader()
+{
+  QString path = QDir::tempPath() + QDir::separator() + "molsketch-fileiotest";
+  QString libraryPath = path + QDir::separator() + "library";
+  QString cachePath = path + QDir::separator() + "thumbnails";
+  QDir().mkpath(libraryPath);
+  writeFile(libraryPath + QDir::separator() + "water.smi", "O");
+  writeFile(libraryPath + QDir::separator() + "ammonia.smi", "N");
+  writeFile(libraryPath + QDir::separator() + "notes.unknownformat", "not a molecule");
+
+  QString indexFile = path + QDir::separator() + "library.index";
+  QString water = libraryPath + QDir::separator() + "water.smi";
+  {
+    QListWidget list;
+    LibraryLoader loader(0, cachePath, indexFile);
+    loader.loadDirectory(libraryPath, &list);
+    QCOMPARE( list.count(), 3 );
+    QVERIFY( loader.isLoading() );
+    loader.waitForFinished();
+    QVERIFY( !loader.isLoading() );
+    QCOMPARE( list.count(), 2 );
+    for (int row = 0; row < list.count(); ++row) {
+      QVERIFY( !list.item(row)->icon().isNull() );
+      QVERIFY( static_cast<MolLibItem*>(list.item(row))->entry().isValid() );
+    }
+    QCOMPARE( loader.index()->size(), 2 );
+    QVERIFY( !loader.index()->isModified() );
+
+    // the next time the thumbnails come from the cache
+    QVERIFY( QFile::exists(LibraryLoader::cacheFileName(loader.index()->entry(water), cachePath)) );
+    QVERIFY( !LibraryLoader::thumbnail(loader.index()->entry(water), cachePath, false).isNull() );
+  }
+
+  // and the molecules from the index
+  QListWidget list;
+  LibraryLoader loader(0, cachePath, indexFile);
+  QCOMPARE( loader.index()->size(), 2 );
+  loader.loadDirectory(libraryPath, &list);
+  loader.waitForFinished();
+  QCOMPARE( list.count(), 2 );
+  MolLibItem *item = static_cast<MolLibItem*>(list.item(list.count() - 1));
+  QCOMPARE( item->getFileName().fileName(), QString("water.smi") );
+  Molecule *molecule = item->getMolecule();
+  QVERIFY( molecule );
+  QCOMPARE( molecule->atoms().size(), 1 );
+  delete molecule;
+
+  // the thumbnails of removed files are removed from the cache
+  QString thumbnail = LibraryLoader::cacheFileName(loader.index()->entry(water), cachePath);
+  QVERIFY( QFile::exists(thumbnail) );
+  QFile::remove(water);
+  loader.loadDirectory(libraryPath, &list);
+  loader.waitForFinished();
+  QCOMPARE( list.count(), 1 );
+  QVERIFY( !QFile::exists(thumbnail) );
+
+  foreach (const QFileInfo &file, QDir(libraryPath).entryInfoList(QDir::Files))
+    QFile::remove(file.filePath());
+  foreach (const QFileInfo &file, QDir(cachePath).entryInfoList(QDir::Files))
+    QFile::remove(file.filePath());
+  QFile::remove(indexFile);
+  QDir(path).rmdir("library");
+  QDir(path).rmdir("thumbnails");
+  QDir().rmdir(path);
+}
+
+/**
+ * The fingerprints screen out the aliphatic rings, the matcher does the rest.
+ */
+void FileIOTest::substructureSearch()
+{
+  QString path = QDir::tempPath() + QDir::separator() + "molsketch-fileiotest";
+  QString libraryPath = path + QDir::separator() + "library";
+  QString cachePath = path + QDir::separator() + "thumbnails";
+  QString indexFile = path + QDir::separator() + "library.index";
+  QDir().mkpath(libraryPath);
+  writeFile(libraryPath + QDir::separator() + "benzene.smi", "c1ccccc1");
+  writeFile(libraryPath + QDir::separator() + "phenol.smi", "Oc1ccccc1");
+  writeFile(libraryPath + QDir::separator() + "cyclohexanol.smi", "OC1CCCCC1");
+  writeFile(libraryPath + QDir::separator() + "ethanol.smi", "CCO");
+
+  LibraryEntry benzene, cyclohexane, methanol, invalid;
+  QVERIFY( smilesEntry("c1ccccc1", benzene) );
+  QVERIFY( smilesEntry("C1CCCCC1", cyclohexane) );
+  QVERIFY( smilesEntry("CO", methanol) );
+  QVERIFY( !smilesEntry("", invalid) );
+
+  LibraryIndex index(indexFile);
+  QCOMPARE( index.update(libraryPath), 4 );
+  LibraryEntry phenol = index.entry(libraryPath + QDir::separator() + "phenol.smi");
+  LibraryEntry cyclohexanol = index.entry(libraryPath + QDir::separator() + "cyclohexanol.smi");
+  LibraryEntry ethanol = index.entry(libraryPath + QDir::separator() + "ethanol.smi");
+
+  SubstructureMatcher ring(benzene);
+  QVERIFY( ring.isValid() );
+  QVERIFY( SubstructureMatcher::screen(benzene.fingerprint, phenol.fingerprint) );
+  QVERIFY( ring.matches(phenol) );
+  QVERIFY( !ring.matches(cyclohexanol) );
+  QVERIFY( !ring.matches(ethanol) );
+  QVERIFY( SubstructureMatcher(cyclohexane).matches(cyclohexanol) );
+  QVERIFY( !SubstructureMatcher(cyclohexanol).matches(cyclohexane) );
+  QVERIFY( SubstructureMatcher(methanol).matches(ethanol) );
+  QVERIFY( SubstructureMatcher(methanol).matches(cyclohexanol) );
+  QVERIFY( !SubstructureMatcher(ethanol).matches(methanol) );
+
+  // only aromatic bonds match whatever their order, also without fingerprints
+  LibraryEntry cyclohexadiene, toluene;
+  QVERIFY( smilesEntry("C1=CC=CCC1", cyclohexadiene) );
+  QVERIFY( smilesEntry("Cc1ccccc1", toluene) );
+  QVERIFY( !SubstructureMatcher::screen(benzene.fingerprint, QVector<quint32>()) );
+  QVERIFY( !SubstructureMatcher::screen(QVector<quint32>(), phenol.fingerprint) );
+  QVERIFY( !SubstructureMatcher::screen(benzene.fingerprint, benzene.fingerprint.mid(1)) );
+  cyclohexadiene.fingerprint.clear();
+  toluene.fingerprint.clear();
+  QVERIFY( !ring.matches(cyclohexadiene) );
+  QVERIFY( ring.matches(toluene) );
+  QVERIFY( !SubstructureMatcher(cyclohexadiene).matches(phenol) );
+
+  // the matches of a query drawn on the scene are added to the list
+  MolScene scene;
+  Molecule *mol = new Molecule;
+  Atom *carbon = mol->addAtom("C", QPointF(0.0, 0.0), false);
+  Atom *oxygen = mol->addAtom("O", QPointF(40.0, 0.0), false);
+  mol->addBond(carbon, oxygen);
+  scene.addItem(mol);
+
+  QListWidget list;
+  LibraryLoader loader(0, cachePath, indexFile);
+  loader.loadDirectory(libraryPath, &list);
+  loader.waitForFinished();
+  LibrarySearch search(&loader);
+  QVERIFY( search.setQuery(mol) );
+  QListWidget results;
+  search.start(&results);
+  search.waitForFinished();
+  QVERIFY( !search.isRunning() );
+  QStringList names;
+  for (int row = 0; row < results.count(); ++row)
+    names.append(results.item(row)->text());
+  QVERIFY( names.contains("ethanol") );
+  QVERIFY( names.contains("cyclohexanol") );
+  QVERIFY( !names.contains("benzene") );
+
+  QVERIFY( search.setQuery("c1ccccc1") );
+  search.start(&results);
+  search.waitForFinished();
+  QCOMPARE( results.count(), 2 );
+
+  // the similar molecules are ranked in the background, with those on the scene
+  QSignalSpy finished(&search, SIGNAL(finished()));
+  search.rankSimilar(&results, QList<Molecule*>() << mol);
+  search.waitForFinished();
+  QVERIFY( !search.isRunning() );
+  QCOMPARE( finished.count(), 1 );
+  QVERIFY( results.count() >= 2 );
+  QCOMPARE( results.item(0)->text(), QString("benzene (1.00)") );
+  QCOMPARE( mol->atoms().size(), 2 );
+
+  // a query without fingerprint finishes at once
+  LibrarySearch empty(&loader);
+  QSignalSpy emptyFinished(&empty, SIGNAL(finished()));
+  empty.rankSimilar(&results);
+  QCOMPARE( emptyFinished.count(), 1 );
+  QCOMPARE( results.count(), 0 );
+
+  foreach (const QFileInfo &file, QDir(libraryPath).entryInfoList(QDir::Files))
+    QFile::remove(file.filePath());
+  foreach (const QFileInfo &file, QDir(cachePath).entryInfoList(QDir::Files))
+    QFile::remove(file.filePath());
+  QFile::remove(indexFile);
+  QDir(path).rmdir("library");
+  QDir(path).rmdir("thumbnails");
+  QDir().rmdir(path);
+}
+
+/**
+ * The table ranks like the plain Tanimoto similarity.
+ */
+void FileIOTest::similarity()
+{
+  QCOMPARE( FingerprintTable::popCount(0u), 0 );
+  QCOMPARE( FingerprintTable::popCount(0xffffffffu), 32 );
+  QCOMPARE( FingerprintTable::popCount(0x80000001u), 2 );
+
+  QStringList smiles;
+  smiles << "CCO" << "Cc1ccccc1" << "c1ccccc1" << "Oc1ccccc1" << "CCCCCCCC";
+  QList<LibraryEntry> entries;
+  FingerprintTable table;
+  foreach (const QString &s, smiles) {
+    LibraryEntry entry;
+    QVERIFY( smilesEntry(s, entry) );
+    QCOMPARE( entry.fingerprint.size(), table.numWords() );
+    entries.append(entry);
+    table.append(entry.fingerprint);
+  }
+  QCOMPARE( table.size(), smiles.size() );
+
+  const QVector<quint32> &toluene = entries.at(1).fingerprint;
+  QCOMPARE( FingerprintTable::tanimoto(toluene, toluene), 1.0 );
+  for (int i = 0; i < entries.size(); ++i)
+    QVERIFY( qAbs(table.similarity(i, toluene) - FingerprintTable::tanimoto(entries.at(i).fingerprint, toluene)) < 1e-9 );
+
+  QList<FingerprintTable::Hit> hits = table.rank(toluene, 3);
+  QVERIFY( hits.size() <= 3 );
+  QVERIFY( !hits.isEmpty() );
+  QCOMPARE( hits.first().index, 1 );
+  QCOMPARE( hits.first().similarity, 1.0 );
+  for (int i = 1; i < hits.size(); ++i)
+    QVERIFY( hits.at(i - 1).similarity >= hits.at(i).similarity );
+  // benzene is more like toluene than ethanol is
+  QVERIFY( table.similarity(2, toluene) > table.similarity(0, toluene) );
+
+  // a fingerprint of another size is never similar
+  QCOMPARE( table.similarity(table.append(QVector<quint32>(3, 0xffffffffu)), toluene), 0.0 );
+
+  // the best hits of the blocks are the best hits of a table large enough to be split
+  qsrand(42);
+  FingerprintTable large;
+  QVector<quint32> fingerprint(large.numWords());
+  for (int i = 0; i < 20000; ++i) {
+    for (int j = 0; j < fingerprint.size(); ++j)
+      fingerprint[j] = (quint32(qrand()) << 16 ^ qrand()) & (quint32(qrand()) << 16 ^ qrand());
+    large.append(fingerprint);
+  }
+  QList<FingerprintTable::Hit> all;
+  for (int i = 0; i < large.size(); ++i)
+    all.append(FingerprintTable::Hit(i, large.similarity(i, toluene)));
+  qSort(all);
+  hits = large.rank(toluene, 25);
+  QCOMPARE( hits.size(), 25 );
+  for (int i = 0; i < hits.size(); ++i) {
+    QCOMPARE( hits.at(i).index, all.at(i).index );
+    QCOMPARE( hits.at(i).similarity, all.at(i).similarity );
+  }
+}
+
+void FileIOTest::benchmarkLoad_data()
+{
+  QTest::addColumn<int>("numAtoms");
+
+  QTest::newRow("1000 atoms") << 1000;
+  QTest::newRow("10000 atoms") << 10000;
+  QTest::newRow("100000 atoms") << 100000;
+}
+
+/**
+ * Load a linear alkane. The time should grow linearly with the number of
+ * atoms.
+ */
+void FileIOTest::benchmarkLoad()
+{
+  QFETCH(int, numAtoms);
+  QString fileName = writeSmilesFile(QString(numAtoms, 'C'));
+
+  Molecule *mol = 0;
+  QBENCHMARK_ONCE {
+    mol = loadFile(fileName);
+  }
+  QVERIFY( mol );
+  QCOMPARE( mol->atoms().size(), numAtoms );
+  QCOMPARE( mol->bonds().size(), numAtoms - 1 );
+
+  delete mol;
+}
+
+QTEST_MAIN(FileIOTest)
+
+#include "moc_fileiotest.cxx"
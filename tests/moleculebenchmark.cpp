@@ -0,0 +1,328 @@
+/***************************************************************************
+ *   Copyright (C) 2009 Tim Vandermeersch                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QObject>
+#include <QtTest>
+
+#include <molsketch/molecule.h>
+#include <molsketch/atom.h>
+#include <molsketch/bond.h>
+#include <molsketch/minimise.h>
+#include <molsketch/moleculerenderer.h>
+
+#include "testmolecules.h"
+
+using namespace Molsketch;
+
+/**
+ * Benchmarks of the molecules and the minimiser. They take too long for the
+ * unit tests and are run by hand, e.g. with -tickcounter.
+ */
+class MoleculeBenchmark : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void benchmarkAtomQueries_data();
+    void benchmarkAtomQueries();
+    void benchmarkRingPerception_data();
+    void benchmarkRingPerception();
+    void benchmarkElectronSystems_data();
+    void benchmarkElectronSystems();
+    void benchmarkThumbnails_data();
+    void benchmarkThumbnails();
+    void benchmarkMinimise_data();
+    void benchmarkMinimise();
+    void benchmarkForceField_data();
+    void benchmarkForceField();
+    void benchmarkConformationalSearch_data();
+    void benchmarkConformationalSearch();
+    void benchmarkMutate_data();
+    void benchmarkMutate();
+};
+
+void MoleculeBenchmark::benchmarkAtomQueries_data()
+{
+  QTest::addColumn<int>("numAtoms");
+
+  QTest::newRow("250 atoms") << 250;
+  QTest::newRow("500 atoms") << 500;
+  QTest::newRow("1000 atoms") << 1000;
+  QTest::newRow("2000 atoms") << 2000;
+}
+
+/**
+ * The per-atom queries done while painting a frame. The time per iteration
+ * should grow linearly with the number of atoms.
+ */
+void MoleculeBenchmark::benchmarkAtomQueries()
+{
+  QFETCH(int, numAtoms);
+  Molecule *mol = createChain(numAtoms);
+
+  int sum = 0;
+  QBENCHMARK {
+    foreach (Atom *atom, mol->atoms()) {
+      sum += atom->bondOrderSum();
+      sum += atom->numImplicitHydrogens();
+    }
+  }
+  QVERIFY( sum > 0 );
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkRingPerception_data()
+{
+  QTest::addColumn<int>("numRings");
+
+  QTest::newRow("100 rings") << 100;
+  QTest::newRow("1000 rings") << 1000;
+  QTest::newRow("10000 rings") << 10000;
+}
+
+/**
+ * Perceive the rings of a ladder of fused rings. The time should grow
+ * linearly with the number of rings.
+ */
+void MoleculeBenchmark::benchmarkRingPerception()
+{
+  QFETCH(int, numRings);
+  Molecule *mol = createLadder(numRings);
+  QCOMPARE( mol->rings().size(), numRings );
+
+  QBENCHMARK {
+    mol->perceiveRings();
+  }
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkElectronSystems_data()
+{
+  QTest::addColumn<int>("numAtoms");
+
+  QTest::newRow("1000 atoms") << 1000;
+  QTest::newRow("10000 atoms") << 10000;
+  QTest::newRow("100000 atoms") << 100000;
+}
+
+/**
+ * Perceive the electron systems of a polyene. The time should grow linearly
+ * with the number of atoms.
+ */
+void MoleculeBenchmark::benchmarkElectronSystems()
+{
+  QFETCH(int, numAtoms);
+  Molecule *mol = createChain(numAtoms);
+  mol->beginBatch();
+  for (int i = 0; i < mol->bonds().size(); i += 2)
+    mol->bonds().at(i)->setOrder(2);
+  mol->endBatch();
+  QCOMPARE( mol->electronSystems().size(), 1 );
+
+  QBENCHMARK {
+    mol->invalidateElectronSystems();
+    mol->electronSystems();
+  }
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkThumbnails_data()
+{
+  QTest::addColumn<int>("numMolecules");
+
+  QTest::newRow("100 molecules") << 100;
+  QTest::newRow("1000 molecules") << 1000;
+}
+
+/**
+ * Draw library thumbnails of small molecules.
+ */
+void MoleculeBenchmark::benchmarkThumbnails()
+{
+  QFETCH(int, numMolecules);
+  Molecule *mol = createLadder(4);
+  mol->atoms().first()->setElement("O");
+
+  QBENCHMARK {
+    for (int i = 0; i < numMolecules; ++i)
+      MoleculeRenderer(mol).toImage();
+  }
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkMinimise_data()
+{
+  QTest::addColumn<int>("numAtoms");
+
+  QTest::newRow("300 atoms") << 300;
+  QTest::newRow("1000 atoms") << 1000;
+  QTest::newRow("3000 atoms") << 3000;
+}
+
+/**
+ * Clean up a macrocycle. The time should grow about linearly with the number
+ * of atoms.
+ */
+void MoleculeBenchmark::benchmarkMinimise()
+{
+  QFETCH(int, numAtoms);
+  Molecule *mol = createMacrocycle(numAtoms);
+
+  QBENCHMARK_ONCE {
+    Minimise minimise;
+    minimise.minimiseMolecule(mol);
+  }
+  QCOMPARE( mol->atoms().size(), numAtoms );
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkForceField_data()
+{
+  QTest::addColumn<int>("numAtoms");
+  QTest::addColumn<bool>("reference");
+
+  QTest::newRow("FF classes, 1000 atoms") << 1000 << true;
+  QTest::newRow("arrays, 1000 atoms") << 1000 << false;
+  QTest::newRow("FF classes, 10000 atoms") << 10000 << true;
+  QTest::newRow("arrays, 10000 atoms") << 10000 << false;
+}
+
+/**
+ * One evaluation of the stretches, bends and clashes of a macrocycle, by the
+ * FF classes and by the arrays of Minimise.
+ */
+void MoleculeBenchmark::benchmarkForceField()
+{
+  QFETCH(int, numAtoms);
+  QFETCH(bool, reference);
+  Molecule *mol = createMacrocycle(numAtoms);
+  QList<Atom*> atoms = mol->atoms();
+
+  if (reference) {
+    std::vector<FFAtom> ffatoms;
+    foreach (Atom *atom, atoms)
+      ffatoms.push_back(FFAtom(atom));
+    QList<FFInteraction*> interactions;
+    for (int i = 0; i < numAtoms; ++i) {
+      int next = (i + 1) % numAtoms;
+      interactions.append(new FFBondstretch(&ffatoms[i], &ffatoms[next], 40));
+      interactions.append(new FFAngleBend(&ffatoms[(i + numAtoms - 1) % numAtoms], &ffatoms[i], &ffatoms[next]));
+      // the same pairs as the clash list of Minimise
+      for (int j = i + 3; j < numAtoms; ++j)
+        if ((i + numAtoms - j > 2) && (distance(ffatoms[i], ffatoms[j]) < 40 * (0.75 + CLASH_SKIN)))
+          interactions.append(new FFclash(&ffatoms[i], &ffatoms[j], 40));
+    }
+    QBENCHMARK {
+      foreach (FFInteraction *interaction, interactions)
+        interaction->apply();
+    }
+    qDeleteAll(interactions);
+  } else {
+    Minimise minimise;
+    minimise.initialise(mol);
+    QBENCHMARK {
+      minimise.score_interactions();
+    }
+  }
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkConformationalSearch_data()
+{
+  QTest::addColumn<int>("chains");
+
+  QTest::newRow("1 chain") << 1;
+  QTest::newRow("2 chains") << 2;
+  QTest::newRow("4 chains") << 4;
+  QTest::newRow("8 chains") << 8;
+}
+
+/**
+ * A search of 400 steps on a chain of 60 atoms, divided over the chains. The
+ * time should drop with the number of chains up to the number of cores.
+ */
+void MoleculeBenchmark::benchmarkConformationalSearch()
+{
+  QFETCH(int, chains);
+  Molecule *mol = createChain(60);
+
+  QBENCHMARK_ONCE {
+    Minimise minimise;
+    minimise.setSeed(42);
+    minimise.initialise(mol);
+    minimise.conformationalSearch(400, chains);
+  }
+
+  delete mol;
+}
+
+void MoleculeBenchmark::benchmarkMutate_data()
+{
+  QTest::addColumn<int>("numAtoms");
+  QTest::addColumn<bool>("branched");
+  QTest::addColumn<bool>("incremental");
+
+  QTest::newRow("total score, 60 atom chain") << 60 << false << false;
+  QTest::newRow("mirrors, 60 atom chain") << 60 << false << true;
+  QTest::newRow("total score, 60 atom comb") << 60 << true << false;
+  QTest::newRow("mirrors, 60 atom comb") << 60 << true << true;
+  QTest::newRow("total score, 300 atom chain") << 300 << false << false;
+  QTest::newRow("mirrors, 300 atom chain") << 300 << false << true;
+  QTest::newRow("total score, 300 atom comb") << 300 << true << false;
+  QTest::newRow("mirrors, 300 atom comb") << 300 << true << true;
+  QTest::newRow("total score, 3000 atom chain") << 3000 << false << false;
+  QTest::newRow("mirrors, 3000 atom chain") << 3000 << false << true;
+}
+
+/**
+ * The mutate-and-score loop of the conformational search, scored in full and
+ * from the mirrors. The mirrors themselves take most of the time, so both
+ * should be about as fast.
+ */
+void MoleculeBenchmark::benchmarkMutate()
+{
+  QFETCH(int, numAtoms);
+  QFETCH(bool, branched);
+  QFETCH(bool, incremental);
+  Molecule *mol = branched ? createComb(numAtoms) : createChain(numAtoms);
+
+  Minimise minimise;
+  minimise.setSeed(42);
+  minimise.initialise(mol);
+  minimise.startSearch();
+  QBENCHMARK {
+    minimise.loadBestPose();
+    minimise.mutate();
+    if (incremental)
+      minimise.mutatedScore();
+    else
+      minimise.total_score();
+  }
+
+  delete mol;
+}
+
+QTEST_MAIN(MoleculeBenchmark)
+
+#include "moc_moleculebenchmark.cxx"
@@ -0,0 +1,674 @@
+/***************************************************************************
+ *   Copyright (C) 2009 Tim Vandermeersch                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QObject>
+#include <QtTest>
+#include <QFontDatabase>
+#include <QtConcurrentRun>
+
+#include <molsketch/molecule.h>
+#include <molsketch/atom.h>
+#include <molsketch/bond.h>
+#include <molsketch/ring.h>
+#include <molsketch/electronsystem.h>
+#include <molsketch/minimise.h>
+#include <molsketch/minimisethread.h>
+#include <molsketch/moleculerenderer.h>
+
+#include "testmolecules.h"
+
+using namespace Molsketch;
+
+class MoleculeTest : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    /**
+     * Called before the first test function is executed.
+     */
+    void initTestCase();
+
+    /**
+     * Called after the last test function is executed.
+     */
+    void cleanupTestCase();
+
+    /**
+     * Called before each test function is executed.
+     */
+    void init();
+
+    /**
+     * Called after every test function.
+     */
+    void cleanup();
+
+    void adjacency();
+    void adjacencyAfterDelete();
+    void valenceInvalidation();
+    void splitComponents();
+    void batchDefersRings();
+    void ringPerception();
+    void electronSystems();
+    void renderer();
+    void rendererInThread();
+    void minimiseClashes();
+    void minimiseForceField_data();
+    void minimiseForceField();
+    void minimiseThread();
+    void minimiseSeed();
+    void minimiseScoreDelta_data();
+    void minimiseScoreDelta();
+};
+
+void MoleculeTest::initTestCase()
+{
+}
+
+void MoleculeTest::cleanupTestCase()
+{
+}
+
+void MoleculeTest::init()
+{
+}
+
+void MoleculeTest::cleanup()
+{
+}
+
+void MoleculeTest::adjacency()
+{
+  Molecule *mol = createChain(3);
+  Atom *a1 = mol->atoms().at(0);
+  Atom *a2 = mol->atoms().at(1);
+  Atom *a3 = mol->atoms().at(2);
+
+  QCOMPARE( mol->bonds(a1).size(), 1 );
+  QCOMPARE( mol->bonds(a2).size(), 2 );
+  QCOMPARE( mol->bonds(a3).size(), 1 );
+
+  QVERIFY( mol->bondBetween(a1, a2) );
+  QCOMPARE( mol->bondBetween(a1, a2), mol->bondBetween(a2, a1) );
+  QVERIFY( !mol->bondBetween(a1, a3) );
+
+  // adding an existing bond returns the existing one
+  Bond *bond = mol->bondBetween(a2, a3);
+  QCOMPARE( mol->addBond(a3, a2), bond );
+  QCOMPARE( mol->bonds().size(), 2 );
+
+  QCOMPARE( a2->bondOrderSum(), 4 );
+  QCOMPARE( a2->numImplicitHydrogens(), 2 );
+
+  delete mol;
+}
+
+void MoleculeTest::adjacencyAfterDelete()
+{
+  Molecule *mol = createChain(3);
+  Atom *a1 = mol->atoms().at(0);
+  Atom *a2 = mol->atoms().at(1);
+  Atom *a3 = mol->atoms().at(2);
+
+  Bond *bond = mol->bondBetween(a2, a3);
+  mol->delBond(bond);
+  QVERIFY( !mol->bondBetween(a2, a3) );
+  QCOMPARE( mol->bonds(a2).size(), 1 );
+  QCOMPARE( mol->bonds(a3).size(), 0 );
+  QCOMPARE( a3->numBonds(), 0 );
+
+  // undo: add the same bond again
+  mol->addBond(bond);
+  QCOMPARE( mol->bondBetween(a3, a2), bond );
+  QCOMPARE( a3->numBonds(), 1 );
+
+  QList<Bond*> removed = mol->delAtom(a2);
+  QCOMPARE( removed.size(), 2 );
+  QCOMPARE( mol->bonds(a1).size(), 0 );
+  QCOMPARE( mol->bonds(a3).size(), 0 );
+  QVERIFY( !mol->bondBetween(a1, a2) );
+  QCOMPARE( a1->numImplicitHydrogens(), 4 );
+
+  qDeleteAll(removed);
+  delete a2;
+  delete mol;
+}
+
+void MoleculeTest::valenceInvalidation()
+{
+  Molecule *mol = createChain(3);
+  Atom *a1 = mol->atoms().at(0);
+  Atom *a2 = mol->atoms().at(1);
+  Atom *a3 = mol->atoms().at(2);
+  QCOMPARE( a1->numImplicitHydrogens(), 3 );
+  QCOMPARE( a2->numImplicitHydrogens(), 2 );
+
+  // changing the bond order updates both atoms, but not the third one
+  mol->bondBetween(a1, a2)->setOrder(2);
+  QCOMPARE( a1->numImplicitHydrogens(), 2 );
+  QCOMPARE( a2->numImplicitHydrogens(), 1 );
+  QCOMPARE( a3->numImplicitHydrogens(), 3 );
+  QCOMPARE( a2->bondOrderSum(), 4 );
+
+  // changing the element
+  a3->setElement("O");
+  QCOMPARE( a3->numImplicitHydrogens(), 1 );
+  QCOMPARE( a3->numNonBondingElectrons(), 4 );
+  QCOMPARE( a3->charge(), 0 );
+
+  // user overrides
+  a3->setCharge(-1);
+  QCOMPARE( a3->charge(), -1 );
+  a3->setNumImplicitHydrogens(0);
+  QCOMPARE( a3->numImplicitHydrogens(), 0 );
+
+  delete mol;
+}
+
+void MoleculeTest::splitComponents()
+{
+  Molecule *mol = createChain(4);
+  QVERIFY( !mol->canSplit() );
+
+  // break the chain in the middle and add a lone atom
+  Atom *a2 = mol->atoms().at(1);
+  Atom *a3 = mol->atoms().at(2);
+  Bond *bond = mol->bondBetween(a2, a3);
+  mol->delBond(bond);
+  delete bond;
+  Atom *lone = mol->addAtom("N", QPointF(0.0, 100.0), true);
+  QVERIFY( mol->canSplit() );
+
+  QList<Atom*> atoms = mol->atoms();
+  QList<Molecule*> parts = mol->split();
+  QCOMPARE( parts.size(), 3 );
+  QVERIFY( mol->atoms().isEmpty() );
+  QVERIFY( mol->bonds().isEmpty() );
+
+  // the atoms are moved, not copied
+  QCOMPARE( parts.at(0)->atoms().size(), 2 );
+  QCOMPARE( parts.at(0)->atoms().at(0), atoms.at(0) );
+  QCOMPARE( parts.at(0)->bonds().size(), 1 );
+  QCOMPARE( parts.at(1)->atoms().size(), 2 );
+  QCOMPARE( parts.at(1)->atoms().at(0), a3 );
+  QCOMPARE( parts.at(2)->atoms().size(), 1 );
+  QCOMPARE( parts.at(2)->atoms().at(0), lone );
+  QCOMPARE( a3->molecule(), parts.at(1) );
+  QCOMPARE( a3->numImplicitHydrogens(), 3 );
+  foreach (Molecule *part, parts)
+    QVERIFY( !part->canSplit() );
+
+  // move them back
+  foreach (Molecule *part, parts) {
+    QList<Atom*> partAtoms = part->atoms();
+    QList<Bond*> partBonds = part->bonds();
+    part->releaseAtomsAndBonds();
+    mol->addAtomsAndBonds(partAtoms, partBonds);
+  }
+  QCOMPARE( mol->atoms().size(), 5 );
+  QCOMPARE( mol->bonds().size(), 2 );
+  QCOMPARE( a2->molecule(), mol );
+
+  qDeleteAll(parts);
+  delete mol;
+}
+
+void MoleculeTest::batchDefersRings()
+{
+  Molecule *mol = createChain(6);
+  Atom *first = mol->atoms().first();
+  Atom *last = mol->atoms().last();
+
+  // closing the ring outside a batch perceives it right away
+  Bond *bond = mol->addBond(first, last);
+  QCOMPARE( mol->rings().size(), 1 );
+  mol->delBond(bond);
+  delete bond;
+  QCOMPARE( mol->rings().size(), 0 );
+
+  // nested batches, the rings are perceived when the outermost one ends
+  mol->beginBatch();
+  {
+    Molecule::Batch batch(mol);
+    mol->addBond(first, last);
+    QVERIFY( mol->inBatch() );
+  }
+  QVERIFY( mol->inBatch() );
+  QCOMPARE( mol->rings().size(), 0 );
+  mol->endBatch();
+  QVERIFY( !mol->inBatch() );
+  QCOMPARE( mol->rings().size(), 1 );
+  QVERIFY( mol->bondBetween(first, last)->ring() );
+
+  delete mol;
+}
+
+void MoleculeTest::ringPerception()
+{
+  // no rings in a chain
+  Molecule *mol = createChain(10);
+  QCOMPARE( mol->rings().size(), 0 );
+  delete mol;
+
+  // naphthalene
+  mol = createChain(10);
+  QList<Atom*> atoms = mol->atoms();
+  mol->addBond(atoms.at(9), atoms.at(0));
+  mol->addBond(atoms.at(4), atoms.at(9));
+  QCOMPARE( mol->rings().size(), 2 );
+  QCOMPARE( mol->rings().at(0)->size(), 6 );
+  QCOMPARE( mol->rings().at(1)->size(), 6 );
+  // the atoms are in ring order
+  foreach (Ring *ring, mol->rings())
+    for (int i = 0; i < ring->size(); ++i)
+      QVERIFY( mol->bondBetween(ring->atoms().at(i), ring->atoms().at((i + 1) % ring->size())) );
+  delete mol;
+
+  // cubane: 12 bonds and 8 atoms give 5 independent four-membered rings
+  mol = new Molecule;
+  QList<Atom*> corners;
+  for (int i = 0; i < 8; ++i)
+    corners.append(mol->addAtom("C", QPointF((i & 1) * 35.0 + (i & 4) * 5.0, (i & 2) * 17.5 + (i & 4) * 5.0), true));
+  for (int i = 0; i < 8; ++i)
+    for (int bit = 1; bit < 8; bit <<= 1)
+      if (!(i & bit))
+        mol->addBond(corners.at(i), corners.at(i | bit));
+  QCOMPARE( mol->bonds().size(), 12 );
+  QCOMPARE( mol->rings().size(), 5 );
+  foreach (Ring *ring, mol->rings())
+    QCOMPARE( ring->size(), 4 );
+  delete mol;
+
+  // a ring with a tail and a second component
+  mol = createChain(8);
+  atoms = mol->atoms();
+  mol->addBond(atoms.at(2), atoms.at(7));
+  mol->addAtom("N", QPointF(0.0, 200.0), true);
+  QCOMPARE( mol->rings().size(), 1 );
+  QCOMPARE( mol->rings().at(0)->size(), 6 );
+  QVERIFY( !mol->bondBetween(atoms.at(0), atoms.at(1))->ring() );
+  delete mol;
+}
+
+/**
+ * Helper function to get the numbers of atoms and electrons of the electron
+ * systems of @p mol with more than one atom.
+ */
+static QList<QPair<int, int> > conjugatedSystems(Molecule *mol)
+{
+  QList<QPair<int, int> > result;
+  foreach (ElectronSystem *es, mol->electronSystems())
+    if (es->numAtoms() > 1)
+      result.append(qMakePair(es->numAtoms(), es->numElectrons()));
+  qSort(result);
+  return result;
+}
+
+void MoleculeTest::electronSystems()
+{
+  // butadiene: one system over the four atoms
+  Molecule *mol = createChain(4);
+  QList<Bond*> bonds = mol->bonds();
+  bonds.at(0)->setOrder(2);
+  bonds.at(2)->setOrder(2);
+  QCOMPARE( mol->electronSystems().size(), 1 );
+  QCOMPARE( mol->electronSystems().at(0)->numAtoms(), 4 );
+  QCOMPARE( mol->electronSystems().at(0)->numElectrons(), 4 );
+
+  // only the changed part is recomputed
+  bonds.at(0)->setOrder(1);
+  QList<QPair<int, int> > expected;
+  expected << qMakePair(2, 2);
+  QCOMPARE( conjugatedSystems(mol), expected );
+  bonds.at(0)->setOrder(2);
+  expected.clear();
+  expected << qMakePair(4, 4);
+  QCOMPARE( conjugatedSystems(mol), expected );
+
+  // a triple bond conjugates with one of its pi bonds only
+  bonds.at(2)->setOrder(3);
+  expected.clear();
+  expected << qMakePair(2, 2) << qMakePair(4, 4);
+  QCOMPARE( conjugatedSystems(mol), expected );
+  delete mol;
+
+  // furan: one lone pair of the oxygen is part of the aromatic sextet
+  mol = createChain(4);
+  QList<Atom*> atoms = mol->atoms();
+  Atom *oxygen = mol->addAtom("O", QPointF(50.0, 50.0), true);
+  mol->addBond(atoms.at(0), oxygen);
+  mol->addBond(atoms.at(3), oxygen);
+  mol->bondBetween(atoms.at(0), atoms.at(1))->setOrder(2);
+  mol->bondBetween(atoms.at(2), atoms.at(3))->setOrder(2);
+  expected.clear();
+  expected << qMakePair(5, 6);
+  QCOMPARE( conjugatedSystems(mol), expected );
+  QCOMPARE( mol->electronSystems().size(), 2 );
+
+  // deleting the oxygen leaves butadiene
+  foreach (Bond *bond, mol->delAtom(oxygen))
+    delete bond;
+  delete oxygen;
+  expected.clear();
+  expected << qMakePair(4, 4);
+  QCOMPARE( conjugatedSystems(mol), expected );
+  QCOMPARE( mol->electronSystems().size(), 1 );
+  delete mol;
+}
+
+/**
+ * @return @c true if @p image has pixels that are not white.
+ */
+static bool hasDrawing(const QImage &image)
+{
+  QImage white(image.size(), image.format());
+  white.fill(QColor(Qt::white).rgb());
+  return image != white;
+}
+
+/**
+ * The renderer draws a copy of the molecule, no scene is needed.
+ */
+void MoleculeTest::renderer()
+{
+  Molecule *mol = createLadder(3);
+  mol->atoms().first()->setElement("O");
+  MoleculeRenderer renderer(mol);
+  QCOMPARE( renderer.atoms().size(), mol->atoms().size() );
+  QCOMPARE( renderer.bonds().size(), mol->bonds().size() );
+  QCOMPARE( renderer.atoms().first().element, QString("O") );
+  foreach (Atom *atom, mol->atoms())
+    QVERIFY( renderer.boundingRect().contains(atom->pos()) );
+
+  QImage image = renderer.toImage(2.0);
+  QVERIFY( image.width() >= 2 * int(renderer.boundingRect().width()) );
+  QVERIFY( hasDrawing(image) );
+
+  // later changes are not drawn
+  delete mol;
+  QVERIFY( renderer.toImage(2.0) == image );
+
+  // a plain array of atoms and bonds
+  QVector<MoleculeRenderer::AtomData> atoms(2);
+  atoms[0].element = "C";
+  atoms[1].element = "N";
+  atoms[1].position = QPointF(35.0, 0.0);
+  QVector<MoleculeRenderer::BondData> bonds(1);
+  bonds[0].begin = 0;
+  bonds[0].end = 1;
+  bonds[0].order = 3;
+  MoleculeRenderer plain;
+  plain.setAtoms(atoms);
+  plain.setBonds(bonds);
+  QVERIFY( hasDrawing(plain.toImage()) );
+}
+
+/**
+ * Thumbnails drawn in another thread should look the same.
+ */
+void MoleculeTest::rendererInThread()
+{
+  if (!QFontDatabase::supportsThreadedFontRendering())
+    QSKIP("The font backend can not draw text outside the GUI thread", SkipSingle);
+
+  Molecule *mol = createLadder(5);
+  mol->addAtom("N", QPointF(-35.0, 0.0), true);
+  MoleculeRenderer renderer(mol);
+  delete mol;
+
+  QFuture<QImage> future = QtConcurrent::run(&renderer, &MoleculeRenderer::toImage, 1.0);
+  QVERIFY( future.result() == renderer.toImage() );
+}
+
+/**
+ * The clashes from the cell list are those of all pairs that are not 1-2 or
+ * 1-3 neighbours.
+ */
+void MoleculeTest::minimiseClashes()
+{
+  // a chain folded into a square of 20 by 20 atoms, 10 apart
+  Molecule *mol = new Molecule;
+  {
+    Molecule::Batch batch(mol);
+    Atom *previous = 0;
+    for (int i = 0; i < 400; ++i) {
+      Atom *atom = mol->addAtom("C", QPointF((i % 20) * 10.0, (i / 20) * 10.0), true);
+      if (previous)
+        mol->addBond(previous, atom);
+      previous = atom;
+    }
+  }
+
+  Minimise minimise;
+  minimise.initialise(mol);
+
+  QList<Atom*> atoms = mol->atoms();
+  std::vector<FFAtom> ffatoms;
+  foreach (Atom *atom, atoms)
+    ffatoms.push_back(FFAtom(atom));
+  qreal expected = 0;
+  for (int i = 0; i < atoms.size(); ++i)
+    for (int j = i + 1; j < atoms.size(); ++j) {
+      bool excluded = false;
+      foreach (Atom *n, atoms.at(i)->neighbours())
+        if ((n == atoms.at(j)) || n->neighbours().contains(atoms.at(j)))
+          excluded = true;
+      if (!excluded)
+        FFclash(&ffatoms[i], &ffatoms[j], 40).score(expected);
+    }
+
+  QVERIFY( expected > 0 );
+  QVERIFY( qAbs(minimise.clash_score() - expected) < 1e-6 * expected );
+
+  delete mol;
+}
+
+void MoleculeTest::minimiseForceField_data()
+{
+  QTest::addColumn<int>("shape");
+  QTest::addColumn<qreal>("scale");
+
+  QTest::newRow("chain") << 0 << 1.0;
+  QTest::newRow("ladder") << 1 << 1.0;
+  QTest::newRow("macrocycle") << 2 << 1.0;
+  // the atoms are 12 apart, so most pairs clash
+  QTest::newRow("compressed macrocycle") << 2 << 0.3;
+}
+
+/**
+ * The force field arrays of Minimise give the same scores and forces as the
+ * FF classes.
+ */
+void MoleculeTest::minimiseForceField()
+{
+  QFETCH(int, shape);
+  QFETCH(qreal, scale);
+  Molecule *mol;
+  switch (shape) {
+    case 0: mol = createChain(50); break;
+    case 1: mol = createLadder(20); break;
+    default: mol = createMacrocycle(40);
+  }
+  // move the atoms off the grid, so all terms contribute
+  QList<Atom*> atoms = mol->atoms();
+  for (int i = 0; i < atoms.size(); ++i)
+    atoms.at(i)->setPos(atoms.at(i)->pos() * scale + QPointF((i * 7) % 5 - 2.3, (i * 3) % 5 - 1.6));
+
+  Minimise minimise;
+  minimise.initialise(mol);
+
+  // the reference force field, with all pairs that are not 1-2 or 1-3 neighbours as clashes
+  std::vector<FFAtom> ffatoms;
+  foreach (Atom *atom, atoms)
+    ffatoms.push_back(FFAtom(atom));
+  QList<FFInteraction*> interactions;
+  QList<FFInteraction*> rotations;
+  foreach (Bond *bond, mol->bonds()) {
+    FFAtom *begin = &ffatoms[atoms.indexOf(bond->beginAtom())];
+    FFAtom *end = &ffatoms[atoms.indexOf(bond->endAtom())];
+    interactions.append(new FFBondstretch(begin, end, 40));
+    rotations.append(new FFBondorient(begin, end));
+  }
+  for (int i = 0; i < atoms.size(); ++i) {
+    QList<Atom*> neighbours = atoms.at(i)->neighbours();
+    for (int j = 0; j < neighbours.size(); ++j)
+      for (int k = j + 1; k < neighbours.size(); ++k)
+        interactions.append(new FFAngleBend(&ffatoms[atoms.indexOf(neighbours.at(j))], &ffatoms[i],
+              &ffatoms[atoms.indexOf(neighbours.at(k))]));
+  }
+  for (int i = 0; i < atoms.size(); ++i)
+    for (int j = i + 1; j < atoms.size(); ++j) {
+      bool excluded = false;
+      foreach (Atom *n, atoms.at(i)->neighbours())
+        if ((n == atoms.at(j)) || n->neighbours().contains(atoms.at(j)))
+          excluded = true;
+      if (!excluded)
+        interactions.append(new FFclash(&ffatoms[i], &ffatoms[j], 40));
+    }
+
+  qreal expected = 0;
+  foreach (FFInteraction *interaction, interactions + rotations)
+    interaction->score(expected);
+  qreal score = minimise.total_score() - minimise.elongation_score();
+  QVERIFY( expected > 0 );
+  // the large elongation is subtracted again, so its rounding counts as well
+  QVERIFY( qAbs(score - expected) < 1e-9 * (expected + qAbs(minimise.elongation_score())) );
+
+  // one step of the interactions
+  foreach (FFInteraction *interaction, interactions)
+    interaction->apply();
+  minimise.score_interactions();
+  minimise.move_atoms();
+  minimise.finalise();
+  for (int i = 0; i < atoms.size(); ++i) {
+    QVERIFY( qAbs(atoms.at(i)->x() - (ffatoms[i].x() + ffatoms[i].force_x())) < 1e-6 );
+    QVERIFY( qAbs(atoms.at(i)->y() - (ffatoms[i].y() + ffatoms[i].force_y())) < 1e-6 );
+  }
+
+  qDeleteAll(interactions);
+  qDeleteAll(rotations);
+  delete mol;
+}
+
+/**
+ * The clean-up on a MinimiseThread works on a copy of the molecule, reports
+ * its progress and can be cancelled.
+ */
+void MoleculeTest::minimiseThread()
+{
+  Molecule *mol = createChain(30);
+  QList<QPointF> positions;
+  foreach (Atom *atom, mol->atoms())
+    positions.append(atom->pos());
+
+  MinimiseThread thread(mol, 40, 20);
+  thread.setChains(1);
+  QSignalSpy progressSpy(&thread, SIGNAL(progress(int, int)));
+  thread.start();
+  QVERIFY( thread.wait(60000) );
+  QCOMPARE( progressSpy.count(), 20 );
+  QCOMPARE( progressSpy.last().at(0).toInt(), 20 );
+  QVERIFY( !thread.isCancelled() );
+
+  // the molecule is only changed by the caller
+  for (int i = 0; i < positions.size(); ++i)
+    QCOMPARE( mol->atoms().at(i)->pos(), positions.at(i) );
+  QCOMPARE( thread.positions().size(), positions.size() );
+  Minimise minimise;
+  minimise.initialise(mol);
+  QVERIFY( thread.positions() != minimise.bestPositions() );
+
+  MinimiseThread cancelled(mol, 40, 100000);
+  cancelled.start();
+  cancelled.cancel();
+  QVERIFY( cancelled.wait(60000) );
+  QVERIFY( cancelled.isCancelled() );
+  QCOMPARE( cancelled.positions().size(), positions.size() );
+
+  delete mol;
+}
+
+/**
+ * The conformational search gives the same result for the same seed, also
+ * with several chains.
+ */
+void MoleculeTest::minimiseSeed()
+{
+  Molecule *mol = createChain(30);
+
+  for (int chains = 1; chains <= 4; chains *= 2) {
+    Minimise first;
+    first.setSeed(42);
+    first.initialise(mol);
+    first.conformationalSearch(40, chains);
+    Minimise second;
+    second.setSeed(42);
+    second.initialise(mol);
+    second.conformationalSearch(40, chains);
+    QCOMPARE( first.bestPositions(), second.bestPositions() );
+  }
+
+  delete mol;
+}
+
+void MoleculeTest::minimiseScoreDelta_data()
+{
+  QTest::addColumn<qreal>("scale");
+  QTest::addColumn<bool>("branched");
+
+  QTest::newRow("chain") << 1.0 << false;
+  // the bonds are 20 long, so many atoms clash
+  QTest::newRow("compressed chain") << 0.5 << false;
+  // mostly small mirrors, which are scored one by one
+  QTest::newRow("branched") << 1.0 << true;
+  QTest::newRow("compressed branched") << 0.5 << true;
+}
+
+/**
+ * The score of a mutated pose from the changes of its mirrors is its total
+ * score, also after search steps have changed the best pose.
+ */
+void MoleculeTest::minimiseScoreDelta()
+{
+  QFETCH(qreal, scale);
+  QFETCH(bool, branched);
+  Molecule *mol = branched ? createComb(60) : createChain(60);
+  foreach (Atom *atom, mol->atoms())
+    atom->setPos(atom->pos() * scale);
+
+  Minimise minimise;
+  minimise.setSeed(7);
+  minimise.initialise(mol);
+  minimise.startSearch();
+  for (int i = 0; i < 200; ++i) {
+    if (i % 10 == 0)
+      minimise.searchStep();
+    minimise.loadBestPose();
+    minimise.mutate();
+    qreal score = minimise.mutatedScore();
+    qreal expected = minimise.total_score();
+    QVERIFY( qAbs(score - expected) < 1e-9 * qAbs(expected) );
+  }
+
+  delete mol;
+}
+
+QTEST_MAIN(MoleculeTest)
+
+#include "moc_moleculetest.cxx"
@@ -0,0 +1,589 @@
+/***************************************************************************
+ *   Copyright (C) 2009 Tim Vandermeersch                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QObject>
+#include <QtTest>
+#include <QStyleOptionGraphicsItem>
+#include <QGraphicsView>
+#include <QScrollBar>
+#include <QUndoStack>
+
+#include <molsketch/molscene.h>
+#include <molsketch/molecule.h>
+#include <molsketch/atom.h>
+#include <molsketch/bond.h>
+#include <molsketch/labellayout.h>
+
+using namespace Molsketch;
+
+/**
+ * Create a zig-zag carbon chain with @p numAtoms atoms, wrapped in rows of 100 atoms.
+ */
+Molecule* createGrid(int numAtoms)
+{
+  Molecule *mol = new Molecule;
+  Molecule::Batch batch(mol);
+  Atom *previous = 0;
+  for (int i = 0; i < numAtoms; ++i) {
+    Atom *atom = mol->addAtom("C", QPointF((i % 100) * 35.0, (i / 100) * 60.0 + (i % 2) * 20.0), true);
+    if (previous && (i % 100))
+      mol->addBond(previous, atom);
+    previous = atom;
+  }
+  return mol;
+}
+
+class MolSceneTest : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    /**
+     * Called before the first test function is executed.
+     */
+    void initTestCase();
+
+    /**
+     * Called after the last test function is executed.
+     */
+    void cleanupTestCase();
+
+    /**
+     * Called before each test function is executed.
+     */
+    void init();
+
+    /**
+     * Called after every test function.
+     */
+    void cleanup();
+
+    void spatialIndex();
+    void spatialIndexFollowsMoves();
+    void spatialIndexWideLabels();
+    void bondGeometryFollowsMoves();
+    void batchedMacros();
+    void labelLayout();
+    void detailLevel();
+    void collapsedMolecules();
+    void batchedBondRendering();
+    void moleculeCache();
+
+    void benchmarkHitTesting_data();
+    void benchmarkHitTesting();
+    void benchmarkLabelLayout();
+    void benchmarkBondRendering_data();
+    void benchmarkBondRendering();
+    void benchmarkScrolling_data();
+    void benchmarkScrolling();
+
+};
+
+void MolSceneTest::initTestCase()
+{
+}
+
+void MolSceneTest::cleanupTestCase()
+{
+}
+
+void MolSceneTest::init()
+{
+}
+
+void MolSceneTest::cleanup()
+{
+}
+
+void MolSceneTest::spatialIndex()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(3);
+  scene.addItem(mol);
+  Atom *a1 = mol->atoms().at(0);
+  Atom *a2 = mol->atoms().at(1);
+  Bond *bond = mol->bondBetween(a1, a2);
+
+  QCOMPARE( scene.spatialIndex()->numAtoms(), 3 );
+  QCOMPARE( scene.spatialIndex()->numBonds(), 2 );
+  QCOMPARE( scene.atomAt(a2->scenePos()), a2 );
+  QCOMPARE( scene.bondAt(0.5 * (a1->scenePos() + a2->scenePos())), bond );
+  QCOMPARE( scene.moleculeAt(a1->scenePos()), mol );
+  QVERIFY( !scene.atomAt(QPointF(1000.0, 1000.0)) );
+  QVERIFY( !scene.bondAt(QPointF(1000.0, 1000.0)) );
+
+  // removing a bond
+  mol->delBond(bond);
+  QCOMPARE( scene.spatialIndex()->numBonds(), 1 );
+  QVERIFY( !scene.bondAt(0.5 * (a1->scenePos() + a2->scenePos())) );
+  delete bond;
+
+  // removing the molecule
+  scene.removeItem(mol);
+  QCOMPARE( scene.spatialIndex()->numAtoms(), 0 );
+  QCOMPARE( scene.spatialIndex()->numBonds(), 0 );
+  QVERIFY( !scene.atomAt(a2->scenePos()) );
+
+  // deleting items on the scene
+  scene.addItem(mol);
+  QCOMPARE( scene.spatialIndex()->numAtoms(), 3 );
+  delete mol;
+  QCOMPARE( scene.spatialIndex()->numAtoms(), 0 );
+  QCOMPARE( scene.spatialIndex()->numBonds(), 0 );
+}
+
+void MolSceneTest::spatialIndexFollowsMoves()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(2);
+  scene.addItem(mol);
+  Atom *a1 = mol->atoms().at(0);
+  Atom *a2 = mol->atoms().at(1);
+  Bond *bond = mol->bondBetween(a1, a2);
+
+  // moving an atom
+  QPointF oldPos = a2->scenePos();
+  a2->setPos(a2->pos() + QPointF(0.0, 200.0));
+  QVERIFY( !scene.atomAt(oldPos) );
+  QCOMPARE( scene.atomAt(a2->scenePos()), a2 );
+  QCOMPARE( scene.bondAt(0.5 * (a1->scenePos() + a2->scenePos())), bond );
+
+  // moving the molecule
+  oldPos = a1->scenePos();
+  mol->setPos(QPointF(500.0, 500.0));
+  QVERIFY( !scene.atomAt(oldPos) );
+  QCOMPARE( scene.atomAt(a1->scenePos()), a1 );
+  QCOMPARE( scene.bondAt(0.5 * (a1->scenePos() + a2->scenePos())), bond );
+}
+
+/**
+ * Clicks on the outer part of a label wider than the cells of the index hit
+ * the atom, also after the label grew with the font.
+ */
+void MolSceneTest::spatialIndexWideLabels()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(3);
+  Atom *atom = mol->atoms().at(0);
+  atom->setElement("N");
+  scene.addItem(mol);
+
+  QFont font = scene.atomSymbolFont();
+  font.setPointSize(48);
+  scene.setAtomSymbolFont(font);
+  QRectF rect = atom->sceneBoundingRect();
+  QPointF center = atom->scenePos();
+  // just inside the corner of the label farthest from the centre
+  QPointF corner((rect.right() - center.x() > center.x() - rect.left()) ? rect.right() - 1.0 : rect.left() + 1.0,
+      (rect.bottom() - center.y() > center.y() - rect.top()) ? rect.bottom() - 1.0 : rect.top() + 1.0);
+  QVERIFY( QLineF(center, corner).length() > scene.spatialIndex()->cellSize() );
+  QCOMPARE( scene.atomAt(corner), atom );
+}
+
+/**
+ * The undo macros leave no molecule in a batch, and the rings are perceived
+ * when the macro ends, after a redo and after an undo.
+ */
+void MolSceneTest::batchedMacros()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(6);
+  mol->addBond(mol->atoms().first(), mol->atoms().last());
+  mol->addAtom("O", QPointF(500.0, 500.0), true);
+  QCOMPARE( mol->rings().size(), 1 );
+
+  // adding the molecule splits off the oxygen
+  scene.addMolecule(mol);
+  QList<Molecule*> molecules;
+  foreach (QGraphicsItem *item, scene.items())
+    if (item->type() == Molecule::Type)
+      molecules.append(dynamic_cast<Molecule*>(item));
+  QCOMPARE( molecules.size(), 2 );
+  int numRings = 0;
+  foreach (Molecule *molecule, molecules) {
+    QVERIFY( !molecule->inBatch() );
+    numRings += molecule->rings().size();
+  }
+  QCOMPARE( numRings, 1 );
+
+  scene.stack()->undo();
+  QCOMPARE( mol->scene(), static_cast<QGraphicsScene*>(0) );
+  QVERIFY( !mol->inBatch() );
+  QCOMPARE( mol->atoms().size(), 7 );
+  QCOMPARE( mol->rings().size(), 1 );
+
+  scene.stack()->redo();
+  QVERIFY( !mol->inBatch() );
+  foreach (Molecule *molecule, molecules) {
+    QCOMPARE( molecule->scene(), static_cast<QGraphicsScene*>(&scene) );
+    QVERIFY( !molecule->inBatch() );
+  }
+}
+
+void MolSceneTest::bondGeometryFollowsMoves()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(2);
+  scene.addItem(mol);
+  Atom *a1 = mol->atoms().at(0);
+  Atom *a2 = mol->atoms().at(1);
+  Bond *bond = mol->bondBetween(a1, a2);
+  QPointF oldMidPoint = bond->mapFromScene(0.5 * (a1->scenePos() + a2->scenePos()));
+  QVERIFY( bond->shape().contains(oldMidPoint) );
+
+  // the cached shape and bounding rect follow the atoms
+  a2->setPos(a2->pos() + QPointF(0.0, 200.0));
+  QPointF midPoint = bond->mapFromScene(0.5 * (a1->scenePos() + a2->scenePos()));
+  QVERIFY( bond->shape().contains(midPoint) );
+  QVERIFY( !bond->shape().contains(oldMidPoint) );
+  QVERIFY( bond->boundingRect().normalized().contains(bond->mapFromScene(a2->scenePos())) );
+  QCOMPARE( scene.items(bond->mapToScene(midPoint)).contains(bond), true );
+}
+
+void MolSceneTest::labelLayout()
+{
+  MolScene scene;
+  QFont font = scene.atomSymbolFont();
+  font.setPointSize(12);
+  scene.setAtomSymbolFont(font);
+  Molecule *mol = createGrid(3);
+  Atom *atom = mol->atoms().at(0);
+  atom->setElement("N");
+  scene.addItem(mol);
+  QRectF shape = atom->boundingRect();
+  QVERIFY( shape.width() > 0.0 );
+
+  // the layouts are shared
+  LabelLayout::clearCache();
+  LabelLayout layout = LabelLayout::layout("NH2", LabelLayout::Right, font);
+  QCOMPARE( LabelLayout::layout("NH2", LabelLayout::Right, font).shape(), layout.shape() );
+  QCOMPARE( LabelLayout::cacheSize(), 1 );
+  QCOMPARE( layout.runs().size(), 2 );
+  QCOMPARE( layout.runs().at(0).text, QString("NH") );
+  QVERIFY( !layout.runs().at(0).subscript );
+  QCOMPARE( layout.runs().at(1).text, QString("2") );
+  QVERIFY( layout.runs().at(1).subscript );
+
+  // changing the font lays out the labels again
+  QSignalSpy spy(&scene, SIGNAL(atomSymbolFontChanged(const QFont &)));
+  font.setPointSize(24);
+  scene.setAtomSymbolFont(font);
+  QCOMPARE( spy.count(), 1 );
+  QVERIFY( atom->boundingRect().height() > shape.height() );
+  scene.setAtomSymbolFont(font);
+  QCOMPARE( spy.count(), 1 );
+}
+
+/**
+ * Helper function to get the level of detail of @p scene when painting at @p scale
+ * in @p view, or to an image without a view.
+ */
+static MolScene::DetailLevel detailAt(MolScene &scene, qreal scale, const QWidget *view = 0)
+{
+  QImage image(10, 10, QImage::Format_ARGB32_Premultiplied);
+  QPainter painter(&image);
+  painter.scale(scale, scale);
+  QStyleOptionGraphicsItem option;
+  option.levelOfDetail = scale;
+  return scene.detailLevel(&option, &painter, view);
+}
+
+void MolSceneTest::detailLevel()
+{
+  MolScene scene;
+  QWidget view, otherView;
+  QCOMPARE( detailAt(scene, 1.0, &view), MolScene::FullDetail );
+  QCOMPARE( detailAt(scene, 0.45, &view), MolScene::FullDetail );
+  QCOMPARE( detailAt(scene, 0.3, &view), MolScene::ReducedDetail );
+  // no flicker around the threshold
+  QCOMPARE( detailAt(scene, 0.45, &view), MolScene::ReducedDetail );
+  // the other view has its own level
+  QCOMPARE( detailAt(scene, 0.45, &otherView), MolScene::FullDetail );
+  QCOMPARE( detailAt(scene, 0.45, &view), MolScene::ReducedDetail );
+  QCOMPARE( detailAt(scene, 0.6, &view), MolScene::FullDetail );
+
+  // images follow the zoom level
+  QCOMPARE( detailAt(scene, 0.3), MolScene::ReducedDetail );
+  QCOMPARE( detailAt(scene, 0.45), MolScene::FullDetail );
+
+  // the other render modes are not affected
+  scene.setRenderMode(MolScene::RenderColoredCircles);
+  QCOMPARE( detailAt(scene, 0.1, &view), MolScene::FullDetail );
+}
+
+void MolSceneTest::collapsedMolecules()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(10);
+  scene.addItem(mol);
+  QRectF source = mol->sceneBoundingRect();
+  QImage image(source.size().toSize() + QSize(1, 1), QImage::Format_ARGB32_Premultiplied);
+  QPainter painter(&image);
+
+  // a few pixels wide
+  scene.render(&painter, QRectF(0.0, 0.0, 5.0, 5.0), source);
+  QVERIFY( mol->collapsed() );
+  // full size
+  scene.render(&painter, QRectF(QPointF(0.0, 0.0), source.size()), source);
+  QVERIFY( !mol->collapsed() );
+
+  // in the views, the molecule only expands again with a margin
+  QWidget view, otherView;
+  QStyleOptionGraphicsItem option;
+  qreal width = qMax(mol->boundingRect().width(), mol->boundingRect().height());
+  painter.save();
+  painter.scale(20.0 / width, 20.0 / width);
+  option.levelOfDetail = 20.0 / width;
+  mol->paint(&painter, &option, &view);
+  QVERIFY( mol->collapsed() );
+  painter.restore();
+  painter.save();
+  painter.scale(56.0 / width, 56.0 / width);
+  option.levelOfDetail = 56.0 / width;
+  mol->paint(&painter, &option, &view);
+  QVERIFY( mol->collapsed() );
+  // not in a view that was not zoomed out
+  mol->paint(&painter, &option, &otherView);
+  QVERIFY( !mol->collapsed() );
+  // the state of a destroyed view is dropped, the other views keep theirs
+  QWidget *closedView = new QWidget;
+  mol->paint(&painter, &option, closedView);
+  delete closedView;
+  mol->paint(&painter, &option, &view);
+  QVERIFY( mol->collapsed() );
+  painter.restore();
+}
+
+/**
+ * Render @p mol on @p scene at full size.
+ */
+QImage renderMolecule(MolScene &scene, Molecule *mol)
+{
+  QRectF source = mol->sceneBoundingRect();
+  QImage image(source.size().toSize() + QSize(1, 1), QImage::Format_ARGB32_Premultiplied);
+  image.fill(0);
+  QPainter painter(&image);
+  scene.render(&painter, QRectF(QPointF(0.0, 0.0), source.size()), source);
+  return image;
+}
+
+void MolSceneTest::batchedBondRendering()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(20);
+  scene.addItem(mol);
+  mol->bonds().at(2)->setOrder(2);
+  mol->bonds().at(5)->setOrder(3);
+  mol->bonds().at(8)->setType(Bond::WedgeOrHash);
+  mol->bonds().at(11)->setType(Bond::Wedge);
+  mol->atoms().at(14)->setElement("N");
+
+  // the molecule draws the same lines as the bonds
+  QImage image = renderMolecule(scene, mol);
+  scene.setBatchedBondRendering(true);
+  QCOMPARE( renderMolecule(scene, mol), image );
+
+  // the paths follow the changes
+  mol->bonds().at(2)->setOrder(1);
+  mol->atoms().at(5)->setPos(mol->atoms().at(5)->pos() + QPointF(0.0, 10.0));
+  mol->atoms().at(17)->setElement("O");
+  QImage batched = renderMolecule(scene, mol);
+  scene.setBatchedBondRendering(false);
+  QCOMPARE( batched, renderMolecule(scene, mol) );
+}
+
+void MolSceneTest::moleculeCache()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(20);
+  scene.addItem(mol);
+  QGraphicsView view(&scene);
+  view.resize(400, 300);
+  QPixmap pixmap(view.size());
+
+  // the molecule is cached once it is painted twice without changes
+  view.render(&pixmap);
+  QVERIFY( !mol->drawsChildren() );
+  view.render(&pixmap);
+  QVERIFY( mol->drawsChildren() );
+  view.render(&pixmap);
+  QVERIFY( mol->drawsChildren() );
+
+  // edits drop the cache
+  mol->bonds().at(3)->setOrder(2);
+  view.render(&pixmap);
+  QVERIFY( !mol->drawsChildren() );
+  view.render(&pixmap);
+  QVERIFY( mol->drawsChildren() );
+
+  // a view zoomed differently has its own cache
+  QGraphicsView zoomedView(&scene);
+  zoomedView.resize(400, 300);
+  zoomedView.scale(2.0, 2.0);
+  QPixmap cached(view.size());
+  view.render(&cached);
+  zoomedView.render(&pixmap);
+  zoomedView.render(&pixmap);
+  QVERIFY( mol->drawsChildren() );
+  QPixmap again(view.size());
+  view.render(&again);
+  QVERIFY( mol->drawsChildren() );
+  QCOMPARE( again.toImage(), cached.toImage() );
+
+  // the cache of a view is dropped with it, the others are kept
+  QGraphicsView *closedView = new QGraphicsView(&scene);
+  closedView->resize(400, 300);
+  closedView->render(&pixmap);
+  closedView->render(&pixmap);
+  delete closedView;
+  view.render(&pixmap);
+  QVERIFY( mol->drawsChildren() );
+
+  // and so does selecting
+  mol->atoms().at(3)->setFlag(QGraphicsItem::ItemIsSelectable);
+  mol->atoms().at(3)->setSelected(true);
+  view.render(&pixmap);
+  QVERIFY( !mol->drawsChildren() );
+
+  // exported images are not cached
+  QImage image(100, 100, QImage::Format_ARGB32_Premultiplied);
+  QPainter painter(&image);
+  scene.render(&painter);
+  QVERIFY( !mol->drawsChildren() );
+  scene.render(&painter);
+  QVERIFY( !mol->drawsChildren() );
+
+  scene.setMoleculeCaching(false);
+  view.render(&pixmap);
+  view.render(&pixmap);
+  QVERIFY( !mol->drawsChildren() );
+}
+
+void MolSceneTest::benchmarkHitTesting_data()
+{
+  QTest::addColumn<int>("numAtoms");
+
+  QTest::newRow("1000 atoms") << 1000;
+  QTest::newRow("10000 atoms") << 10000;
+  QTest::newRow("50000 atoms") << 50000;
+}
+
+/**
+ * The queries done by the draw tool on every mouse move. The time per
+ * iteration should not depend on the number of atoms.
+ */
+void MolSceneTest::benchmarkHitTesting()
+{
+  QFETCH(int, numAtoms);
+  MolScene scene;
+  Molecule *mol = createGrid(numAtoms);
+  scene.addItem(mol);
+  QPointF pos = mol->atoms().at(numAtoms / 2)->scenePos();
+
+  int hits = 0;
+  QBENCHMARK {
+    for (int i = 0; i < 100; ++i) {
+      QPointF p = pos + QPointF(i % 10, i / 10);
+      if (scene.atomAt(p))
+        ++hits;
+      if (scene.bondAt(p))
+        ++hits;
+    }
+  }
+  QVERIFY( hits > 0 );
+}
+
+/**
+ * Lay out the labels of 10000 atoms in a new font.
+ */
+void MolSceneTest::benchmarkLabelLayout()
+{
+  MolScene scene;
+  Molecule *mol = createGrid(10000);
+  scene.addItem(mol);
+  QFont small = scene.atomSymbolFont();
+  QFont large = small;
+  large.setPointSize(small.pointSize() + 4);
+
+  bool toggle = false;
+  QBENCHMARK {
+    scene.setAtomSymbolFont(toggle ? small : large);
+    toggle = !toggle;
+  }
+}
+
+void MolSceneTest::benchmarkBondRendering_data()
+{
+  QTest::addColumn<bool>("batched");
+
+  QTest::newRow("bond items") << false;
+  QTest::newRow("batched") << true;
+}
+
+void MolSceneTest::benchmarkBondRendering()
+{
+  QFETCH(bool, batched);
+  MolScene scene;
+  Molecule *mol = createGrid(10000);
+  scene.addItem(mol);
+  scene.setBatchedBondRendering(batched);
+  QRectF source = mol->sceneBoundingRect();
+  QImage image(source.size().toSize() / 2, QImage::Format_ARGB32_Premultiplied);
+  QPainter painter(&image);
+
+  QBENCHMARK {
+    scene.render(&painter, image.rect(), source);
+  }
+}
+
+void MolSceneTest::benchmarkScrolling_data()
+{
+  QTest::addColumn<bool>("cached");
+
+  QTest::newRow("not cached") << false;
+  QTest::newRow("cached") << true;
+}
+
+/**
+ * Scrolling through a document with 200 molecules.
+ */
+void MolSceneTest::benchmarkScrolling()
+{
+  QFETCH(bool, cached);
+  MolScene scene;
+  scene.setMoleculeCaching(cached);
+  for (int i = 0; i < 200; ++i) {
+    Molecule *mol = createGrid(20);
+    mol->setPos((i % 10) * 400.0, (i / 10) * 200.0);
+    scene.addItem(mol);
+  }
+  QGraphicsView view(&scene);
+  view.resize(800, 600);
+  QPixmap pixmap(view.size());
+  view.render(&pixmap);
+
+  int step = 0;
+  QBENCHMARK {
+    view.verticalScrollBar()->setValue(view.verticalScrollBar()->value() + ((step++ % 20) < 10 ? 20 : -20));
+    view.render(&pixmap);
+  }
+}
+
+QTEST_MAIN(MolSceneTest)
+
+#include "moc_molscenetest.cxx"
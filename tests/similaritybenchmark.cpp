@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   Copyright (C) 2009 Tim Vandermeersch                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QObject>
+#include <QtTest>
+#include <QTime>
+
+#include <molsketch/similarity.h>
+
+using namespace Molsketch;
+
+/**
+ * Benchmarks of the similarity search. They take too long for the unit
+ * tests and are run by hand, e.g. with -tickcounter.
+ */
+class SimilarityBenchmark : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void benchmarkTanimoto_data();
+    void benchmarkTanimoto();
+};
+
+void SimilarityBenchmark::benchmarkTanimoto_data()
+{
+  QTest::addColumn<int>("size");
+
+  QTest::newRow("10000 fingerprints") << 10000;
+  QTest::newRow("100000 fingerprints") << 100000;
+  QTest::newRow("1000000 fingerprints") << 1000000;
+}
+
+/**
+ * Rank random fingerprints with a quarter of their bits set, and report the
+ * number of comparisons per second.
+ */
+void SimilarityBenchmark::benchmarkTanimoto()
+{
+  QFETCH(int, size);
+  qsrand(42);
+  FingerprintTable table;
+  table.reserve(size);
+  QVector<quint32> fingerprint(table.numWords());
+  for (int i = 0; i <= size; ++i) {
+    for (int j = 0; j < fingerprint.size(); ++j)
+      fingerprint[j] = (quint32(qrand()) << 16 ^ qrand()) & (quint32(qrand()) << 16 ^ qrand());
+    // the last one is the query
+    if (i < size)
+      table.append(fingerprint);
+  }
+
+  QList<FingerprintTable::Hit> hits;
+  int iterations = 0;
+  QTime time;
+  time.start();
+  QBENCHMARK {
+    hits = table.rank(fingerprint, 25);
+    ++iterations;
+  }
+  int elapsed = qMax(time.elapsed(), 1);
+  qDebug() << "comparisons per second:" << qint64(size) * iterations * 1000 / elapsed;
+  QCOMPARE( hits.size(), 25 );
+}
+
+QTEST_MAIN(SimilarityBenchmark)
+
+#include "moc_similaritybenchmark.cxx"
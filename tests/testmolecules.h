@@ -0,0 +1,115 @@
+/***************************************************************************
+ *   Copyright (C) 2009 Tim Vandermeersch                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+// the molecules of the molecule tests and benchmarks
+#ifndef MSK_TESTMOLECULES_H
+#define MSK_TESTMOLECULES_H
+
+#include <cmath>
+
+#include <molsketch/molecule.h>
+#include <molsketch/atom.h>
+
+using namespace Molsketch;
+
+/**
+ * Create a zig-zag carbon chain with @p numAtoms atoms.
+ */
+inline Molecule* createChain(int numAtoms)
+{
+  Molecule *mol = new Molecule;
+  Molecule::Batch batch(mol);
+  Atom *previous = 0;
+  for (int i = 0; i < numAtoms; ++i) {
+    Atom *atom = mol->addAtom("C", QPointF(i * 35.0, (i % 2) * 20.0), true);
+    if (previous)
+      mol->addBond(previous, atom);
+    previous = atom;
+  }
+  return mol;
+}
+
+/**
+ * Create a zig-zag chain of @p numAtoms / 3 atoms with a branch of two atoms
+ * on each, so most bonds have a small side.
+ */
+inline Molecule* createComb(int numAtoms)
+{
+  Molecule *mol = new Molecule;
+  Molecule::Batch batch(mol);
+  Atom *previous = 0;
+  for (int i = 0; i < numAtoms / 3; ++i) {
+    qreal y = (i % 2) * 20.0;
+    qreal side = (i % 2) ? 1.0 : -1.0;
+    Atom *atom = mol->addAtom("C", QPointF(i * 35.0, y), true);
+    Atom *branch = mol->addAtom("C", QPointF(i * 35.0, y + side * 40.0), true);
+    Atom *end = mol->addAtom("C", QPointF(i * 35.0 + 35.0, y + side * 60.0), true);
+    mol->addBond(atom, branch);
+    mol->addBond(branch, end);
+    if (previous)
+      mol->addBond(previous, atom);
+    previous = atom;
+  }
+  return mol;
+}
+
+/**
+ * Create a ladder of @p numRings fused four-membered rings.
+ */
+inline Molecule* createLadder(int numRings)
+{
+  Molecule *mol = new Molecule;
+  Molecule::Batch batch(mol);
+  Atom *top = mol->addAtom("C", QPointF(0.0, 0.0), true);
+  Atom *bottom = mol->addAtom("C", QPointF(0.0, 35.0), true);
+  mol->addBond(top, bottom);
+  for (int i = 1; i <= numRings; ++i) {
+    Atom *nextTop = mol->addAtom("C", QPointF(i * 35.0, 0.0), true);
+    Atom *nextBottom = mol->addAtom("C", QPointF(i * 35.0, 35.0), true);
+    mol->addBond(top, nextTop);
+    mol->addBond(bottom, nextBottom);
+    mol->addBond(nextTop, nextBottom);
+    top = nextTop;
+    bottom = nextBottom;
+  }
+  return mol;
+}
+
+/**
+ * Create a ring of @p numAtoms atoms with bonds of 40.
+ */
+inline Molecule* createMacrocycle(int numAtoms)
+{
+  Molecule *mol = new Molecule;
+  Molecule::Batch batch(mol);
+  qreal radius = 20.0 / std::sin(M_PI / numAtoms);
+  Atom *first = 0, *previous = 0;
+  for (int i = 0; i < numAtoms; ++i) {
+    qreal angle = 2 * M_PI * i / numAtoms;
+    Atom *atom = mol->addAtom("C", QPointF(radius * std::cos(angle), radius * std::sin(angle)), true);
+    if (previous)
+      mol->addBond(previous, atom);
+    else
+      first = atom;
+    previous = atom;
+  }
+  mol->addBond(previous, first);
+  return mol;
+}
+
+#endif
@@ -54,6 +54,9 @@ class ValenceTest : public QObject
     void expectedValences();
     void valenceElectrons();
     void implicitHydrogensAndCharge();
+    void elementSymbols();
+
+    void benchmarkSymbolLookup();
 
 };
 
@@ -316,6 +319,60 @@ void ValenceTest::implicitHydrogensAndCharge()
 
 
 
+}
+
+void ValenceTest::elementSymbols()
+{
+  // every element maps back to itself
+  for (int number = 1; number <= Element::Uut; ++number)
+    QCOMPARE( symbol2number(number2symbol(number)), number );
+
+  QCOMPARE( number2symbol(Element::C), QString("C") );
+  QCOMPARE( number2symbol(Element::Cl), QString("Cl") );
+  QCOMPARE( number2symbol(Element::Uub), QString("Uub") );
+  QCOMPARE( number2symbol(200), QString() );
+
+  // the case of the letters does not matter
+  QCOMPARE( symbol2number("cl"), int(Element::Cl) );
+  QCOMPARE( symbol2number("CL"), int(Element::Cl) );
+  QCOMPARE( symbol2number("D"), int(Element::H) );
+  QCOMPARE( symbol2number("T"), int(Element::H) );
+
+  // labels are not elements
+  QCOMPARE( symbol2number(""), 0 );
+  QCOMPARE( symbol2number("R"), 0 );
+  QCOMPARE( symbol2number("Xx"), 0 );
+  QCOMPARE( symbol2number("COOH"), 0 );
+  QCOMPARE( symbol2number("C1"), 0 );
+  QCOMPARE( symbol2number("C "), 0 );
+  QCOMPARE( symbol2number(QString("C") + QChar(0xe9)), 0 );
+  QCOMPARE( symbol2number(QString("C") + QChar(0x106)), 0 );
+
+  QVERIFY( qAbs(weightOfElement(Element::C) - 12.0107) < 1e-6 );
+  QVERIFY( qAbs(weightOfElement(Element::Cl) - 35.453) < 1e-6 );
+  QCOMPARE( elementColor(Element::O), QColor(255, 0, 0) );
+
+  Atom atom(QPointF(0.0, 0.0), "N", true);
+  QCOMPARE( atom.atomicNumber(), int(Element::N) );
+  atom.setElement("Br");
+  QCOMPARE( atom.atomicNumber(), int(Element::Br) );
+}
+
+/**
+ * Look up the symbols of all elements.
+ */
+void ValenceTest::benchmarkSymbolLookup()
+{
+  QStringList symbols;
+  for (int number = 1; number <= Element::Uut; ++number)
+    symbols.append(number2symbol(number));
+
+  int sum = 0;
+  QBENCHMARK {
+    foreach (const QString &symbol, symbols)
+      sum += symbol2number(symbol);
+  }
+  QVERIFY( sum > 0 );
 }
 
 QTEST_MAIN(ValenceTest)